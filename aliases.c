@@ -5,6 +5,7 @@
 
 #include "aliases.h"
 #include "builtins.h"
+#include "subsystems.h"
 
 // Global variables for alias storage
 AliasEntry *aliases = NULL;
@@ -203,6 +204,8 @@ int remove_alias(const char *name) {
  * Find an alias by name
  */
 AliasEntry* find_alias(const char *name) {
+    ensure_subsystem(SUBSYSTEM_ALIASES);
+
     if (!name) return NULL;
     
     for (int i = 0; i < alias_count; i++) {
@@ -267,6 +270,8 @@ char* expand_aliases(const char *command) {
  * Command handler for the "alias" command
  */
 int lsh_alias(char **args) {
+    ensure_subsystem(SUBSYSTEM_ALIASES);
+
     // "alias edit" command - open the aliases file in a text editor
     if (args[1] != NULL && strcmp(args[1], "edit") == 0) {
         // Try to determine if neovim or vim is available
@@ -340,6 +345,7 @@ int lsh_alias(char **args) {
         printf("%s=%s\n", alias->name, alias->command);
     } else {
         printf("Alias '%s' not found\n", args[1]);
+        return lsh_builtin_failed();
     }
     
     return 1;
@@ -349,9 +355,11 @@ int lsh_alias(char **args) {
  * Command handler for the "unalias" command
  */
 int lsh_unalias(char **args) {
+    ensure_subsystem(SUBSYSTEM_ALIASES);
+
     if (args[1] == NULL) {
         fprintf(stderr, "lsh: expected argument to \"unalias\"\n");
-        return 1;
+        return lsh_builtin_failed();
     }
     
     if (remove_alias(args[1])) {
@@ -359,6 +367,7 @@ int lsh_unalias(char **args) {
         printf("Alias '%s' removed\n", args[1]);
     } else {
         printf("Alias '%s' not found\n", args[1]);
+        return lsh_builtin_failed();
     }
     
     return 1;
@@ -373,6 +382,8 @@ int lsh_unalias(char **args) {
  * Simply displays all defined aliases
  */
 int lsh_aliases(char **args) {
+    ensure_subsystem(SUBSYSTEM_ALIASES);
+
     if (alias_count == 0) {
         printf("No aliases defined\n");
     } else {
@@ -404,6 +415,8 @@ int lsh_aliases(char **args) {
  * Get alias names for tab completion
  */
 char** get_alias_names(int *count) {
+    ensure_subsystem(SUBSYSTEM_ALIASES);
+
     if (alias_count == 0) {
         *count = 0;
         return NULL;
@@ -0,0 +1,113 @@
+/**
+ * arena.c
+ * Implementation of the bump allocator
+ */
+
+#include "arena.h"
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t capacity;
+  size_t used;
+  char data[];
+};
+
+static ArenaBlock *new_block(size_t capacity) {
+  ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + capacity);
+  if (!block) {
+    return NULL;
+  }
+  block->next = NULL;
+  block->capacity = capacity;
+  block->used = 0;
+  return block;
+}
+
+/**
+ * Initialize an empty arena
+ */
+void arena_init(Arena *arena, size_t block_size) {
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+}
+
+/**
+ * Allocate memory from an arena
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+  size = (size + 7) & ~(size_t)7;
+
+  ArenaBlock *block = arena->current;
+  if (block && block->used + size <= block->capacity) {
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+  }
+
+  // Current block is full - chain a new one
+  size_t capacity = size > arena->block_size ? size : arena->block_size;
+  ArenaBlock *fresh = new_block(capacity);
+  if (!fresh) {
+    return NULL;
+  }
+
+  if (block) {
+    block->next = fresh;
+  } else {
+    arena->first = fresh;
+  }
+
+  arena->current = fresh;
+  fresh->used = size;
+  return fresh->data;
+}
+
+/**
+ * Copy a string span into an arena
+ */
+char *arena_strndup(Arena *arena, const char *text, size_t length) {
+  char *copy = (char *)arena_alloc(arena, length + 1);
+  if (!copy) {
+    return NULL;
+  }
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+/**
+ * Release every allocation at once
+ */
+void arena_reset(Arena *arena) {
+  if (!arena->first) {
+    return;
+  }
+
+  // Keep the first block; drop any overflow blocks so one huge line does not
+  // pin memory for the rest of the session
+  ArenaBlock *block = arena->first->next;
+  while (block) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+
+  arena->first->next = NULL;
+  arena->first->used = 0;
+  arena->current = arena->first;
+}
+
+/**
+ * Free all memory owned by an arena
+ */
+void arena_free(Arena *arena) {
+  ArenaBlock *block = arena->first;
+  while (block) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->first = NULL;
+  arena->current = NULL;
+}
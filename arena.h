@@ -0,0 +1,64 @@
+/**
+ * arena.h
+ * Bump allocator for short-lived allocations that are freed all at once
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "common.h"
+
+#define ARENA_DEFAULT_BLOCK_SIZE (16 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+// An arena is a chain of blocks; pointers stay valid until the next reset
+typedef struct {
+  ArenaBlock *first;
+  ArenaBlock *current;
+  size_t block_size;
+} Arena;
+
+/**
+ * Initialize an empty arena. No memory is allocated until first use.
+ *
+ * @param arena The arena
+ * @param block_size Size of each block, or 0 for the default
+ */
+void arena_init(Arena *arena, size_t block_size);
+
+/**
+ * Allocate memory from an arena (8-byte aligned, not zeroed)
+ *
+ * @param arena The arena
+ * @param size Number of bytes
+ * @return Pointer to the memory, or NULL on allocation failure
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Copy a string span into an arena as a NUL-terminated string
+ *
+ * @param arena The arena
+ * @param text Start of the span
+ * @param length Length of the span
+ * @return The copy, or NULL on allocation failure
+ */
+char *arena_strndup(Arena *arena, const char *text, size_t length);
+
+/**
+ * Release every allocation at once. The first block is kept for reuse, so an
+ * arena reset after each command line stops allocating once it is warm.
+ *
+ * @param arena The arena
+ */
+void arena_reset(Arena *arena);
+
+/**
+ * Free all memory owned by an arena
+ *
+ * @param arena The arena
+ */
+void arena_free(Arena *arena);
+
+#endif // ARENA_H
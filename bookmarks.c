@@ -4,6 +4,8 @@
  */
 
 #include "bookmarks.h"
+#include "builtins.h"
+#include "subsystems.h"
 
 // Global variables for bookmark storage
 BookmarkEntry *bookmarks = NULL;
@@ -36,11 +38,9 @@ void init_bookmarks(void) {
     strcpy(bookmarks_file_path, ".lsh_bookmarks");
   }
 
-  // Load bookmarks from file
+  // Load bookmarks from file. This runs on the startup thread, so it
+  // prints nothing that could land in the middle of the prompt.
   load_bookmarks();
-
-  // Print debug info about loaded bookmarks
-  printf("Loaded %d bookmarks\n", bookmark_count);
 }
 
 /**
@@ -214,6 +214,8 @@ int remove_bookmark(const char *name) {
  * Find a bookmark by name
  */
 BookmarkEntry *find_bookmark(const char *name) {
+  ensure_subsystem(SUBSYSTEM_BOOKMARKS);
+
   if (!name)
     return NULL;
 
@@ -231,6 +233,8 @@ BookmarkEntry *find_bookmark(const char *name) {
  * Usage: bookmark [name] - Bookmark the current directory
  */
 int lsh_bookmark(char **args) {
+  ensure_subsystem(SUBSYSTEM_BOOKMARKS);
+
   char cwd[MAX_PATH];
 
   // If no arguments, show usage
@@ -261,6 +265,8 @@ int lsh_bookmark(char **args) {
  * Usage: bookmarks [edit] - List all bookmarks or edit them
  */
 int lsh_bookmarks(char **args) {
+  ensure_subsystem(SUBSYSTEM_BOOKMARKS);
+
   // "bookmarks edit" command - open the bookmarks file in a text editor
   if (args[1] != NULL && strcmp(args[1], "edit") == 0) {
     // Try to determine if neovim or vim is available
@@ -340,12 +346,14 @@ int lsh_bookmarks(char **args) {
  * Usage: goto <bookmark> - Change to the bookmarked directory
  */
 int lsh_goto(char **args) {
+  ensure_subsystem(SUBSYSTEM_BOOKMARKS);
+
   // Check for bookmark name
   if (args[1] == NULL) {
     fprintf(stderr, "lsh: expected bookmark name\n");
     fprintf(stderr, "Usage: goto <bookmark>\n");
     fprintf(stderr, "  e.g.: goto projects\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Find the bookmark
@@ -365,6 +373,7 @@ int lsh_goto(char **args) {
         save_bookmarks();
         printf("Bookmark '%s' removed.\n", args[1]);
       }
+      return lsh_builtin_failed();
     } else {
       printf("Changed directory to '%s' (%s)\n", args[1], bookmark->path);
     }
@@ -379,6 +388,7 @@ int lsh_goto(char **args) {
       }
       printf("\n");
     }
+    return lsh_builtin_failed();
   }
 
   return 1;
@@ -389,11 +399,13 @@ int lsh_goto(char **args) {
  * Usage: unbookmark <name> - Remove a bookmark
  */
 int lsh_unbookmark(char **args) {
+  ensure_subsystem(SUBSYSTEM_BOOKMARKS);
+
   if (args[1] == NULL) {
     fprintf(stderr, "lsh: expected bookmark name\n");
     fprintf(stderr, "Usage: unbookmark <name>\n");
     fprintf(stderr, "  e.g.: unbookmark projects\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   if (remove_bookmark(args[1])) {
@@ -401,6 +413,7 @@ int lsh_unbookmark(char **args) {
     printf("Bookmark '%s' removed\n", args[1]);
   } else {
     printf("Bookmark '%s' not found\n", args[1]);
+    return lsh_builtin_failed();
   }
 
   return 1;
@@ -410,6 +423,8 @@ int lsh_unbookmark(char **args) {
  * Get bookmark names for tab completion
  */
 char **get_bookmark_names(int *count) {
+  ensure_subsystem(SUBSYSTEM_BOOKMARKS);
+
   if (bookmark_count == 0) {
     *count = 0;
     return NULL;
@@ -433,6 +448,8 @@ char **get_bookmark_names(int *count) {
  * Find a matching bookmark by partial name
  */
 char *find_matching_bookmark(const char *partial_name) {
+  ensure_subsystem(SUBSYSTEM_BOOKMARKS);
+
   // Easy case - if we have no bookmarks
   if (bookmark_count == 0) {
     return NULL;
@@ -5,11 +5,16 @@
 
 #include "builtins.h"
 #include "common.h"
+#include "file_index.h"
 #include "filters.h"
 #include "fzf_native.h"
+#include "git_files.h"
 #include "git_integration.h"
+#include "git_object.h"
 #include "grep.h"
+#include "parallel.h"
 #include "persistent_history.h"
+#include "shell.h"
 #include "structured_data.h"
 #include "themes.h"
 #include <Psapi.h>
@@ -23,6 +28,7 @@
 #include <processenv.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <time.h>
 #include <tlhelp32.h>
 #include <winbase.h>
 #include <wincrypt.h>
@@ -81,6 +87,8 @@ char *builtin_str[] = {
     "weather",  "grep",      "cities",      "fzf",
     "ripgrep",  "clip",      "echo",        "self-destruct",
     "theme",    "loc",       "gs",          "gg",
+    "parallel",
+    "git-files",
 };
 
 // Add to the builtin_func array:
@@ -128,23 +136,27 @@ int (*builtin_func[])(char **) = {
     &lsh_loc,
     &lsh_git_status,
     &lsh_gg,
+    &lsh_parallel,
+    &lsh_git_files,
 };
 
 // Return the number of built-in commands
 int lsh_num_builtins() { return sizeof(builtin_str) / sizeof(char *); }
 
+// Record a failed builtin, so that && and || see a nonzero exit code
+int lsh_builtin_failed(void) {
+  g_last_exit_code = 1;
+  return 1;
+}
+
 int lsh_gg(char **args) {
   char repo_name[256] = "";
   char git_url[1024] = "";
-  char origin_url[1024] = "";
   char repo_root[1024] = "";
-  char cmd[1024] = "";
   char relative_path[1024] = "";
   char final_url[2048] = "";
   char original_dir[1024] = "";
   char target_dir[1024] = "";
-  FILE *fp;
-  BOOL success = FALSE;
   BOOL changed_dir = FALSE;
   BOOL found_repo = FALSE;
   int arg_offset =
@@ -200,8 +212,7 @@ int lsh_gg(char **args) {
 
         // Now check if this is a git repository
         char branch_name[128] = "";
-        int is_dirty = 0;
-        if (get_git_branch(branch_name, sizeof(branch_name), &is_dirty)) {
+        if (get_git_branch(branch_name, sizeof(branch_name), NULL)) {
           found_repo = TRUE;
 
           // The first argument was the repo - set arg_offset to look for file
@@ -222,8 +233,7 @@ int lsh_gg(char **args) {
 
     // Check if current directory is a git repo
     char branch_name[128] = "";
-    int is_dirty = 0;
-    if (get_git_branch(branch_name, sizeof(branch_name), &is_dirty)) {
+    if (get_git_branch(branch_name, sizeof(branch_name), NULL)) {
       found_repo = TRUE;
       strcpy(target_dir, original_dir);
       // No offset - all arguments are potential files
@@ -257,45 +267,14 @@ int lsh_gg(char **args) {
   }
 
   // Get the repository root path
-  snprintf(cmd, sizeof(cmd), "git rev-parse --show-toplevel 2>nul");
-  fp = _popen(cmd, "r");
-  if (fp) {
-    if (fgets(repo_root, sizeof(repo_root), fp)) {
-      // Remove newline
-      size_t len = strlen(repo_root);
-      if (len > 0 && repo_root[len - 1] == '\n') {
-        repo_root[len - 1] = '\0';
-      }
-      // Convert forward slashes to backslashes for consistency
-      for (char *p = repo_root; *p; p++) {
-        if (*p == '/')
-          *p = '\\';
-      }
-    }
-    _pclose(fp);
-  }
+  get_git_repo_root(repo_root, sizeof(repo_root));
 
   // Get branch name again (in case we've changed directories)
   char branch_name[128] = "";
-  int is_dirty = 0;
-  get_git_branch(branch_name, sizeof(branch_name), &is_dirty);
-
-  // Try to get the remote origin URL
-  snprintf(cmd, sizeof(cmd), "git config --get remote.origin.url 2>nul");
-  fp = _popen(cmd, "r");
-  if (fp) {
-    if (fgets(origin_url, sizeof(origin_url), fp)) {
-      // Remove newline
-      size_t len = strlen(origin_url);
-      if (len > 0 && origin_url[len - 1] == '\n') {
-        origin_url[len - 1] = '\0';
-      }
-      success = TRUE;
-    }
-    _pclose(fp);
-  }
+  get_git_branch(branch_name, sizeof(branch_name), NULL);
 
-  if (!success || strlen(origin_url) == 0) {
+  // Get the remote origin URL as a web URL (SSH remotes are converted)
+  if (!get_git_remote_url(git_url, sizeof(git_url))) {
     SetConsoleTextAttribute(hConsole, current_theme.ERROR_COLOR);
     fprintf(stderr, "Error: Repository doesn't have a remote origin URL\n");
     SetConsoleTextAttribute(hConsole, originalAttributes);
@@ -307,41 +286,6 @@ int lsh_gg(char **args) {
     return 1;
   }
 
-  // Convert SSH URLs to HTTPS URLs if needed
-  if (strncmp(origin_url, "git@", 4) == 0) {
-    // SSH format: git@github.com:username/repo.git
-    char *domain_start = origin_url + 4;
-    char *repo_path = strchr(domain_start, ':');
-
-    if (repo_path) {
-      *repo_path = '\0'; // Terminate the domain part
-      repo_path++;       // Move past the colon
-
-      // Remove .git suffix if present
-      char *git_suffix = strstr(repo_path, ".git");
-      if (git_suffix) {
-        *git_suffix = '\0';
-      }
-
-      // Construct HTTPS URL
-      snprintf(git_url, sizeof(git_url), "https://%s/%s", domain_start,
-               repo_path);
-    } else {
-      // Fallback - just use the original
-      strcpy(git_url, origin_url);
-    }
-  } else if (strncmp(origin_url, "https://", 8) == 0) {
-    // Already HTTPS URL, just remove .git suffix if present
-    char *git_suffix = strstr(origin_url, ".git");
-    if (git_suffix) {
-      *git_suffix = '\0';
-    }
-    strcpy(git_url, origin_url);
-  } else {
-    // Unknown format, use as-is
-    strcpy(git_url, origin_url);
-  }
-
   // Process specific file/folder argument if provided
   if (args[1 + arg_offset] != NULL) {
     char arg_path[1024] = "";
@@ -1853,7 +1797,7 @@ void print_file_with_highlighting(FILE *file, FileType type) {
 int lsh_cat(char **args) {
   if (args[1] == NULL) {
     fprintf(stderr, "lsh: expected file argument to \"cat\"\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Check for flags (e.g., -s for syntax highlighting)
@@ -1873,7 +1817,7 @@ int lsh_cat(char **args) {
 
     if (start_index >= 2 && args[start_index] == NULL) {
       fprintf(stderr, "lsh: expected file argument after %s\n", args[1]);
-      return 1;
+      return lsh_builtin_failed();
     }
   }
 
@@ -1957,14 +1901,14 @@ int lsh_cat(char **args) {
   // Make sure we reset the console color
   reset_color();
 
-  return success;
+  return success ? 1 : lsh_builtin_failed();
 }
 
 // Delete files
 int lsh_del(char **args) {
   if (args[1] == NULL) {
     fprintf(stderr, "lsh: expected file argument to \"del\"\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Handle multiple files
@@ -1998,18 +1942,19 @@ int lsh_del(char **args) {
     i++;
   }
 
-  return success;
+  return success ? 1 : lsh_builtin_failed();
 }
 
 // Create directory
 int lsh_mkdir(char **args) {
   if (args[1] == NULL) {
     fprintf(stderr, "lsh: expected argument to \"mkdir\"\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   if (_mkdir(args[1]) != 0) {
     perror("lsh: mkdir");
+    return lsh_builtin_failed();
   }
 
   return 1;
@@ -2019,11 +1964,12 @@ int lsh_mkdir(char **args) {
 int lsh_rmdir(char **args) {
   if (args[1] == NULL) {
     fprintf(stderr, "lsh: expected argument to \"rmdir\"\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   if (_rmdir(args[1]) != 0) {
     perror("lsh: rmdir");
+    return lsh_builtin_failed();
   }
 
   return 1;
@@ -2033,7 +1979,7 @@ int lsh_rmdir(char **args) {
 int lsh_touch(char **args) {
   if (args[1] == NULL) {
     fprintf(stderr, "lsh: expected file argument to \"touch\"\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Handle multiple files
@@ -2081,16 +2027,18 @@ int lsh_touch(char **args) {
     i++;
   }
 
-  return success;
+  return success ? 1 : lsh_builtin_failed();
 }
 
 // Change directory
 int lsh_cd(char **args) {
   if (args[1] == NULL) {
     fprintf(stderr, "lsh: expected argument to \"cd\"\n");
+    return lsh_builtin_failed();
   } else {
     if (_chdir(args[1]) != 0) { // Use _chdir for Windows
       perror("lsh");
+      return lsh_builtin_failed();
     }
   }
   return 1;
@@ -2216,8 +2164,6 @@ WORD get_file_color(const char *filename) {
 }
 int lsh_dir(char **args) {
   char cwd[1024];
-  WIN32_FIND_DATA findData;
-  HANDLE hFind;
 
   // Get handle to console for output
   HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -2261,29 +2207,15 @@ int lsh_dir(char **args) {
     infoBoxWidth = consoleWidth - 4;
   }
 
-  // Prepare search pattern for all files
-  char searchPath[1024];
-  strcpy(searchPath, cwd);
-  strcat(searchPath, "\\*");
-
-  // First pass to count files
-  int fileCount = 0;
-  hFind = FindFirstFile(searchPath, &findData);
-
-  if (hFind == INVALID_HANDLE_VALUE) {
+  // The shared file index has the entries in memory unless the directory
+  // changed since it was last read
+  FileIndexEntry *entries = NULL;
+  int fileCount = file_index_list(NULL, cwd, &entries);
+  if (fileCount < 0) {
     fprintf(stderr, "lsh: Failed to list directory contents\n");
     return 1;
   }
 
-  do {
-    if (strcmp(findData.cFileName, ".") != 0 &&
-        strcmp(findData.cFileName, "..") != 0) {
-      fileCount++;
-    }
-  } while (FindNextFile(hFind, &findData));
-
-  FindClose(hFind);
-
   // Dynamic column width calculation - start with minimum sizes
   int nameColWidth = 4;      // Minimum for "Name"
   int sizeColWidth = 4;      // Minimum for "Size"
@@ -2295,101 +2227,90 @@ int lsh_dir(char **args) {
       (FileInfo *)malloc(sizeof(FileInfo) * (fileCount > 0 ? fileCount : 1));
   if (!fileInfoArray) {
     fprintf(stderr, "lsh: allocation error\n");
+    free(entries);
     return 1;
   }
 
   int fileInfoIndex = 0;
 
-  // Second pass to process files and compute maximum column widths
-  hFind = FindFirstFile(searchPath, &findData);
+  // Process all files and determine max column widths dynamically
+  for (int i = 0; i < fileCount; i++) {
+    const FileIndexEntry *entry = &entries[i];
+    // Format the last modified time as a relative time
+    ULARGE_INTEGER fileTimeValue;
+    fileTimeValue.LowPart = entry->write_time.dwLowDateTime;
+    fileTimeValue.HighPart = entry->write_time.dwHighDateTime;
 
-  if (hFind == INVALID_HANDLE_VALUE) {
-    fprintf(stderr, "lsh: Failed to list directory contents\n");
-    free(fileInfoArray);
-    return 1;
-  }
+    // Calculate difference in 100-nanosecond intervals
+    ULONGLONG timeDiff =
+        (currentTimeValue.QuadPart - fileTimeValue.QuadPart) /
+        10000000; // Convert to seconds
 
-  // Process all files and determine max column widths dynamically
-  do {
-    if (strcmp(findData.cFileName, ".") != 0 &&
-        strcmp(findData.cFileName, "..") != 0) {
-      // Format the last modified time as a relative time
-      ULARGE_INTEGER fileTimeValue;
-      fileTimeValue.LowPart = findData.ftLastWriteTime.dwLowDateTime;
-      fileTimeValue.HighPart = findData.ftLastWriteTime.dwHighDateTime;
-
-      // Calculate difference in 100-nanosecond intervals
-      ULONGLONG timeDiff =
-          (currentTimeValue.QuadPart - fileTimeValue.QuadPart) /
-          10000000; // Convert to seconds
-
-      char timeString[64];
-      if (timeDiff < 60) {
-        sprintf(timeString, "%llu seconds ago", timeDiff);
-      } else if (timeDiff < 3600) {
-        sprintf(timeString, "%llu minutes ago", timeDiff / 60);
-      } else if (timeDiff < 86400) {
-        sprintf(timeString, "%llu hours ago", timeDiff / 3600);
-      } else if (timeDiff < 604800) {
-        sprintf(timeString, "%llu days ago", timeDiff / 86400);
-      } else if (timeDiff < 2629800) { // ~1 month in seconds
-        sprintf(timeString, "%llu weeks ago", timeDiff / 604800);
-      } else if (timeDiff < 31557600) { // ~1 year in seconds
-        sprintf(timeString, "%llu months ago", timeDiff / 2629800);
-      } else {
-        sprintf(timeString, "%llu years ago", timeDiff / 31557600);
-      }
+    char timeString[64];
+    if (timeDiff < 60) {
+      sprintf(timeString, "%llu seconds ago", timeDiff);
+    } else if (timeDiff < 3600) {
+      sprintf(timeString, "%llu minutes ago", timeDiff / 60);
+    } else if (timeDiff < 86400) {
+      sprintf(timeString, "%llu hours ago", timeDiff / 3600);
+    } else if (timeDiff < 604800) {
+      sprintf(timeString, "%llu days ago", timeDiff / 86400);
+    } else if (timeDiff < 2629800) { // ~1 month in seconds
+      sprintf(timeString, "%llu weeks ago", timeDiff / 604800);
+    } else if (timeDiff < 31557600) { // ~1 year in seconds
+      sprintf(timeString, "%llu months ago", timeDiff / 2629800);
+    } else {
+      sprintf(timeString, "%llu years ago", timeDiff / 31557600);
+    }
 
-      // Update max width for modified column
-      int len = strlen(timeString);
-      if (len > modifiedColWidth)
-        modifiedColWidth = len;
+    // Update max width for modified column
+    int len = strlen(timeString);
+    if (len > modifiedColWidth)
+      modifiedColWidth = len;
 
-      // Check if it's a directory
-      BOOL isDirectory = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
-      const char *fileType = isDirectory ? "Directory" : "File";
+    // Check if it's a directory
+    BOOL isDirectory = (entry->attributes & FILE_ATTRIBUTE_DIRECTORY);
+    const char *fileType = isDirectory ? "Directory" : "File";
 
-      // Update max width for type column
-      len = strlen(fileType);
-      if (len > typeColWidth)
-        typeColWidth = len;
+    // Update max width for type column
+    len = strlen(fileType);
+    if (len > typeColWidth)
+      typeColWidth = len;
 
-      // Format size (only for files)
-      char sizeString[32];
-      if (isDirectory) {
-        strcpy(sizeString, "-");
+    // Format size (only for files)
+    char sizeString[32];
+    if (isDirectory) {
+      strcpy(sizeString, "-");
+    } else {
+      if (entry->size < 1024) {
+        sprintf(sizeString, "%llu B", entry->size);
+      } else if (entry->size < 1024 * 1024) {
+        sprintf(sizeString, "%.1f KB", entry->size / 1024.0);
       } else {
-        if (findData.nFileSizeLow < 1024) {
-          sprintf(sizeString, "%lu B", findData.nFileSizeLow);
-        } else if (findData.nFileSizeLow < 1024 * 1024) {
-          sprintf(sizeString, "%.1f KB", findData.nFileSizeLow / 1024.0);
-        } else {
-          sprintf(sizeString, "%.1f MB",
-                  findData.nFileSizeLow / (1024.0 * 1024.0));
-        }
+        sprintf(sizeString, "%.1f MB", entry->size / (1024.0 * 1024.0));
       }
-
-      // Update max width for size column
-      len = strlen(sizeString);
-      if (len > sizeColWidth)
-        sizeColWidth = len;
-
-      // Update max width for name column
-      len = strlen(findData.cFileName);
-      if (len > nameColWidth)
-        nameColWidth = len;
-
-      // Store file info
-      strcpy(fileInfoArray[fileInfoIndex].timeString, timeString);
-      strcpy(fileInfoArray[fileInfoIndex].sizeString, sizeString);
-      strcpy(fileInfoArray[fileInfoIndex].fileType, fileType);
-      strcpy(fileInfoArray[fileInfoIndex].fileName, findData.cFileName);
-      fileInfoArray[fileInfoIndex].isDirectory = isDirectory;
-      fileInfoIndex++;
     }
-  } while (FindNextFile(hFind, &findData));
 
-  FindClose(hFind);
+    // Update max width for size column
+    len = strlen(sizeString);
+    if (len > sizeColWidth)
+      sizeColWidth = len;
+
+    // Update max width for name column
+    len = strlen(entry->name);
+    if (len > nameColWidth)
+      nameColWidth = len;
+
+    // Store file info
+    strcpy(fileInfoArray[fileInfoIndex].timeString, timeString);
+    strcpy(fileInfoArray[fileInfoIndex].sizeString, sizeString);
+    strcpy(fileInfoArray[fileInfoIndex].fileType, fileType);
+    strcpy(fileInfoArray[fileInfoIndex].fileName, entry->name);
+    fileInfoArray[fileInfoIndex].isDirectory = isDirectory;
+    fileInfoIndex++;
+  }
+
+  free(entries);
 
   // Add padding to column widths
   nameColWidth += 2;
@@ -2569,7 +2490,7 @@ int lsh_copy(char **args) {
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -raw    Copy file contents to clipboard instead of the "
                     "file itself\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Check for -raw flag
@@ -2581,7 +2502,7 @@ int lsh_copy(char **args) {
 
     if (args[2] == NULL) {
       fprintf(stderr, "lsh: expected file argument after -raw\n");
-      return 1;
+      return lsh_builtin_failed();
     }
 
     filename = args[2];
@@ -2592,7 +2513,7 @@ int lsh_copy(char **args) {
   if (file == NULL) {
     fprintf(stderr, "lsh: cannot find '%s': ", filename);
     perror("");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Get file size
@@ -2608,7 +2529,7 @@ int lsh_copy(char **args) {
     if (!file_content) {
       fprintf(stderr, "lsh: failed to allocate memory for file content\n");
       fclose(file);
-      return 1;
+      return lsh_builtin_failed();
     }
 
     size_t bytes_read = fread(file_content, 1, file_size, file);
@@ -2620,7 +2541,7 @@ int lsh_copy(char **args) {
     if (h_mem == NULL) {
       fprintf(stderr, "lsh: failed to allocate global memory for clipboard\n");
       free(file_content);
-      return 1;
+      return lsh_builtin_failed();
     }
 
     // Lock the memory and copy file content
@@ -2629,7 +2550,7 @@ int lsh_copy(char **args) {
       fprintf(stderr, "lsh: failed to lock global memory\n");
       GlobalFree(h_mem);
       free(file_content);
-      return 1;
+      return lsh_builtin_failed();
     }
 
     memcpy(clipboard_content, file_content, bytes_read);
@@ -2641,7 +2562,7 @@ int lsh_copy(char **args) {
       fprintf(stderr, "lsh: failed to open clipboard\n");
       GlobalFree(h_mem);
       free(file_content);
-      return 1;
+      return lsh_builtin_failed();
     }
 
     EmptyClipboard();
@@ -2652,7 +2573,7 @@ int lsh_copy(char **args) {
       fprintf(stderr, "lsh: failed to set clipboard data\n");
       GlobalFree(h_mem);
       free(file_content);
-      return 1;
+      return lsh_builtin_failed();
     }
 
     // Don't free h_mem here - Windows takes ownership of it
@@ -2668,7 +2589,7 @@ int lsh_copy(char **args) {
     char fullPath[1024];
     if (_fullpath(fullPath, filename, sizeof(fullPath)) == NULL) {
       fprintf(stderr, "lsh: failed to get full path for '%s'\n", filename);
-      return 1;
+      return lsh_builtin_failed();
     }
 
     // Extract just the filename from the path
@@ -2718,14 +2639,14 @@ int lsh_copy(char **args) {
 int lsh_paste(char **args) {
   if (copied_file_path == NULL || copied_file_name == NULL) {
     fprintf(stderr, "lsh: no file has been copied\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Construct destination path (current directory + filename)
   char destPath[1024];
   if (_getcwd(destPath, sizeof(destPath)) == NULL) {
     fprintf(stderr, "lsh: failed to get current directory\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Add backslash if needed
@@ -2738,7 +2659,7 @@ int lsh_paste(char **args) {
   // Check if source and destination are the same
   if (strcmp(copied_file_path, destPath) == 0) {
     fprintf(stderr, "lsh: source and destination are the same file\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Check if destination file already exists
@@ -2759,7 +2680,7 @@ int lsh_paste(char **args) {
   if (sourceFile == NULL) {
     fprintf(stderr, "lsh: cannot open source file '%s': ", copied_file_path);
     perror("");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Open destination file
@@ -2768,7 +2689,7 @@ int lsh_paste(char **args) {
     fprintf(stderr, "lsh: cannot create destination file '%s': ", destPath);
     perror("");
     fclose(sourceFile);
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Copy the file contents
@@ -2782,7 +2703,7 @@ int lsh_paste(char **args) {
       fprintf(stderr, "lsh: error writing to '%s'\n", destPath);
       fclose(sourceFile);
       fclose(destFile);
-      return 1;
+      return lsh_builtin_failed();
     }
     totalBytes += bytesRead;
   }
@@ -2800,7 +2721,7 @@ int lsh_move(char **args) {
     fprintf(stderr,
             "lsh: expected source and destination arguments for \"move\"\n");
     fprintf(stderr, "Usage: move <source> <destination>\n");
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Check if source exists
@@ -2810,7 +2731,7 @@ int lsh_move(char **args) {
   if (hFind == INVALID_HANDLE_VALUE) {
     fprintf(stderr, "lsh: cannot find source '%s': No such file or directory\n",
             args[1]);
-    return 1;
+    return lsh_builtin_failed();
   }
 
   FindClose(hFind);
@@ -2821,12 +2742,12 @@ int lsh_move(char **args) {
 
   if (_fullpath(srcPath, args[1], MAX_PATH) == NULL) {
     fprintf(stderr, "lsh: failed to get full path for '%s'\n", args[1]);
-    return 1;
+    return lsh_builtin_failed();
   }
 
   if (_fullpath(destPath, args[2], MAX_PATH) == NULL) {
     fprintf(stderr, "lsh: failed to get full path for '%s'\n", args[2]);
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Check if destination is a directory
@@ -2853,7 +2774,7 @@ int lsh_move(char **args) {
   if (_stricmp(srcPath, destPath) == 0) {
     fprintf(stderr, "lsh: '%s' and '%s' are the same file\n", srcPath,
             destPath);
-    return 1;
+    return lsh_builtin_failed();
   }
 
   // Check if destination already exists
@@ -2893,7 +2814,7 @@ int lsh_move(char **args) {
       break;
     }
 
-    return 1;
+    return lsh_builtin_failed();
   }
 
   printf("Moved '%s' to '%s'\n", args[1], destPath);
@@ -2957,8 +2878,6 @@ int lsh_help(char **args) {
  */
 TableData *lsh_dir_structured(char **args) {
   char cwd[1024];
-  WIN32_FIND_DATA findData;
-  HANDLE hFind;
 
   // Create table with appropriate headers - matching the order in lsh_dir()
   char *headers[] = {"Name", "Size", "Type", "Last Modified"};
@@ -2983,31 +2902,16 @@ TableData *lsh_dir_structured(char **args) {
   currentTimeValue.LowPart = currentFileTime.dwLowDateTime;
   currentTimeValue.HighPart = currentFileTime.dwHighDateTime;
 
-  // Prepare search pattern for all files
-  char searchPath[1024];
-  strcpy(searchPath, cwd);
-  strcat(searchPath, "\\*");
-
-  // First find to count files
-  hFind = FindFirstFile(searchPath, &findData);
-
-  if (hFind == INVALID_HANDLE_VALUE) {
+  // The shared file index has the entries in memory unless the directory
+  // changed since it was last read
+  FileIndexEntry *entries = NULL;
+  int fileCount = file_index_list(NULL, cwd, &entries);
+  if (fileCount < 0) {
     fprintf(stderr, "lsh: Failed to list directory contents\n");
     free_table(table);
     return NULL;
   }
 
-  // Count files for initial allocation
-  int fileCount = 0;
-  do {
-    if (strcmp(findData.cFileName, ".") != 0 &&
-        strcmp(findData.cFileName, "..") != 0) {
-      fileCount++;
-    }
-  } while (FindNextFile(hFind, &findData));
-
-  FindClose(hFind);
-
   // Structure to hold file info for sorting
   typedef struct {
     char timeString[64];
@@ -3019,19 +2923,11 @@ TableData *lsh_dir_structured(char **args) {
   } FileInfoItem;
 
   // Allocate array for sorting
-  FileInfoItem *fileInfoArray =
-      (FileInfoItem *)malloc(sizeof(FileInfoItem) * fileCount);
+  FileInfoItem *fileInfoArray = (FileInfoItem *)malloc(
+      sizeof(FileInfoItem) * (fileCount > 0 ? fileCount : 1));
   if (!fileInfoArray) {
     fprintf(stderr, "lsh: allocation error in lsh_dir_structured\n");
-    free_table(table);
-    return NULL;
-  }
-
-  // Second pass to collect file info
-  hFind = FindFirstFile(searchPath, &findData);
-  if (hFind == INVALID_HANDLE_VALUE) {
-    fprintf(stderr, "lsh: Failed to list directory contents\n");
-    free(fileInfoArray);
+    free(entries);
     free_table(table);
     return NULL;
   }
@@ -3039,77 +2935,73 @@ TableData *lsh_dir_structured(char **args) {
   int fileIndex = 0;
 
   // Process all files
-  do {
-    // Skip . and .. directories for cleaner output
-    if (strcmp(findData.cFileName, ".") != 0 &&
-        strcmp(findData.cFileName, "..") != 0) {
-      // Format the last modified time as a relative time
-      ULARGE_INTEGER fileTimeValue;
-      fileTimeValue.LowPart = findData.ftLastWriteTime.dwLowDateTime;
-      fileTimeValue.HighPart = findData.ftLastWriteTime.dwHighDateTime;
-
-      // Calculate difference in 100-nanosecond intervals
-      ULONGLONG timeDiff =
-          (currentTimeValue.QuadPart - fileTimeValue.QuadPart) /
-          10000000; // Convert to seconds
-
-      // Store the time difference for sorting
-      fileInfoArray[fileIndex].timeDiff = timeDiff;
-
-      // Format the time difference as a human-readable string
-      if (timeDiff < 60) {
-        sprintf(fileInfoArray[fileIndex].timeString, "%llu seconds ago",
-                timeDiff);
-      } else if (timeDiff < 3600) {
-        sprintf(fileInfoArray[fileIndex].timeString, "%llu minutes ago",
-                timeDiff / 60);
-      } else if (timeDiff < 86400) {
-        sprintf(fileInfoArray[fileIndex].timeString, "%llu hours ago",
-                timeDiff / 3600);
-      } else if (timeDiff < 604800) {
-        sprintf(fileInfoArray[fileIndex].timeString, "%llu days ago",
-                timeDiff / 86400);
-      } else if (timeDiff < 2629800) { // ~1 month in seconds
-        sprintf(fileInfoArray[fileIndex].timeString, "%llu weeks ago",
-                timeDiff / 604800);
-      } else if (timeDiff < 31557600) { // ~1 year in seconds
-        sprintf(fileInfoArray[fileIndex].timeString, "%llu months ago",
-                timeDiff / 2629800);
-      } else {
-        sprintf(fileInfoArray[fileIndex].timeString, "%llu years ago",
-                timeDiff / 31557600);
-      }
+  for (int i = 0; i < fileCount; i++) {
+    const FileIndexEntry *entry = &entries[i];
+    // Format the last modified time as a relative time
+    ULARGE_INTEGER fileTimeValue;
+    fileTimeValue.LowPart = entry->write_time.dwLowDateTime;
+    fileTimeValue.HighPart = entry->write_time.dwHighDateTime;
+
+    // Calculate difference in 100-nanosecond intervals
+    ULONGLONG timeDiff =
+        (currentTimeValue.QuadPart - fileTimeValue.QuadPart) /
+        10000000; // Convert to seconds
+
+    // Store the time difference for sorting
+    fileInfoArray[fileIndex].timeDiff = timeDiff;
+
+    // Format the time difference as a human-readable string
+    if (timeDiff < 60) {
+      sprintf(fileInfoArray[fileIndex].timeString, "%llu seconds ago",
+              timeDiff);
+    } else if (timeDiff < 3600) {
+      sprintf(fileInfoArray[fileIndex].timeString, "%llu minutes ago",
+              timeDiff / 60);
+    } else if (timeDiff < 86400) {
+      sprintf(fileInfoArray[fileIndex].timeString, "%llu hours ago",
+              timeDiff / 3600);
+    } else if (timeDiff < 604800) {
+      sprintf(fileInfoArray[fileIndex].timeString, "%llu days ago",
+              timeDiff / 86400);
+    } else if (timeDiff < 2629800) { // ~1 month in seconds
+      sprintf(fileInfoArray[fileIndex].timeString, "%llu weeks ago",
+              timeDiff / 604800);
+    } else if (timeDiff < 31557600) { // ~1 year in seconds
+      sprintf(fileInfoArray[fileIndex].timeString, "%llu months ago",
+              timeDiff / 2629800);
+    } else {
+      sprintf(fileInfoArray[fileIndex].timeString, "%llu years ago",
+              timeDiff / 31557600);
+    }
 
-      // Check if it's a directory
-      BOOL isDirectory = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
-      strcpy(fileInfoArray[fileIndex].fileType,
-             isDirectory ? "Directory" : "File");
-      fileInfoArray[fileIndex].isDirectory = isDirectory;
+    // Check if it's a directory
+    BOOL isDirectory = (entry->attributes & FILE_ATTRIBUTE_DIRECTORY);
+    strcpy(fileInfoArray[fileIndex].fileType,
+           isDirectory ? "Directory" : "File");
+    fileInfoArray[fileIndex].isDirectory = isDirectory;
 
-      // Format size (only for files)
-      if (isDirectory) {
-        strcpy(fileInfoArray[fileIndex].sizeString, "-");
+    // Format size (only for files)
+    if (isDirectory) {
+      strcpy(fileInfoArray[fileIndex].sizeString, "-");
+    } else {
+      if (entry->size < 1024) {
+        sprintf(fileInfoArray[fileIndex].sizeString, "%llu B", entry->size);
+      } else if (entry->size < 1024 * 1024) {
+        sprintf(fileInfoArray[fileIndex].sizeString, "%.1f KB",
+                entry->size / 1024.0);
       } else {
-        if (findData.nFileSizeLow < 1024) {
-          sprintf(fileInfoArray[fileIndex].sizeString, "%lu B",
-                  findData.nFileSizeLow);
-        } else if (findData.nFileSizeLow < 1024 * 1024) {
-          sprintf(fileInfoArray[fileIndex].sizeString, "%.1f KB",
-                  findData.nFileSizeLow / 1024.0);
-        } else {
-          sprintf(fileInfoArray[fileIndex].sizeString, "%.1f MB",
-                  findData.nFileSizeLow / (1024.0 * 1024.0));
-        }
+        sprintf(fileInfoArray[fileIndex].sizeString, "%.1f MB",
+                entry->size / (1024.0 * 1024.0));
       }
+    }
 
-      // Store filename
-      strcpy(fileInfoArray[fileIndex].fileName, findData.cFileName);
+    // Store filename
+    strcpy(fileInfoArray[fileIndex].fileName, entry->name);
 
-      fileIndex++;
-    }
-  } while (FindNextFile(hFind, &findData));
+    fileIndex++;
+  }
 
-  FindClose(hFind);
+  free(entries);
 
   // Sort the files - directories first, then by name
   for (int i = 0; i < fileCount - 1; i++) {
@@ -3909,7 +3801,8 @@ int lsh_self_destruct() {
  */
 int is_source_code_file(const char *filename);
 unsigned long count_lines_in_file(const char *filename);
-void count_lines_in_directory(const char *directory, unsigned long *total_files,
+void count_lines_in_directory(const char *root, const char *directory,
+                              unsigned long *total_files,
                               unsigned long *total_lines, int recursive,
                               int verbose, HANDLE hConsole);
 
@@ -3969,9 +3862,13 @@ int lsh_loc(char **args) {
          recursive ? " (recursive)" : "");
   SetConsoleTextAttribute(hConsole, originalAttributes);
 
-  // Start the count process
-  count_lines_in_directory(path, &total_files, &total_lines, recursive, verbose,
-                           hConsole);
+  // Read the tree into the shared file index in parallel first, then count,
+  // leaving out what .gitignore files exclude
+  if (recursive) {
+    file_index_fill(path);
+  }
+  count_lines_in_directory(recursive ? path : NULL, path, &total_files,
+                           &total_lines, recursive, verbose, hConsole);
 
   // Print the results with nice formatting
   printf("\n");
@@ -4060,14 +3957,15 @@ unsigned long count_lines_in_file(const char *filename) {
 }
 
 /**
- * Helper function to count lines in a directory
+ * Helper function to count lines in a directory, reading its entries from
+ * the shared file index (root is the top of a recursive count, or NULL)
  */
-void count_lines_in_directory(const char *directory, unsigned long *total_files,
+void count_lines_in_directory(const char *root, const char *directory,
+                              unsigned long *total_files,
                               unsigned long *total_lines, int recursive,
                               int verbose, HANDLE hConsole) {
-  char search_path[MAX_PATH];
-  WIN32_FIND_DATA find_data;
-  HANDLE h_find;
+  FileIndexEntry *entries = NULL;
+  int entry_count;
   WORD originalAttributes;
 
   // Get original console attributes
@@ -4075,13 +3973,10 @@ void count_lines_in_directory(const char *directory, unsigned long *total_files,
   GetConsoleScreenBufferInfo(hConsole, &csbi);
   originalAttributes = csbi.wAttributes;
 
-  // Construct search pattern
-  snprintf(search_path, sizeof(search_path), "%s\\*", directory);
+  // Get the directory's entries
+  entry_count = file_index_list(root, directory, &entries);
 
-  // Start file search
-  h_find = FindFirstFile(search_path, &find_data);
-
-  if (h_find == INVALID_HANDLE_VALUE) {
+  if (entry_count < 0) {
     SetConsoleTextAttribute(hConsole, current_theme.WARNING_COLOR);
     fprintf(stderr, "Error: Failed to access directory '%s'\n", directory);
     SetConsoleTextAttribute(hConsole, originalAttributes);
@@ -4096,38 +3991,39 @@ void count_lines_in_directory(const char *directory, unsigned long *total_files,
   }
 
   // Process all files in the directory
-  do {
-    // Skip "." and ".." directories
-    if (strcmp(find_data.cFileName, ".") == 0 ||
-        strcmp(find_data.cFileName, "..") == 0) {
+  for (int i = 0; i < entry_count; i++) {
+    const FileIndexEntry *entry = &entries[i];
+
+    // Skip the repository itself, and ignored entries; ignored directories
+    // are never opened
+    if (entry->ignored || _stricmp(entry->name, ".git") == 0) {
       continue;
     }
 
     // Construct full path to the file/directory
     char full_path[MAX_PATH];
-    snprintf(full_path, sizeof(full_path), "%s\\%s", directory,
-             find_data.cFileName);
+    snprintf(full_path, sizeof(full_path), "%s\\%s", directory, entry->name);
 
-    if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+    if (entry->attributes & FILE_ATTRIBUTE_DIRECTORY) {
       // It's a directory - recurse if enabled
       if (recursive) {
-        count_lines_in_directory(full_path, total_files, total_lines, recursive,
-                                 verbose, hConsole);
+        count_lines_in_directory(root, full_path, total_files, total_lines,
+                                 recursive, verbose, hConsole);
       }
     } else {
       // It's a file - count lines if it's a source code file
-      if (is_source_code_file(find_data.cFileName)) {
+      if (is_source_code_file(entry->name)) {
         unsigned long lines = count_lines_in_file(full_path);
         (*total_files)++;
         (*total_lines) += lines;
 
         if (verbose) {
           // Get file color based on extension
-          WORD fileColor = get_file_color(find_data.cFileName);
+          WORD fileColor = get_file_color(entry->name);
 
           printf("  ");
           SetConsoleTextAttribute(hConsole, fileColor);
-          printf("%-40s", find_data.cFileName);
+          printf("%-40s", entry->name);
           SetConsoleTextAttribute(hConsole, originalAttributes);
           printf(": ");
           SetConsoleTextAttribute(hConsole, current_theme.ACCENT_COLOR);
@@ -4136,9 +4032,9 @@ void count_lines_in_directory(const char *directory, unsigned long *total_files,
         }
       }
     }
-  } while (FindNextFile(h_find, &find_data));
+  }
 
-  FindClose(h_find);
+  free(entries);
 }
 
 int lsh_git_status(char **args) {
@@ -4147,9 +4043,14 @@ int lsh_git_status(char **args) {
   int is_dirty = 0;
   char repo_name[256] = "";
   char repo_url[512] = "";
+  char upstream_ref[512] = "";
+  char upstream_name[512] = "";
+  int has_upstream = 0;
   int ahead_count = 0;
   int behind_count = 0;
   int commit_count = 0;
+  GitCommitSummary recent[5];
+  int recent_count = -1;
   FILE *fp;
   char buffer[1024];
 
@@ -4175,32 +4076,35 @@ int lsh_git_status(char **args) {
   }
 
   // Get remote URL
-  fp = _popen("git config --get remote.origin.url 2>nul", "r");
-  if (fp && fgets(buffer, sizeof(buffer), fp)) {
-    // Remove newline
-    buffer[strcspn(buffer, "\n")] = 0;
-    strcpy(repo_url, buffer);
-  }
-  if (fp)
-    _pclose(fp);
-
-  // Get ahead/behind counts
-  fp =
-      _popen("git rev-list --left-right --count HEAD...@{upstream} 2>nul", "r");
-  if (fp && fgets(buffer, sizeof(buffer), fp)) {
-    // Parse ahead/behind counts
-    sscanf(buffer, "%d %d", &ahead_count, &behind_count);
-  }
-  if (fp)
-    _pclose(fp);
+  get_git_origin_url(repo_url, sizeof(repo_url));
+
+  // Ahead/behind counts, commit count and recent commits come from walking
+  // the commit graph in-process
+  GitRepo repo;
+  unsigned char head[GIT_OID_RAW_LEN];
+  if (git_repo_open(NULL, &repo) && repo.head_oid[0] &&
+      git_oid_from_hex(repo.head_oid, head)) {
+    GitObjectDb *db = git_odb_open(&repo);
+    if (db) {
+      char upstream_hex[GIT_OID_HEX_LEN + 1];
+      unsigned char upstream[GIT_OID_RAW_LEN];
+      if (git_branch_upstream(&repo, repo.branch, upstream_ref,
+                              sizeof(upstream_ref), upstream_name,
+                              sizeof(upstream_name)) &&
+          git_resolve_ref(&repo, upstream_ref, upstream_hex) &&
+          git_oid_from_hex(upstream_hex, upstream)) {
+        has_upstream = git_ahead_behind(db, head, upstream, &ahead_count,
+                                        &behind_count);
+      }
 
-  // Get total commit count
-  fp = _popen("git rev-list --count HEAD 2>nul", "r");
-  if (fp && fgets(buffer, sizeof(buffer), fp)) {
-    commit_count = atoi(buffer);
+      commit_count = git_count_commits(db, head, 1000000);
+      if (commit_count < 0) {
+        commit_count = 0;
+      }
+      recent_count = git_recent_commits(db, head, recent, 5);
+      git_odb_close(db);
+    }
   }
-  if (fp)
-    _pclose(fp);
 
   // Display enhanced git status with color
   printf("\n");
@@ -4233,7 +4137,7 @@ int lsh_git_status(char **args) {
   printf("  Total commits: %d\n", commit_count);
 
   // Ahead/behind status
-  if (ahead_count > 0 || behind_count > 0) {
+  if (has_upstream && (ahead_count > 0 || behind_count > 0)) {
     printf("  Sync status: ");
     if (ahead_count > 0) {
       SetConsoleTextAttribute(hConsole,
@@ -4249,13 +4153,16 @@ int lsh_git_status(char **args) {
       printf("%d commit(s) behind", behind_count);
       SetConsoleTextAttribute(hConsole, current_theme.PRIMARY_COLOR);
     }
-    printf(" of origin/%s\n", branch_name);
-  } else if (strlen(repo_url) > 0) {
+    printf(" of %s\n", upstream_name);
+  } else if (has_upstream) {
     printf("  Sync status: ");
     SetConsoleTextAttribute(hConsole, FOREGROUND_GREEN | FOREGROUND_INTENSITY);
     printf("Up to date");
     SetConsoleTextAttribute(hConsole, current_theme.PRIMARY_COLOR);
-    printf(" with origin/%s\n", branch_name);
+    printf(" with %s\n", upstream_name);
+  } else if (strlen(repo_url) > 0) {
+    printf("  Sync status: ");
+    printf("No upstream branch\n");
   } else {
     printf("  Sync status: ");
     printf("No remote configured\n");
@@ -4321,73 +4228,48 @@ int lsh_git_status(char **args) {
 
   printf("\n\n");
 
-  // Show the last few commits - using separate commands for different info
+  // Show the last few commits
   printf("  Recent commits:\n");
 
-  // Get the basic commit info using --oneline which is more reliable
-  fp = _popen("git log -5 --oneline 2>nul", "r");
-  if (fp) {
-    int count = 0;
-    char commit_hashes[5][10]; // Store hashes for later lookup
-
-    while (fgets(buffer, sizeof(buffer), fp) && count < 5) {
-      // Remove newline
-      buffer[strcspn(buffer, "\n")] = 0;
-
-      // Extract hash (first 7 characters)
-      strncpy(commit_hashes[count], buffer, 7);
-      commit_hashes[count][7] = '\0';
-
-      // Extract message (everything after the first space)
-      char *message = strchr(buffer, ' ');
-      if (message)
-        message++;
-      else
-        message = "";
-
-      // Print hash with highlighting
-      SetConsoleTextAttribute(hConsole, current_theme.SECONDARY_COLOR);
-      printf("    %s", commit_hashes[count]);
-      SetConsoleTextAttribute(hConsole, current_theme.PRIMARY_COLOR);
-      printf(" %s", message);
-
-      // Look up additional information for this commit
-      char cmd[256];
-      char time_buffer[128] = "";
-      char author_buffer[128] = "";
-      FILE *time_fp, *author_fp;
-
-      // Get relative time
-      sprintf(cmd, "git show -s --format=%%cr %s 2>nul", commit_hashes[count]);
-      time_fp = _popen(cmd, "r");
-      if (time_fp && fgets(time_buffer, sizeof(time_buffer), time_fp)) {
-        time_buffer[strcspn(time_buffer, "\n")] = 0;
-        printf(" (%s)", time_buffer);
-        _pclose(time_fp);
-      }
+  if (recent_count < 0) {
+    printf("    Unable to retrieve commit history\n");
+  } else if (recent_count == 0) {
+    printf("    No commits found\n");
+  }
 
-      // Get author
-      sprintf(cmd, "git show -s --format=%%an %s 2>nul", commit_hashes[count]);
-      author_fp = _popen(cmd, "r");
-      if (author_fp && fgets(author_buffer, sizeof(author_buffer), author_fp)) {
-        author_buffer[strcspn(author_buffer, "\n")] = 0;
-        printf(" <%s>", author_buffer);
-        _pclose(author_fp);
-      }
+  time_t now = time(NULL);
+  for (int i = 0; i < recent_count; i++) {
+    // Print abbreviated hash with highlighting
+    SetConsoleTextAttribute(hConsole, current_theme.SECONDARY_COLOR);
+    printf("    %.7s", recent[i].oid);
+    SetConsoleTextAttribute(hConsole, current_theme.PRIMARY_COLOR);
+    printf(" %s", recent[i].subject);
 
-      printf("\n");
-      count++;
+    // Relative commit time
+    long long timeDiff = (long long)now - recent[i].commit_time;
+    if (timeDiff < 0) {
+      timeDiff = 0;
     }
-
-    if (count == 0) {
-      printf("    No commits found\n");
+    char timeString[64];
+    if (timeDiff < 60) {
+      sprintf(timeString, "%lld seconds ago", timeDiff);
+    } else if (timeDiff < 3600) {
+      sprintf(timeString, "%lld minutes ago", timeDiff / 60);
+    } else if (timeDiff < 86400) {
+      sprintf(timeString, "%lld hours ago", timeDiff / 3600);
+    } else if (timeDiff < 604800) {
+      sprintf(timeString, "%lld days ago", timeDiff / 86400);
+    } else if (timeDiff < 2629800) { // ~1 month in seconds
+      sprintf(timeString, "%lld weeks ago", timeDiff / 604800);
+    } else if (timeDiff < 31557600) { // ~1 year in seconds
+      sprintf(timeString, "%lld months ago", timeDiff / 2629800);
+    } else {
+      sprintf(timeString, "%lld years ago", timeDiff / 31557600);
     }
-  } else {
-    printf("    Unable to retrieve commit history\n");
-  }
+    printf(" (%s)", timeString);
 
-  if (fp)
-    _pclose(fp);
+    printf(" <%s>\n", recent[i].author);
+  }
 
   printf("\n");
 
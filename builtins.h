@@ -84,6 +84,7 @@ int lsh_theme(char **args);
 int lsh_loc(char **args);
 int lsh_git_status(char **args);
 int lsh_gg(char **args);
+int lsh_parallel(char **args);
 
 // Commands with structured output
 TableData *lsh_dir_structured(char **args);
@@ -99,6 +100,14 @@ int lsh_num_builtins(void);
 extern char *builtin_str[];
 extern int (*builtin_func[])(char **);
 
+/**
+ * Mark the running builtin as failed. lsh_execute clears the exit code
+ * before a builtin runs, so builtins only report failure.
+ *
+ * @return 1, so the shell keeps running
+ */
+int lsh_builtin_failed(void);
+
 /**
  * Extract a string value from a JSON object
  *
@@ -25,8 +25,6 @@
 
 // Common defines
 #define LSH_RL_BUFSIZE 1024
-#define LSH_TOK_BUFSIZE 64
-#define LSH_TOK_DELIM " \t\r\n\a"
 
 // Console and input defines
 #ifndef CP_UTF8
@@ -5,6 +5,7 @@
 
 #include "favorite_cities.h"
 #include "builtins.h"
+#include "subsystems.h"
 
 // Define FOREGROUND_CYAN since it's not in the standard Windows API
 #define FOREGROUND_CYAN (FOREGROUND_GREEN | FOREGROUND_BLUE)
@@ -194,6 +195,8 @@ int remove_favorite_city(const char *name) {
  * Find a favorite city by name
  */
 CityEntry *find_favorite_city(const char *name) {
+  ensure_subsystem(SUBSYSTEM_CITIES);
+
   if (!name)
     return NULL;
 
@@ -210,6 +213,8 @@ CityEntry *find_favorite_city(const char *name) {
  * Get favorite city names for tab completion
  */
 char **get_favorite_city_names(int *count) {
+  ensure_subsystem(SUBSYSTEM_CITIES);
+
   if (favorite_city_count == 0) {
     *count = 0;
     return NULL;
@@ -237,6 +242,8 @@ char **get_favorite_city_names(int *count) {
  *   cities list
  */
 int lsh_cities(char **args) {
+  ensure_subsystem(SUBSYSTEM_CITIES);
+
   if (args[1] == NULL) {
     // No subcommand - show usage
     printf("Usage: cities <command> [arguments]\n");
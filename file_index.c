@@ -0,0 +1,1152 @@
+/**
+ * file_index.c
+ * Shared in-memory index of directory trees
+ *
+ * Each indexed tree has a root directory and one watch on it. A walk's
+ * tree is rooted where the walk starts; a directory listed on its own
+ * (by dir or tab completion) is served from the tree of the repository
+ * holding it, or else from a tree of just that directory with a watch on
+ * it alone, so listing C:\ does not watch the whole drive.
+ *
+ * A directory is read the first time it is asked for; its entries, with
+ * their attributes, sizes, write times and ignore status, are then served
+ * from memory until the watch reports a change anywhere in the tree. After
+ * that every directory is read again the next time it is asked for, and
+ * the nodes of entries that are still there are kept along with the
+ * subtrees under them. Trees whose watch fell back to polling are read on
+ * every request, as polling sees changes late.
+ */
+
+#include "file_index.h"
+#include "arena.h"
+#include "fs_watch.h"
+#include "git_repo.h"
+#include "ignore_rules.h"
+#include "thread_pool.h"
+#include <ctype.h>
+
+#define INDEX_NAME_BLOCK (64 * 1024) // Arena block for interned names
+#define INDEX_LIST_BLOCK (16 * 1024) // Arena block for names being read
+#define INDEX_NAME_SLOTS 4096        // Initial size of the name table
+
+// A file or directory in an indexed tree
+typedef struct IndexNode IndexNode;
+struct IndexNode {
+  const char *name; // Interned
+  IndexNode *parent;
+  DWORD attributes;
+  ULONGLONG size;
+  FILETIME write_time;
+  BOOL ignored;
+  IndexNode **children;     // Sorted by name, ignoring case
+  int child_count;
+  IgnoreStack *ignore;      // Rules in effect inside the directory
+  unsigned long generation; // Watch generation the children were read at
+  BOOL listed;              // Children have been read at least once
+  IndexNode *next_retired;
+};
+
+// An indexed tree
+typedef struct {
+  char path[MAX_PATH]; // Full path without a trailing backslash ("C:" for
+                       // the root of a drive)
+  char full_path[MAX_PATH]; // path as callers wrote it, before long names
+                            // were resolved
+  BOOL recursive;      // FALSE for a directory listed on its own, whose
+                       // tree holds only that directory
+  IndexNode *node;
+  IgnoreStack *base;   // Rules from above the root
+  int watch_id;        // 0 if the tree is not cached
+  int users;           // Calls using the tree; nodes are only freed at 0
+  BOOL evicted;        // Dropped from index_roots, freed at 0 users
+  IndexNode *retired;  // Subtrees no longer on disk, freed at 0 users
+  ULONGLONG last_used;
+} IndexRoot;
+
+// An entry read from a directory, before it is merged into the tree
+typedef struct {
+  char *name;
+  DWORD attributes;
+  ULONGLONG size;
+  FILETIME write_time;
+  BOOL ignored;
+} ListedEntry;
+
+// A directory to fill, queued on the pool
+typedef struct {
+  IndexRoot *root;
+  IndexNode *node;
+  volatile LONG *remaining; // Tasks of the fill still running
+  HANDLE done;              // Set when the last one finishes
+  char path[MAX_PATH];
+} FillTask;
+
+// A glob match being collected
+typedef struct {
+  FileIndexEntry *entries;
+  int count;
+  int capacity;
+  size_t name_bytes;
+  Arena names;
+} GlobMatches;
+
+static INIT_ONCE index_once = INIT_ONCE_STATIC_INIT;
+static CRITICAL_SECTION index_lock; // Guards the trees and the name table;
+                                    // never held while reading the disk
+static IndexRoot *index_roots[FILE_INDEX_ROOTS];
+
+// Names are interned once for the life of the process, so entries handed
+// out keep pointing at them after their nodes are freed
+static Arena name_arena;
+static const char **name_slots = NULL;
+static size_t name_capacity = 0;
+static size_t name_count = 0;
+
+static BOOL CALLBACK init_file_index(PINIT_ONCE once, PVOID param,
+                                     PVOID *context) {
+  InitializeCriticalSection(&index_lock);
+  arena_init(&name_arena, INDEX_NAME_BLOCK);
+  return TRUE;
+}
+
+// ---------------------------------------------------------------------------
+// Names and paths
+// ---------------------------------------------------------------------------
+
+static size_t hash_name(const char *name) {
+  unsigned int hash = 2166136261u; // FNV-1a
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+    hash = (hash ^ *p) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * Grow the name table to keep it at most half full
+ */
+static BOOL grow_name_table(void) {
+  size_t capacity = name_capacity ? name_capacity * 2 : INDEX_NAME_SLOTS;
+  const char **slots = (const char **)calloc(capacity, sizeof(char *));
+  if (!slots) {
+    return FALSE;
+  }
+  for (size_t i = 0; i < name_capacity; i++) {
+    if (name_slots[i]) {
+      size_t slot = hash_name(name_slots[i]) & (capacity - 1);
+      while (slots[slot]) {
+        slot = (slot + 1) & (capacity - 1);
+      }
+      slots[slot] = name_slots[i];
+    }
+  }
+  free((void *)name_slots);
+  name_slots = slots;
+  name_capacity = capacity;
+  return TRUE;
+}
+
+/**
+ * Get the shared copy of a name (index_lock held)
+ *
+ * @return The copy, or NULL if out of memory
+ */
+static const char *intern_name(const char *name) {
+  if ((name_count + 1) * 2 > name_capacity && !grow_name_table() &&
+      name_count + 1 >= name_capacity) {
+    return NULL;
+  }
+
+  size_t slot = hash_name(name) & (name_capacity - 1);
+  while (name_slots[slot]) {
+    if (strcmp(name_slots[slot], name) == 0) {
+      return name_slots[slot];
+    }
+    slot = (slot + 1) & (name_capacity - 1);
+  }
+
+  char *copy = arena_strndup(&name_arena, name, strlen(name));
+  if (copy) {
+    name_slots[slot] = copy;
+    name_count++;
+  }
+  return copy;
+}
+
+/**
+ * Build the path of a directory's entry
+ *
+ * @return TRUE, or FALSE if it does not fit in MAX_PATH
+ */
+static BOOL join_path(char *buffer, size_t size, const char *directory,
+                      const char *name) {
+  int length = snprintf(buffer, size, "%s\\%s", directory, name);
+  return length > 0 && (size_t)length < size;
+}
+
+/**
+ * Drop a path's trailing backslashes
+ */
+static void strip_separators(char *path) {
+  size_t length = strlen(path);
+  while (length > 0 && path[length - 1] == '\\') {
+    path[--length] = '\0';
+  }
+}
+
+/**
+ * Resolve a directory to the form trees are keyed by: full, with long
+ * names and without a trailing backslash. Resolving long names reads the
+ * disk, so a path under a tree reuses the tree's resolved root, and only
+ * the part below it is taken as written.
+ *
+ * @param directory Directory as the caller gave it
+ * @param path Receives the resolved path (MAX_PATH)
+ * @param full_path Receives the full path before resolving (MAX_PATH)
+ */
+static BOOL index_path(const char *directory, char *path, char *full_path) {
+  char full[MAX_PATH];
+  DWORD length = GetFullPathName(directory, sizeof(full), full, NULL);
+  if (length == 0 || length >= sizeof(full)) {
+    return FALSE;
+  }
+  snprintf(full_path, MAX_PATH, "%s", full);
+  strip_separators(full_path);
+
+  InitOnceExecuteOnce(&index_once, init_file_index, NULL, NULL);
+  BOOL resolved = FALSE;
+  EnterCriticalSection(&index_lock);
+  for (int i = 0; i < FILE_INDEX_ROOTS && !resolved; i++) {
+    IndexRoot *root = index_roots[i];
+    size_t root_length = root ? strlen(root->full_path) : 0;
+    // A ~ below the root may be a short name, which only the disk knows
+    if (root_length > 0 &&
+        _strnicmp(full_path, root->full_path, root_length) == 0 &&
+        (full_path[root_length] == '\0' ||
+         full_path[root_length] == '\\') &&
+        !strchr(full_path + root_length, '~')) {
+      int written = snprintf(path, MAX_PATH, "%s%s", root->path,
+                             full_path + root_length);
+      resolved = written > 0 && written < MAX_PATH;
+    }
+  }
+  LeaveCriticalSection(&index_lock);
+
+  if (!resolved) {
+    length = GetLongPathName(full, path, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH) {
+      snprintf(path, MAX_PATH, "%s", full);
+    }
+    strip_separators(path);
+  }
+  return path[0] != '\0';
+}
+
+/**
+ * Get the path to hand to the system for a tree's root: a drive's root
+ * needs its backslash back
+ */
+static void root_system_path(const IndexRoot *root, char *buffer,
+                             size_t size) {
+  size_t length = strlen(root->path);
+  snprintf(buffer, size, "%s%s", root->path,
+           length > 0 && root->path[length - 1] == ':' ? "\\" : "");
+}
+
+// ---------------------------------------------------------------------------
+// Trees
+// ---------------------------------------------------------------------------
+
+static void free_node(IndexNode *node) {
+  for (int i = 0; i < node->child_count; i++) {
+    free_node(node->children[i]);
+  }
+  free(node->children);
+  ignore_stack_release(node->ignore);
+  free(node);
+}
+
+static void free_retired(IndexRoot *root) {
+  while (root->retired) {
+    IndexNode *node = root->retired;
+    root->retired = node->next_retired;
+    free_node(node);
+  }
+}
+
+static void destroy_root(IndexRoot *root) {
+  if (root->watch_id) {
+    fs_watch_remove(root->watch_id);
+  }
+  if (root->node) {
+    free_node(root->node);
+  }
+  free_retired(root);
+  ignore_stack_release(root->base);
+  free(root);
+}
+
+/**
+ * Check whether a path is a directory or lies under it
+ */
+static BOOL path_within(const char *path, const char *directory) {
+  size_t length = strlen(directory);
+  return _strnicmp(path, directory, length) == 0 &&
+         (path[length] == '\0' || path[length] == '\\');
+}
+
+/**
+ * Find the deepest tree holding a path (index_lock held). A tree of a
+ * directory listed on its own holds only that directory.
+ */
+static IndexRoot *find_root(const char *path) {
+  IndexRoot *best = NULL;
+  for (int i = 0; i < FILE_INDEX_ROOTS; i++) {
+    IndexRoot *root = index_roots[i];
+    if (!root || !path_within(path, root->path) ||
+        (!root->recursive && _stricmp(path, root->path) != 0)) {
+      continue;
+    }
+    if (!best || strlen(root->path) > strlen(best->path)) {
+      best = root;
+    }
+  }
+  return best;
+}
+
+/**
+ * Take a use of the tree to serve a directory from, indexing a new one if
+ * no tree holds it
+ *
+ * @param anchor Top of the caller's walk, or NULL for a directory listed
+ *               on its own
+ * @param directory The directory
+ * @param path Receives the directory's resolved path (MAX_PATH)
+ * @return The tree (release with release_root), or NULL if the directory
+ *         is not one
+ */
+static IndexRoot *acquire_root(const char *anchor, const char *directory,
+                               char *path) {
+  char full_path[MAX_PATH];
+  if (!index_path(directory, path, full_path)) {
+    return NULL;
+  }
+
+  EnterCriticalSection(&index_lock);
+  IndexRoot *root = find_root(path);
+  if (root) {
+    root->users++;
+    root->last_used = GetTickCount64();
+  }
+  LeaveCriticalSection(&index_lock);
+  if (root) {
+    return root;
+  }
+
+  IndexRoot *created = (IndexRoot *)calloc(1, sizeof(IndexRoot));
+  if (!created) {
+    return NULL;
+  }
+
+  // Root the tree at the walk's top, or at the repository holding a
+  // directory listed on its own; anything else gets a tree of its own
+  char root_path[MAX_PATH];
+  char root_full_path[MAX_PATH];
+  GitRepo repo;
+  created->recursive = TRUE;
+  if (anchor && index_path(anchor, root_path, root_full_path) &&
+      path_within(path, root_path)) {
+    snprintf(created->path, sizeof(created->path), "%s", root_path);
+    snprintf(created->full_path, sizeof(created->full_path), "%s",
+             root_full_path);
+  } else if (!anchor && git_find_repository(path, &repo) &&
+             index_path(repo.root, root_path, root_full_path) &&
+             path_within(path, root_path)) {
+    snprintf(created->path, sizeof(created->path), "%s", root_path);
+    snprintf(created->full_path, sizeof(created->full_path), "%s",
+             root_full_path);
+  } else {
+    snprintf(created->path, sizeof(created->path), "%s", path);
+    snprintf(created->full_path, sizeof(created->full_path), "%s",
+             full_path);
+    created->recursive = anchor != NULL;
+  }
+  char system_path[MAX_PATH];
+  root_system_path(created, system_path, sizeof(system_path));
+
+  // Watch before reading, so a change made while reading is not missed.
+  // A polled watch could lag behind, so such trees are not cached.
+  created->watch_id =
+      fs_watch_add(system_path, created->recursive, NULL, NULL);
+  if (created->watch_id && fs_watch_is_polled(created->watch_id)) {
+    fs_watch_remove(created->watch_id);
+    created->watch_id = 0;
+  }
+  if (!created->watch_id) {
+    DWORD attributes = GetFileAttributes(system_path);
+    if (attributes == INVALID_FILE_ATTRIBUTES ||
+        !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      free(created);
+      return NULL;
+    }
+  }
+
+  created->node = (IndexNode *)calloc(1, sizeof(IndexNode));
+  if (!created->node) {
+    destroy_root(created);
+    return NULL;
+  }
+  created->node->name = "";
+  created->node->attributes = FILE_ATTRIBUTE_DIRECTORY;
+  created->base = ignore_stack_open(system_path);
+  created->users = 1;
+  created->last_used = GetTickCount64();
+
+  IndexRoot *dropped = NULL;
+  EnterCriticalSection(&index_lock);
+  root = find_root(path); // Another call may have indexed it meanwhile
+  if (root) {
+    root->users++;
+    root->last_used = GetTickCount64();
+  } else {
+    // A walk's tree takes over from the tree of its top directory listed
+    // on its own; otherwise a free slot or the least recently used one
+    int slot = -1;
+    for (int i = 0; i < FILE_INDEX_ROOTS && slot < 0; i++) {
+      if (index_roots[i] &&
+          _stricmp(index_roots[i]->path, created->path) == 0) {
+        slot = i;
+      }
+    }
+    for (int i = 0; i < FILE_INDEX_ROOTS && slot < 0; i++) {
+      if (!index_roots[i]) {
+        slot = i;
+      }
+    }
+    if (slot < 0) {
+      slot = 0;
+      for (int i = 1; i < FILE_INDEX_ROOTS; i++) {
+        if (index_roots[i]->last_used < index_roots[slot]->last_used) {
+          slot = i;
+        }
+      }
+    }
+    if (index_roots[slot]) {
+      index_roots[slot]->evicted = TRUE;
+      if (index_roots[slot]->users == 0) {
+        dropped = index_roots[slot];
+      }
+    }
+    index_roots[slot] = created;
+  }
+  LeaveCriticalSection(&index_lock);
+
+  if (root) {
+    destroy_root(created);
+    return root;
+  }
+  if (dropped) {
+    destroy_root(dropped);
+  }
+  return created;
+}
+
+/**
+ * Give back a use of a tree; the last user frees what was retired
+ */
+static void release_root(IndexRoot *root) {
+  BOOL drop = FALSE;
+
+  EnterCriticalSection(&index_lock);
+  if (--root->users == 0) {
+    free_retired(root);
+    drop = root->evicted;
+  }
+  LeaveCriticalSection(&index_lock);
+
+  if (drop) {
+    destroy_root(root);
+  }
+}
+
+/**
+ * Check whether a directory's children are up to date (index_lock held)
+ */
+static BOOL node_current(const IndexRoot *root, const IndexNode *node) {
+  return node->listed && root->watch_id && node->generation != 0 &&
+         node->generation == fs_watch_generation(root->watch_id);
+}
+
+/**
+ * Find a directory's child by name (index_lock held)
+ */
+static IndexNode *find_child(const IndexNode *node, const char *name) {
+  int low = 0;
+  int high = node->child_count - 1;
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    int order = _stricmp(node->children[middle]->name, name);
+    if (order == 0) {
+      return node->children[middle];
+    }
+    if (order < 0) {
+      low = middle + 1;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return NULL;
+}
+
+static int compare_listed(const void *a, const void *b) {
+  return _stricmp(((const ListedEntry *)a)->name,
+                  ((const ListedEntry *)b)->name);
+}
+
+/**
+ * Move a subtree that is gone from disk to the retired list (index_lock
+ * held). Calls in progress may still be walking it.
+ */
+static void retire_node(IndexRoot *root, IndexNode *node) {
+  node->next_retired = root->retired;
+  root->retired = node;
+}
+
+/**
+ * Read a directory's entries unless they are up to date, and merge them
+ * into its children
+ *
+ * @param root Tree holding the directory
+ * @param node The directory's node
+ * @param path The directory's full path
+ * @return TRUE if the children are up to date, FALSE if the directory
+ *         cannot be read
+ */
+static BOOL list_node(IndexRoot *root, IndexNode *node, const char *path) {
+  EnterCriticalSection(&index_lock);
+  if (node_current(root, node)) {
+    LeaveCriticalSection(&index_lock);
+    return TRUE;
+  }
+  IgnoreStack *parent_rules =
+      ignore_stack_retain(node->parent ? node->parent->ignore : root->base);
+  LeaveCriticalSection(&index_lock);
+
+  // Taken before reading, so a change made while reading is seen next time
+  unsigned long generation =
+      root->watch_id ? fs_watch_generation(root->watch_id) : 0;
+
+  char search_path[MAX_PATH];
+  snprintf(search_path, sizeof(search_path), "%s\\*", path);
+  WIN32_FIND_DATA find_data;
+  HANDLE h_find = FindFirstFile(search_path, &find_data);
+  if (h_find == INVALID_HANDLE_VALUE) {
+    ignore_stack_release(parent_rules);
+    return FALSE;
+  }
+
+  Arena names;
+  arena_init(&names, INDEX_LIST_BLOCK);
+  ListedEntry *listed = NULL;
+  int count = 0;
+  int capacity = 0;
+  BOOL has_git = FALSE;
+  BOOL ok = TRUE;
+
+  do {
+    if (strcmp(find_data.cFileName, ".") == 0 ||
+        strcmp(find_data.cFileName, "..") == 0) {
+      continue;
+    }
+
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      ListedEntry *grown =
+          (ListedEntry *)realloc(listed, capacity * sizeof(ListedEntry));
+      if (!grown) {
+        ok = FALSE;
+        break;
+      }
+      listed = grown;
+    }
+
+    ListedEntry *entry = &listed[count];
+    entry->name = arena_strndup(&names, find_data.cFileName,
+                                strlen(find_data.cFileName));
+    if (!entry->name) {
+      ok = FALSE;
+      break;
+    }
+    entry->attributes = find_data.dwFileAttributes;
+    entry->size = ((ULONGLONG)find_data.nFileSizeHigh << 32) |
+                  find_data.nFileSizeLow;
+    entry->write_time = find_data.ftLastWriteTime;
+    entry->ignored = FALSE;
+    if (_stricmp(entry->name, ".git") == 0) {
+      has_git = TRUE;
+    }
+    count++;
+  } while (FindNextFile(h_find, &find_data));
+  FindClose(h_find);
+
+  if (!ok) {
+    free(listed);
+    arena_free(&names);
+    ignore_stack_release(parent_rules);
+    return FALSE;
+  }
+
+  // A repository nested in the tree starts over from its own excludes, as
+  // git does
+  IgnoreStack *rules;
+  if (has_git && node != root->node) {
+    IgnoreStack *repo_rules = ignore_stack_open(path);
+    rules = ignore_stack_enter(repo_rules, path);
+    ignore_stack_release(repo_rules);
+  } else {
+    rules = ignore_stack_enter(parent_rules, path);
+  }
+  ignore_stack_release(parent_rules);
+
+  for (int i = 0; i < count; i++) {
+    char full_path[MAX_PATH];
+    if (join_path(full_path, sizeof(full_path), path, listed[i].name)) {
+      listed[i].ignored = ignore_stack_match(
+          rules, full_path,
+          (listed[i].attributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    }
+  }
+  if (count > 1) {
+    qsort(listed, count, sizeof(ListedEntry), compare_listed);
+  }
+
+  EnterCriticalSection(&index_lock);
+  IndexNode **children =
+      count ? (IndexNode **)malloc(count * sizeof(IndexNode *)) : NULL;
+  if (count && !children) {
+    LeaveCriticalSection(&index_lock);
+    free(listed);
+    arena_free(&names);
+    ignore_stack_release(rules);
+    return FALSE;
+  }
+
+  // Both lists are sorted the same way, so they merge in one pass; nodes
+  // of entries still there keep their subtrees
+  int kept = 0;
+  int old_index = 0;
+  for (int i = 0; i < count; i++) {
+    ListedEntry *entry = &listed[i];
+    while (old_index < node->child_count &&
+           _stricmp(node->children[old_index]->name, entry->name) < 0) {
+      retire_node(root, node->children[old_index++]);
+    }
+
+    IndexNode *child = NULL;
+    if (old_index < node->child_count &&
+        _stricmp(node->children[old_index]->name, entry->name) == 0) {
+      child = node->children[old_index++];
+      // A file replaced by a directory (or the reverse) starts over
+      if ((child->attributes ^ entry->attributes) &
+          FILE_ATTRIBUTE_DIRECTORY) {
+        retire_node(root, child);
+        child = NULL;
+      }
+    }
+
+    if (child && strcmp(child->name, entry->name) != 0) {
+      // Renamed to a different case
+      const char *name = intern_name(entry->name);
+      if (name) {
+        child->name = name;
+      }
+    }
+    if (!child) {
+      const char *name = intern_name(entry->name);
+      child = name ? (IndexNode *)calloc(1, sizeof(IndexNode)) : NULL;
+      if (!child) {
+        continue;
+      }
+      child->name = name;
+      child->parent = node;
+    }
+
+    child->attributes = entry->attributes;
+    child->size = entry->size;
+    child->write_time = entry->write_time;
+    child->ignored = entry->ignored;
+    children[kept++] = child;
+  }
+  while (old_index < node->child_count) {
+    retire_node(root, node->children[old_index++]);
+  }
+
+  free(node->children);
+  node->children = children;
+  node->child_count = kept;
+  IgnoreStack *old_rules = node->ignore;
+  node->ignore = rules;
+  node->generation = generation;
+  node->listed = TRUE;
+  LeaveCriticalSection(&index_lock);
+
+  ignore_stack_release(old_rules);
+  free(listed);
+  arena_free(&names);
+  return TRUE;
+}
+
+/**
+ * Find the node of a directory in a tree, reading the directories on the
+ * way down as needed
+ *
+ * @return The node, or NULL if the path is not a directory in the tree
+ */
+static IndexNode *resolve_node(IndexRoot *root, const char *path) {
+  IndexNode *node = root->node;
+  char node_path[MAX_PATH];
+  snprintf(node_path, sizeof(node_path), "%s", root->path);
+
+  const char *rest = path + strlen(root->path);
+  while (*rest == '\\') {
+    rest++;
+  }
+  while (*rest) {
+    const char *end = strchr(rest, '\\');
+    size_t length = end ? (size_t)(end - rest) : strlen(rest);
+    char name[MAX_PATH];
+    if (length >= sizeof(name)) {
+      return NULL;
+    }
+    memcpy(name, rest, length);
+    name[length] = '\0';
+
+    if (!list_node(root, node, node_path)) {
+      return NULL;
+    }
+    EnterCriticalSection(&index_lock);
+    IndexNode *child = find_child(node, name);
+    BOOL found = child && (child->attributes & FILE_ATTRIBUTE_DIRECTORY);
+    if (found) {
+      snprintf(name, sizeof(name), "%s", child->name);
+    }
+    LeaveCriticalSection(&index_lock);
+    if (!found) {
+      return NULL;
+    }
+
+    size_t used = strlen(node_path);
+    if (!join_path(node_path + used, sizeof(node_path) - used, "", name)) {
+      return NULL;
+    }
+    node = child;
+    rest += length;
+    while (*rest == '\\') {
+      rest++;
+    }
+  }
+  return node;
+}
+
+static void fill_entry(FileIndexEntry *entry, const IndexNode *node,
+                       const char *name) {
+  entry->name = name;
+  entry->attributes = node->attributes;
+  entry->size = node->size;
+  entry->write_time = node->write_time;
+  entry->ignored = node->ignored;
+}
+
+// ---------------------------------------------------------------------------
+// Listing and filling
+// ---------------------------------------------------------------------------
+
+/**
+ * Get the entries of a directory
+ */
+int file_index_list(const char *root_directory, const char *directory,
+                    FileIndexEntry **entries) {
+  *entries = NULL;
+
+  char path[MAX_PATH];
+  IndexRoot *root = acquire_root(root_directory, directory, path);
+  if (!root) {
+    return -1;
+  }
+
+  int count = -1;
+  IndexNode *node = resolve_node(root, path);
+  if (node && list_node(root, node, path)) {
+    EnterCriticalSection(&index_lock);
+    FileIndexEntry *copy =
+        node->child_count
+            ? (FileIndexEntry *)malloc(node->child_count *
+                                       sizeof(FileIndexEntry))
+            : NULL;
+    if (copy || node->child_count == 0) {
+      for (int i = 0; i < node->child_count; i++) {
+        fill_entry(&copy[i], node->children[i], node->children[i]->name);
+      }
+      count = node->child_count;
+      *entries = copy;
+    }
+    LeaveCriticalSection(&index_lock);
+  }
+
+  release_root(root);
+  return count;
+}
+
+/**
+ * Check whether a walk goes into a directory entry: ignored directories,
+ * .git and links (which could loop) are left out
+ */
+static BOOL walk_into(const FileIndexEntry *entry) {
+  return (entry->attributes & FILE_ATTRIBUTE_DIRECTORY) &&
+         !(entry->attributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+         !entry->ignored && _stricmp(entry->name, ".git") != 0;
+}
+
+static void queue_fill_task(IndexRoot *root, IndexNode *node,
+                            const char *path, volatile LONG *remaining,
+                            HANDLE done);
+
+/**
+ * Pool task: read a directory and queue its subdirectories
+ */
+static void run_fill_task(void *arg) {
+  FillTask *task = (FillTask *)arg;
+
+  if (list_node(task->root, task->node, task->path)) {
+    EnterCriticalSection(&index_lock);
+    int count = 0;
+    int child_count = task->node->child_count;
+    IndexNode **subdirectories =
+        child_count ? (IndexNode **)malloc(child_count * sizeof(IndexNode *))
+                    : NULL;
+    const char **names =
+        subdirectories ? (const char **)malloc(child_count * sizeof(char *))
+                       : NULL;
+    for (int i = 0; names && i < child_count; i++) {
+      IndexNode *child = task->node->children[i];
+      FileIndexEntry entry;
+      fill_entry(&entry, child, child->name);
+      if (walk_into(&entry)) {
+        subdirectories[count] = child;
+        names[count++] = child->name;
+      }
+    }
+    LeaveCriticalSection(&index_lock);
+
+    for (int i = 0; i < count; i++) {
+      char child_path[MAX_PATH];
+      if (join_path(child_path, sizeof(child_path), task->path, names[i])) {
+        queue_fill_task(task->root, subdirectories[i], child_path,
+                        task->remaining, task->done);
+      }
+    }
+    free(subdirectories);
+    free((void *)names);
+  }
+
+  if (InterlockedDecrement(task->remaining) == 0) {
+    SetEvent(task->done);
+  }
+  free(task);
+}
+
+/**
+ * Queue a directory of a fill on the pool; without a pool it is read on
+ * the calling thread
+ */
+static void queue_fill_task(IndexRoot *root, IndexNode *node,
+                            const char *path, volatile LONG *remaining,
+                            HANDLE done) {
+  InterlockedIncrement(remaining);
+
+  FillTask *task = (FillTask *)malloc(sizeof(FillTask));
+  if (!task) {
+    if (InterlockedDecrement(remaining) == 0) {
+      SetEvent(done);
+    }
+    return;
+  }
+  task->root = root;
+  task->node = node;
+  task->remaining = remaining;
+  task->done = done;
+  snprintf(task->path, sizeof(task->path), "%s", path);
+
+  if (!thread_pool_submit(thread_pool_shared(), run_fill_task, task)) {
+    run_fill_task(task);
+  }
+}
+
+/**
+ * Read a tree's changed and unread directories in parallel
+ */
+void file_index_fill(const char *directory) {
+  char path[MAX_PATH];
+  IndexRoot *root = acquire_root(directory, directory, path);
+  if (!root) {
+    return;
+  }
+
+  IndexNode *node = resolve_node(root, path);
+  HANDLE done = node ? CreateEvent(NULL, TRUE, FALSE, NULL) : NULL;
+  if (done) {
+    volatile LONG remaining = 0;
+    queue_fill_task(root, node, path, &remaining, done);
+    WaitForSingleObject(done, INFINITE);
+    CloseHandle(done);
+  }
+
+  release_root(root);
+}
+
+// ---------------------------------------------------------------------------
+// Queries
+// ---------------------------------------------------------------------------
+
+static BOOL is_separator(char c) { return c == '\\' || c == '/'; }
+
+/**
+ * Match a path against a glob, ignoring case
+ */
+static BOOL glob_match(const char *pattern, const char *text) {
+  for (;;) {
+    if (pattern[0] == '*' && pattern[1] == '*') {
+      pattern += 2;
+      // "**/" also matches no directory at all
+      if (is_separator(*pattern) && glob_match(pattern + 1, text)) {
+        return TRUE;
+      }
+      for (;; text++) {
+        if (glob_match(pattern, text)) {
+          return TRUE;
+        }
+        if (!*text) {
+          return FALSE;
+        }
+      }
+    }
+    if (*pattern == '*') {
+      pattern++;
+      for (;; text++) {
+        if (glob_match(pattern, text)) {
+          return TRUE;
+        }
+        if (!*text || is_separator(*text)) {
+          return FALSE;
+        }
+      }
+    }
+
+    if (!*pattern || !*text) {
+      return !*pattern && !*text;
+    }
+    if (*pattern == '?') {
+      if (is_separator(*text)) {
+        return FALSE;
+      }
+    } else if (is_separator(*pattern)) {
+      if (!is_separator(*text)) {
+        return FALSE;
+      }
+    } else if (tolower((unsigned char)*pattern) !=
+               tolower((unsigned char)*text)) {
+      return FALSE;
+    }
+    pattern++;
+    text++;
+  }
+}
+
+static void add_glob_match(GlobMatches *matches, const FileIndexEntry *entry,
+                           const char *relative) {
+  if (matches->count == matches->capacity) {
+    int capacity = matches->capacity ? matches->capacity * 2 : 64;
+    FileIndexEntry *grown = (FileIndexEntry *)realloc(
+        matches->entries, capacity * sizeof(FileIndexEntry));
+    if (!grown) {
+      return;
+    }
+    matches->entries = grown;
+    matches->capacity = capacity;
+  }
+
+  size_t length = strlen(relative);
+  char *name = arena_strndup(&matches->names, relative, length);
+  if (!name) {
+    return;
+  }
+  matches->entries[matches->count] = *entry;
+  matches->entries[matches->count].name = name;
+  matches->count++;
+  matches->name_bytes += length + 1;
+}
+
+/**
+ * Collect the entries under a directory that match a glob
+ */
+static void collect_glob(IndexRoot *root, IndexNode *node, const char *path,
+                         const char *relative, const char *pattern,
+                         BOOL match_names, GlobMatches *matches) {
+  if (!list_node(root, node, path)) {
+    return;
+  }
+
+  // Take the children as they are now; the walk goes on without the lock
+  EnterCriticalSection(&index_lock);
+  int count = node->child_count;
+  IndexNode **children =
+      count ? (IndexNode **)malloc(count * sizeof(IndexNode *)) : NULL;
+  FileIndexEntry *entries =
+      children ? (FileIndexEntry *)malloc(count * sizeof(FileIndexEntry))
+               : NULL;
+  if (entries) {
+    for (int i = 0; i < count; i++) {
+      children[i] = node->children[i];
+      fill_entry(&entries[i], node->children[i], node->children[i]->name);
+    }
+  }
+  LeaveCriticalSection(&index_lock);
+  if (!entries) {
+    free(children);
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (entries[i].ignored || _stricmp(entries[i].name, ".git") == 0) {
+      continue;
+    }
+
+    char child_relative[MAX_PATH];
+    if (relative[0]) {
+      if (!join_path(child_relative, sizeof(child_relative), relative,
+                     entries[i].name)) {
+        continue;
+      }
+    } else {
+      snprintf(child_relative, sizeof(child_relative), "%s",
+               entries[i].name);
+    }
+
+    if (glob_match(pattern, match_names ? entries[i].name : child_relative)) {
+      add_glob_match(matches, &entries[i], child_relative);
+    }
+
+    char child_path[MAX_PATH];
+    if (walk_into(&entries[i]) &&
+        join_path(child_path, sizeof(child_path), path, entries[i].name)) {
+      collect_glob(root, children[i], child_path, child_relative, pattern,
+                   match_names, matches);
+    }
+  }
+
+  free(entries);
+  free(children);
+}
+
+/**
+ * Find a tree's entries matching a glob
+ */
+static int find_glob(const char *directory, const char *pattern,
+                     FileIndexEntry **entries) {
+  file_index_fill(directory);
+
+  char path[MAX_PATH];
+  IndexRoot *root = acquire_root(directory, directory, path);
+  if (!root) {
+    return -1;
+  }
+  IndexNode *node = resolve_node(root, path);
+  if (!node) {
+    release_root(root);
+    return -1;
+  }
+
+  BOOL match_names = TRUE;
+  for (const char *p = pattern; *p; p++) {
+    if (is_separator(*p)) {
+      match_names = FALSE;
+    }
+  }
+
+  GlobMatches matches = {0};
+  arena_init(&matches.names, INDEX_LIST_BLOCK);
+  collect_glob(root, node, path, "", pattern, match_names, &matches);
+  release_root(root);
+
+  // Hand the matches and their paths back in one block
+  int count = matches.count;
+  FileIndexEntry *result =
+      count ? (FileIndexEntry *)malloc(count * sizeof(FileIndexEntry) +
+                                       matches.name_bytes)
+            : NULL;
+  if (result) {
+    char *names = (char *)(result + count);
+    for (int i = 0; i < count; i++) {
+      size_t length = strlen(matches.entries[i].name) + 1;
+      result[i] = matches.entries[i];
+      result[i].name = names;
+      memcpy(names, matches.entries[i].name, length);
+      names += length;
+    }
+  } else {
+    count = 0;
+  }
+
+  free(matches.entries);
+  arena_free(&matches.names);
+  *entries = result;
+  return count;
+}
+
+/**
+ * Find entries by name prefix or glob
+ */
+int file_index_find(const char *directory, const char *pattern,
+                    FileIndexMatch match, FileIndexEntry **entries) {
+  *entries = NULL;
+
+  if (match == FILE_INDEX_GLOB) {
+    return find_glob(directory, pattern, entries);
+  }
+
+  int count = file_index_list(NULL, directory, entries);
+  size_t length = strlen(pattern);
+  int matched = 0;
+  for (int i = 0; i < count; i++) {
+    if (_strnicmp((*entries)[i].name, pattern, length) == 0) {
+      (*entries)[matched++] = (*entries)[i];
+    }
+  }
+  return count < 0 ? -1 : matched;
+}
+
+/**
+ * Drop every indexed tree
+ */
+void file_index_shutdown(void) {
+  InitOnceExecuteOnce(&index_once, init_file_index, NULL, NULL);
+
+  IndexRoot *dropped[FILE_INDEX_ROOTS];
+  int count = 0;
+
+  EnterCriticalSection(&index_lock);
+  for (int i = 0; i < FILE_INDEX_ROOTS; i++) {
+    IndexRoot *root = index_roots[i];
+    index_roots[i] = NULL;
+    if (root) {
+      root->evicted = TRUE;
+      if (root->users == 0) {
+        dropped[count++] = root;
+      }
+    }
+  }
+  LeaveCriticalSection(&index_lock);
+
+  for (int i = 0; i < count; i++) {
+    destroy_root(dropped[i]);
+  }
+}
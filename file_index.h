@@ -0,0 +1,84 @@
+/**
+ * file_index.h
+ * Shared in-memory index of directory trees, used by every command that
+ * enumerates files
+ */
+
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include "common.h"
+
+// Trees indexed at once; the least recently used is dropped first
+#define FILE_INDEX_ROOTS 8
+
+// A directory entry as last seen on disk
+typedef struct {
+  const char *name; // Entry name; for glob matches, the path relative to the
+                    // directory searched
+  DWORD attributes; // FILE_ATTRIBUTE_* flags
+  unsigned long long size;
+  FILETIME write_time;
+  int ignored;      // Excluded by .gitignore, .ignore, info/exclude or the
+                    // global excludes file
+} FileIndexEntry;
+
+// How file_index_find matches entries
+typedef enum {
+  FILE_INDEX_PREFIX, // Entries of the directory whose names start with the
+                     // pattern, ignoring case
+  FILE_INDEX_GLOB    // Entries anywhere under the directory, skipping ignored
+                     // ones, matching a glob (see file_index_find)
+} FileIndexMatch;
+
+/**
+ * Get the entries of a directory (without . and ..), sorted by name
+ * ignoring case. A directory is read the first time it is asked for and
+ * then served from memory until the watch on its tree reports a change.
+ *
+ * A directory no tree holds yet starts one at root_directory, the top of
+ * the walk it is part of. A directory listed on its own (root_directory
+ * NULL) is served from the tree of the repository holding it, or else is
+ * watched alone, so listing a drive's root does not watch the drive.
+ *
+ * @param root_directory Top of the caller's walk, or NULL
+ * @param directory Directory to list
+ * @param entries Receives the entries, in one block to free with free();
+ *                names stay valid for the life of the process
+ * @return Number of entries, or -1 if the directory cannot be read
+ */
+int file_index_list(const char *root_directory, const char *directory,
+                    FileIndexEntry **entries);
+
+/**
+ * Read every directory under a directory that is not yet indexed (or has
+ * changed) in parallel, skipping ignored directories and .git, so that
+ * walks that follow are served from memory
+ *
+ * @param directory Top of the tree to fill, which a new tree is rooted at
+ */
+void file_index_fill(const char *directory);
+
+/**
+ * Find entries of a directory by name prefix, or entries of its tree by
+ * glob. In a glob, '*' and '?' do not match a path separator, "**" matches
+ * any number of directories, and '/' and '\' are the same; a glob with no
+ * separator is matched against entry names at any depth, otherwise
+ * against paths relative to the directory. Prefixes are looked up like
+ * file_index_list(NULL, ...); a glob walks a tree rooted at the directory.
+ *
+ * @param directory Directory to search
+ * @param pattern Name prefix or glob
+ * @param match FILE_INDEX_PREFIX or FILE_INDEX_GLOB
+ * @param entries Receives the matches, in one block to free with free()
+ * @return Number of matches, or -1 if the directory cannot be read
+ */
+int file_index_find(const char *directory, const char *pattern,
+                    FileIndexMatch match, FileIndexEntry **entries);
+
+/**
+ * Drop every indexed tree and stop watching them
+ */
+void file_index_shutdown(void);
+
+#endif // FILE_INDEX_H
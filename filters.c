@@ -4,6 +4,7 @@
  */
 
 #include "filters.h"
+#include "parallel.h"
 
 /**
  * Filter a table based on a condition (e.g., where size > 10kb)
@@ -488,13 +489,139 @@ TableData* lsh_limit(TableData *input, char **args) {
     return result;
 }
 
+/**
+ * Format a value as the text group-by compares
+ */
+static void group_key(const DataValue *value, char *key, size_t key_size) {
+    switch (value->type) {
+        case TYPE_INT:
+            snprintf(key, key_size, "%d", value->value.int_val);
+            break;
+        case TYPE_FLOAT:
+            snprintf(key, key_size, "%g", value->value.float_val);
+            break;
+        default:
+            snprintf(key, key_size, "%s",
+                     value->value.str_val ? value->value.str_val : "");
+            break;
+    }
+}
+
+/**
+ * Count the rows sharing each value of a column (e.g., group-by file)
+ * Groups are listed in the order their values first appear; rows are
+ * matched to groups through a hash table, so large inputs stay linear.
+ */
+TableData* lsh_group_by(TableData *input, char **args) {
+    if (!input || !args || !args[0]) {
+        fprintf(stderr, "lsh: group-by: missing arguments\n");
+        fprintf(stderr, "Usage: ... | group-by FIELD\n");
+        fprintf(stderr, "  e.g.: grep TODO | group-by file | sort-by count desc\n");
+        return NULL;
+    }
+    
+    // Find field index
+    int field_idx = -1;
+    for (int i = 0; i < input->header_count; i++) {
+        if (strcasecmp(input->headers[i], args[0]) == 0) {
+            field_idx = i;
+            break;
+        }
+    }
+    
+    if (field_idx == -1) {
+        fprintf(stderr, "lsh: group-by: unknown field '%s'\n", args[0]);
+        fprintf(stderr, "Available fields: ");
+        for (int i = 0; i < input->header_count; i++) {
+            fprintf(stderr, "%s%s", i > 0 ? ", " : "", input->headers[i]);
+        }
+        fprintf(stderr, "\n");
+        return NULL;
+    }
+    
+    char *headers[] = {input->headers[field_idx], "Count"};
+    TableData *result = create_table(headers, 2);
+    if (!result) {
+        return NULL;
+    }
+    
+    // Open addressing over group numbers, at most half full
+    int slot_count = 16;
+    while (slot_count < input->row_count * 2) {
+        slot_count *= 2;
+    }
+    int *slots = (int*)malloc(slot_count * sizeof(int));
+    char **keys = (char**)malloc((input->row_count + 1) * sizeof(char*));
+    if (!slots || !keys) {
+        fprintf(stderr, "lsh: allocation error in group-by\n");
+        free(slots);
+        free(keys);
+        free_table(result);
+        return NULL;
+    }
+    memset(slots, -1, slot_count * sizeof(int));
+    
+    for (int i = 0; i < input->row_count; i++) {
+        char key[1024];
+        group_key(&input->rows[i][field_idx], key, sizeof(key));
+        
+        // FNV-1a
+        unsigned int hash = 2166136261u;
+        for (const char *p = key; *p; p++) {
+            hash = (hash ^ (unsigned char)*p) * 16777619u;
+        }
+        
+        int slot = hash & (slot_count - 1);
+        while (slots[slot] >= 0 && strcmp(keys[slots[slot]], key) != 0) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        
+        if (slots[slot] >= 0) {
+            result->rows[slots[slot]][1].value.int_val++;
+            continue;
+        }
+        
+        DataValue *row = (DataValue*)malloc(2 * sizeof(DataValue));
+        keys[result->row_count] = _strdup(key);
+        if (!row || !keys[result->row_count]) {
+            fprintf(stderr, "lsh: allocation error in group-by\n");
+            free(row);
+            free(keys[result->row_count]);
+            break;
+        }
+        row[0] = copy_data_value(&input->rows[i][field_idx]);
+        row[1].type = TYPE_INT;
+        row[1].value.int_val = 1;
+        row[1].is_highlighted = 0;
+        
+        slots[slot] = result->row_count;
+        add_table_row(result, row);
+        if (result->row_count == slots[slot]) {
+            slots[slot] = -1;
+            free_data_value(&row[0]);
+            free(row);
+            free(keys[result->row_count]);
+            break;
+        }
+    }
+    
+    for (int i = 0; i < result->row_count; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+    free(slots);
+    return result;
+}
+
 // Define the filter arrays here
 char *filter_str[] = {
     "where",
     "sort-by",
     "select",
     "contains",
-    "limit"
+    "limit",
+    "group-by",
+    "parallel"
 };
 
 TableData* (*filter_func[]) (TableData*, char**) = {
@@ -502,7 +629,9 @@ TableData* (*filter_func[]) (TableData*, char**) = {
     &lsh_sort_by,
     &lsh_select,
     &lsh_contains,
-    &lsh_limit
+    &lsh_limit,
+    &lsh_group_by,
+    &lsh_parallel_filter
 };
 
 int filter_count = sizeof(filter_str) / sizeof(char*);
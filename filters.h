@@ -53,6 +53,15 @@ TableData* lsh_contains(TableData *input, char **args);
  */
 TableData* lsh_limit(TableData *input, char **args);
 
+/**
+ * Count the rows sharing each value of a column (e.g., group-by file)
+ * 
+ * @param input The input table
+ * @param args Command arguments
+ * @return Table with the column and a Count column, or NULL on error
+ */
+TableData* lsh_group_by(TableData *input, char **args);
+
 /**
  * Case-insensitive substring search (strcasestr equivalent for Windows)
  */
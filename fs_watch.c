@@ -0,0 +1,505 @@
+/**
+ * fs_watch.c
+ * Implementation of the file system change notification service
+ */
+
+#include "fs_watch.h"
+
+#define FS_WATCH_MAX 256
+#define FS_WATCH_BUFFER_SIZE 16384
+#define FS_WATCH_QUIET_MS 50       // Fire once changes pause this long...
+#define FS_WATCH_MAX_DELAY_MS 500  // ...or at least this often in a storm
+#define FS_WATCH_POLL_MS 1000
+
+#define FS_WATCH_NOTIFY_FILTER                                                 \
+  (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |                \
+   FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |                   \
+   FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_CREATION)
+
+typedef enum {
+  WATCH_SETUP,    // Registered, waiting for the watch thread
+  WATCH_ACTIVE,
+  WATCH_REMOVING, // Waiting for the watch thread to tear it down
+} WatchState;
+
+typedef struct {
+  int id;
+  char path[MAX_PATH];
+  int recursive;
+  FsWatchCallback callback;
+  void *context;
+  WatchState state;
+  volatile LONG generation;
+
+  // Native watch
+  HANDLE dir;
+  OVERLAPPED overlapped;
+  void *buffer;
+  int read_pending;
+
+  // Polling fallback
+  int polled;
+  unsigned long long poll_stamp;
+  ULONGLONG next_poll;
+
+  // Coalescing
+  int pending;
+  ULONGLONG first_change;
+  ULONGLONG last_change;
+} FsWatch;
+
+// A callback collected under the lock and run after releasing it
+typedef struct {
+  FsWatchCallback callback;
+  int id;
+  char path[MAX_PATH];
+  void *context;
+} DueCallback;
+
+static FsWatch *watches[FS_WATCH_MAX];
+static int next_watch_id = 1;
+static CRITICAL_SECTION watch_lock;
+static CONDITION_VARIABLE watch_changed; // A watch finished setup/removal
+static INIT_ONCE watch_once = INIT_ONCE_STATIC_INIT;
+static HANDLE watch_thread = NULL;
+static HANDLE watch_wakeup = NULL;
+static volatile LONG watch_stop = 0;
+
+static BOOL CALLBACK init_watch_service(PINIT_ONCE once, PVOID param,
+                                        PVOID *context) {
+  InitializeCriticalSection(&watch_lock);
+  InitializeConditionVariable(&watch_changed);
+  return TRUE;
+}
+
+static FsWatch *find_watch(int id) {
+  for (int i = 0; i < FS_WATCH_MAX; i++) {
+    if (watches[i] && watches[i]->id == id) {
+      return watches[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Hash the names, sizes and times of a directory's entries (FNV-1a), for
+ * the polling fallback
+ */
+static unsigned long long directory_stamp(const char *path) {
+  char pattern[MAX_PATH + 4];
+  WIN32_FIND_DATA find_data;
+  unsigned long long hash = 14695981039346656037ULL;
+
+  snprintf(pattern, sizeof(pattern), "%s\\*", path);
+  HANDLE find = FindFirstFile(pattern, &find_data);
+  if (find == INVALID_HANDLE_VALUE) {
+    return 0;
+  }
+
+  do {
+    const unsigned char *name = (const unsigned char *)find_data.cFileName;
+    for (; *name; name++) {
+      hash = (hash ^ *name) * 1099511628211ULL;
+    }
+    DWORD values[5] = {find_data.nFileSizeLow, find_data.nFileSizeHigh,
+                       find_data.ftLastWriteTime.dwLowDateTime,
+                       find_data.ftLastWriteTime.dwHighDateTime,
+                       find_data.dwFileAttributes};
+    const unsigned char *bytes = (const unsigned char *)values;
+    for (size_t i = 0; i < sizeof(values); i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+  } while (FindNextFile(find, &find_data));
+
+  FindClose(find);
+  return hash;
+}
+
+static int issue_read(FsWatch *watch) {
+  watch->read_pending =
+      ReadDirectoryChangesW(watch->dir, watch->buffer, FS_WATCH_BUFFER_SIZE,
+                            watch->recursive, FS_WATCH_NOTIFY_FILTER, NULL,
+                            &watch->overlapped, NULL) != 0;
+  return watch->read_pending;
+}
+
+static void close_native(FsWatch *watch) {
+  if (watch->dir) {
+    if (watch->read_pending) {
+      // The buffer must outlive the read, so wait for the cancellation
+      DWORD ignored;
+      CancelIoEx(watch->dir, &watch->overlapped);
+      GetOverlappedResult(watch->dir, &watch->overlapped, &ignored, TRUE);
+      watch->read_pending = 0;
+    }
+    CloseHandle(watch->dir);
+    watch->dir = NULL;
+  }
+  if (watch->overlapped.hEvent) {
+    CloseHandle(watch->overlapped.hEvent);
+    watch->overlapped.hEvent = NULL;
+  }
+  free(watch->buffer);
+  watch->buffer = NULL;
+}
+
+static void start_polling(FsWatch *watch) {
+  close_native(watch);
+  watch->polled = 1;
+  watch->poll_stamp = directory_stamp(watch->path);
+  watch->next_poll = GetTickCount64() + FS_WATCH_POLL_MS;
+}
+
+/**
+ * Start a native watch, or fall back to polling when out of wait slots or
+ * the directory cannot be watched. Called on the watch thread.
+ */
+static void setup_watch(FsWatch *watch, int native_count) {
+  // One wait slot is taken by the wakeup event
+  if (native_count >= MAXIMUM_WAIT_OBJECTS - 1) {
+    start_polling(watch);
+    return;
+  }
+
+  watch->dir = CreateFile(watch->path, FILE_LIST_DIRECTORY,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE |
+                              FILE_SHARE_DELETE,
+                          NULL, OPEN_EXISTING,
+                          FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+                          NULL);
+  if (watch->dir == INVALID_HANDLE_VALUE) {
+    watch->dir = NULL;
+    start_polling(watch);
+    return;
+  }
+
+  watch->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  watch->buffer = malloc(FS_WATCH_BUFFER_SIZE);
+  if (!watch->overlapped.hEvent || !watch->buffer || !issue_read(watch)) {
+    start_polling(watch);
+  }
+}
+
+/**
+ * Record a change: the generation moves immediately, the callback waits
+ * for the burst to settle
+ */
+static void note_change(FsWatch *watch, ULONGLONG now) {
+  InterlockedIncrement(&watch->generation);
+  if (!watch->pending) {
+    watch->pending = 1;
+    watch->first_change = now;
+  }
+  watch->last_change = now;
+}
+
+static int callback_due(const FsWatch *watch, ULONGLONG now) {
+  return watch->pending && (now - watch->last_change >= FS_WATCH_QUIET_MS ||
+                            now - watch->first_change >= FS_WATCH_MAX_DELAY_MS);
+}
+
+static unsigned __stdcall watch_worker(void *arg) {
+  HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+  FsWatch *handle_watches[MAXIMUM_WAIT_OBJECTS];
+  DueCallback *due = (DueCallback *)malloc(FS_WATCH_MAX * sizeof(DueCallback));
+  if (!due) {
+    return 1;
+  }
+
+  EnterCriticalSection(&watch_lock);
+  while (!watch_stop) {
+    // Set up new watches and tear down removed ones
+    int native_count = 0;
+    for (int i = 0; i < FS_WATCH_MAX; i++) {
+      if (watches[i] && watches[i]->state == WATCH_ACTIVE &&
+          !watches[i]->polled) {
+        native_count++;
+      }
+    }
+    int changed = 0;
+    for (int i = 0; i < FS_WATCH_MAX; i++) {
+      FsWatch *watch = watches[i];
+      if (!watch) {
+        continue;
+      }
+      if (watch->state == WATCH_SETUP) {
+        setup_watch(watch, native_count);
+        native_count += !watch->polled;
+        watch->state = WATCH_ACTIVE;
+        changed = 1;
+      } else if (watch->state == WATCH_REMOVING) {
+        close_native(watch);
+        free(watch);
+        watches[i] = NULL;
+        changed = 1;
+      }
+    }
+    if (changed) {
+      WakeAllConditionVariable(&watch_changed);
+    }
+
+    // Wait for a notification, the next poll or the next coalesced callback
+    ULONGLONG now = GetTickCount64();
+    DWORD timeout = INFINITE;
+    int handle_count = 0;
+    handles[handle_count] = watch_wakeup;
+    handle_watches[handle_count++] = NULL;
+
+    for (int i = 0; i < FS_WATCH_MAX; i++) {
+      FsWatch *watch = watches[i];
+      if (!watch || watch->state != WATCH_ACTIVE) {
+        continue;
+      }
+      ULONGLONG deadline = (ULONGLONG)-1;
+      if (watch->polled) {
+        deadline = watch->next_poll;
+      } else {
+        handles[handle_count] = watch->overlapped.hEvent;
+        handle_watches[handle_count++] = watch;
+      }
+      if (watch->pending) {
+        ULONGLONG fire = watch->last_change + FS_WATCH_QUIET_MS;
+        ULONGLONG latest = watch->first_change + FS_WATCH_MAX_DELAY_MS;
+        ULONGLONG next = fire < latest ? fire : latest;
+        if (next < deadline) {
+          deadline = next;
+        }
+      }
+      if (deadline != (ULONGLONG)-1) {
+        DWORD wait = deadline > now ? (DWORD)(deadline - now) : 0;
+        if (wait < timeout) {
+          timeout = wait;
+        }
+      }
+    }
+    LeaveCriticalSection(&watch_lock);
+
+    DWORD result =
+        WaitForMultipleObjects(handle_count, handles, FALSE, timeout);
+
+    EnterCriticalSection(&watch_lock);
+    now = GetTickCount64();
+
+    if (result > WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + handle_count) {
+      FsWatch *watch = handle_watches[result - WAIT_OBJECT_0];
+      if (watch->state == WATCH_ACTIVE) {
+        // Zero bytes means the buffer overflowed and changes were lost,
+        // which still just means "changed"
+        DWORD bytes = 0;
+        GetOverlappedResult(watch->dir, &watch->overlapped, &bytes, FALSE);
+        watch->read_pending = 0;
+        note_change(watch, now);
+        if (!issue_read(watch)) {
+          start_polling(watch); // Directory deleted or unmounted
+        }
+      }
+    }
+
+    // Poll the fallback watches that are due, and collect due callbacks
+    int due_count = 0;
+    for (int i = 0; i < FS_WATCH_MAX; i++) {
+      FsWatch *watch = watches[i];
+      if (!watch || watch->state != WATCH_ACTIVE) {
+        continue;
+      }
+      if (watch->polled && now >= watch->next_poll) {
+        unsigned long long stamp = directory_stamp(watch->path);
+        if (stamp != watch->poll_stamp) {
+          watch->poll_stamp = stamp;
+          note_change(watch, now);
+        }
+        watch->next_poll = now + FS_WATCH_POLL_MS;
+      }
+      if (callback_due(watch, now)) {
+        watch->pending = 0;
+        if (watch->callback) {
+          due[due_count].callback = watch->callback;
+          due[due_count].id = watch->id;
+          due[due_count].context = watch->context;
+          snprintf(due[due_count].path, sizeof(due[due_count].path), "%s",
+                   watch->path);
+          due_count++;
+        }
+      }
+    }
+
+    // Callbacks run unlocked; a watch removed meanwhile is only freed by
+    // this thread, after they return
+    if (due_count > 0) {
+      LeaveCriticalSection(&watch_lock);
+      for (int i = 0; i < due_count; i++) {
+        due[i].callback(due[i].id, due[i].path, due[i].context);
+      }
+      EnterCriticalSection(&watch_lock);
+    }
+  }
+
+  // Shutting down - release everything
+  for (int i = 0; i < FS_WATCH_MAX; i++) {
+    if (watches[i]) {
+      close_native(watches[i]);
+      free(watches[i]);
+      watches[i] = NULL;
+    }
+  }
+  WakeAllConditionVariable(&watch_changed);
+  LeaveCriticalSection(&watch_lock);
+
+  free(due);
+  return 0;
+}
+
+/**
+ * Start watching a directory for changes
+ */
+int fs_watch_add(const char *path, int recursive, FsWatchCallback callback,
+                 void *context) {
+  InitOnceExecuteOnce(&watch_once, init_watch_service, NULL, NULL);
+
+  DWORD attributes = GetFileAttributes(path);
+  if (attributes == INVALID_FILE_ATTRIBUTES ||
+      !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+    return 0;
+  }
+
+  FsWatch *watch = (FsWatch *)calloc(1, sizeof(FsWatch));
+  if (!watch) {
+    return 0;
+  }
+  snprintf(watch->path, sizeof(watch->path), "%s", path);
+  size_t length = strlen(watch->path);
+  while (length > 3 && (watch->path[length - 1] == '\\' ||
+                        watch->path[length - 1] == '/')) {
+    watch->path[--length] = '\0';
+  }
+  watch->recursive = recursive;
+  watch->callback = callback;
+  watch->context = context;
+  watch->generation = 1;
+  watch->state = WATCH_SETUP;
+
+  EnterCriticalSection(&watch_lock);
+
+  if (!watch_thread) {
+    watch_stop = 0;
+    watch_wakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (watch_wakeup) {
+      watch_thread =
+          (HANDLE)_beginthreadex(NULL, 0, watch_worker, NULL, 0, NULL);
+    }
+    if (!watch_thread) {
+      if (watch_wakeup) {
+        CloseHandle(watch_wakeup);
+        watch_wakeup = NULL;
+      }
+      LeaveCriticalSection(&watch_lock);
+      free(watch);
+      return 0;
+    }
+  }
+
+  int slot = -1;
+  for (int i = 0; i < FS_WATCH_MAX; i++) {
+    if (!watches[i]) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    LeaveCriticalSection(&watch_lock);
+    free(watch);
+    return 0;
+  }
+
+  int id = next_watch_id++;
+  watch->id = id;
+  watches[slot] = watch;
+  SetEvent(watch_wakeup);
+
+  // Wait until the watch is live, so nothing changed after this returns
+  // can be missed
+  while (watch->state == WATCH_SETUP && !watch_stop) {
+    SleepConditionVariableCS(&watch_changed, &watch_lock, INFINITE);
+  }
+
+  LeaveCriticalSection(&watch_lock);
+  return id;
+}
+
+/**
+ * Stop a watch
+ */
+void fs_watch_remove(int id) {
+  InitOnceExecuteOnce(&watch_once, init_watch_service, NULL, NULL);
+  EnterCriticalSection(&watch_lock);
+
+  FsWatch *watch = find_watch(id);
+  if (watch) {
+    watch->state = WATCH_REMOVING;
+    SetEvent(watch_wakeup);
+    while (find_watch(id)) {
+      SleepConditionVariableCS(&watch_changed, &watch_lock, INFINITE);
+    }
+  }
+
+  LeaveCriticalSection(&watch_lock);
+}
+
+/**
+ * Get a counter that increases whenever something under the watched
+ * directory changes
+ */
+unsigned long fs_watch_generation(int id) {
+  InitOnceExecuteOnce(&watch_once, init_watch_service, NULL, NULL);
+  EnterCriticalSection(&watch_lock);
+
+  FsWatch *watch = find_watch(id);
+  unsigned long generation =
+      watch && watch->state == WATCH_ACTIVE ? (unsigned long)watch->generation
+                                            : 0;
+
+  LeaveCriticalSection(&watch_lock);
+  return generation;
+}
+
+/**
+ * Check whether a watch fell back to polling
+ */
+int fs_watch_is_polled(int id) {
+  InitOnceExecuteOnce(&watch_once, init_watch_service, NULL, NULL);
+  EnterCriticalSection(&watch_lock);
+
+  FsWatch *watch = find_watch(id);
+  int polled = watch ? watch->polled : 0;
+
+  LeaveCriticalSection(&watch_lock);
+  return polled;
+}
+
+/**
+ * Stop the watch thread and remove all watches
+ */
+void fs_watch_shutdown(void) {
+  InitOnceExecuteOnce(&watch_once, init_watch_service, NULL, NULL);
+
+  EnterCriticalSection(&watch_lock);
+  HANDLE thread = watch_thread;
+  if (thread) {
+    InterlockedExchange(&watch_stop, 1);
+    SetEvent(watch_wakeup);
+  }
+  LeaveCriticalSection(&watch_lock);
+
+  if (!thread) {
+    return;
+  }
+
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+  CloseHandle(watch_wakeup);
+
+  EnterCriticalSection(&watch_lock);
+  watch_thread = NULL;
+  watch_wakeup = NULL;
+  LeaveCriticalSection(&watch_lock);
+}
@@ -0,0 +1,71 @@
+/**
+ * fs_watch.h
+ * Shared file system change notification service
+ */
+
+#ifndef FS_WATCH_H
+#define FS_WATCH_H
+
+#include "common.h"
+
+/**
+ * Called on the watch thread after changes under a watched directory.
+ * Bursts of changes are coalesced into one call.
+ *
+ * @param id Watch id returned by fs_watch_add
+ * @param path The watched directory
+ * @param context Value passed to fs_watch_add
+ */
+typedef void (*FsWatchCallback)(int id, const char *path, void *context);
+
+/**
+ * Start watching a directory for changes
+ *
+ * Watches use ReadDirectoryChangesW. When the watch thread has no wait
+ * slots left, or the directory cannot be watched natively (some network
+ * shares), the directory is polled for changed entries instead; a polled
+ * recursive watch only sees changes directly inside the directory.
+ *
+ * @param path Directory to watch
+ * @param recursive 1 to include subdirectories
+ * @param callback Function notified of changes, or NULL to only use
+ *        fs_watch_generation
+ * @param context Passed to callback
+ * @return Watch id (> 0), or 0 on error
+ */
+int fs_watch_add(const char *path, int recursive, FsWatchCallback callback,
+                 void *context);
+
+/**
+ * Stop a watch. Once this returns the callback will not be called again.
+ * Must not be called from a watch callback.
+ *
+ * @param id Watch id
+ */
+void fs_watch_remove(int id);
+
+/**
+ * Get a counter that increases whenever something under the watched
+ * directory changes. It moves as soon as a change is seen, before the
+ * (coalesced) callback, so a cache that records it when filling can tell
+ * precisely whether it is still valid.
+ *
+ * @param id Watch id
+ * @return The counter, or 0 if id is not an active watch
+ */
+unsigned long fs_watch_generation(int id);
+
+/**
+ * Check whether a watch fell back to polling
+ *
+ * @param id Watch id
+ * @return 1 if polled (changes are seen up to a second late), 0 if native
+ */
+int fs_watch_is_polled(int id);
+
+/**
+ * Stop the watch thread and remove all watches
+ */
+void fs_watch_shutdown(void);
+
+#endif // FS_WATCH_H
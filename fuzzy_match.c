@@ -0,0 +1,288 @@
+/**
+ * fuzzy_match.c
+ * Implementation of fuzzy matching by dynamic programming over the text and
+ * the query, with bonuses for matches that start words or continue runs
+ */
+
+#include "fuzzy_match.h"
+#include <limits.h>
+
+// Scores are in the same units as fzf's, so rankings feel familiar
+#define SCORE_MATCH 16
+#define SCORE_GAP_START (-3)
+#define SCORE_GAP_EXTENSION (-1)
+#define BONUS_BOUNDARY (SCORE_MATCH / 2)
+#define BONUS_BOUNDARY_WHITE (BONUS_BOUNDARY + 2)
+#define BONUS_BOUNDARY_DELIMITER (BONUS_BOUNDARY + 1)
+#define BONUS_NON_WORD (SCORE_MATCH / 2)
+#define BONUS_CAMEL (BONUS_BOUNDARY + SCORE_GAP_EXTENSION)
+#define BONUS_CONSECUTIVE (-(SCORE_GAP_START + SCORE_GAP_EXTENSION))
+#define BONUS_FIRST_CHAR_MULTIPLIER 2
+
+// Cells no alignment reaches
+#define NO_SCORE (INT_MIN / 2)
+
+// Ordered so every class after CHAR_DELIMITER is part of a word
+typedef enum {
+  CHAR_WHITE,
+  CHAR_NON_WORD,
+  CHAR_DELIMITER,
+  CHAR_LOWER,
+  CHAR_UPPER,
+  CHAR_NUMBER
+} CharClass;
+
+struct FuzzyPattern {
+  int length;
+  unsigned char folded[FUZZY_MAX_PATTERN + 1];
+  unsigned long long mask;
+};
+
+static unsigned char fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + 32) : c;
+}
+
+static CharClass char_class(unsigned char c) {
+  if (c >= 'a' && c <= 'z') {
+    return CHAR_LOWER;
+  }
+  if (c >= 'A' && c <= 'Z') {
+    return CHAR_UPPER;
+  }
+  if (c >= '0' && c <= '9') {
+    return CHAR_NUMBER;
+  }
+  if (c == ' ' || c == '\t') {
+    return CHAR_WHITE;
+  }
+  if (c == '/' || c == '\\' || c == ',' || c == ':' || c == ';' ||
+      c == '|') {
+    return CHAR_DELIMITER;
+  }
+  // Bytes of UTF-8 sequences count as letters, so they never start a word
+  return c >= 0x80 ? CHAR_LOWER : CHAR_NON_WORD;
+}
+
+/**
+ * Get the bonus for matching a character, given the one before it
+ */
+static int bonus_for(CharClass prev, CharClass cls) {
+  if (cls > CHAR_DELIMITER) {
+    if (prev == CHAR_WHITE) {
+      return BONUS_BOUNDARY_WHITE;
+    }
+    if (prev == CHAR_DELIMITER) {
+      return BONUS_BOUNDARY_DELIMITER;
+    }
+    if (prev == CHAR_NON_WORD) {
+      return BONUS_BOUNDARY;
+    }
+  }
+  if ((prev == CHAR_LOWER && cls == CHAR_UPPER) ||
+      (prev != CHAR_NUMBER && cls == CHAR_NUMBER)) {
+    return BONUS_CAMEL;
+  }
+  if (cls == CHAR_NON_WORD || cls == CHAR_DELIMITER) {
+    return BONUS_NON_WORD;
+  }
+  if (cls == CHAR_WHITE) {
+    return BONUS_BOUNDARY_WHITE;
+  }
+  return 0;
+}
+
+static unsigned long long char_bit(unsigned char c) {
+  c = fold(c);
+  if (c >= 'a' && c <= 'z') {
+    return 1ULL << (c - 'a');
+  }
+  if (c >= '0' && c <= '9') {
+    return 1ULL << (26 + c - '0');
+  }
+  return 1ULL << (36 + c % 28);
+}
+
+/**
+ * Compile a query
+ */
+FuzzyPattern *fuzzy_pattern_create(const char *pattern) {
+  size_t length = strlen(pattern);
+  if (length > FUZZY_MAX_PATTERN) {
+    return NULL;
+  }
+
+  FuzzyPattern *compiled = (FuzzyPattern *)calloc(1, sizeof(FuzzyPattern));
+  if (!compiled) {
+    return NULL;
+  }
+  compiled->length = (int)length;
+  for (size_t i = 0; i < length; i++) {
+    compiled->folded[i] = fold((unsigned char)pattern[i]);
+    compiled->mask |= char_bit((unsigned char)pattern[i]);
+  }
+  return compiled;
+}
+
+/**
+ * Free a compiled query
+ */
+void fuzzy_pattern_free(FuzzyPattern *pattern) { free(pattern); }
+
+/**
+ * Get the character-presence mask of a text
+ */
+unsigned long long fuzzy_char_mask(const char *text, int length) {
+  unsigned long long mask = 0;
+  for (int i = 0; i < length; i++) {
+    mask |= char_bit((unsigned char)text[i]);
+  }
+  return mask;
+}
+
+/**
+ * Get the character-presence mask of a compiled query
+ */
+unsigned long long fuzzy_pattern_mask(const FuzzyPattern *pattern) {
+  return pattern->mask;
+}
+
+/**
+ * Score the best alignment of a query within a text
+ */
+double fuzzy_match(const FuzzyPattern *pattern, const char *text, int length,
+                   int *match_start, int *match_length) {
+  const unsigned char *data = (const unsigned char *)text;
+  const unsigned char *query = pattern->folded;
+  int m = pattern->length;
+
+  *match_start = 0;
+  *match_length = 0;
+  if (m == 0 || m > length) {
+    return 0.0;
+  }
+
+  // Every alignment lies between the first occurrence of the first query
+  // character and the last occurrence of the last; finding the first also
+  // checks that the characters occur in order at all
+  int first = -1;
+  int j = 0;
+  for (int i = 0; i < length && j < m; i++) {
+    if (fold(data[i]) == query[j]) {
+      if (j == 0) {
+        first = i;
+      }
+      j++;
+    }
+  }
+  if (j < m) {
+    return 0.0;
+  }
+  int last = length - 1;
+  while (fold(data[last]) != query[m - 1]) {
+    last--;
+  }
+
+  // One column per query character, updated in place from the last query
+  // character down, so each cell still holds the previous text position's
+  // values when its successor reads them:
+  //   match[j]: best score with query[j] matched at the previous position
+  //   gap[j]:   best score with query[j] matched earlier, the skipped text
+  //             already paid for
+  int match[FUZZY_MAX_PATTERN];
+  int gap[FUZZY_MAX_PATTERN];
+  int run_bonus[FUZZY_MAX_PATTERN];  // First bonus of the run ending there
+  int match_from[FUZZY_MAX_PATTERN]; // Where each alignment starts
+  int gap_from[FUZZY_MAX_PATTERN];
+  for (j = 0; j < m; j++) {
+    match[j] = NO_SCORE;
+    gap[j] = NO_SCORE;
+    run_bonus[j] = 0;
+    match_from[j] = 0;
+    gap_from[j] = 0;
+  }
+
+  CharClass prev = first > 0 ? char_class(data[first - 1]) : CHAR_WHITE;
+  int best = NO_SCORE;
+  int best_start = 0;
+  int best_end = 0;
+
+  for (int i = first; i <= last; i++) {
+    CharClass cls = char_class(data[i]);
+    int bonus = bonus_for(prev, cls);
+    unsigned char c = fold(data[i]);
+    prev = cls;
+
+    // query[j] cannot be matched before first + j
+    int top = i - first < m - 1 ? i - first : m - 1;
+    for (j = top; j >= 0; j--) {
+      // Skipping this character extends the gap after query[j]
+      int new_gap = NO_SCORE;
+      int new_gap_from = 0;
+      if (match[j] > NO_SCORE &&
+          match[j] + SCORE_GAP_START >= gap[j] + SCORE_GAP_EXTENSION) {
+        new_gap = match[j] + SCORE_GAP_START;
+        new_gap_from = match_from[j];
+      } else if (gap[j] > NO_SCORE) {
+        new_gap = gap[j] + SCORE_GAP_EXTENSION;
+        new_gap_from = gap_from[j];
+      }
+
+      int new_match = NO_SCORE;
+      int new_from = 0;
+      int new_run = 0;
+      if (c == query[j]) {
+        if (j == 0) {
+          new_match = SCORE_MATCH + bonus * BONUS_FIRST_CHAR_MULTIPLIER;
+          new_from = i;
+          new_run = bonus;
+        } else {
+          if (gap[j - 1] > NO_SCORE) {
+            new_match = gap[j - 1] + SCORE_MATCH + bonus;
+            new_from = gap_from[j - 1];
+            new_run = bonus;
+          }
+
+          // A consecutive match keeps the bonus its run started with, unless
+          // this character starts a word with a larger one
+          if (match[j - 1] > NO_SCORE) {
+            int run = run_bonus[j - 1];
+            if (bonus >= BONUS_BOUNDARY && bonus > run) {
+              run = bonus;
+            }
+            int b = bonus > run ? bonus : run;
+            if (b < BONUS_CONSECUTIVE) {
+              b = BONUS_CONSECUTIVE;
+            }
+            int score = match[j - 1] + SCORE_MATCH + b;
+            if (score >= new_match) {
+              new_match = score;
+              new_from = match_from[j - 1];
+              new_run = run;
+            }
+          }
+        }
+      }
+
+      gap[j] = new_gap;
+      gap_from[j] = new_gap_from;
+      match[j] = new_match;
+      match_from[j] = new_from;
+      run_bonus[j] = new_run;
+    }
+
+    if (match[m - 1] > best) {
+      best = match[m - 1];
+      best_start = match_from[m - 1];
+      best_end = i;
+    }
+  }
+
+  *match_start = best_start;
+  *match_length = best_end - best_start + 1;
+
+  // The query as one run at the start of the text scores highest
+  int perfect = m * SCORE_MATCH +
+                BONUS_BOUNDARY_WHITE * (BONUS_FIRST_CHAR_MULTIPLIER + m - 1);
+  double score = (double)best / perfect;
+  return score < 0.0 ? 0.0 : (score > 1.0 ? 1.0 : score);
+}
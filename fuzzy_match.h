@@ -0,0 +1,74 @@
+/**
+ * fuzzy_match.h
+ * Fuzzy matching: a Smith-Waterman style scorer with match bonuses
+ */
+
+#ifndef FUZZY_MATCH_H
+#define FUZZY_MATCH_H
+
+#include "common.h"
+
+// Longest query that can be compiled
+#define FUZZY_MAX_PATTERN 255
+
+// A compiled query is read-only and can be shared between threads
+typedef struct FuzzyPattern FuzzyPattern;
+
+/**
+ * Compile a query. Matching ignores ASCII case.
+ *
+ * @param pattern The query
+ * @return Compiled query, or NULL if it is longer than FUZZY_MAX_PATTERN or
+ *         memory runs out
+ */
+FuzzyPattern *fuzzy_pattern_create(const char *pattern);
+
+/**
+ * Free a compiled query
+ *
+ * @param pattern The query
+ */
+void fuzzy_pattern_free(FuzzyPattern *pattern);
+
+/**
+ * Get the character-presence mask of a text: one bit per letter (folded),
+ * digit and group of other bytes. A text can only match a query if its mask
+ * holds every bit of the query's.
+ *
+ * @param text The text
+ * @param length Length of text
+ * @return The mask
+ */
+unsigned long long fuzzy_char_mask(const char *text, int length);
+
+/**
+ * Get the character-presence mask of a compiled query
+ *
+ * @param pattern The query
+ * @return The mask
+ */
+unsigned long long fuzzy_pattern_mask(const FuzzyPattern *pattern);
+
+/**
+ * Score the best alignment of a query's characters, in order, within a text
+ *
+ * Matches earn a bonus at the start of a word, at a camelCase hump and after
+ * a delimiter, and runs of consecutive matches keep the bonus of the run's
+ * first character; gaps between matches cost a penalty. The alignment is
+ * found by dynamic programming in O(n*m) time and O(m) space; like fzf, a
+ * run's bonus is settled per cell, so the rare alignment that trades score
+ * early for a larger run bonus later can be missed.
+ *
+ * @param pattern The query
+ * @param text Text to match
+ * @param length Length of text
+ * @param match_start Receives the offset of the first matched character
+ * @param match_length Receives the span up to the last matched character
+ * @return Score in [0, 1], 1 for the query at the start of the text; 0 if
+ *         the text does not contain the query's characters in order, or
+ *         they are too scattered to score
+ */
+double fuzzy_match(const FuzzyPattern *pattern, const char *text, int length,
+                   int *match_start, int *match_length);
+
+#endif // FUZZY_MATCH_H
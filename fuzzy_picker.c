@@ -0,0 +1,1010 @@
+/**
+ * fuzzy_picker.c
+ * In-process fuzzy finder: candidates stream in from any thread, a search
+ * thread ranks them with fuzzy_match on the work-stealing pool, and the
+ * console view redraws only the rows that fit on screen
+ */
+
+#include "fuzzy_picker.h"
+#include "arena.h"
+#include "file_index.h"
+#include "fuzzy_match.h"
+#include "thread_pool.h"
+
+#define PICKER_BLOCK_ITEMS 16384 // Candidates per block of the item table
+#define PICKER_MAX_BLOCKS (PICKER_MAX_ITEMS / PICKER_BLOCK_ITEMS)
+#define PICKER_TEXT_BLOCK (256 * 1024) // Arena block for candidate text
+#define PICKER_CHUNK_ITEMS 8192  // Candidates scored per pool task
+#define PICKER_MAX_QUERY 255
+#define PICKER_INPUT_POLL_MS 30  // How often arriving candidates are scored
+#define PICKER_KEY_POLL_MS 15    // How often the view checks for changes
+#define PICKER_REDRAW_MS 50      // Minimum time between streamed redraws
+#define PICKER_PREVIEW_MIN_WIDTH 60 // Narrower consoles show no preview
+
+// A candidate; its text lives in the picker's arena
+typedef struct {
+  const char *text;
+  int length;
+  unsigned long long mask; // fuzzy_char_mask of the text
+} PickerItem;
+
+// A candidate matching the query, with where the match lies in it
+typedef struct {
+  int item;
+  int length; // The candidate's length, which breaks ties in score
+  int match_start;
+  int match_length;
+  double score;
+} PickerMatch;
+
+struct FuzzyPicker {
+  // Blocks are allocated once and never move, so items below item_count
+  // can be read without a lock
+  PickerItem *blocks[PICKER_MAX_BLOCKS];
+  volatile LONG item_count;
+  Arena text;                  // Guarded by input_lock
+  CRITICAL_SECTION input_lock; // Held while a candidate is added
+  volatile LONG input_open;    // More candidates may come
+  volatile LONG walking;       // Directory tasks queued or running
+  HANDLE walk_done;            // Set while no walk is running
+  char walk_root[MAX_PATH];    // Top of the running walk
+
+  CRITICAL_SECTION lock;
+  HANDLE thread;
+  HANDLE wakeup;             // Signalled when a query is posted or on exit
+  volatile LONG generation;  // Bumped to cancel the search in progress
+  volatile LONG stop;
+  volatile LONG closed;      // The view has returned
+
+  PickerPreview preview;     // Called from the view only
+  void *preview_context;
+
+  // Guarded by lock
+  char query[PICKER_MAX_QUERY + 1]; // Latest posted query
+  char shown_query[PICKER_MAX_QUERY + 1]; // Query the ranking is for
+  PickerMatch *shown;   // Best matches of shown_query, best first
+  int shown_count;
+  int match_count;      // Every match of shown_query
+  LONG version;         // Bumped whenever the ranking is published
+
+  // Owned by the search thread
+  char ranked_query[PICKER_MAX_QUERY + 1]; // Query matches and top are for
+  int *matches;         // Candidates containing ranked_query, in order
+  int matched;
+  PickerMatch *top;     // Min-heap of its best matches
+  int top_count;
+  int scored_to;        // Candidates below this have been searched
+};
+
+// One slice of candidates scored for a query on the pool
+typedef struct {
+  FuzzyPicker *picker;
+  LONG generation;
+  const FuzzyPattern *fuzzy;
+  unsigned long long mask;  // The query's fuzzy_pattern_mask
+  const char *query_lower;
+  const int *list;  // Candidate indices, or NULL for the range from first
+  int first;
+  int count;
+  int *matches;     // Candidates that contain the query, in order
+  int match_count;
+  PickerMatch *top; // Min-heap of the slice's best matches
+  int top_count;
+  BOOL cancelled;
+  volatile LONG *remaining; // Slices still running
+  HANDLE done;              // Set when the last slice finishes
+} ScoreChunk;
+
+// A directory to enumerate, queued on the pool
+typedef struct {
+  FuzzyPicker *picker;
+  int include_dirs;
+  int recursive;
+  char path[MAX_PATH];
+} WalkTask;
+
+// A growable frame of console output
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} Frame;
+
+// Workers for walking and scoring: the shared pool, taken on first use
+static ThreadPool *picker_pool = NULL;
+
+static const PickerItem *picker_item(const FuzzyPicker *picker, int index) {
+  return &picker->blocks[index / PICKER_BLOCK_ITEMS]
+                        [index % PICKER_BLOCK_ITEMS];
+}
+
+/**
+ * Add a candidate
+ */
+void fuzzy_picker_add(FuzzyPicker *picker, const char *text, int length) {
+  if (length <= 0) {
+    return;
+  }
+  unsigned long long mask = fuzzy_char_mask(text, length);
+
+  EnterCriticalSection(&picker->input_lock);
+  LONG index = picker->item_count;
+  if (index < PICKER_MAX_ITEMS) {
+    PickerItem **block = &picker->blocks[index / PICKER_BLOCK_ITEMS];
+    if (!*block) {
+      *block = (PickerItem *)malloc(PICKER_BLOCK_ITEMS * sizeof(PickerItem));
+    }
+    char *copy = arena_strndup(&picker->text, text, length);
+    if (*block && copy) {
+      PickerItem *item = &(*block)[index % PICKER_BLOCK_ITEMS];
+      item->text = copy;
+      item->length = length;
+      item->mask = mask;
+      // The item is complete before readers can see it
+      InterlockedExchange(&picker->item_count, index + 1);
+    }
+  }
+  LeaveCriticalSection(&picker->input_lock);
+}
+
+/**
+ * Tell the picker no more candidates are coming
+ */
+void fuzzy_picker_end_input(FuzzyPicker *picker) {
+  InterlockedExchange(&picker->input_open, 0);
+  SetEvent(picker->wakeup);
+}
+
+/**
+ * Check whether the picker's view has returned
+ */
+BOOL fuzzy_picker_closed(const FuzzyPicker *picker) {
+  return picker->closed != 0;
+}
+
+/**
+ * Show a preview of the selected candidate beside the list
+ */
+void fuzzy_picker_set_preview(FuzzyPicker *picker, PickerPreview preview,
+                              void *context) {
+  picker->preview = preview;
+  picker->preview_context = context;
+}
+
+static void queue_walk_task(FuzzyPicker *picker, const char *path,
+                            int include_dirs, int recursive);
+
+/**
+ * Count a directory task as finished; the last one ends the input
+ */
+static void finish_walk_task(FuzzyPicker *picker) {
+  if (InterlockedDecrement(&picker->walking) == 0) {
+    fuzzy_picker_end_input(picker);
+    SetEvent(picker->walk_done);
+  }
+}
+
+/**
+ * Pool task: add a directory's entries, as the shared file index has
+ * them, and queue its subdirectories
+ */
+static void run_walk_task(void *arg) {
+  WalkTask *task = (WalkTask *)arg;
+  FuzzyPicker *picker = task->picker;
+  FileIndexEntry *entries = NULL;
+  int count =
+      picker->stop
+          ? 0
+          : file_index_list(task->recursive ? picker->walk_root : NULL,
+                            task->path, &entries);
+
+  for (int i = 0; i < count && !picker->stop; i++) {
+    if (entries[i].ignored || _stricmp(entries[i].name, ".git") == 0) {
+      continue;
+    }
+
+    char full_path[MAX_PATH];
+    snprintf(full_path, sizeof(full_path), "%s\\%s", task->path,
+             entries[i].name);
+
+    // Drop the leading ".\" of paths under the current directory
+    int is_directory =
+        (entries[i].attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    if (!is_directory || task->include_dirs) {
+      const char *shown =
+          strncmp(full_path, ".\\", 2) == 0 ? full_path + 2 : full_path;
+      fuzzy_picker_add(picker, shown, (int)strlen(shown));
+    }
+    if (is_directory && task->recursive) {
+      queue_walk_task(picker, full_path, task->include_dirs,
+                      task->recursive);
+    }
+  }
+
+  free(entries);
+  free(task);
+  finish_walk_task(picker);
+}
+
+/**
+ * Queue a directory on the pool; tasks queued by a worker go to its own
+ * deque and idle workers steal them. Without a pool the directory is
+ * walked on the calling thread.
+ */
+static void queue_walk_task(FuzzyPicker *picker, const char *path,
+                            int include_dirs, int recursive) {
+  InterlockedIncrement(&picker->walking);
+
+  WalkTask *task = (WalkTask *)malloc(sizeof(WalkTask));
+  if (!task) {
+    finish_walk_task(picker);
+    return;
+  }
+  task->picker = picker;
+  task->include_dirs = include_dirs;
+  task->recursive = recursive;
+  snprintf(task->path, sizeof(task->path), "%s", path);
+
+  if (!picker_pool || !thread_pool_submit(picker_pool, run_walk_task, task)) {
+    run_walk_task(task);
+  }
+}
+
+/**
+ * Stream a directory's entries into a picker from a parallel walk
+ */
+void fuzzy_picker_walk(FuzzyPicker *picker, const char *root,
+                       int include_dirs, int recursive) {
+  ResetEvent(picker->walk_done);
+  snprintf(picker->walk_root, sizeof(picker->walk_root), "%s", root);
+  queue_walk_task(picker, root, include_dirs, recursive);
+}
+
+/**
+ * Order matches best first: by score, then shorter candidates, then those
+ * that arrived first
+ */
+static BOOL match_better(const PickerMatch *a, const PickerMatch *b) {
+  if (a->score != b->score) {
+    return a->score > b->score;
+  }
+  if (a->length != b->length) {
+    return a->length < b->length;
+  }
+  return a->item < b->item;
+}
+
+static int compare_matches(const void *a, const void *b) {
+  const PickerMatch *left = (const PickerMatch *)a;
+  const PickerMatch *right = (const PickerMatch *)b;
+  return match_better(left, right) ? -1 : match_better(right, left) ? 1 : 0;
+}
+
+/**
+ * Insert a match into a min-heap of the best PICKER_TOP_RESULTS, whose root
+ * is the worst kept, replacing the root when the heap is full
+ */
+static void insert_match(PickerMatch *heap, int *count,
+                         const PickerMatch *match) {
+  int i;
+
+  if (*count < PICKER_TOP_RESULTS) {
+    i = (*count)++;
+    while (i > 0 && match_better(&heap[(i - 1) / 2], match)) {
+      heap[i] = heap[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    heap[i] = *match;
+    return;
+  }
+
+  if (!match_better(match, &heap[0])) {
+    return;
+  }
+  i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= *count) {
+      break;
+    }
+    if (child + 1 < *count && match_better(&heap[child], &heap[child + 1])) {
+      child++;
+    }
+    if (!match_better(match, &heap[child])) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = *match;
+}
+
+/**
+ * Check whether a text holds the (lowercase) query's characters in order
+ */
+static BOOL contains_subsequence(const char *text, int length,
+                                 const char *query_lower) {
+  for (int i = 0; i < length && *query_lower; i++) {
+    if (tolower((unsigned char)text[i]) == (unsigned char)*query_lower) {
+      query_lower++;
+    }
+  }
+  return *query_lower == '\0';
+}
+
+/**
+ * Pool task: score one slice of candidates. Gives up as soon as a newer
+ * query is posted.
+ */
+static void run_score_chunk(void *arg) {
+  ScoreChunk *chunk = (ScoreChunk *)arg;
+  FuzzyPicker *picker = chunk->picker;
+  int heap_size = chunk->count < PICKER_TOP_RESULTS ? chunk->count
+                                                    : PICKER_TOP_RESULTS;
+
+  chunk->matches = (int *)malloc((chunk->count + 1) * sizeof(int));
+  chunk->top = (PickerMatch *)malloc((heap_size + 1) * sizeof(PickerMatch));
+  if (!chunk->matches || !chunk->top) {
+    chunk->cancelled = TRUE;
+  }
+
+  for (int i = 0; i < chunk->count && !chunk->cancelled; i++) {
+    if ((i & 1023) == 0 && picker->generation != chunk->generation) {
+      chunk->cancelled = TRUE;
+      break;
+    }
+
+    int index = chunk->list ? chunk->list[i] : chunk->first + i;
+    const PickerItem *item = picker_item(picker, index);
+    if ((item->mask & chunk->mask) != chunk->mask ||
+        !contains_subsequence(item->text, item->length,
+                              chunk->query_lower)) {
+      continue;
+    }
+    chunk->matches[chunk->match_count++] = index;
+
+    // Scattered matches score 0 but still count, ranked last
+    PickerMatch match;
+    match.item = index;
+    match.length = item->length;
+    match.score = fuzzy_match(chunk->fuzzy, item->text, item->length,
+                              &match.match_start, &match.match_length);
+    if (match.score <= 0.0) {
+      match.match_start = 0;
+      match.match_length = 0;
+    }
+    insert_match(chunk->top, &chunk->top_count, &match);
+  }
+
+  if (InterlockedDecrement(chunk->remaining) == 0) {
+    SetEvent(chunk->done);
+  }
+}
+
+/**
+ * Score candidates for a query on the pool: those listed, then the range
+ * [first, end). Matches are appended to *matches in order and merged into
+ * the heap top.
+ * @return FALSE if a newer query cancelled the search (or memory ran out),
+ *         leaving *matches and top as they were
+ */
+static BOOL score_items(FuzzyPicker *picker, LONG generation,
+                        const char *query, const int *list, int list_count,
+                        int first, int end, int **matches, int *matched,
+                        PickerMatch *top, int *top_count) {
+  int list_chunks = (list_count + PICKER_CHUNK_ITEMS - 1) / PICKER_CHUNK_ITEMS;
+  int range = end > first ? end - first : 0;
+  int range_chunks = (range + PICKER_CHUNK_ITEMS - 1) / PICKER_CHUNK_ITEMS;
+  int chunk_count = list_chunks + range_chunks;
+  if (chunk_count == 0) {
+    return TRUE;
+  }
+
+  char query_lower[PICKER_MAX_QUERY + 1];
+  snprintf(query_lower, sizeof(query_lower), "%s", query);
+  for (char *p = query_lower; *p; p++) {
+    *p = (char)tolower((unsigned char)*p);
+  }
+
+  FuzzyPattern *fuzzy = fuzzy_pattern_create(query);
+  ScoreChunk *chunks = (ScoreChunk *)calloc(chunk_count, sizeof(ScoreChunk));
+  HANDLE done = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (!fuzzy || !chunks || !done) {
+    fuzzy_pattern_free(fuzzy);
+    free(chunks);
+    if (done) {
+      CloseHandle(done);
+    }
+    return FALSE;
+  }
+
+  volatile LONG remaining = chunk_count;
+  for (int i = 0; i < chunk_count; i++) {
+    ScoreChunk *chunk = &chunks[i];
+    chunk->picker = picker;
+    chunk->generation = generation;
+    chunk->fuzzy = fuzzy;
+    chunk->mask = fuzzy_pattern_mask(fuzzy);
+    chunk->query_lower = query_lower;
+    if (i < list_chunks) {
+      chunk->list = list + i * PICKER_CHUNK_ITEMS;
+      chunk->count = list_count - i * PICKER_CHUNK_ITEMS;
+    } else {
+      chunk->first = first + (i - list_chunks) * PICKER_CHUNK_ITEMS;
+      chunk->count = end - chunk->first;
+    }
+    if (chunk->count > PICKER_CHUNK_ITEMS) {
+      chunk->count = PICKER_CHUNK_ITEMS;
+    }
+    chunk->remaining = &remaining;
+    chunk->done = done;
+  }
+  for (int i = 0; i < chunk_count; i++) {
+    if (!picker_pool ||
+        !thread_pool_submit(picker_pool, run_score_chunk, &chunks[i])) {
+      run_score_chunk(&chunks[i]);
+    }
+  }
+  WaitForSingleObject(done, INFINITE);
+  CloseHandle(done);
+
+  BOOL complete = picker->generation == generation;
+  int total = *matched;
+  for (int i = 0; i < chunk_count; i++) {
+    complete = complete && !chunks[i].cancelled;
+    total += chunks[i].match_count;
+  }
+
+  int *grown = NULL;
+  if (complete) {
+    grown = (int *)realloc(*matches, (total + 1) * sizeof(int));
+    complete = grown != NULL;
+  }
+  if (complete) {
+    *matches = grown;
+    for (int i = 0; i < chunk_count; i++) {
+      memcpy(*matches + *matched, chunks[i].matches,
+             chunks[i].match_count * sizeof(int));
+      *matched += chunks[i].match_count;
+      for (int j = 0; j < chunks[i].top_count; j++) {
+        insert_match(top, top_count, &chunks[i].top[j]);
+      }
+    }
+  }
+
+  for (int i = 0; i < chunk_count; i++) {
+    free(chunks[i].matches);
+    free(chunks[i].top);
+  }
+  free(chunks);
+  fuzzy_pattern_free(fuzzy);
+  return complete;
+}
+
+/**
+ * Hand the search thread's ranking to the view
+ */
+static void publish_ranking(FuzzyPicker *picker) {
+  PickerMatch *sorted = NULL;
+  if (picker->top_count > 0) {
+    sorted = (PickerMatch *)malloc(picker->top_count * sizeof(PickerMatch));
+    if (sorted) {
+      memcpy(sorted, picker->top, picker->top_count * sizeof(PickerMatch));
+      qsort(sorted, picker->top_count, sizeof(PickerMatch), compare_matches);
+    }
+  }
+
+  EnterCriticalSection(&picker->lock);
+  free(picker->shown);
+  picker->shown = sorted;
+  picker->shown_count = sorted ? picker->top_count : 0;
+  picker->match_count =
+      picker->ranked_query[0] ? picker->matched : picker->scored_to;
+  memcpy(picker->shown_query, picker->ranked_query,
+         sizeof(picker->shown_query));
+  picker->version++;
+  LeaveCriticalSection(&picker->lock);
+}
+
+/**
+ * Bring the ranking up to date with the latest query and candidates. A
+ * candidate containing a query contains every prefix of it too, so when the
+ * query extends the one ranked, only that query's matches are searched
+ * again; candidates that arrived since are searched on their own.
+ */
+static void update_ranking(FuzzyPicker *picker, const char *query,
+                           LONG generation) {
+  int count = picker->item_count;
+
+  if (strcmp(query, picker->ranked_query) == 0) {
+    if (count == picker->scored_to) {
+      return;
+    }
+    if (query[0] != '\0' &&
+        !score_items(picker, generation, query, NULL, 0, picker->scored_to,
+                     count, &picker->matches, &picker->matched, picker->top,
+                     &picker->top_count)) {
+      return;
+    }
+    picker->scored_to = count;
+    publish_ranking(picker);
+    return;
+  }
+
+  int *matches = NULL;
+  int matched = 0;
+  PickerMatch *top = NULL;
+  int top_count = 0;
+
+  if (query[0] != '\0') {
+    BOOL narrow = picker->ranked_query[0] != '\0' &&
+                  strncmp(query, picker->ranked_query,
+                          strlen(picker->ranked_query)) == 0;
+    top = (PickerMatch *)malloc(PICKER_TOP_RESULTS * sizeof(PickerMatch));
+    if (!top ||
+        !score_items(picker, generation, query,
+                     narrow ? picker->matches : NULL,
+                     narrow ? picker->matched : 0,
+                     narrow ? picker->scored_to : 0, count, &matches,
+                     &matched, top, &top_count)) {
+      free(top);
+      free(matches);
+      return;
+    }
+  }
+
+  free(picker->matches);
+  free(picker->top);
+  picker->matches = matches;
+  picker->matched = matched;
+  picker->top = top;
+  picker->top_count = top_count;
+  picker->scored_to = count;
+  snprintf(picker->ranked_query, sizeof(picker->ranked_query), "%s", query);
+  publish_ranking(picker);
+}
+
+/**
+ * Search thread: rank for the latest query, and score candidates as they
+ * arrive while the input is open
+ */
+static unsigned __stdcall picker_search_worker(void *arg) {
+  FuzzyPicker *picker = (FuzzyPicker *)arg;
+  char query[PICKER_MAX_QUERY + 1];
+
+  for (;;) {
+    WaitForSingleObject(picker->wakeup, picker->input_open
+                                            ? PICKER_INPUT_POLL_MS
+                                            : INFINITE);
+    if (picker->stop) {
+      break;
+    }
+
+    EnterCriticalSection(&picker->lock);
+    memcpy(query, picker->query, sizeof(query));
+    LONG generation = picker->generation;
+    LeaveCriticalSection(&picker->lock);
+
+    update_ranking(picker, query, generation);
+  }
+
+  return 0;
+}
+
+/**
+ * Start ranking for a query, cancelling the search in progress
+ */
+static void post_query(FuzzyPicker *picker, const char *query) {
+  EnterCriticalSection(&picker->lock);
+  snprintf(picker->query, sizeof(picker->query), "%s", query);
+  InterlockedIncrement(&picker->generation);
+  LeaveCriticalSection(&picker->lock);
+  SetEvent(picker->wakeup);
+}
+
+/**
+ * Create a picker and start its search thread
+ */
+FuzzyPicker *fuzzy_picker_create(void) {
+  if (!picker_pool) {
+    picker_pool = thread_pool_shared();
+  }
+
+  FuzzyPicker *picker = (FuzzyPicker *)calloc(1, sizeof(FuzzyPicker));
+  if (!picker) {
+    return NULL;
+  }
+  arena_init(&picker->text, PICKER_TEXT_BLOCK);
+  InitializeCriticalSection(&picker->input_lock);
+  InitializeCriticalSection(&picker->lock);
+  picker->input_open = 1;
+  picker->version = 1;
+  picker->wakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+  picker->walk_done = CreateEvent(NULL, TRUE, TRUE, NULL);
+  if (picker->wakeup && picker->walk_done) {
+    picker->thread = (HANDLE)_beginthreadex(NULL, 0, picker_search_worker,
+                                            picker, 0, NULL);
+  }
+
+  if (!picker->thread) {
+    fuzzy_picker_free(picker);
+    return NULL;
+  }
+  return picker;
+}
+
+/**
+ * Stop a picker's search thread and any walk, and free it
+ */
+void fuzzy_picker_free(FuzzyPicker *picker) {
+  if (!picker) {
+    return;
+  }
+
+  // Walk tasks see stop and finish without reading further
+  InterlockedExchange(&picker->stop, 1);
+  InterlockedIncrement(&picker->generation);
+  if (picker->walk_done) {
+    WaitForSingleObject(picker->walk_done, INFINITE);
+    CloseHandle(picker->walk_done);
+  }
+  if (picker->thread) {
+    SetEvent(picker->wakeup);
+    WaitForSingleObject(picker->thread, INFINITE);
+    CloseHandle(picker->thread);
+  }
+  if (picker->wakeup) {
+    CloseHandle(picker->wakeup);
+  }
+
+  for (int i = 0; i < PICKER_MAX_BLOCKS; i++) {
+    free(picker->blocks[i]);
+  }
+  arena_free(&picker->text);
+  free(picker->matches);
+  free(picker->top);
+  free(picker->shown);
+  DeleteCriticalSection(&picker->input_lock);
+  DeleteCriticalSection(&picker->lock);
+  free(picker);
+}
+
+static void frame_append(Frame *frame, const char *text, size_t length) {
+  if (frame->length + length + 1 > frame->capacity) {
+    size_t capacity = frame->capacity ? frame->capacity : 4096;
+    while (capacity < frame->length + length + 1) {
+      capacity *= 2;
+    }
+    char *data = (char *)realloc(frame->data, capacity);
+    if (!data) {
+      return;
+    }
+    frame->data = data;
+    frame->capacity = capacity;
+  }
+  memcpy(frame->data + frame->length, text, length);
+  frame->length += length;
+  frame->data[frame->length] = '\0';
+}
+
+static void frame_string(Frame *frame, const char *text) {
+  frame_append(frame, text, strlen(text));
+}
+
+/**
+ * Append a candidate, cut to width columns, with control characters shown
+ * as spaces and the matched span highlighted
+ * @return Columns written
+ */
+static int frame_item(Frame *frame, const char *text, int length, int width,
+                      int match_start, int match_length, BOOL selected) {
+  if (length > width) {
+    length = width;
+  }
+  if (length < 0) {
+    length = 0;
+  }
+  int match_end = match_start + match_length;
+  for (int i = 0; i < length; i++) {
+    if (match_length > 0 && i == match_start) {
+      frame_string(frame, "\033[1;31m");
+    }
+    char c = (unsigned char)text[i] < 0x20 ? ' ' : text[i];
+    frame_append(frame, &c, 1);
+    if (match_length > 0 && i == match_end - 1) {
+      frame_string(frame, selected ? "\033[0;7m" : "\033[0m");
+    }
+  }
+  return length;
+}
+
+/**
+ * Append spaces up to a column
+ */
+static void frame_pad(Frame *frame, int written, int width) {
+  for (; written < width; written++) {
+    frame_append(frame, " ", 1);
+  }
+}
+
+// What the view shows: the latest ranking it has taken
+typedef struct {
+  PickerMatch *matches;
+  int count;
+  int match_count;
+  char query[PICKER_MAX_QUERY + 1];
+  LONG version;
+} PickerView;
+
+/**
+ * Take the latest published ranking, if it is newer than the view's
+ * @return TRUE if the view changed
+ */
+static BOOL take_ranking(FuzzyPicker *picker, PickerView *view) {
+  BOOL changed = FALSE;
+
+  EnterCriticalSection(&picker->lock);
+  if (picker->version != view->version) {
+    PickerMatch *copy = NULL;
+    if (picker->shown_count > 0) {
+      copy = (PickerMatch *)malloc(picker->shown_count * sizeof(PickerMatch));
+      if (copy) {
+        memcpy(copy, picker->shown, picker->shown_count * sizeof(PickerMatch));
+      }
+    }
+    free(view->matches);
+    view->matches = copy;
+    view->count = copy ? picker->shown_count : 0;
+    view->match_count = picker->match_count;
+    memcpy(view->query, picker->shown_query, sizeof(view->query));
+    view->version = picker->version;
+    changed = TRUE;
+  }
+  LeaveCriticalSection(&picker->lock);
+  return changed;
+}
+
+/**
+ * Get how many rows the list has: every candidate for the empty query, in
+ * the order they arrived, or the ranked matches
+ */
+static int view_rows(const FuzzyPicker *picker, const PickerView *view) {
+  return view->query[0] ? view->count : (int)picker->item_count;
+}
+
+/**
+ * Draw the prompt, the status line and the rows in view, with the selected
+ * candidate's preview beside them when there is room, as one write
+ */
+static void draw_picker(FuzzyPicker *picker, const PickerView *view,
+                        const char *prompt, const char *query, int selected,
+                        int scroll, int list_height, int width) {
+  Frame frame = {NULL, 0, 0};
+  char status[128];
+  int rows = view_rows(picker, view);
+
+  // The preview takes the right 60%, after a separator column
+  BOOL previewing =
+      picker->preview && width >= PICKER_PREVIEW_MIN_WIDTH && selected < rows;
+  int list_width = previewing ? width * 2 / 5 : width - 1;
+  int preview_width = width - list_width - 2;
+  PickerPreviewLine *lines = NULL;
+  int line_count = 0;
+  if (previewing) {
+    lines = (PickerPreviewLine *)calloc(list_height, sizeof(PickerPreviewLine));
+    if (lines) {
+      const PickerItem *item = picker_item(
+          picker, view->query[0] ? view->matches[selected].item : selected);
+      line_count = picker->preview(picker->preview_context, item->text,
+                                   item->length, lines, list_height);
+    }
+  }
+
+  frame_string(&frame, "\033[?25l\033[H");
+  frame_string(&frame, prompt);
+  frame_item(&frame, query, (int)strlen(query),
+             width - (int)strlen(prompt) - 1, 0, 0, FALSE);
+  frame_string(&frame, "\033[K\r\n");
+
+  snprintf(status, sizeof(status), "  %d/%d%s%s", view->match_count,
+           (int)picker->item_count, picker->input_open ? " (loading)" : "",
+           strcmp(view->query, query) != 0 ? " (searching)" : "");
+  frame_string(&frame, "\033[90m");
+  frame_item(&frame, status, (int)strlen(status), width - 1, 0, 0, FALSE);
+  frame_string(&frame, "\033[0m\033[K");
+
+  for (int row = 0; row < list_height; row++) {
+    int index = scroll + row;
+    int written = 0;
+    frame_string(&frame, "\r\n");
+    if (index < rows) {
+      const PickerMatch *match = view->query[0] ? &view->matches[index] : NULL;
+      const PickerItem *item =
+          picker_item(picker, match ? match->item : index);
+      BOOL is_selected = index == selected;
+      frame_string(&frame, is_selected ? "\033[7m> " : "  ");
+      written = 2 + frame_item(&frame, item->text, item->length,
+                               list_width - 2,
+                               match ? match->match_start : 0,
+                               match ? match->match_length : 0, is_selected);
+    }
+    if (previewing) {
+      frame_pad(&frame, written, list_width);
+      frame_string(&frame, "\033[0m\033[90m|\033[0m");
+      if (row < line_count) {
+        const PickerPreviewLine *line = &lines[row];
+        char number[16] = "";
+        if (line->number > 0) {
+          snprintf(number, sizeof(number), "%5d ", line->number);
+        }
+        frame_string(&frame, line->highlight ? "\033[1;33m" : "\033[90m");
+        int shown = frame_item(&frame, number, (int)strlen(number),
+                               preview_width, 0, 0, FALSE);
+        if (!line->highlight) {
+          frame_string(&frame, "\033[0m");
+        }
+        frame_item(&frame, line->text, line->length, preview_width - shown,
+                   0, 0, FALSE);
+      }
+    }
+    frame_string(&frame, "\033[0m\033[K");
+  }
+
+  snprintf(status, sizeof(status), "\033[1;%dH\033[?25h",
+           (int)(strlen(prompt) + strlen(query)) + 1);
+  frame_string(&frame, status);
+
+  if (frame.data) {
+    fwrite(frame.data, 1, frame.length, stdout);
+    fflush(stdout);
+  }
+  free(frame.data);
+  free(lines);
+}
+
+/**
+ * Run the picker in the console until a candidate is chosen or the user
+ * cancels
+ */
+char *fuzzy_picker_run(FuzzyPicker *picker, const char *prompt,
+                       const char *query) {
+  HANDLE h_stdin = GetStdHandle(STD_INPUT_HANDLE);
+  HANDLE h_console = GetStdHandle(STD_OUTPUT_HANDLE);
+  DWORD original_mode;
+  char typed[PICKER_MAX_QUERY + 1];
+  char *chosen = NULL;
+
+  snprintf(typed, sizeof(typed), "%s", query ? query : "");
+  post_query(picker, typed);
+
+  GetConsoleMode(h_stdin, &original_mode);
+  SetConsoleMode(h_stdin, ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT);
+
+  // The alternate screen keeps the shell's output intact underneath
+  printf("\033[?1049h");
+
+  PickerView view;
+  memset(&view, 0, sizeof(view));
+  int selected = 0;
+  int scroll = 0;
+  int shown_items = -1;
+  BOOL dirty = TRUE;
+  DWORD last_draw = 0;
+  BOOL running = TRUE;
+
+  while (running) {
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    int width = 80;
+    int height = 24;
+    if (GetConsoleScreenBufferInfo(h_console, &csbi)) {
+      width = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+      height = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+    }
+    int list_height = height > 3 ? height - 2 : 1;
+
+    if (!_kbhit()) {
+      dirty = take_ranking(picker, &view) || dirty;
+
+      // Arriving candidates only move the counts, so they redraw less often
+      int items = picker->item_count;
+      if (items != shown_items &&
+          GetTickCount() - last_draw >= PICKER_REDRAW_MS) {
+        dirty = TRUE;
+      }
+
+      if (dirty) {
+        int rows = view_rows(picker, &view);
+        if (selected >= rows) {
+          selected = rows > 0 ? rows - 1 : 0;
+        }
+        if (selected < scroll) {
+          scroll = selected;
+        } else if (selected >= scroll + list_height) {
+          scroll = selected - list_height + 1;
+        }
+        draw_picker(picker, &view, prompt, typed, selected, scroll,
+                    list_height, width);
+        shown_items = items;
+        last_draw = GetTickCount();
+        dirty = FALSE;
+      }
+
+      Sleep(PICKER_KEY_POLL_MS);
+      continue;
+    }
+
+    int c = _getch();
+    int rows = view_rows(picker, &view);
+    BOOL edited = FALSE;
+
+    if (c == 3 || c == KEY_ESCAPE) { // Ctrl+C or Esc
+      running = FALSE;
+    } else if (c == KEY_ENTER) {
+      if (selected < rows) {
+        const PickerItem *item = picker_item(
+            picker, view.query[0] ? view.matches[selected].item : selected);
+        chosen = (char *)malloc(item->length + 1);
+        if (chosen) {
+          memcpy(chosen, item->text, item->length);
+          chosen[item->length] = '\0';
+        }
+      }
+      running = FALSE;
+    } else if (c == 0 || c == 224) { // Arrow and page keys
+      int key = _getch();
+      if (key == RAW_KEY_UP && selected > 0) {
+        selected--;
+      } else if (key == RAW_KEY_DOWN && selected + 1 < rows) {
+        selected++;
+      } else if (key == 73) { // Page Up
+        selected = selected > list_height ? selected - list_height : 0;
+      } else if (key == 81) { // Page Down
+        selected = selected + list_height < rows ? selected + list_height
+                                                 : (rows > 0 ? rows - 1 : 0);
+      }
+      dirty = TRUE;
+    } else if (c == 11 || c == 16) { // Ctrl+K or Ctrl+P
+      if (selected > 0) {
+        selected--;
+      }
+      dirty = TRUE;
+    } else if (c == 10 || c == 14) { // Ctrl+J or Ctrl+N
+      if (selected + 1 < rows) {
+        selected++;
+      }
+      dirty = TRUE;
+    } else if (c == 21) { // Ctrl+U
+      edited = typed[0] != '\0';
+      typed[0] = '\0';
+    } else if (c == KEY_BACKSPACE) {
+      size_t len = strlen(typed);
+      if (len > 0) {
+        typed[len - 1] = '\0';
+        edited = TRUE;
+      }
+    } else if (isprint(c)) {
+      size_t len = strlen(typed);
+      if (len < sizeof(typed) - 1) {
+        typed[len] = (char)c;
+        typed[len + 1] = '\0';
+        edited = TRUE;
+      }
+    }
+
+    if (edited) {
+      post_query(picker, typed);
+      selected = 0;
+      scroll = 0;
+      dirty = TRUE;
+    }
+  }
+
+  // Producers still feeding the picker can stop now
+  InterlockedExchange(&picker->closed, 1);
+
+  printf("\033[?1049l");
+  fflush(stdout);
+  SetConsoleMode(h_stdin, original_mode);
+  free(view.matches);
+  return chosen;
+}
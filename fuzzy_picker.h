@@ -0,0 +1,117 @@
+/**
+ * fuzzy_picker.h
+ * In-process fuzzy finder: streamed candidates, parallel scoring and a
+ * full-screen picker that draws only the rows in view
+ */
+
+#ifndef FUZZY_PICKER_H
+#define FUZZY_PICKER_H
+
+#include "common.h"
+
+// Most candidates a picker holds; later ones are dropped
+#define PICKER_MAX_ITEMS (16 * 1024 * 1024)
+
+// Best matches kept in rank order for a query
+#define PICKER_TOP_RESULTS 1000
+
+// A set of candidates and the search thread ranking them. Candidates may be
+// added from any thread while the picker runs.
+typedef struct FuzzyPicker FuzzyPicker;
+
+// A line of a candidate's preview
+typedef struct {
+  const char *text; // Not NUL-terminated; valid until the next preview
+  int length;
+  int number;       // Line number shown before the text, or 0 for none
+  BOOL highlight;   // Drawn highlighted, like the line a match is on
+} PickerPreviewLine;
+
+// Fills lines with up to max_lines lines previewing a candidate and returns
+// how many it filled. Called from the view's thread only.
+typedef int (*PickerPreview)(void *context, const char *candidate,
+                             int length, PickerPreviewLine *lines,
+                             int max_lines);
+
+/**
+ * Create a picker and start its search thread
+ *
+ * @return New picker (free with fuzzy_picker_free), or NULL on failure
+ */
+FuzzyPicker *fuzzy_picker_create(void);
+
+/**
+ * Add a candidate. Safe to call from several threads at once; the text is
+ * copied.
+ *
+ * @param picker The picker
+ * @param text Candidate text (a single line)
+ * @param length Length of text
+ */
+void fuzzy_picker_add(FuzzyPicker *picker, const char *text, int length);
+
+/**
+ * Tell the picker no more candidates are coming, so it stops showing that
+ * input is still arriving. Every producer must be done adding first.
+ *
+ * @param picker The picker
+ */
+void fuzzy_picker_end_input(FuzzyPicker *picker);
+
+/**
+ * Check whether the picker's view has returned, so producers still adding
+ * candidates can stop
+ *
+ * @param picker The picker
+ * @return TRUE once fuzzy_picker_run has returned
+ */
+BOOL fuzzy_picker_closed(const FuzzyPicker *picker);
+
+/**
+ * Show a preview of the selected candidate beside the list, on consoles
+ * wide enough for both
+ *
+ * @param picker The picker
+ * @param preview Fills the preview lines
+ * @param context Passed to preview
+ */
+void fuzzy_picker_set_preview(FuzzyPicker *picker, PickerPreview preview,
+                              void *context);
+
+/**
+ * Stream a directory's entries into a picker from a parallel walk on the
+ * picker's pool, one task per directory. Paths are added relative to the
+ * current directory, without a leading ".\"; .git and whatever the ignore
+ * rules exclude are left out, and ignored directories are never opened.
+ * The input ends when the walk finishes.
+ *
+ * @param picker The picker, with no other producer
+ * @param root Directory to walk
+ * @param include_dirs Add directories as well as files if 1
+ * @param recursive Walk subdirectories if 1
+ */
+void fuzzy_picker_walk(FuzzyPicker *picker, const char *root,
+                       int include_dirs, int recursive);
+
+/**
+ * Run the picker in the console until a candidate is chosen or the user
+ * cancels. Typing narrows the list as candidates keep arriving; Up/Down,
+ * Ctrl+K/Ctrl+J and Ctrl+P/Ctrl+N move, PgUp/PgDn page, Ctrl+U clears the
+ * query, Enter chooses and Esc or Ctrl+C cancels.
+ *
+ * @param picker The picker
+ * @param prompt Text shown before the query
+ * @param query Initial query, or NULL
+ * @return The chosen candidate (free with free), or NULL if cancelled
+ */
+char *fuzzy_picker_run(FuzzyPicker *picker, const char *prompt,
+                       const char *query);
+
+/**
+ * Stop a picker's search thread and any walk, and free it
+ *
+ * @param picker The picker, or NULL
+ */
+void fuzzy_picker_free(FuzzyPicker *picker);
+
+#endif // FUZZY_PICKER_H
@@ -1,357 +1,104 @@
 /**
  * fzf_native.c
- * Wrapper for the native fzf command-line fuzzy finder
+ * The fzf command: fuzzy finding over files and history with the built-in
+ * picker
  */
 
 #include "fzf_native.h"
 #include "common.h"
-#include "line_reader.h"
+#include "fuzzy_picker.h"
+#include "preview_cache.h"
 #include "shell.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 /**
- * Check if native fzf is installed on the system
- *
- * @return 1 if installed, 0 if not
+ * Preview a file's first lines, from the cache of mapped files
  */
-int is_fzf_installed(void) {
-  // Try to run fzf --version to check if it's installed
-  FILE *fp = _popen("fzf --version 2>nul", "r");
-  if (fp == NULL) {
+static int preview_file(void *context, const char *candidate, int length,
+                        PickerPreviewLine *lines, int max_lines) {
+  char path[MAX_PATH];
+  if (length >= (int)sizeof(path)) {
     return 0;
   }
-
-  // Read output (if any)
-  char buffer[128];
-  int has_output = (fgets(buffer, sizeof(buffer), fp) != NULL);
-
-  // Close the process
-  _pclose(fp);
-
-  return has_output;
+  memcpy(path, candidate, length);
+  path[length] = '\0';
+  return preview_cache_lines((PreviewCache *)context, path, 0, lines,
+                             max_lines);
 }
 
 /**
- * Display instructions for installing fzf
+ * Let the user pick an entry of the current directory, streamed in from a
+ * parallel walk that leaves out .git and whatever the ignore rules exclude
  */
-void show_fzf_install_instructions(void) {
-  printf("\nfzf is not installed on this system. To use this feature, install "
-         "fzf:\n\n");
-  printf("Installation options:\n");
-  printf("1. Using Git:\n");
-  printf("   git clone --depth 1 https://github.com/junegunn/fzf.git ~/.fzf\n");
-  printf("   ~/.fzf/install\n\n");
-  printf("2. Using Chocolatey (Windows):\n");
-  printf("   choco install fzf\n\n");
-  printf("3. Using Scoop (Windows):\n");
-  printf("   scoop install fzf\n\n");
-  printf("4. Download prebuilt binary from: "
-         "https://github.com/junegunn/fzf/releases\n\n");
-  printf("After installation, restart your shell.\n");
+static char *pick_path(int include_dirs, int recursive, int preview,
+                       const char *query) {
+  FuzzyPicker *picker = fuzzy_picker_create();
+  if (!picker) {
+    return NULL;
+  }
+
+  PreviewCache *previews = preview ? preview_cache_create() : NULL;
+  if (previews) {
+    fuzzy_picker_set_preview(picker, preview_file, previews);
+  }
+
+  fuzzy_picker_walk(picker, ".", include_dirs, recursive);
+  char *selected = fuzzy_picker_run(picker, "> ", query);
+  fuzzy_picker_free(picker);
+  preview_cache_free(previews);
+  return selected;
 }
 
 /**
- * Run fzf with files from the current directory
+ * Pick a file from the current directory
  *
  * @param preview Enable preview window if 1
- * @param args Additional arguments for fzf
+ * @param query Initial query, or NULL
  * @return Selected filename or NULL if canceled
  */
-char *run_native_fzf_files(int preview, char **args) {
-  // Check if fzf is installed
-  if (!is_fzf_installed()) {
-    show_fzf_install_instructions();
-    return NULL;
-  }
-
-  // Build the command
-  char command[1024] = "dir /b /a-d | fzf";
-
-  // Add proper keybindings for both navigation and search toggle
-  strcat(command, " --bind=\"ctrl-j:down,ctrl-k:up,/:toggle-search\"");
-
-  // Add preview if requested
-  if (preview) {
-    strcat(command, " --preview=\"cat {}\"");
-  }
-
-  // Add any additional arguments
-  if (args && args[1] != NULL) {
-    int i = 1;
-    while (args[i] != NULL) {
-      strcat(command, " ");
-
-      // If the argument contains spaces, quote it
-      if (strchr(args[i], ' ') != NULL) {
-        strcat(command, "\"");
-        strcat(command, args[i]);
-        strcat(command, "\"");
-      } else {
-        strcat(command, args[i]);
-      }
-
-      i++;
-    }
-  }
-
-  // Redirect output to a temporary file to capture selection
-  char tempfile[MAX_PATH];
-  GetTempPath(MAX_PATH, tempfile);
-  strcat(tempfile, "fzf_result.txt");
-
-  // Append output redirection to the command
-  strcat(command, " > ");
-  strcat(command, tempfile);
-
-  // Run the command
-  int result = system(command);
-
-  // Check if user canceled (fzf returns non-zero)
-  if (result != 0) {
-    remove(tempfile); // Clean up temp file even on cancel
-    return NULL;
-  }
-
-  // Read the selected filename from the temporary file
-  FILE *fp = fopen(tempfile, "r");
-  if (!fp) {
-    remove(tempfile);
-    return NULL;
-  }
-
-  // Read the selected line
-  char *selected = (char *)malloc(MAX_PATH);
-  if (!selected) {
-    fclose(fp);
-    remove(tempfile);
-    return NULL;
-  }
-
-  if (fgets(selected, MAX_PATH, fp) == NULL) {
-    fclose(fp);
-    remove(tempfile);
-    free(selected);
-    return NULL;
-  }
-
-  // Remove newline if present
-  size_t len = strlen(selected);
-  if (len > 0 && selected[len - 1] == '\n') {
-    selected[len - 1] = '\0';
-  }
-
-  // Close the file and delete it
-  fclose(fp);
-  remove(tempfile);
-
-  return selected;
+char *run_native_fzf_files(int preview, const char *query) {
+  return pick_path(0, 0, preview, query);
 }
 
 /**
- * Run fzf with all files and directories from the current directory
+ * Pick a file or directory from the current directory
  *
  * @param recursive Search recursively if 1
- * @param args Additional arguments for fzf
+ * @param query Initial query, or NULL
  * @return Selected path or NULL if canceled
  */
-char *run_native_fzf_all(int recursive, char **args) {
-  // Check if fzf is installed
-  if (!is_fzf_installed()) {
-    show_fzf_install_instructions();
-    return NULL;
-  }
-
-  // Build the command - note: using 'dir /b /a' instead of 'find' for Windows
-  char command[1024];
-
-  if (recursive) {
-    strcpy(command, "dir /b /s /a | fzf");
-  } else {
-    strcpy(command, "dir /b /a | fzf");
-  }
-
-  // Add proper keybindings for both navigation and search toggle
-  strcat(command, " --bind=\"ctrl-j:down,ctrl-k:up,/:toggle-search\"");
-
-  // Add preview window showing file info or directory contents
-  strcat(command, " --preview=\"if exist {}\\NUL (dir /b {}) else (bat "
-                  "--color=always {} 2>NUL || type {} 2>NUL)\"");
-
-  // Add any additional arguments
-  if (args && args[1] != NULL) {
-    int i = 1;
-    while (args[i] != NULL) {
-      if (strcmp(args[i], "-r") != 0 && strcmp(args[i], "--recursive") != 0) {
-        strcat(command, " ");
-
-        // If the argument contains spaces, quote it
-        if (strchr(args[i], ' ') != NULL) {
-          strcat(command, "\"");
-          strcat(command, args[i]);
-          strcat(command, "\"");
-        } else {
-          strcat(command, args[i]);
-        }
-      }
-      i++;
-    }
-  }
-
-  // Redirect output to a temporary file to capture selection
-  char tempfile[MAX_PATH];
-  GetTempPath(MAX_PATH, tempfile);
-  strcat(tempfile, "fzf_result.txt");
-
-  // Append output redirection to the command
-  strcat(command, " > ");
-  strcat(command, tempfile);
-
-  // Run the command
-  int result = system(command);
-
-  // Check if user canceled (fzf returns non-zero)
-  if (result != 0) {
-    remove(tempfile); // Clean up temp file even on cancel
-    return NULL;
-  }
-
-  // Read the selected path from the temporary file
-  FILE *fp = fopen(tempfile, "r");
-  if (!fp) {
-    remove(tempfile);
-    return NULL;
-  }
-
-  // Read the selected line
-  char *selected = (char *)malloc(MAX_PATH);
-  if (!selected) {
-    fclose(fp);
-    remove(tempfile);
-    return NULL;
-  }
-
-  if (fgets(selected, MAX_PATH, fp) == NULL) {
-    fclose(fp);
-    remove(tempfile);
-    free(selected);
-    return NULL;
-  }
-
-  // Remove newline if present
-  size_t len = strlen(selected);
-  if (len > 0 && selected[len - 1] == '\n') {
-    selected[len - 1] = '\0';
-  }
-
-  // Close the file and delete it
-  fclose(fp);
-  remove(tempfile);
-
-  return selected;
+char *run_native_fzf_all(int recursive, const char *query) {
+  return pick_path(1, recursive, 1, query);
 }
 
 /**
- * Run fzf with command history
+ * Pick a command from the history, most recent first
  *
  * @return Selected command or NULL if canceled
  */
 char *run_native_fzf_history(void) {
-  // Check if fzf is installed
-  if (!is_fzf_installed()) {
-    show_fzf_install_instructions();
+  FuzzyPicker *picker = fuzzy_picker_create();
+  if (!picker) {
     return NULL;
   }
 
-  // Create a temporary file with command history
-  char tempfile_in[MAX_PATH];
-  GetTempPath(MAX_PATH, tempfile_in);
-  strcat(tempfile_in, "fzf_history.txt");
-
-  FILE *fp_in = fopen(tempfile_in, "w");
-  if (!fp_in) {
-    return NULL;
-  }
-
-  // Write history to temporary file
   int num_to_display =
       (history_count < HISTORY_SIZE) ? history_count : HISTORY_SIZE;
-  int start_idx;
-
-  if (history_count <= HISTORY_SIZE) {
-    // Haven't filled the buffer yet
-    start_idx = 0;
-  } else {
-    // History buffer is full, start from the oldest command
-    start_idx = history_index; // Next slot to overwrite contains oldest command
-  }
 
-  for (int i = 0; i < num_to_display; i++) {
-    int idx = (start_idx + i) % HISTORY_SIZE;
-    if (command_history[idx].command) {
-      fprintf(fp_in, "%s\n", command_history[idx].command);
+  // history_index is the slot the next command goes in
+  for (int i = 1; i <= num_to_display; i++) {
+    int idx = (history_index - i + HISTORY_SIZE) % HISTORY_SIZE;
+    const char *command = command_history[idx].command;
+    if (command) {
+      fuzzy_picker_add(picker, command, (int)strlen(command));
     }
   }
+  fuzzy_picker_end_input(picker);
 
-  fclose(fp_in);
-
-  // Create a temporary file for the result
-  char tempfile_out[MAX_PATH];
-  GetTempPath(MAX_PATH, tempfile_out);
-  strcat(tempfile_out, "fzf_result.txt");
-
-  // Build the command
-  char command[1024];
-  sprintf(command,
-          "type \"%s\" | fzf --tac --no-sort "
-          "--bind=\"ctrl-j:down,ctrl-k:up,/:toggle-search\" > \"%s\"",
-          tempfile_in, tempfile_out);
-
-  // Run the command
-  int result = system(command);
-
-  // Delete the input file
-  remove(tempfile_in);
-
-  // Check if user canceled
-  if (result != 0) {
-    remove(tempfile_out); // Clean up temp file even on cancel
-    return NULL;
-  }
-
-  // Read the selected command from the output file
-  FILE *fp_out = fopen(tempfile_out, "r");
-  if (!fp_out) {
-    remove(tempfile_out);
-    return NULL;
-  }
-
-  // Read the selected line
-  char *selected = (char *)malloc(MAX_PATH);
-  if (!selected) {
-    fclose(fp_out);
-    remove(tempfile_out);
-    return NULL;
-  }
-
-  if (fgets(selected, MAX_PATH, fp_out) == NULL) {
-    fclose(fp_out);
-    remove(tempfile_out);
-    free(selected);
-    return NULL;
-  }
-
-  // Remove newline if present
-  size_t len = strlen(selected);
-  if (len > 0 && selected[len - 1] == '\n') {
-    selected[len - 1] = '\0';
-  }
-
-  // Close and delete the output file
-  fclose(fp_out);
-  remove(tempfile_out);
-
+  char *selected = fuzzy_picker_run(picker, "history> ", NULL);
+  fuzzy_picker_free(picker);
   return selected;
 }
 
@@ -439,12 +186,6 @@ int open_in_best_editor(const char *file_path, int line_number) {
  * @return 1 to continue shell execution, 0 to exit shell
  */
 int lsh_fzf_native(char **args) {
-  // Check if fzf is installed
-  if (!is_fzf_installed()) {
-    show_fzf_install_instructions();
-    return 1;
-  }
-
   // Parse options
   int recursive = 0;
   int mode = 0;    // 0 = all, 1 = files only, 2 = history
@@ -460,13 +201,13 @@ int lsh_fzf_native(char **args) {
     printf("  -h, --history       Search command history\n");
     printf("  --no-open           Don't automatically open selected files\n");
     printf("\nControls:\n");
-    printf("  Ctrl+j/Ctrl+k       Move down/up (vim-style navigation)\n");
-    printf("  Type directly       To search (default mode)\n");
-    printf("  /                   Toggle search mode (allows searching for 'j' "
-           "and 'k')\n");
+    printf("  Type directly       To search; results narrow as you type\n");
+    printf("  Up/Down             Move up/down\n");
+    printf("  Ctrl+k/Ctrl+j       Move up/down (vim-style navigation)\n");
+    printf("  PgUp/PgDn           Move a page up/down\n");
+    printf("  Ctrl+u              Clear the search\n");
     printf("  Enter               Select item (and open file)\n");
     printf("  Ctrl+C/Esc          Cancel\n");
-    printf("  ?                   Toggle preview window\n");
     return 1;
   }
 
@@ -492,7 +233,16 @@ int lsh_fzf_native(char **args) {
     }
   }
 
-  // Run fzf based on the selected mode
+  // The remaining arguments make up the initial query
+  char query[256] = "";
+  for (int i = arg_index; args[i] != NULL; i++) {
+    if (i > arg_index) {
+      strncat(query, " ", sizeof(query) - strlen(query) - 1);
+    }
+    strncat(query, args[i], sizeof(query) - strlen(query) - 1);
+  }
+
+  // Run the picker based on the selected mode
   char *result = NULL;
 
   if (mode == 2) {
@@ -500,10 +250,10 @@ int lsh_fzf_native(char **args) {
     result = run_native_fzf_history();
   } else if (mode == 1) {
     // Files only mode
-    result = run_native_fzf_files(1, args);
+    result = run_native_fzf_files(1, query);
   } else {
     // All files and directories
-    result = run_native_fzf_all(recursive, args);
+    result = run_native_fzf_all(recursive, query);
   }
 
   // Handle the result
@@ -512,16 +262,16 @@ int lsh_fzf_native(char **args) {
       // Execute the selected command from history
       printf("Executing: %s\n", result);
 
-      // Parse and execute the command
-      char *cmd_copy = _strdup(result);
-      if (cmd_copy) {
-        char **cmd_args = lsh_split_line(cmd_copy);
-        lsh_execute(cmd_args);
-
-        // Clean up
-        free(cmd_args);
-        free(cmd_copy);
+      // Parse it like a typed line. The line arena holds the fzf command
+      // that is still running, so the entry gets an arena of its own.
+      Arena arena = {0};
+      CommandList list;
+      if (lsh_parse_line(result, &arena, &list)) {
+        lsh_execute_list(&list);
+      } else {
+        g_last_exit_code = 2;
       }
+      arena_free(&arena);
     } else {
       // File or directory selected
 
@@ -1,6 +1,6 @@
 /**
  * fzf_native.h
- * Header for native fzf command-line fuzzy finder wrapper
+ * Header for the fzf command and the built-in pickers behind it
  */
 
 #ifndef FZF_NATIVE_H
@@ -10,37 +10,25 @@
 #include "common.h"
 
 /**
- * Check if native fzf is installed on the system
- *
- * @return 1 if installed, 0 if not
- */
-int is_fzf_installed(void);
-
-/**
- * Display instructions for installing fzf
- */
-void show_fzf_install_instructions(void);
-
-/**
- * Run fzf with files from the current directory
+ * Pick a file from the current directory
  *
  * @param preview Enable preview window if 1
- * @param args Additional arguments for fzf
+ * @param query Initial query, or NULL
  * @return Selected filename or NULL if canceled
  */
-char *run_native_fzf_files(int preview, char **args);
+char *run_native_fzf_files(int preview, const char *query);
 
 /**
- * Run fzf with all files and directories from the current directory
+ * Pick a file or directory from the current directory
  *
  * @param recursive Search recursively if 1
- * @param args Additional arguments for fzf
+ * @param query Initial query, or NULL
  * @return Selected path or NULL if canceled
  */
-char *run_native_fzf_all(int recursive, char **args);
+char *run_native_fzf_all(int recursive, const char *query);
 
 /**
- * Run fzf with command history
+ * Pick a command from the history, most recent first
  *
  * @return Selected command or NULL if canceled
  */
@@ -0,0 +1,98 @@
+/**
+ * git_files.c
+ * Implementation of the git-files command
+ */
+
+#include "git_files.h"
+#include "git_index.h"
+#include "git_repo.h"
+
+/**
+ * Format a size the same way ls does
+ */
+static void format_size(unsigned long long size, char *out, size_t out_size) {
+  if (size < 1024) {
+    snprintf(out, out_size, "%llu B", size);
+  } else if (size < 1024 * 1024) {
+    snprintf(out, out_size, "%.1f KB", size / 1024.0);
+  } else {
+    snprintf(out, out_size, "%.1f MB", size / (1024.0 * 1024.0));
+  }
+}
+
+/**
+ * Run "git-files" as the first stage of a pipeline
+ */
+TableData *lsh_git_files_structured(char **args) {
+  GitRepo repo;
+  GitFileStatus *files;
+  int count;
+  int changed_only = 0;
+
+  for (int i = 1; args[i] != NULL; i++) {
+    if (strcmp(args[i], "-m") == 0) {
+      changed_only = 1;
+    } else {
+      fprintf(stderr, "lsh: git-files: unknown option '%s'\n", args[i]);
+      return NULL;
+    }
+  }
+
+  if (!git_find_repository(NULL, &repo)) {
+    fprintf(stderr, "lsh: git-files: not a git repository\n");
+    return NULL;
+  }
+
+  if (!git_index_status(&repo, !changed_only, &files, &count)) {
+    fprintf(stderr, "lsh: git-files: could not read the index\n");
+    return NULL;
+  }
+
+  char *headers[] = {"Path", "Status", "Size"};
+  TableData *table = create_table(headers, 3);
+  if (!table) {
+    fprintf(stderr, "lsh: allocation error\n");
+    git_index_free_status(files, count);
+    return NULL;
+  }
+
+  for (int i = 0; i < count; i++) {
+    DataValue *row = (DataValue *)malloc(3 * sizeof(DataValue));
+    if (!row) {
+      break;
+    }
+
+    char status[2] = {files[i].status == ' ' ? '-' : files[i].status, '\0'};
+    char size[32];
+    format_size(files[i].size, size, sizeof(size));
+
+    row[0].type = TYPE_STRING;
+    row[0].value.str_val = _strdup(files[i].path);
+    row[0].is_highlighted = 0;
+    row[1].type = TYPE_STRING;
+    row[1].value.str_val = _strdup(status);
+    row[1].is_highlighted = files[i].status != ' ';
+    row[2].type = TYPE_SIZE;
+    row[2].value.str_val = _strdup(size);
+    row[2].is_highlighted = 0;
+
+    add_table_row(table, row);
+  }
+
+  git_index_free_status(files, count);
+  return table;
+}
+
+/**
+ * Command handler for the "git-files" command
+ */
+int lsh_git_files(char **args) {
+  TableData *table = lsh_git_files_structured(args);
+
+  if (table) {
+    print_table(table);
+    free_table(table);
+  }
+
+  return 1;
+}
@@ -0,0 +1,33 @@
+/**
+ * git_files.h
+ * Built-in git-files command: per-file working tree status
+ */
+
+#ifndef GIT_FILES_H
+#define GIT_FILES_H
+
+#include "common.h"
+#include "structured_data.h"
+
+/**
+ * Command handler for the "git-files" command
+ *
+ * Usage: git-files [-m]
+ * Lists tracked files of the current repository with their status (M, D,
+ * U, A, or - when unmodified). -m lists changed files only.
+ *
+ * @param args Command arguments
+ * @return 1 to continue shell execution
+ */
+int lsh_git_files(char **args);
+
+/**
+ * Run "git-files" as the first stage of a pipeline
+ * (e.g. git-files | where status == M)
+ *
+ * @param args Command arguments
+ * @return Table with Path, Status and Size columns, or NULL on error
+ */
+TableData *lsh_git_files_structured(char **args);
+
+#endif // GIT_FILES_H
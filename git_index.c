@@ -0,0 +1,788 @@
+/**
+ * git_index.c
+ * Implementation of the .git/index reader and working tree status
+ */
+
+#include "git_index.h"
+#include "arena.h"
+#include "git_object.h"
+#include "sha1.h"
+#include "thread_pool.h"
+
+#define GIT_INDEX_CACHE_ENTRIES 4
+#define SCAN_CHUNK_SIZE 256
+#define PARALLEL_SCAN_THRESHOLD 1024
+
+// Entry flags
+#define INDEX_FLAG_ASSUME_VALID 0x8000
+#define INDEX_FLAG_EXTENDED 0x4000
+#define INDEX_FLAG_STAGE_MASK 0x3000
+#define INDEX_EXT_SKIP_WORKTREE 0x4000
+#define INDEX_EXT_INTENT_TO_ADD 0x2000
+
+// Object types in the mode field
+#define INDEX_MODE_TYPE_MASK 0170000
+#define INDEX_MODE_SYMLINK 0120000
+#define INDEX_MODE_GITLINK 0160000
+#define INDEX_MODE_TREE 0040000
+
+// Seconds between 1601-01-01 (FILETIME) and 1970-01-01 (index timestamps)
+#define FILETIME_UNIX_EPOCH 116444736000000000ULL
+
+typedef struct {
+  char *path;
+  unsigned int mtime_sec;
+  unsigned int mtime_nsec;
+  unsigned int mode;
+  unsigned int size; // Truncated to 32 bits, as stored by git
+  unsigned char oid[SHA1_DIGEST_SIZE];
+  unsigned short flags;
+  unsigned short ext_flags;
+
+  // Working tree stat last verified to match the index, so an unchanged
+  // file is never hashed twice
+  ULONGLONG verified_mtime;
+  ULONGLONG verified_size;
+} IndexEntry;
+
+// A parsed index, cached per git directory
+typedef struct {
+  char git_dir[MAX_PATH];
+  FILETIME file_mtime;
+  ULONGLONG file_size;
+  unsigned int mtime_sec; // Index file mtime, for the racy-git check
+  unsigned int mtime_nsec;
+  IndexEntry *entries;
+  int count;
+  Arena paths;
+  int last_dirty; // Entry found dirty by the last check, tried first next time
+  ULONGLONG last_used;
+
+  // Root of the cache-tree extension: the tree the index would write, if
+  // nothing has invalidated it since it was computed
+  int has_cached_tree;
+  unsigned char cached_tree[SHA1_DIGEST_SIZE];
+
+  // Result of the last comparison with HEAD (staged changes)
+  unsigned char checked_head[SHA1_DIGEST_SIZE];
+  int head_matches; // -1 when not checked yet
+} GitIndex;
+
+// One range of entries checked by a pool worker
+typedef struct {
+  GitIndex *index;
+  const char *root;
+  int start;
+  int end;
+  char *results;
+  volatile LONG *stop; // Set to end the scan early (dirty check)
+} ScanChunk;
+
+static GitIndex index_cache[GIT_INDEX_CACHE_ENTRIES];
+static INIT_ONCE index_once = INIT_ONCE_STATIC_INIT;
+static CRITICAL_SECTION index_lock; // Held for a whole scan
+
+static BOOL CALLBACK init_index_cache(PINIT_ONCE once, PVOID param,
+                                      PVOID *context) {
+  InitializeCriticalSection(&index_lock);
+  return TRUE;
+}
+
+static unsigned int read_be32(const unsigned char *p) {
+  return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+         ((unsigned int)p[2] << 8) | p[3];
+}
+
+static unsigned short read_be16(const unsigned char *p) {
+  return (unsigned short)((p[0] << 8) | p[1]);
+}
+
+static ULONGLONG filetime_to_u64(FILETIME ft) {
+  return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+static void filetime_to_unix(ULONGLONG ft, unsigned int *sec,
+                             unsigned int *nsec) {
+  ULONGLONG since_epoch = ft > FILETIME_UNIX_EPOCH ? ft - FILETIME_UNIX_EPOCH
+                                                   : 0;
+  *sec = (unsigned int)(since_epoch / 10000000ULL);
+  *nsec = (unsigned int)(since_epoch % 10000000ULL) * 100;
+}
+
+/**
+ * Read a whole file into memory
+ */
+static unsigned char *read_whole_file(const char *path, size_t *size) {
+  HANDLE file = CreateFile(path, GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE |
+                               FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                           NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart > 0x7FFFFFFF) {
+    CloseHandle(file);
+    return NULL;
+  }
+
+  unsigned char *data = (unsigned char *)malloc((size_t)file_size.QuadPart + 1);
+  if (!data) {
+    CloseHandle(file);
+    return NULL;
+  }
+
+  DWORD total = 0;
+  while (total < (DWORD)file_size.QuadPart) {
+    DWORD got = 0;
+    if (!ReadFile(file, data + total, (DWORD)file_size.QuadPart - total, &got,
+                  NULL) ||
+        got == 0) {
+      break;
+    }
+    total += got;
+  }
+  CloseHandle(file);
+
+  *size = total;
+  return data;
+}
+
+/**
+ * Decode the variable length integer used for v4 path prefixes
+ */
+static size_t read_offset_varint(const unsigned char **p,
+                                 const unsigned char *end) {
+  const unsigned char *q = *p;
+  if (q >= end) {
+    return 0;
+  }
+
+  unsigned char c = *q++;
+  size_t value = c & 127;
+  while ((c & 128) && q < end) {
+    c = *q++;
+    value = ((value + 1) << 7) | (c & 127);
+  }
+
+  *p = q;
+  return value;
+}
+
+/**
+ * Read the root entry of the cache-tree extension: "" NUL, entry count
+ * (-1 when invalidated), space, subtree count, newline, then the tree id
+ */
+static void parse_cached_tree(GitIndex *index, const unsigned char *p,
+                              const unsigned char *end) {
+  if (p >= end || *p != '\0') {
+    return;
+  }
+  p++;
+
+  const unsigned char *newline = (const unsigned char *)memchr(p, '\n', end - p);
+  if (!newline || *p == '-' || newline + 1 + SHA1_DIGEST_SIZE > end) {
+    return;
+  }
+
+  memcpy(index->cached_tree, newline + 1, SHA1_DIGEST_SIZE);
+  index->has_cached_tree = 1;
+}
+
+static void free_index(GitIndex *index) {
+  free(index->entries);
+  arena_free(&index->paths);
+  index->entries = NULL;
+  index->count = 0;
+  index->git_dir[0] = '\0';
+}
+
+/**
+ * Parse an index file into index->entries
+ */
+static int parse_index(GitIndex *index, const unsigned char *data,
+                       size_t size) {
+  if (size < 12 + SHA1_DIGEST_SIZE || memcmp(data, "DIRC", 4) != 0) {
+    return 0;
+  }
+
+  unsigned int version = read_be32(data + 4);
+  unsigned int count = read_be32(data + 8);
+  if (version < 2 || version > 4) {
+    return 0;
+  }
+
+  index->entries = (IndexEntry *)calloc(count ? count : 1, sizeof(IndexEntry));
+  if (!index->entries) {
+    return 0;
+  }
+  arena_init(&index->paths, 0);
+
+  const unsigned char *p = data + 12;
+  const unsigned char *end = data + size - SHA1_DIGEST_SIZE;
+  const char *previous_path = "";
+  size_t previous_length = 0;
+
+  for (unsigned int i = 0; i < count; i++) {
+    const unsigned char *entry_start = p;
+    if (p + 62 > end) {
+      return 0;
+    }
+
+    IndexEntry *entry = &index->entries[i];
+    entry->mtime_sec = read_be32(p + 8);
+    entry->mtime_nsec = read_be32(p + 12);
+    entry->mode = read_be32(p + 24);
+    entry->size = read_be32(p + 36);
+    memcpy(entry->oid, p + 40, SHA1_DIGEST_SIZE);
+    entry->flags = read_be16(p + 60);
+    p += 62;
+
+    if (entry->flags & INDEX_FLAG_EXTENDED) {
+      if (version < 3 || p + 2 > end) {
+        return 0;
+      }
+      entry->ext_flags = read_be16(p);
+      p += 2;
+    }
+
+    const char *name;
+    size_t name_length;
+    size_t prefix_length = 0;
+
+    if (version == 4) {
+      // Path is stored as "drop N bytes of the previous path, then append"
+      size_t strip = read_offset_varint(&p, end);
+      if (strip > previous_length) {
+        return 0;
+      }
+      prefix_length = previous_length - strip;
+    }
+
+    name = (const char *)p;
+    name_length = strnlen(name, end - p);
+    if (p + name_length >= end) {
+      return 0;
+    }
+
+    entry->path = (char *)arena_alloc(&index->paths,
+                                      prefix_length + name_length + 1);
+    if (!entry->path) {
+      return 0;
+    }
+    memcpy(entry->path, previous_path, prefix_length);
+    memcpy(entry->path + prefix_length, name, name_length);
+    entry->path[prefix_length + name_length] = '\0';
+
+    if (version == 4) {
+      p += name_length + 1;
+    } else {
+      // Entries are NUL padded to a multiple of 8 bytes
+      size_t entry_length = (p - entry_start) + name_length;
+      p = entry_start + ((entry_length + 8) & ~(size_t)7);
+    }
+
+    previous_path = entry->path;
+    previous_length = prefix_length + name_length;
+    index->count++;
+  }
+
+  // Extensions: 4 byte signature, 4 byte size, data
+  while (p + 8 <= end) {
+    unsigned int ext_size = read_be32(p + 4);
+    if (ext_size > (size_t)(end - p) - 8) {
+      break;
+    }
+    if (memcmp(p, "TREE", 4) == 0) {
+      parse_cached_tree(index, p + 8, p + 8 + ext_size);
+    }
+    p += 8 + ext_size;
+  }
+
+  return 1;
+}
+
+/**
+ * Get the parsed index for a repository, re-reading it if the file changed.
+ * Called with index_lock held.
+ */
+static GitIndex *load_index(const GitRepo *repo) {
+  char path[MAX_PATH];
+  WIN32_FILE_ATTRIBUTE_DATA attr;
+
+  snprintf(path, sizeof(path), "%s\\index", repo->git_dir);
+  if (!GetFileAttributesEx(path, GetFileExInfoStandard, &attr)) {
+    return NULL;
+  }
+  ULONGLONG file_size =
+      ((ULONGLONG)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+
+  GitIndex *index = NULL;
+  GitIndex *oldest = &index_cache[0];
+  for (int i = 0; i < GIT_INDEX_CACHE_ENTRIES; i++) {
+    if (index_cache[i].git_dir[0] &&
+        _stricmp(index_cache[i].git_dir, repo->git_dir) == 0) {
+      index = &index_cache[i];
+      break;
+    }
+    if (index_cache[i].last_used < oldest->last_used) {
+      oldest = &index_cache[i];
+    }
+  }
+
+  if (index && CompareFileTime(&index->file_mtime, &attr.ftLastWriteTime) ==
+                   0 &&
+      index->file_size == file_size) {
+    index->last_used = GetTickCount64();
+    return index;
+  }
+
+  // Missing or stale - parse the file again
+  if (!index) {
+    index = oldest;
+  }
+  if (index->git_dir[0]) {
+    free_index(index);
+  }
+  memset(index, 0, sizeof(*index));
+
+  size_t size;
+  unsigned char *data = read_whole_file(path, &size);
+  if (!data) {
+    return NULL;
+  }
+
+  int ok = parse_index(index, data, size);
+  free(data);
+  if (!ok) {
+    free_index(index);
+    return NULL;
+  }
+
+  snprintf(index->git_dir, sizeof(index->git_dir), "%s", repo->git_dir);
+  index->file_mtime = attr.ftLastWriteTime;
+  index->file_size = file_size;
+  filetime_to_unix(filetime_to_u64(attr.ftLastWriteTime), &index->mtime_sec,
+                   &index->mtime_nsec);
+  index->last_dirty = -1;
+  index->head_matches = -1;
+  index->last_used = GetTickCount64();
+  return index;
+}
+
+/**
+ * Hash a file's content the way git hashes a blob
+ */
+static void hash_blob(const unsigned char *data, size_t size,
+                      unsigned char oid[SHA1_DIGEST_SIZE]) {
+  char header[32];
+  int header_length = snprintf(header, sizeof(header), "blob %zu", size) + 1;
+
+  Sha1Context ctx;
+  sha1_init(&ctx);
+  sha1_update(&ctx, header, header_length);
+  sha1_update(&ctx, data, size);
+  sha1_final(&ctx, oid);
+}
+
+/**
+ * Check whether a working tree file's content matches the index entry
+ */
+static int content_matches(const char *full_path, const IndexEntry *entry) {
+  unsigned char oid[SHA1_DIGEST_SIZE];
+  size_t size;
+
+  unsigned char *data = read_whole_file(full_path, &size);
+  if (!data) {
+    return 0;
+  }
+
+  hash_blob(data, size, oid);
+  int matches = memcmp(oid, entry->oid, SHA1_DIGEST_SIZE) == 0;
+
+  if (!matches && memchr(data, '\r', size)) {
+    // With core.autocrlf the blob has LF line endings where the working tree
+    // has CRLF; compare the normalized content as well
+    size_t out = 0;
+    for (size_t i = 0; i < size; i++) {
+      if (!(data[i] == '\r' && i + 1 < size && data[i + 1] == '\n')) {
+        data[out++] = data[i];
+      }
+    }
+    hash_blob(data, out, oid);
+    matches = memcmp(oid, entry->oid, SHA1_DIGEST_SIZE) == 0;
+  }
+
+  free(data);
+  return matches;
+}
+
+/**
+ * Work out the status of one entry, hashing only when its stat changed
+ */
+static char check_entry(const GitIndex *index, IndexEntry *entry,
+                        const char *root) {
+  char full_path[MAX_PATH * 2];
+  WIN32_FILE_ATTRIBUTE_DATA attr;
+
+  if (entry->flags & INDEX_FLAG_STAGE_MASK) {
+    return 'U';
+  }
+  if ((entry->flags & INDEX_FLAG_ASSUME_VALID) ||
+      (entry->ext_flags & INDEX_EXT_SKIP_WORKTREE) ||
+      (entry->mode & INDEX_MODE_TYPE_MASK) == INDEX_MODE_GITLINK) {
+    return ' '; // Not compared with the working tree
+  }
+  if (entry->ext_flags & INDEX_EXT_INTENT_TO_ADD) {
+    return 'A';
+  }
+
+  snprintf(full_path, sizeof(full_path), "%s\\%s", root, entry->path);
+  for (char *p = full_path; *p; p++) {
+    if (*p == '/') {
+      *p = '\\';
+    }
+  }
+
+  if (!GetFileAttributesEx(full_path, GetFileExInfoStandard, &attr) ||
+      (attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+    return 'D';
+  }
+
+  ULONGLONG mtime = filetime_to_u64(attr.ftLastWriteTime);
+  ULONGLONG size = ((ULONGLONG)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+
+  // Verified clean by an earlier scan and untouched since
+  if (entry->verified_mtime == mtime && entry->verified_size == size) {
+    return ' ';
+  }
+
+  if ((entry->mode & INDEX_MODE_TYPE_MASK) == INDEX_MODE_SYMLINK) {
+    return ' '; // Link targets are not compared on Windows
+  }
+
+  // A zero size may just mean the stat data was never filled in (as after
+  // git read-tree), so only a nonzero mismatch proves a change
+  if ((unsigned int)size != entry->size && entry->size != 0) {
+    return 'M';
+  }
+
+  unsigned int sec, nsec;
+  filetime_to_unix(mtime, &sec, &nsec);
+
+  // The index only stores nanoseconds when git was built to
+  int same_mtime = sec == entry->mtime_sec &&
+                   (entry->mtime_nsec == 0 || nsec == entry->mtime_nsec);
+
+  // A file written in the same instant as the index may have changed after
+  // git recorded its stat ("racy git"), so its content has to be checked
+  int racy = entry->mtime_sec > index->mtime_sec ||
+             (entry->mtime_sec == index->mtime_sec &&
+              entry->mtime_nsec >= index->mtime_nsec);
+
+  if ((same_mtime && !racy) || content_matches(full_path, entry)) {
+    entry->verified_mtime = mtime;
+    entry->verified_size = size;
+    return ' ';
+  }
+
+  return 'M';
+}
+
+static void scan_chunk(void *arg) {
+  ScanChunk *chunk = (ScanChunk *)arg;
+
+  for (int i = chunk->start; i < chunk->end; i++) {
+    if (chunk->stop && *chunk->stop) {
+      break;
+    }
+
+    char status = check_entry(chunk->index, &chunk->index->entries[i],
+                              chunk->root);
+    chunk->results[i] = status;
+
+    if (status != ' ' && chunk->stop) {
+      InterlockedExchange(chunk->stop, 1);
+    }
+  }
+}
+
+/**
+ * Check every entry, in parallel for large indexes. Unchecked entries (after
+ * an early stop) are left as 0 in results. Called with index_lock held.
+ */
+static void scan_index(GitIndex *index, const char *root, char *results,
+                       volatile LONG *stop) {
+  memset(results, 0, index->count);
+
+  int chunk_count = (index->count + SCAN_CHUNK_SIZE - 1) / SCAN_CHUNK_SIZE;
+  ScanChunk *chunks = NULL;
+
+  ThreadPool *pool = NULL;
+  if (index->count >= PARALLEL_SCAN_THRESHOLD) {
+    pool = thread_pool_shared();
+    if (pool) {
+      chunks = (ScanChunk *)malloc(chunk_count * sizeof(ScanChunk));
+    }
+  }
+
+  if (!chunks) {
+    // Small index (or no pool) - one range on this thread
+    ScanChunk all = {index, root, 0, index->count, results, stop};
+    scan_chunk(&all);
+    return;
+  }
+
+  ThreadPoolGroup tasks = {0};
+  for (int i = 0; i < chunk_count; i++) {
+    ScanChunk *chunk = &chunks[i];
+    chunk->index = index;
+    chunk->root = root;
+    chunk->start = i * SCAN_CHUNK_SIZE;
+    chunk->end = chunk->start + SCAN_CHUNK_SIZE < index->count
+                     ? chunk->start + SCAN_CHUNK_SIZE
+                     : index->count;
+    chunk->results = results;
+    chunk->stop = stop;
+
+    if (!thread_pool_submit_group(pool, &tasks, scan_chunk, chunk)) {
+      scan_chunk(chunk);
+    }
+  }
+
+  thread_pool_wait_group(pool, &tasks);
+  free(chunks);
+}
+
+/**
+ * Compare every tracked file with its index entry
+ */
+int git_index_status(const GitRepo *repo, int include_unmodified,
+                     GitFileStatus **files, int *count) {
+  *files = NULL;
+  *count = 0;
+
+  InitOnceExecuteOnce(&index_once, init_index_cache, NULL, NULL);
+  EnterCriticalSection(&index_lock);
+
+  GitIndex *index = load_index(repo);
+  if (!index) {
+    LeaveCriticalSection(&index_lock);
+    return 0;
+  }
+
+  char *results = (char *)malloc(index->count ? index->count : 1);
+  GitFileStatus *out = (GitFileStatus *)malloc(
+      (index->count ? index->count : 1) * sizeof(GitFileStatus));
+  if (!results || !out) {
+    free(results);
+    free(out);
+    LeaveCriticalSection(&index_lock);
+    return 0;
+  }
+
+  scan_index(index, repo->root, results, NULL);
+
+  int n = 0;
+  for (int i = 0; i < index->count; i++) {
+    IndexEntry *entry = &index->entries[i];
+
+    // Unmerged paths have up to three entries; report them once
+    if (results[i] == 'U' && n > 0 && out[n - 1].status == 'U' &&
+        strcmp(out[n - 1].path, entry->path) == 0) {
+      continue;
+    }
+    if (results[i] == ' ' && !include_unmodified) {
+      continue;
+    }
+
+    out[n].path = _strdup(entry->path);
+    out[n].status = results[i];
+    out[n].size = entry->size;
+    if (results[i] != 'D') {
+      // Report the current size of modified files
+      char full_path[MAX_PATH * 2];
+      WIN32_FILE_ATTRIBUTE_DATA attr;
+      snprintf(full_path, sizeof(full_path), "%s\\%s", repo->root,
+               entry->path);
+      if (GetFileAttributesEx(full_path, GetFileExInfoStandard, &attr)) {
+        out[n].size =
+            ((ULONGLONG)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+      }
+    }
+    n++;
+  }
+
+  LeaveCriticalSection(&index_lock);
+  free(results);
+
+  *files = out;
+  *count = n;
+  return 1;
+}
+
+/**
+ * Free an array returned by git_index_status
+ */
+void git_index_free_status(GitFileStatus *files, int count) {
+  if (!files) {
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    free((char *)files[i].path);
+  }
+  free(files);
+}
+
+/**
+ * Compare a tree, recursively, with the index entries from *position on.
+ * Index order is the order a recursive tree walk visits paths in, so the
+ * two can be merged in one pass.
+ */
+static int tree_matches_index(GitObjectDb *db, const unsigned char *tree_oid,
+                              char *path, size_t path_length,
+                              const GitIndex *index, int *position) {
+  GitObjectType type;
+  size_t size;
+  unsigned char *tree = git_odb_read(db, tree_oid, &type, &size);
+  if (!tree || type != GIT_OBJECT_TREE) {
+    free(tree);
+    return 0;
+  }
+
+  // Entries are "<octal mode> <name>\0<20 byte id>"
+  const unsigned char *p = tree;
+  const unsigned char *end = tree + size;
+  int matches = 1;
+
+  while (matches && p < end) {
+    unsigned int mode = 0;
+    while (p < end && *p >= '0' && *p <= '7') {
+      mode = mode * 8 + (*p++ - '0');
+    }
+    if (p >= end || *p != ' ') {
+      matches = 0;
+      break;
+    }
+    p++;
+
+    size_t name_length = strnlen((const char *)p, end - p);
+    const unsigned char *oid = p + name_length + 1;
+    if (oid + SHA1_DIGEST_SIZE > end ||
+        path_length + name_length + 2 > MAX_PATH * 2) {
+      matches = 0;
+      break;
+    }
+    memcpy(path + path_length, p, name_length);
+    p = oid + SHA1_DIGEST_SIZE;
+
+    if ((mode & INDEX_MODE_TYPE_MASK) == INDEX_MODE_TREE) {
+      path[path_length + name_length] = '/';
+      matches = tree_matches_index(db, oid, path,
+                                   path_length + name_length + 1, index,
+                                   position);
+      continue;
+    }
+
+    path[path_length + name_length] = '\0';
+    const IndexEntry *entry =
+        *position < index->count ? &index->entries[*position] : NULL;
+    matches = entry && entry->mode == mode && strcmp(entry->path, path) == 0 &&
+              memcmp(entry->oid, oid, SHA1_DIGEST_SIZE) == 0;
+    (*position)++;
+  }
+
+  free(tree);
+  return matches;
+}
+
+/**
+ * Check whether the index still matches HEAD, i.e. nothing is staged.
+ * Called with index_lock held, after the working tree scan found no
+ * unmerged or intent-to-add entries.
+ */
+static int index_matches_head(GitIndex *index, const GitRepo *repo) {
+  char head_hex[GIT_OID_HEX_LEN + 1];
+  unsigned char head[SHA1_DIGEST_SIZE];
+  unsigned char head_tree[SHA1_DIGEST_SIZE];
+
+  if (!git_resolve_ref(repo, "HEAD", head_hex) ||
+      !git_oid_from_hex(head_hex, head)) {
+    return index->count == 0; // No commits yet - anything in it is staged
+  }
+  if (index->head_matches >= 0 &&
+      memcmp(index->checked_head, head, SHA1_DIGEST_SIZE) == 0) {
+    return index->head_matches;
+  }
+
+  GitObjectDb *db = git_odb_open(repo);
+  if (!db) {
+    return 1;
+  }
+
+  int matches = 1; // Unreadable history is not reported as a change
+  if (git_commit_tree(db, head, head_tree)) {
+    if (index->has_cached_tree) {
+      // The cache-tree is the tree the index would commit as
+      matches = memcmp(index->cached_tree, head_tree, SHA1_DIGEST_SIZE) == 0;
+    } else {
+      char path[MAX_PATH * 2];
+      int position = 0;
+      matches = tree_matches_index(db, head_tree, path, 0, index, &position) &&
+                position == index->count;
+    }
+  }
+  git_odb_close(db);
+
+  memcpy(index->checked_head, head, SHA1_DIGEST_SIZE);
+  index->head_matches = matches;
+  return matches;
+}
+
+/**
+ * Check whether any tracked file differs from the index, or the index from
+ * HEAD
+ */
+int git_index_is_dirty(const GitRepo *repo) {
+  InitOnceExecuteOnce(&index_once, init_index_cache, NULL, NULL);
+  EnterCriticalSection(&index_lock);
+
+  GitIndex *index = load_index(repo);
+  if (!index) {
+    LeaveCriticalSection(&index_lock);
+    return -1;
+  }
+
+  // The file that made the last check dirty usually still is
+  if (index->last_dirty >= 0 && index->last_dirty < index->count &&
+      check_entry(index, &index->entries[index->last_dirty], repo->root) !=
+          ' ') {
+    LeaveCriticalSection(&index_lock);
+    return 1;
+  }
+
+  char *results = (char *)malloc(index->count ? index->count : 1);
+  if (!results) {
+    LeaveCriticalSection(&index_lock);
+    return -1;
+  }
+
+  volatile LONG stop = 0;
+  scan_index(index, repo->root, results, &stop);
+
+  index->last_dirty = -1;
+  for (int i = 0; i < index->count; i++) {
+    if (results[i] != 0 && results[i] != ' ') {
+      index->last_dirty = i;
+      break;
+    }
+  }
+
+  int dirty = stop || !index_matches_head(index, repo);
+
+  LeaveCriticalSection(&index_lock);
+  free(results);
+  return dirty;
+}
@@ -0,0 +1,57 @@
+/**
+ * git_index.h
+ * Native .git/index reader and working tree status
+ */
+
+#ifndef GIT_INDEX_H
+#define GIT_INDEX_H
+
+#include "common.h"
+#include "git_repo.h"
+
+// Working tree status of one tracked file
+typedef struct {
+  const char *path;        // Relative to the repository root, '/' separated
+  char status;             // 'M', 'D', 'U' (unmerged), 'A' (intent to add)
+                           // or ' ' when unmodified
+  unsigned long long size; // Working tree size (index size when deleted)
+} GitFileStatus;
+
+/**
+ * Compare every tracked file with its index entry
+ *
+ * Index versions 2 to 4 are supported. Files are checked in parallel; a file
+ * is only read and hashed when its size or modification time no longer
+ * matches the index, and files verified clean are remembered so later scans
+ * only need to stat them. Untracked files are not reported.
+ *
+ * @param repo Repository found by git_find_repository or git_repo_open
+ * @param include_unmodified 1 to list every tracked file, 0 for changed only
+ * @param files Receives the array (free with git_index_free_status)
+ * @param count Receives the number of entries
+ * @return 1 on success, 0 if the index could not be read
+ */
+int git_index_status(const GitRepo *repo, int include_unmodified,
+                     GitFileStatus **files, int *count);
+
+/**
+ * Free an array returned by git_index_status
+ *
+ * @param files The array
+ * @param count Number of entries
+ */
+void git_index_free_status(GitFileStatus *files, int count);
+
+/**
+ * Check whether any tracked file differs from the index, stopping at the
+ * first change found, or the index differs from HEAD (staged changes)
+ *
+ * The HEAD comparison uses the index's cache-tree when it is valid, and
+ * otherwise walks HEAD's tree alongside the index entries.
+ *
+ * @param repo Repository found by git_find_repository or git_repo_open
+ * @return 1 if dirty, 0 if clean, -1 if the index could not be read
+ */
+int git_index_is_dirty(const GitRepo *repo);
+
+#endif // GIT_INDEX_H
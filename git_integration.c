@@ -4,17 +4,17 @@
  */
 
 #include "git_integration.h"
+#include "git_index.h"
+#include "git_repo.h"
 #include <stdio.h>
 #include <string.h>
 
 /**
- * Check if the current directory is in a Git repository and get branch info
+ * Check if a directory is in a Git repository and get branch info
  */
-int get_git_branch(char *branch_name, size_t buffer_size, int *is_dirty) {
-  char git_dir[1024] = "";
-  char cmd[1024] = "";
-  FILE *fp;
-  int status = 0;
+static int get_git_branch_in(const char *dir, char *branch_name,
+                             size_t buffer_size, int *is_dirty) {
+  GitRepo repo;
 
   // Initialize output parameters
   if (branch_name && buffer_size > 0) {
@@ -24,81 +24,51 @@ int get_git_branch(char *branch_name, size_t buffer_size, int *is_dirty) {
     *is_dirty = 0;
   }
 
-  // First check if .git directory exists (faster than running git command)
-  strcpy(git_dir, ".git");
-  DWORD attr = GetFileAttributes(git_dir);
-  if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY)) {
-    // Try running git command to handle the case of being in a subdirectory
-    // of a git repo
-    snprintf(cmd, sizeof(cmd), "git rev-parse --is-inside-work-tree 2>nul");
-    fp = _popen(cmd, "r");
-    if (!fp) {
-      return 0;
-    }
+  // HEAD and refs are read directly, without starting git
+  if (!git_repo_open(dir, &repo)) {
+    return 0;
+  }
 
-    char output[16];
-    if (fgets(output, sizeof(output), fp) == NULL ||
-        strcmp(output, "true\n") != 0) {
-      _pclose(fp);
-      return 0;
-    }
-    _pclose(fp);
+  if (repo.branch[0]) {
+    snprintf(branch_name, buffer_size, "%s", repo.branch);
+  } else if (repo.head_oid[0]) {
+    // Detached HEAD state - show the abbreviated commit hash
+    snprintf(branch_name, buffer_size, "detached:%.7s", repo.head_oid);
   }
 
-  // We're in a git repo, get the branch name
-  snprintf(cmd, sizeof(cmd), "git branch --show-current 2>nul");
-  fp = _popen(cmd, "r");
-  if (!fp) {
-    return 0;
+  // Check if tracked files differ from the index
+  if (is_dirty) {
+    *is_dirty = (git_index_is_dirty(&repo) == 1);
   }
 
-  // Read the branch name
-  if (fgets(branch_name, buffer_size, fp)) {
-    // Remove newline
-    size_t len = strlen(branch_name);
-    if (len > 0 && branch_name[len - 1] == '\n') {
-      branch_name[len - 1] = '\0';
-    }
-    status = 1;
-  }
-
-  _pclose(fp);
-
-  // If branch name is empty, we might be in a detached HEAD state
-  if (status && strlen(branch_name) == 0) {
-    // Get the current commit hash instead
-    snprintf(cmd, sizeof(cmd), "git rev-parse --short HEAD 2>nul");
-    fp = _popen(cmd, "r");
-    if (fp) {
-      if (fgets(branch_name, buffer_size, fp)) {
-        // Remove newline
-        size_t len = strlen(branch_name);
-        if (len > 0 && branch_name[len - 1] == '\n') {
-          branch_name[len - 1] = '\0';
-        }
-        // Format for detached HEAD state
-        char temp[buffer_size];
-        snprintf(temp, buffer_size, "detached:%s", branch_name);
-        strncpy(branch_name, temp, buffer_size - 1);
-        branch_name[buffer_size - 1] = '\0';
-      }
-      _pclose(fp);
-    }
+  return 1;
+}
+
+/**
+ * Check if the current directory is in a Git repository and get branch info
+ */
+int get_git_branch(char *branch_name, size_t buffer_size, int *is_dirty) {
+  return get_git_branch_in(NULL, branch_name, buffer_size, is_dirty);
+}
+
+/**
+ * Get the name of the Git repository containing a directory
+ */
+static int get_git_repo_name_in(const char *dir, char *repo_name,
+                                size_t buffer_size) {
+  GitRepo repo;
+
+  // Initialize output parameter
+  if (repo_name && buffer_size > 0) {
+    repo_name[0] = '\0';
   }
 
-  // Check if repo has uncommitted changes
-  if (is_dirty && status) {
-    snprintf(cmd, sizeof(cmd), "git status --porcelain 2>nul");
-    fp = _popen(cmd, "r");
-    if (fp) {
-      // If there's any output, the repo has changes
-      char dirty_check[10];
-      *is_dirty = (fgets(dirty_check, sizeof(dirty_check), fp) != NULL);
-      _pclose(fp);
-    }
+  if (!git_repo_open(dir, &repo) || repo.name[0] == '\0') {
+    return 0;
   }
 
-  return status;
+  snprintf(repo_name, buffer_size, "%s", repo.name);
+  return 1;
 }
 
 /**
@@ -109,45 +79,129 @@ int get_git_branch(char *branch_name, size_t buffer_size, int *is_dirty) {
  * @return 1 if successful, 0 otherwise
  */
 int get_git_repo_name(char *repo_name, size_t buffer_size) {
-  char cmd[1024] = "";
-  FILE *fp;
-  int status = 0;
+  return get_git_repo_name_in(NULL, repo_name, buffer_size);
+}
 
-  // Initialize output parameter
-  if (repo_name && buffer_size > 0) {
-    repo_name[0] = '\0';
+/**
+ * Get the web URL of the origin remote of the repository containing a
+ * directory
+ */
+static int get_git_remote_url_in(const char *dir, char *url,
+                                 size_t buffer_size) {
+  char origin_url[1024] = "";
+  GitRepo repo;
+
+  if (url && buffer_size > 0) {
+    url[0] = '\0';
   }
 
-  // Get the path to the root of the Git repository
-  snprintf(cmd, sizeof(cmd), "git rev-parse --show-toplevel 2>nul");
-  fp = _popen(cmd, "r");
-  if (!fp) {
+  if (!git_repo_open(dir, &repo) || repo.origin_url[0] == '\0') {
     return 0;
   }
+  snprintf(origin_url, sizeof(origin_url), "%s", repo.origin_url);
 
-  char git_dir[1024] = "";
-  if (fgets(git_dir, sizeof(git_dir), fp)) {
-    // Remove newline
-    size_t len = strlen(git_dir);
-    if (len > 0 && git_dir[len - 1] == '\n') {
-      git_dir[len - 1] = '\0';
-    }
+  if (strncmp(origin_url, "git@", 4) == 0) {
+    // SSH format: git@github.com:username/repo.git
+    char *domain_start = origin_url + 4;
+    char *repo_path = strchr(domain_start, ':');
 
-    // First try backslash (Windows style)
-    char *last_sep = strrchr(git_dir, '\\');
+    if (repo_path) {
+      *repo_path = '\0'; // Terminate the domain part
+      repo_path++;       // Move past the colon
 
-    // If not found, try forward slash (Git/Unix style)
-    if (!last_sep) {
-      last_sep = strrchr(git_dir, '/');
-    }
+      // Remove .git suffix if present
+      char *git_suffix = strstr(repo_path, ".git");
+      if (git_suffix) {
+        *git_suffix = '\0';
+      }
 
-    if (last_sep) {
-      strncpy(repo_name, last_sep + 1, buffer_size - 1);
-      repo_name[buffer_size - 1] = '\0';
-      status = 1;
+      snprintf(url, buffer_size, "https://%s/%s", domain_start, repo_path);
+    } else {
+      // Fallback - just use the original
+      snprintf(url, buffer_size, "%s", origin_url);
     }
+  } else if (strncmp(origin_url, "https://", 8) == 0) {
+    // Already HTTPS URL, just remove .git suffix if present
+    char *git_suffix = strstr(origin_url, ".git");
+    if (git_suffix) {
+      *git_suffix = '\0';
+    }
+    snprintf(url, buffer_size, "%s", origin_url);
+  } else {
+    // Unknown format, use as-is
+    snprintf(url, buffer_size, "%s", origin_url);
+  }
+
+  return url[0] != '\0';
+}
+
+/**
+ * Get the web URL of the repository's origin remote
+ */
+int get_git_remote_url(char *url, size_t buffer_size) {
+  return get_git_remote_url_in(NULL, url, buffer_size);
+}
+
+/**
+ * Get the origin remote URL exactly as configured
+ */
+int get_git_origin_url(char *url, size_t buffer_size) {
+  GitRepo repo;
+
+  if (url && buffer_size > 0) {
+    url[0] = '\0';
+  }
+
+  if (!git_repo_open(NULL, &repo) || repo.origin_url[0] == '\0') {
+    return 0;
+  }
+
+  snprintf(url, buffer_size, "%s", repo.origin_url);
+  return 1;
+}
+
+/**
+ * Get the root directory of the current repository's working tree
+ */
+int get_git_repo_root(char *root, size_t buffer_size) {
+  GitRepo repo;
+
+  if (root && buffer_size > 0) {
+    root[0] = '\0';
+  }
+
+  if (!git_repo_open(NULL, &repo)) {
+    return 0;
+  }
+
+  snprintf(root, buffer_size, "%s", repo.root);
+  return 1;
+}
+
+/**
+ * Get everything the prompt shows for a directory's repository
+ */
+int get_git_prompt_info(const char *dir, char *info, size_t info_size,
+                        char *url, size_t url_size) {
+  char git_branch[64] = "";
+  char git_repo[64] = "";
+  int is_dirty = 0;
+
+  info[0] = '\0';
+  url[0] = '\0';
+
+  if (!get_git_branch_in(dir, git_branch, sizeof(git_branch), &is_dirty)) {
+    return 0;
+  }
+
+  if (get_git_repo_name_in(dir, git_repo, sizeof(git_repo))) {
+    snprintf(info, info_size, " git:(%s%s%s%s)", git_repo,
+             strlen(git_branch) > 0 ? " " : "", git_branch,
+             is_dirty ? "*" : "");
+  } else {
+    snprintf(info, info_size, " git:(%s%s)", git_branch, is_dirty ? "*" : "");
   }
 
-  _pclose(fp);
-  return status;
+  get_git_remote_url_in(dir, url, url_size);
+  return 1;
 }
@@ -13,10 +13,54 @@
  * 
  * @param branch_name Buffer to store branch name if found
  * @param buffer_size Size of the branch_name buffer
- * @param is_dirty Pointer to store dirty status flag (1 if repo has changes)
+ * @param is_dirty Pointer to store dirty status flag (1 if repo has changes),
+ *                 or NULL to skip the (slower) working tree check
  * @return 1 if in a Git repo, 0 otherwise
  */
 int get_git_branch(char *branch_name, size_t buffer_size, int *is_dirty);
 int get_git_repo_name(char *repo_name, size_t buffer_size);
 
+/**
+ * Get the web URL of the repository's origin remote
+ *
+ * SSH remotes (git@host:user/repo.git) are converted to https://host/user/repo
+ * and a trailing .git is removed.
+ *
+ * @param url Buffer to store the URL
+ * @param buffer_size Size of the url buffer
+ * @return 1 if a URL was found, 0 otherwise
+ */
+int get_git_remote_url(char *url, size_t buffer_size);
+
+/**
+ * Get the origin remote URL of the current repository exactly as configured
+ *
+ * @param url Buffer to store the URL
+ * @param buffer_size Size of the url buffer
+ * @return 1 if a URL was found, 0 otherwise
+ */
+int get_git_origin_url(char *url, size_t buffer_size);
+
+/**
+ * Get the root directory of the current repository's working tree
+ *
+ * @param root Buffer to store the path
+ * @param buffer_size Size of the root buffer
+ * @return 1 if in a Git repo, 0 otherwise
+ */
+int get_git_repo_root(char *root, size_t buffer_size);
+
+/**
+ * Get everything the prompt shows for a directory's repository
+ *
+ * @param dir Directory to inspect, or NULL for the current directory
+ * @param info Buffer for the prompt segment, e.g. " git:(repo main*)"
+ * @param info_size Size of the info buffer
+ * @param url Buffer for the repository web URL (empty if there is none)
+ * @param url_size Size of the url buffer
+ * @return 1 if in a Git repo, 0 otherwise
+ */
+int get_git_prompt_info(const char *dir, char *info, size_t info_size,
+                        char *url, size_t url_size);
+
 #endif // GIT_INTEGRATION_H
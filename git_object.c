@@ -0,0 +1,1410 @@
+/**
+ * git_object.c
+ * Implementation of the object database reader and commit graph walks
+ */
+
+#include "git_object.h"
+#include "inflate.h"
+#include "mapped_file.h"
+
+#define DELTA_CACHE_ENTRIES 64
+#define DELTA_CACHE_MAX_BYTES (16 * 1024 * 1024)
+#define MAX_DELTA_CHAIN 10000
+#define MAX_REF_DELTA_DEPTH 50
+#define MAX_COMMIT_PARENTS 64
+#define WALK_LIMIT 1000000
+
+// Pack entry types besides the four object types
+#define PACK_OFS_DELTA 6
+#define PACK_REF_DELTA 7
+
+// Commit-graph parent encoding
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_EXTRA_EDGES 0x80000000
+#define GRAPH_LAST_EDGE 0x80000000
+#define GRAPH_DATA_WIDTH (GIT_OID_RAW_LEN + 16)
+
+// Walk flags
+#define WALK_LOCAL 1
+#define WALK_UPSTREAM 2
+#define WALK_BOTH (WALK_LOCAL | WALK_UPSTREAM)
+
+typedef struct {
+  char pack_path[MAX_PATH];
+  MappedFile idx;
+  MappedFile pack; // Mapped the first time an object in it is read
+  int pack_failed;
+  int version;
+  unsigned int count;
+  const unsigned char *fanout;
+  const unsigned char *oids; // v2: 20 byte ids; v1: 4 byte offset + id
+  const unsigned char *offsets;
+  const unsigned char *large_offsets;
+  size_t large_offset_count;
+} PackFile;
+
+// A resolved object kept because later deltas are likely to need it
+typedef struct {
+  int pack;
+  size_t offset;
+  GitObjectType type;
+  unsigned char *data;
+  size_t size;
+  unsigned long long last_used;
+} DeltaBase;
+
+typedef struct {
+  MappedFile file;
+  unsigned int count; // 0 when the repository has no commit-graph
+  const unsigned char *fanout;
+  const unsigned char *oids;
+  const unsigned char *commit_data;
+  const unsigned char *extra_edges;
+  size_t extra_edge_count;
+} CommitGraph;
+
+struct GitObjectDb {
+  char objects_dir[MAX_PATH];
+  PackFile *packs;
+  int pack_count;
+  DeltaBase delta_cache[DELTA_CACHE_ENTRIES];
+  size_t delta_cache_bytes;
+  unsigned long long delta_clock;
+  CommitGraph graph;
+};
+
+// What a graph walk needs to know about a commit
+typedef struct {
+  unsigned char tree[GIT_OID_RAW_LEN];
+  unsigned char parents[MAX_COMMIT_PARENTS][GIT_OID_RAW_LEN];
+  int parent_count;
+  long long time;
+} CommitInfo;
+
+typedef struct {
+  unsigned char oid[GIT_OID_RAW_LEN];
+  long long time;
+  int flags;
+  int missing; // Not in the repository (shallow clone boundary)
+  int parents_start; // Index into CommitWalk.parents
+  int parent_count;
+} WalkNode;
+
+typedef struct {
+  int node;
+  int counted; // Whether it was still interesting when queued
+} WalkQueueEntry;
+
+// Commits seen by a walk, plus a queue of those still to visit ordered
+// newest first
+typedef struct {
+  GitObjectDb *db;
+  WalkNode *nodes;
+  int count;
+  int capacity;
+  int *slots; // Open addressing table of node index + 1
+  int slot_count;
+  unsigned char (*parents)[GIT_OID_RAW_LEN];
+  int parent_total;
+  int parent_capacity;
+  WalkQueueEntry *queue;
+  int queue_count;
+  int queue_capacity;
+} CommitWalk;
+
+static unsigned int read_be32(const unsigned char *p) {
+  return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+         ((unsigned int)p[2] << 8) | p[3];
+}
+
+static unsigned long long read_be64(const unsigned char *p) {
+  return ((unsigned long long)read_be32(p) << 32) | read_be32(p + 4);
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * Convert a 40 character hex id to its 20 byte form
+ */
+int git_oid_from_hex(const char *hex, unsigned char oid[GIT_OID_RAW_LEN]) {
+  for (int i = 0; i < GIT_OID_RAW_LEN; i++) {
+    int high = hex_value(hex[i * 2]);
+    int low = high < 0 ? -1 : hex_value(hex[i * 2 + 1]);
+    if (low < 0) {
+      return 0;
+    }
+    oid[i] = (unsigned char)((high << 4) | low);
+  }
+  return 1;
+}
+
+/**
+ * Convert a 20 byte id to hex
+ */
+void git_oid_to_hex(const unsigned char oid[GIT_OID_RAW_LEN],
+                    char hex[GIT_OID_HEX_LEN + 1]) {
+  static const char digits[] = "0123456789abcdef";
+  for (int i = 0; i < GIT_OID_RAW_LEN; i++) {
+    hex[i * 2] = digits[oid[i] >> 4];
+    hex[i * 2 + 1] = digits[oid[i] & 15];
+  }
+  hex[GIT_OID_HEX_LEN] = '\0';
+}
+
+/**
+ * Locate the tables of a mapped .idx file (version 1 or 2)
+ */
+static int parse_pack_index(PackFile *pack) {
+  const unsigned char *data = pack->idx.data;
+  size_t size = pack->idx.size;
+  const size_t trailer = 2 * GIT_OID_RAW_LEN;
+
+  if (size >= 8 && memcmp(data, "\377tOc", 4) == 0) {
+    if (read_be32(data + 4) != 2 || size < 8 + 1024 + trailer) {
+      return 0;
+    }
+    pack->version = 2;
+    pack->fanout = data + 8;
+    pack->count = read_be32(pack->fanout + 255 * 4);
+
+    // Ids, CRCs, 32-bit offsets, then the 64-bit offset table
+    size_t tables = (size_t)pack->count * (GIT_OID_RAW_LEN + 4 + 4);
+    if (size < 8 + 1024 + tables + trailer) {
+      return 0;
+    }
+    pack->oids = pack->fanout + 1024;
+    pack->offsets = pack->oids + (size_t)pack->count * (GIT_OID_RAW_LEN + 4);
+    pack->large_offsets = pack->offsets + (size_t)pack->count * 4;
+    pack->large_offset_count =
+        (size - trailer - (pack->large_offsets - data)) / 8;
+    return 1;
+  }
+
+  // Version 1 has no header: fanout, then offset + id pairs
+  if (size < 1024 + trailer) {
+    return 0;
+  }
+  pack->version = 1;
+  pack->fanout = data;
+  pack->count = read_be32(pack->fanout + 255 * 4);
+  if (size < 1024 + (size_t)pack->count * (4 + GIT_OID_RAW_LEN) + trailer) {
+    return 0;
+  }
+  pack->oids = data + 1024;
+  return 1;
+}
+
+static const unsigned char *pack_oid(const PackFile *pack, unsigned int i) {
+  if (pack->version == 2) {
+    return pack->oids + (size_t)i * GIT_OID_RAW_LEN;
+  }
+  return pack->oids + (size_t)i * (4 + GIT_OID_RAW_LEN) + 4;
+}
+
+static unsigned long long pack_offset(const PackFile *pack, unsigned int i) {
+  if (pack->version == 1) {
+    return read_be32(pack->oids + (size_t)i * (4 + GIT_OID_RAW_LEN));
+  }
+
+  unsigned int offset = read_be32(pack->offsets + (size_t)i * 4);
+  if (!(offset & 0x80000000)) {
+    return offset;
+  }
+
+  // Packs over 2 GB keep large offsets in a separate table
+  offset &= 0x7FFFFFFF;
+  if (offset >= pack->large_offset_count) {
+    return (unsigned long long)-1;
+  }
+  return read_be64(pack->large_offsets + (size_t)offset * 8);
+}
+
+/**
+ * Binary search a pack index, narrowed by the fanout table
+ */
+static int pack_find(const PackFile *pack, const unsigned char *oid,
+                     unsigned long long *offset) {
+  unsigned int low = oid[0] ? read_be32(pack->fanout + (oid[0] - 1) * 4) : 0;
+  unsigned int high = read_be32(pack->fanout + oid[0] * 4);
+  if (high > pack->count) {
+    high = pack->count;
+  }
+
+  while (low < high) {
+    unsigned int mid = low + (high - low) / 2;
+    int cmp = memcmp(oid, pack_oid(pack, mid), GIT_OID_RAW_LEN);
+    if (cmp == 0) {
+      *offset = pack_offset(pack, mid);
+      return 1;
+    }
+    if (cmp < 0) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return 0;
+}
+
+static int ensure_pack_mapped(PackFile *pack) {
+  if (pack->pack.data) {
+    return 1;
+  }
+  if (pack->pack_failed) {
+    return 0;
+  }
+
+  if (!map_file(pack->pack_path, &pack->pack) ||
+      pack->pack.size < 12 + GIT_OID_RAW_LEN ||
+      memcmp(pack->pack.data, "PACK", 4) != 0) {
+    unmap_file(&pack->pack);
+    pack->pack_failed = 1;
+    return 0;
+  }
+  return 1;
+}
+
+static void load_packs(GitObjectDb *db) {
+  char pattern[MAX_PATH];
+  WIN32_FIND_DATA find_data;
+
+  snprintf(pattern, sizeof(pattern), "%s\\pack\\*.idx", db->objects_dir);
+  HANDLE find = FindFirstFile(pattern, &find_data);
+  if (find == INVALID_HANDLE_VALUE) {
+    return;
+  }
+
+  do {
+    PackFile *grown = (PackFile *)realloc(
+        db->packs, (db->pack_count + 1) * sizeof(PackFile));
+    if (!grown) {
+      break;
+    }
+    db->packs = grown;
+
+    PackFile *pack = &db->packs[db->pack_count];
+    char idx_path[MAX_PATH];
+    memset(pack, 0, sizeof(*pack));
+    snprintf(idx_path, sizeof(idx_path), "%s\\pack\\%s", db->objects_dir,
+             find_data.cFileName);
+
+    size_t base_length = strlen(idx_path) - 4; // Strip ".idx"
+    snprintf(pack->pack_path, sizeof(pack->pack_path), "%.*s.pack",
+             (int)base_length, idx_path);
+
+    if (map_file(idx_path, &pack->idx) && parse_pack_index(pack)) {
+      db->pack_count++;
+    } else {
+      unmap_file(&pack->idx);
+    }
+  } while (FindNextFile(find, &find_data));
+
+  FindClose(find);
+}
+
+/**
+ * Map objects/info/commit-graph. Split graph chains are not read; commits
+ * missing from the graph are parsed from their objects instead.
+ */
+static void load_commit_graph(GitObjectDb *db) {
+  char path[MAX_PATH];
+  CommitGraph *graph = &db->graph;
+
+  snprintf(path, sizeof(path), "%s\\info\\commit-graph", db->objects_dir);
+  if (!map_file(path, &graph->file)) {
+    return;
+  }
+
+  const unsigned char *data = graph->file.data;
+  size_t size = graph->file.size;
+  if (size < 8 || memcmp(data, "CGPH", 4) != 0 || data[4] != 1 ||
+      data[5] != 1) {
+    unmap_file(&graph->file);
+    return;
+  }
+
+  int chunk_count = data[6];
+  if (size < 8 + (size_t)(chunk_count + 1) * 12) {
+    unmap_file(&graph->file);
+    return;
+  }
+
+  size_t edge_size = 0;
+  for (int i = 0; i < chunk_count; i++) {
+    const unsigned char *entry = data + 8 + i * 12;
+    unsigned long long start = read_be64(entry + 4);
+    unsigned long long end = read_be64(entry + 16);
+    if (start > end || end > size) {
+      unmap_file(&graph->file);
+      return;
+    }
+
+    if (memcmp(entry, "OIDF", 4) == 0 && end - start >= 1024) {
+      graph->fanout = data + start;
+    } else if (memcmp(entry, "OIDL", 4) == 0) {
+      graph->oids = data + start;
+    } else if (memcmp(entry, "CDAT", 4) == 0) {
+      graph->commit_data = data + start;
+    } else if (memcmp(entry, "EDGE", 4) == 0) {
+      graph->extra_edges = data + start;
+      edge_size = (size_t)(end - start);
+    }
+  }
+
+  if (!graph->fanout || !graph->oids || !graph->commit_data) {
+    unmap_file(&graph->file);
+    return;
+  }
+
+  graph->count = read_be32(graph->fanout + 255 * 4);
+  graph->extra_edge_count = edge_size / 4;
+  size_t end_of_data =
+      (graph->commit_data - data) + (size_t)graph->count * GRAPH_DATA_WIDTH;
+  size_t end_of_oids =
+      (graph->oids - data) + (size_t)graph->count * GIT_OID_RAW_LEN;
+  if (end_of_data > size || end_of_oids > size) {
+    graph->count = 0;
+    unmap_file(&graph->file);
+  }
+}
+
+/**
+ * Open a repository's object database
+ */
+GitObjectDb *git_odb_open(const GitRepo *repo) {
+  GitObjectDb *db = (GitObjectDb *)calloc(1, sizeof(GitObjectDb));
+  if (!db) {
+    return NULL;
+  }
+
+  snprintf(db->objects_dir, sizeof(db->objects_dir), "%s\\objects",
+           repo->common_dir);
+  load_packs(db);
+  load_commit_graph(db);
+  return db;
+}
+
+/**
+ * Close an object database and unmap its files
+ */
+void git_odb_close(GitObjectDb *db) {
+  if (!db) {
+    return;
+  }
+
+  for (int i = 0; i < db->pack_count; i++) {
+    unmap_file(&db->packs[i].idx);
+    unmap_file(&db->packs[i].pack);
+  }
+  free(db->packs);
+
+  for (int i = 0; i < DELTA_CACHE_ENTRIES; i++) {
+    free(db->delta_cache[i].data);
+  }
+  unmap_file(&db->graph.file);
+  free(db);
+}
+
+static DeltaBase *delta_cache_find(GitObjectDb *db, int pack, size_t offset) {
+  for (int i = 0; i < DELTA_CACHE_ENTRIES; i++) {
+    DeltaBase *entry = &db->delta_cache[i];
+    if (entry->data && entry->pack == pack && entry->offset == offset) {
+      entry->last_used = ++db->delta_clock;
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void delta_cache_evict(GitObjectDb *db, DeltaBase *entry) {
+  db->delta_cache_bytes -= entry->size;
+  free(entry->data);
+  entry->data = NULL;
+}
+
+/**
+ * Keep a copy of a delta base, evicting the least recently used bases to
+ * stay within the size budget
+ */
+static void delta_cache_store(GitObjectDb *db, int pack, size_t offset,
+                              GitObjectType type, const unsigned char *data,
+                              size_t size) {
+  if (size > DELTA_CACHE_MAX_BYTES / 4 || delta_cache_find(db, pack, offset)) {
+    return;
+  }
+
+  for (;;) {
+    DeltaBase *free_slot = NULL;
+    DeltaBase *oldest = NULL;
+    for (int i = 0; i < DELTA_CACHE_ENTRIES; i++) {
+      DeltaBase *entry = &db->delta_cache[i];
+      if (!entry->data) {
+        free_slot = entry;
+      } else if (!oldest || entry->last_used < oldest->last_used) {
+        oldest = entry;
+      }
+    }
+
+    if (free_slot && db->delta_cache_bytes + size <= DELTA_CACHE_MAX_BYTES) {
+      free_slot->data = (unsigned char *)malloc(size + 1);
+      if (!free_slot->data) {
+        return;
+      }
+      memcpy(free_slot->data, data, size + 1);
+      free_slot->pack = pack;
+      free_slot->offset = offset;
+      free_slot->type = type;
+      free_slot->size = size;
+      free_slot->last_used = ++db->delta_clock;
+      db->delta_cache_bytes += size;
+      return;
+    }
+    if (!oldest) {
+      return;
+    }
+    delta_cache_evict(db, oldest);
+  }
+}
+
+// A parsed pack entry header
+typedef struct {
+  int type;
+  size_t size;                   // Inflated size (of the delta, for deltas)
+  size_t data_offset;            // Start of the zlib stream
+  size_t base_offset;            // OFS_DELTA base
+  const unsigned char *base_oid; // REF_DELTA base
+} PackEntry;
+
+static int parse_pack_entry(const PackFile *pack, size_t offset,
+                            PackEntry *entry) {
+  const unsigned char *data = pack->pack.data;
+  size_t end = pack->pack.size - GIT_OID_RAW_LEN;
+  size_t pos = offset;
+
+  if (offset < 12 || offset >= end) {
+    return 0;
+  }
+
+  // Type and size: 3 bits of type, then the size 4 + 7n bits at a time
+  unsigned char c = data[pos++];
+  unsigned long long size = c & 15;
+  int shift = 4;
+  entry->type = (c >> 4) & 7;
+  while (c & 0x80) {
+    if (pos >= end || shift > 57) {
+      return 0;
+    }
+    c = data[pos++];
+    size |= (unsigned long long)(c & 0x7F) << shift;
+    shift += 7;
+  }
+  if (size > (SIZE_T)-1 / 2) {
+    return 0;
+  }
+  entry->size = (size_t)size;
+  entry->base_oid = NULL;
+
+  if (entry->type == PACK_OFS_DELTA) {
+    // Big-endian distance back to the base, with an implicit +1 per byte
+    if (pos >= end) {
+      return 0;
+    }
+    c = data[pos++];
+    size_t distance = c & 127;
+    while (c & 128) {
+      if (pos >= end || distance > ((SIZE_T)-1 >> 8)) {
+        return 0;
+      }
+      c = data[pos++];
+      distance = ((distance + 1) << 7) | (c & 127);
+    }
+    if (distance == 0 || distance > offset) {
+      return 0;
+    }
+    entry->base_offset = offset - distance;
+  } else if (entry->type == PACK_REF_DELTA) {
+    if (pos + GIT_OID_RAW_LEN > end) {
+      return 0;
+    }
+    entry->base_oid = data + pos;
+    pos += GIT_OID_RAW_LEN;
+  } else if (entry->type < GIT_OBJECT_COMMIT || entry->type > GIT_OBJECT_TAG) {
+    return 0;
+  }
+
+  entry->data_offset = pos;
+  return 1;
+}
+
+static unsigned char *inflate_pack_entry(const PackFile *pack,
+                                         const PackEntry *entry) {
+  size_t size;
+  unsigned char *data =
+      inflate_zlib(pack->pack.data + entry->data_offset,
+                   pack->pack.size - entry->data_offset, entry->size, &size,
+                   NULL);
+  if (data && size != entry->size) {
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+static size_t read_delta_size(const unsigned char **p,
+                              const unsigned char *end) {
+  size_t size = 0;
+  int shift = 0;
+  while (*p < end && shift < 64) {
+    unsigned char c = *(*p)++;
+    size |= (size_t)(c & 0x7F) << shift;
+    shift += 7;
+    if (!(c & 0x80)) {
+      break;
+    }
+  }
+  return size;
+}
+
+/**
+ * Rebuild an object from its base and a delta of copy/insert instructions
+ */
+static unsigned char *apply_delta(const unsigned char *base, size_t base_size,
+                                  const unsigned char *delta,
+                                  size_t delta_size, size_t *out_size) {
+  const unsigned char *p = delta;
+  const unsigned char *end = delta + delta_size;
+
+  if (read_delta_size(&p, end) != base_size) {
+    return NULL;
+  }
+  size_t result_size = read_delta_size(&p, end);
+  unsigned char *result = (unsigned char *)malloc(result_size + 1);
+  if (!result) {
+    return NULL;
+  }
+
+  size_t pos = 0;
+  while (p < end) {
+    unsigned char command = *p++;
+
+    if (command & 0x80) {
+      // Copy from the base; bits 0-3 select offset bytes, 4-6 size bytes
+      size_t copy_offset = 0;
+      size_t copy_size = 0;
+      for (int i = 0; i < 4; i++) {
+        if (command & (1 << i)) {
+          if (p >= end) {
+            goto corrupt;
+          }
+          copy_offset |= (size_t)*p++ << (i * 8);
+        }
+      }
+      for (int i = 0; i < 3; i++) {
+        if (command & (0x10 << i)) {
+          if (p >= end) {
+            goto corrupt;
+          }
+          copy_size |= (size_t)*p++ << (i * 8);
+        }
+      }
+      if (copy_size == 0) {
+        copy_size = 0x10000;
+      }
+      if (copy_offset > base_size || copy_size > base_size - copy_offset ||
+          copy_size > result_size - pos) {
+        goto corrupt;
+      }
+      memcpy(result + pos, base + copy_offset, copy_size);
+      pos += copy_size;
+    } else if (command) {
+      // Insert the next command bytes literally
+      if (command > (size_t)(end - p) || command > result_size - pos) {
+        goto corrupt;
+      }
+      memcpy(result + pos, p, command);
+      p += command;
+      pos += command;
+    } else {
+      goto corrupt; // Reserved
+    }
+  }
+
+  if (pos != result_size) {
+    goto corrupt;
+  }
+  result[pos] = '\0';
+  *out_size = pos;
+  return result;
+
+corrupt:
+  free(result);
+  return NULL;
+}
+
+static unsigned char *read_object(GitObjectDb *db, const unsigned char *oid,
+                                  GitObjectType *type, size_t *size,
+                                  int depth);
+
+/**
+ * Read the object at an offset in a pack, resolving its delta chain
+ */
+static unsigned char *read_pack_object(GitObjectDb *db, int pack_index,
+                                       size_t offset, GitObjectType *type,
+                                       size_t *size, int depth) {
+  PackFile *pack = &db->packs[pack_index];
+  if (!ensure_pack_mapped(pack)) {
+    return NULL;
+  }
+
+  // Walk down the chain until a base that is cached or stored whole,
+  // remembering the deltas passed on the way
+  size_t *chain = NULL;
+  int chain_count = 0;
+  int chain_capacity = 0;
+  unsigned char *base = NULL;
+  size_t base_size = 0;
+  GitObjectType base_type = GIT_OBJECT_NONE;
+  size_t base_offset = offset;
+  int base_in_pack = 1;
+
+  for (;;) {
+    DeltaBase *cached = delta_cache_find(db, pack_index, base_offset);
+    if (cached) {
+      base = (unsigned char *)malloc(cached->size + 1);
+      if (!base) {
+        goto fail;
+      }
+      memcpy(base, cached->data, cached->size + 1);
+      base_size = cached->size;
+      base_type = cached->type;
+      break;
+    }
+
+    PackEntry entry;
+    if (!parse_pack_entry(pack, base_offset, &entry)) {
+      goto fail;
+    }
+
+    if (entry.type != PACK_OFS_DELTA && entry.type != PACK_REF_DELTA) {
+      base = inflate_pack_entry(pack, &entry);
+      if (!base) {
+        goto fail;
+      }
+      base_size = entry.size;
+      base_type = (GitObjectType)entry.type;
+      break;
+    }
+
+    if (chain_count == chain_capacity) {
+      if (chain_capacity >= MAX_DELTA_CHAIN) {
+        goto fail;
+      }
+      chain_capacity = chain_capacity ? chain_capacity * 2 : 16;
+      size_t *grown = (size_t *)realloc(chain, chain_capacity * sizeof(size_t));
+      if (!grown) {
+        goto fail;
+      }
+      chain = grown;
+    }
+    chain[chain_count++] = base_offset;
+
+    if (entry.type == PACK_OFS_DELTA) {
+      base_offset = entry.base_offset;
+      continue;
+    }
+
+    // A REF_DELTA base may be anywhere, even in another pack
+    if (depth >= MAX_REF_DELTA_DEPTH) {
+      goto fail;
+    }
+    base = read_object(db, entry.base_oid, &base_type, &base_size, depth + 1);
+    if (!base) {
+      goto fail;
+    }
+    base_in_pack = 0;
+    break;
+  }
+
+  // Apply the deltas from the base outwards, caching each base on the way
+  for (int i = chain_count - 1; i >= 0; i--) {
+    PackEntry entry;
+    if (!parse_pack_entry(pack, chain[i], &entry)) {
+      goto fail;
+    }
+
+    if (base_in_pack) {
+      delta_cache_store(db, pack_index, base_offset, base_type, base,
+                        base_size);
+    }
+
+    unsigned char *delta = inflate_pack_entry(pack, &entry);
+    if (!delta) {
+      goto fail;
+    }
+    size_t result_size;
+    unsigned char *result =
+        apply_delta(base, base_size, delta, entry.size, &result_size);
+    free(delta);
+    free(base);
+    base = result;
+    if (!base) {
+      goto fail;
+    }
+    base_size = result_size;
+    base_offset = chain[i];
+    base_in_pack = 1;
+  }
+
+  free(chain);
+  *type = base_type;
+  *size = base_size;
+  return base;
+
+fail:
+  free(chain);
+  free(base);
+  return NULL;
+}
+
+/**
+ * Read a loose object from objects/xx/yyyy...
+ */
+static unsigned char *read_loose_object(GitObjectDb *db,
+                                        const unsigned char *oid,
+                                        GitObjectType *type, size_t *size) {
+  char hex[GIT_OID_HEX_LEN + 1];
+  char path[MAX_PATH];
+  MappedFile file;
+
+  git_oid_to_hex(oid, hex);
+  snprintf(path, sizeof(path), "%s\\%.2s\\%s", db->objects_dir, hex, hex + 2);
+  if (!map_file(path, &file)) {
+    return NULL;
+  }
+
+  size_t raw_size;
+  unsigned char *raw =
+      inflate_zlib(file.data, file.size, 0, &raw_size, NULL);
+  unmap_file(&file);
+  if (!raw) {
+    return NULL;
+  }
+
+  // "<type> <size>\0<content>"
+  static const char *type_names[] = {NULL, "commit", "tree", "blob", "tag"};
+  unsigned char *nul = (unsigned char *)memchr(raw, '\0', raw_size);
+  char *space = (char *)memchr(raw, ' ', raw_size);
+  *type = GIT_OBJECT_NONE;
+  if (nul && space && (unsigned char *)space < nul) {
+    for (int i = GIT_OBJECT_COMMIT; i <= GIT_OBJECT_TAG; i++) {
+      size_t name_length = strlen(type_names[i]);
+      if ((size_t)(space - (char *)raw) == name_length &&
+          memcmp(raw, type_names[i], name_length) == 0) {
+        *type = (GitObjectType)i;
+      }
+    }
+  }
+
+  size_t header_length = nul ? (size_t)(nul - raw) + 1 : 0;
+  if (*type == GIT_OBJECT_NONE ||
+      strtoull(space + 1, NULL, 10) != raw_size - header_length) {
+    free(raw);
+    return NULL;
+  }
+
+  *size = raw_size - header_length;
+  memmove(raw, raw + header_length, *size + 1);
+  return raw;
+}
+
+static unsigned char *read_object(GitObjectDb *db, const unsigned char *oid,
+                                  GitObjectType *type, size_t *size,
+                                  int depth) {
+  for (int i = 0; i < db->pack_count; i++) {
+    unsigned long long offset;
+    if (pack_find(&db->packs[i], oid, &offset)) {
+      if (offset > (SIZE_T)-1) {
+        return NULL;
+      }
+      unsigned char *data =
+          read_pack_object(db, i, (size_t)offset, type, size, depth);
+      if (data) {
+        return data;
+      }
+    }
+  }
+  return read_loose_object(db, oid, type, size);
+}
+
+/**
+ * Read an object, resolving pack deltas
+ */
+unsigned char *git_odb_read(GitObjectDb *db,
+                            const unsigned char oid[GIT_OID_RAW_LEN],
+                            GitObjectType *type, size_t *size) {
+  return read_object(db, oid, type, size, 0);
+}
+
+static int graph_find(const CommitGraph *graph, const unsigned char *oid,
+                      unsigned int *position) {
+  if (graph->count == 0) {
+    return 0;
+  }
+
+  unsigned int low = oid[0] ? read_be32(graph->fanout + (oid[0] - 1) * 4) : 0;
+  unsigned int high = read_be32(graph->fanout + oid[0] * 4);
+  if (high > graph->count) {
+    high = graph->count;
+  }
+
+  while (low < high) {
+    unsigned int mid = low + (high - low) / 2;
+    int cmp = memcmp(oid, graph->oids + (size_t)mid * GIT_OID_RAW_LEN,
+                     GIT_OID_RAW_LEN);
+    if (cmp == 0) {
+      *position = mid;
+      return 1;
+    }
+    if (cmp < 0) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return 0;
+}
+
+static int graph_add_parent(const CommitGraph *graph, unsigned int position,
+                            CommitInfo *info) {
+  if (position >= graph->count) {
+    return 0;
+  }
+  if (info->parent_count < MAX_COMMIT_PARENTS) {
+    memcpy(info->parents[info->parent_count++],
+           graph->oids + (size_t)position * GIT_OID_RAW_LEN, GIT_OID_RAW_LEN);
+  }
+  return 1;
+}
+
+/**
+ * Read a commit's tree, parents and time from the commit-graph
+ */
+static int graph_lookup(const CommitGraph *graph, const unsigned char *oid,
+                        CommitInfo *info) {
+  unsigned int position;
+  if (!graph_find(graph, oid, &position)) {
+    return 0;
+  }
+
+  const unsigned char *data =
+      graph->commit_data + (size_t)position * GRAPH_DATA_WIDTH;
+  unsigned int parent1 = read_be32(data + GIT_OID_RAW_LEN);
+  unsigned int parent2 = read_be32(data + GIT_OID_RAW_LEN + 4);
+
+  memcpy(info->tree, data, GIT_OID_RAW_LEN);
+  info->parent_count = 0;
+  // Low 34 bits of the last 8 bytes; the rest is the generation number
+  info->time = ((long long)(read_be32(data + GIT_OID_RAW_LEN + 8) & 3) << 32) |
+               read_be32(data + GIT_OID_RAW_LEN + 12);
+
+  if (parent1 != GRAPH_PARENT_NONE && !graph_add_parent(graph, parent1, info)) {
+    return 0;
+  }
+  if (parent2 == GRAPH_PARENT_NONE) {
+    return 1;
+  }
+  if (!(parent2 & GRAPH_EXTRA_EDGES)) {
+    return graph_add_parent(graph, parent2, info);
+  }
+
+  // Octopus merge: the rest of the parents are listed in the EDGE chunk
+  for (size_t edge = parent2 & ~GRAPH_EXTRA_EDGES;
+       edge < graph->extra_edge_count; edge++) {
+    unsigned int value = read_be32(graph->extra_edges + edge * 4);
+    if (!graph_add_parent(graph, value & ~GRAPH_LAST_EDGE, info)) {
+      return 0;
+    }
+    if (value & GRAPH_LAST_EDGE) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Parse the headers of a commit object, and optionally its author and
+ * subject line
+ */
+static int parse_commit(const char *data, size_t size, CommitInfo *info,
+                        GitCommitSummary *summary) {
+  const char *p = data;
+  const char *end = data + size;
+  int has_tree = 0;
+
+  info->parent_count = 0;
+  info->time = 0;
+  if (summary) {
+    summary->author[0] = '\0';
+    summary->subject[0] = '\0';
+  }
+
+  while (p < end && *p != '\n') {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (!eol) {
+      eol = end;
+    }
+
+    if (strncmp(p, "tree ", 5) == 0) {
+      has_tree = git_oid_from_hex(p + 5, info->tree);
+    } else if (strncmp(p, "parent ", 7) == 0) {
+      if (info->parent_count < MAX_COMMIT_PARENTS &&
+          git_oid_from_hex(p + 7, info->parents[info->parent_count])) {
+        info->parent_count++;
+      }
+    } else if (strncmp(p, "author ", 7) == 0 && summary) {
+      // "author Name <email> time zone"
+      const char *name = p + 7;
+      const char *name_end = (const char *)memchr(name, '<', eol - name);
+      if (!name_end) {
+        name_end = eol;
+      }
+      while (name_end > name && name_end[-1] == ' ') {
+        name_end--;
+      }
+      snprintf(summary->author, sizeof(summary->author), "%.*s",
+               (int)(name_end - name), name);
+    } else if (strncmp(p, "committer ", 10) == 0) {
+      const char *email_end = p;
+      for (const char *q = p; q < eol; q++) {
+        if (*q == '>') {
+          email_end = q;
+        }
+      }
+      if (email_end > p) {
+        info->time = strtoll(email_end + 1, NULL, 10);
+      }
+    }
+
+    p = eol + 1;
+  }
+
+  if (summary && p < end) {
+    // The message follows the blank line; its first line is the subject
+    p++;
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (!eol) {
+      eol = end;
+    }
+    snprintf(summary->subject, sizeof(summary->subject), "%.*s",
+             (int)(eol - p), p);
+  }
+
+  return has_tree;
+}
+
+/**
+ * Get a commit's parents and time, from the commit-graph when possible
+ */
+static int lookup_commit(GitObjectDb *db, const unsigned char *oid,
+                         CommitInfo *info) {
+  if (graph_lookup(&db->graph, oid, info)) {
+    return 1;
+  }
+
+  GitObjectType type;
+  size_t size;
+  unsigned char *data = git_odb_read(db, oid, &type, &size);
+  if (!data) {
+    return 0;
+  }
+
+  int ok = type == GIT_OBJECT_COMMIT &&
+           parse_commit((const char *)data, size, info, NULL);
+  free(data);
+  return ok;
+}
+
+/**
+ * Look up the tree a commit points at
+ */
+int git_commit_tree(GitObjectDb *db, const unsigned char commit[GIT_OID_RAW_LEN],
+                    unsigned char tree[GIT_OID_RAW_LEN]) {
+  CommitInfo info;
+  if (!lookup_commit(db, commit, &info)) {
+    return 0;
+  }
+  memcpy(tree, info.tree, GIT_OID_RAW_LEN);
+  return 1;
+}
+
+static void walk_init(CommitWalk *walk, GitObjectDb *db) {
+  memset(walk, 0, sizeof(*walk));
+  walk->db = db;
+}
+
+static void walk_free(CommitWalk *walk) {
+  free(walk->nodes);
+  free(walk->slots);
+  free(walk->parents);
+  free(walk->queue);
+}
+
+static unsigned int oid_hash(const unsigned char *oid) {
+  // Object ids are already uniformly distributed
+  return ((unsigned int)oid[0] << 24) | ((unsigned int)oid[1] << 16) |
+         ((unsigned int)oid[2] << 8) | oid[3];
+}
+
+static int walk_rehash(CommitWalk *walk) {
+  int slot_count = walk->slot_count ? walk->slot_count * 2 : 1024;
+  int *slots = (int *)calloc(slot_count, sizeof(int));
+  if (!slots) {
+    return 0;
+  }
+
+  for (int i = 0; i < walk->count; i++) {
+    unsigned int slot = oid_hash(walk->nodes[i].oid) & (slot_count - 1);
+    while (slots[slot]) {
+      slot = (slot + 1) & (slot_count - 1);
+    }
+    slots[slot] = i + 1;
+  }
+
+  free(walk->slots);
+  walk->slots = slots;
+  walk->slot_count = slot_count;
+  return 1;
+}
+
+/**
+ * Find a commit's node, adding it (and loading its parents) if this walk
+ * has not seen it. Commits that cannot be read, such as the missing
+ * parents in a shallow clone, are treated as roots.
+ *
+ * @return The node index, or -1 on error or when the walk is too large
+ */
+static int walk_add(CommitWalk *walk, const unsigned char *oid,
+                    int *created) {
+  *created = 0;
+  if (walk->count * 2 >= walk->slot_count && !walk_rehash(walk)) {
+    return -1;
+  }
+
+  unsigned int slot = oid_hash(oid) & (walk->slot_count - 1);
+  while (walk->slots[slot]) {
+    int index = walk->slots[slot] - 1;
+    if (memcmp(walk->nodes[index].oid, oid, GIT_OID_RAW_LEN) == 0) {
+      return index;
+    }
+    slot = (slot + 1) & (walk->slot_count - 1);
+  }
+
+  if (walk->count >= WALK_LIMIT) {
+    return -1;
+  }
+  if (walk->count == walk->capacity) {
+    int capacity = walk->capacity ? walk->capacity * 2 : 256;
+    WalkNode *grown =
+        (WalkNode *)realloc(walk->nodes, capacity * sizeof(WalkNode));
+    if (!grown) {
+      return -1;
+    }
+    walk->nodes = grown;
+    walk->capacity = capacity;
+  }
+
+  CommitInfo info;
+  int missing = !lookup_commit(walk->db, oid, &info);
+  if (missing) {
+    info.parent_count = 0;
+    info.time = 0;
+  }
+
+  if (walk->parent_total + info.parent_count > walk->parent_capacity) {
+    int capacity = walk->parent_capacity ? walk->parent_capacity : 256;
+    while (capacity < walk->parent_total + info.parent_count) {
+      capacity *= 2;
+    }
+    unsigned char(*grown)[GIT_OID_RAW_LEN] = realloc(
+        walk->parents, (size_t)capacity * GIT_OID_RAW_LEN);
+    if (!grown) {
+      return -1;
+    }
+    walk->parents = grown;
+    walk->parent_capacity = capacity;
+  }
+
+  WalkNode *node = &walk->nodes[walk->count];
+  memcpy(node->oid, oid, GIT_OID_RAW_LEN);
+  node->time = info.time;
+  node->flags = 0;
+  node->missing = missing;
+  node->parents_start = walk->parent_total;
+  node->parent_count = info.parent_count;
+  memcpy(walk->parents[walk->parent_total], info.parents,
+         (size_t)info.parent_count * GIT_OID_RAW_LEN);
+  walk->parent_total += info.parent_count;
+
+  walk->slots[slot] = walk->count + 1;
+  *created = 1;
+  return walk->count++;
+}
+
+// Newer commits first; ties in the order they were found
+static int queue_before(const CommitWalk *walk, WalkQueueEntry a,
+                        WalkQueueEntry b) {
+  const WalkNode *na = &walk->nodes[a.node];
+  const WalkNode *nb = &walk->nodes[b.node];
+  if (na->time != nb->time) {
+    return na->time > nb->time;
+  }
+  return a.node < b.node;
+}
+
+static int walk_push(CommitWalk *walk, int node, int counted) {
+  if (walk->queue_count == walk->queue_capacity) {
+    int capacity = walk->queue_capacity ? walk->queue_capacity * 2 : 256;
+    WalkQueueEntry *grown = (WalkQueueEntry *)realloc(
+        walk->queue, capacity * sizeof(WalkQueueEntry));
+    if (!grown) {
+      return 0;
+    }
+    walk->queue = grown;
+    walk->queue_capacity = capacity;
+  }
+
+  // Sift up
+  WalkQueueEntry entry = {node, counted};
+  int i = walk->queue_count++;
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!queue_before(walk, entry, walk->queue[parent])) {
+      break;
+    }
+    walk->queue[i] = walk->queue[parent];
+    i = parent;
+  }
+  walk->queue[i] = entry;
+  return 1;
+}
+
+static WalkQueueEntry walk_pop(CommitWalk *walk) {
+  WalkQueueEntry top = walk->queue[0];
+  WalkQueueEntry last = walk->queue[--walk->queue_count];
+
+  // Sift down
+  int i = 0;
+  for (;;) {
+    int child = i * 2 + 1;
+    if (child >= walk->queue_count) {
+      break;
+    }
+    if (child + 1 < walk->queue_count &&
+        queue_before(walk, walk->queue[child + 1], walk->queue[child])) {
+      child++;
+    }
+    if (!queue_before(walk, walk->queue[child], last)) {
+      break;
+    }
+    walk->queue[i] = walk->queue[child];
+    i = child;
+  }
+  if (walk->queue_count > 0) {
+    walk->queue[i] = last;
+  }
+  return top;
+}
+
+/**
+ * Count commits reachable from one commit but not the other
+ */
+int git_ahead_behind(GitObjectDb *db, const unsigned char local[GIT_OID_RAW_LEN],
+                     const unsigned char upstream[GIT_OID_RAW_LEN], int *ahead,
+                     int *behind) {
+  CommitWalk walk;
+  int created;
+  int ok = 0;
+
+  *ahead = 0;
+  *behind = 0;
+  walk_init(&walk, db);
+
+  // Paint commits with the side(s) they are reachable from. Queue entries
+  // reachable from only one side are "interesting"; once none are left,
+  // everything older is reachable from both and cannot change the counts.
+  int local_node = walk_add(&walk, local, &created);
+  int upstream_node = walk_add(&walk, upstream, &created);
+  if (local_node < 0 || upstream_node < 0) {
+    goto done;
+  }
+  walk.nodes[local_node].flags |= WALK_LOCAL;
+  walk.nodes[upstream_node].flags |= WALK_UPSTREAM;
+
+  int interesting = 0;
+  if (!walk_push(&walk, local_node, walk.nodes[local_node].flags != WALK_BOTH)) {
+    goto done;
+  }
+  interesting += walk.nodes[local_node].flags != WALK_BOTH;
+  if (upstream_node != local_node) {
+    if (!walk_push(&walk, upstream_node, 1)) {
+      goto done;
+    }
+    interesting++;
+  }
+
+  while (walk.queue_count > 0 && interesting > 0) {
+    WalkQueueEntry entry = walk_pop(&walk);
+    if (entry.counted) {
+      interesting--;
+    }
+
+    int flags = walk.nodes[entry.node].flags;
+    int start = walk.nodes[entry.node].parents_start;
+    int parent_count = walk.nodes[entry.node].parent_count;
+
+    for (int i = 0; i < parent_count; i++) {
+      int parent = walk_add(&walk, walk.parents[start + i], &created);
+      if (parent < 0) {
+        goto done;
+      }
+      if ((walk.nodes[parent].flags & flags) == flags) {
+        continue; // Nothing new to propagate
+      }
+
+      walk.nodes[parent].flags |= flags;
+      int counted = walk.nodes[parent].flags != WALK_BOTH;
+      if (!walk_push(&walk, parent, counted)) {
+        goto done;
+      }
+      interesting += counted;
+    }
+  }
+
+  for (int i = 0; i < walk.count; i++) {
+    if (walk.nodes[i].missing) {
+      continue;
+    }
+    if (walk.nodes[i].flags == WALK_LOCAL) {
+      (*ahead)++;
+    } else if (walk.nodes[i].flags == WALK_UPSTREAM) {
+      (*behind)++;
+    }
+  }
+  ok = 1;
+
+done:
+  walk_free(&walk);
+  return ok;
+}
+
+/**
+ * Count the commits reachable from a commit
+ */
+int git_count_commits(GitObjectDb *db, const unsigned char head[GIT_OID_RAW_LEN],
+                      int limit) {
+  CommitWalk walk;
+  int created;
+  int result = -1;
+
+  if (limit > WALK_LIMIT) {
+    limit = WALK_LIMIT;
+  }
+
+  walk_init(&walk, db);
+  int node = walk_add(&walk, head, &created);
+  if (node < 0 || !walk_push(&walk, node, 0)) {
+    goto done;
+  }
+
+  while (walk.queue_count > 0 && walk.count < limit) {
+    WalkQueueEntry entry = walk_pop(&walk);
+    int start = walk.nodes[entry.node].parents_start;
+    int parent_count = walk.nodes[entry.node].parent_count;
+
+    for (int i = 0; i < parent_count && walk.count < limit; i++) {
+      int parent = walk_add(&walk, walk.parents[start + i], &created);
+      if (parent < 0) {
+        goto done;
+      }
+      if (created && !walk_push(&walk, parent, 0)) {
+        goto done;
+      }
+    }
+  }
+  result = 0;
+  for (int i = 0; i < walk.count; i++) {
+    result += !walk.nodes[i].missing;
+  }
+
+done:
+  walk_free(&walk);
+  return result;
+}
+
+/**
+ * List the most recent commits reachable from a commit, newest first
+ */
+int git_recent_commits(GitObjectDb *db,
+                       const unsigned char head[GIT_OID_RAW_LEN],
+                       GitCommitSummary *commits, int max) {
+  CommitWalk walk;
+  int created;
+  int listed = -1;
+
+  walk_init(&walk, db);
+  int node = walk_add(&walk, head, &created);
+  if (node < 0 || !walk_push(&walk, node, 0)) {
+    goto done;
+  }
+
+  listed = 0;
+  while (walk.queue_count > 0 && listed < max) {
+    WalkQueueEntry entry = walk_pop(&walk);
+    WalkNode *current = &walk.nodes[entry.node];
+
+    // The graph walk has parents and times only; read the rest from the
+    // commit object
+    GitCommitSummary *summary = &commits[listed];
+    GitObjectType type;
+    size_t size;
+    CommitInfo info;
+    unsigned char *data = git_odb_read(db, current->oid, &type, &size);
+    if (!data || type != GIT_OBJECT_COMMIT ||
+        !parse_commit((const char *)data, size, &info, summary)) {
+      free(data);
+      break;
+    }
+    free(data);
+
+    git_oid_to_hex(current->oid, summary->oid);
+    summary->commit_time = current->time;
+    listed++;
+
+    int start = current->parents_start;
+    int parent_count = current->parent_count;
+    for (int i = 0; i < parent_count; i++) {
+      int parent = walk_add(&walk, walk.parents[start + i], &created);
+      if (parent < 0) {
+        goto done;
+      }
+      if (created && !walk_push(&walk, parent, 0)) {
+        goto done;
+      }
+    }
+  }
+
+done:
+  walk_free(&walk);
+  return listed;
+}
@@ -0,0 +1,143 @@
+/**
+ * git_object.h
+ * In-process reader for the Git object database and commit history
+ */
+
+#ifndef GIT_OBJECT_H
+#define GIT_OBJECT_H
+
+#include "common.h"
+#include "git_repo.h"
+
+#define GIT_OID_RAW_LEN 20
+
+typedef enum {
+  GIT_OBJECT_NONE = 0,
+  GIT_OBJECT_COMMIT = 1,
+  GIT_OBJECT_TREE = 2,
+  GIT_OBJECT_BLOB = 3,
+  GIT_OBJECT_TAG = 4
+} GitObjectType;
+
+// An open object database (loose objects, packs and the commit-graph).
+// Not thread-safe; open one per thread.
+typedef struct GitObjectDb GitObjectDb;
+
+// One entry of a history listing
+typedef struct {
+  char oid[GIT_OID_HEX_LEN + 1];
+  char author[128];
+  char subject[256];
+  long long commit_time; // Committer time, seconds since 1970
+} GitCommitSummary;
+
+/**
+ * Convert a 40 character hex id to its 20 byte form
+ *
+ * @param hex Hex id
+ * @param oid Receives the raw id
+ * @return 1 on success, 0 if hex is not a valid id
+ */
+int git_oid_from_hex(const char *hex, unsigned char oid[GIT_OID_RAW_LEN]);
+
+/**
+ * Convert a 20 byte id to hex
+ *
+ * @param oid Raw id
+ * @param hex Receives the 40 character id
+ */
+void git_oid_to_hex(const unsigned char oid[GIT_OID_RAW_LEN],
+                    char hex[GIT_OID_HEX_LEN + 1]);
+
+/**
+ * Open a repository's object database
+ *
+ * Pack indexes and the commit-graph are mapped into memory; pack data is
+ * mapped the first time an object in that pack is read.
+ *
+ * @param repo Repository found by git_find_repository or git_repo_open
+ * @return The database (free with git_odb_close), or NULL on error
+ */
+GitObjectDb *git_odb_open(const GitRepo *repo);
+
+/**
+ * Close an object database and unmap its files
+ *
+ * @param db The database
+ */
+void git_odb_close(GitObjectDb *db);
+
+/**
+ * Read an object, resolving pack deltas
+ *
+ * Recently used delta bases are kept in a small cache, so reading many
+ * objects that share a delta chain only inflates the chain once.
+ *
+ * @param db The database
+ * @param oid Object id
+ * @param type Receives the object type
+ * @param size Receives the object size
+ * @return The object content, NUL terminated (caller frees), or NULL if
+ *         the object is missing or corrupt
+ */
+unsigned char *git_odb_read(GitObjectDb *db,
+                            const unsigned char oid[GIT_OID_RAW_LEN],
+                            GitObjectType *type, size_t *size);
+
+/**
+ * Look up the tree a commit points at
+ *
+ * @param db The database
+ * @param commit Commit id
+ * @param tree Receives the tree id
+ * @return 1 on success, 0 if the commit could not be read
+ */
+int git_commit_tree(GitObjectDb *db, const unsigned char commit[GIT_OID_RAW_LEN],
+                    unsigned char tree[GIT_OID_RAW_LEN]);
+
+/**
+ * Count commits reachable from one commit but not the other, in both
+ * directions (what git rev-list --left-right --count a...b prints)
+ *
+ * The walk goes newest first and stops once every remaining commit is
+ * reachable from both sides, so only the diverged part of history and a
+ * little beyond the merge base is visited.
+ *
+ * @param db The database
+ * @param local Local commit id
+ * @param upstream Upstream commit id
+ * @param ahead Receives the number of commits only in local
+ * @param behind Receives the number of commits only in upstream
+ * @return 1 on success, 0 if history could not be read or the walk went
+ *         past its bound
+ */
+int git_ahead_behind(GitObjectDb *db, const unsigned char local[GIT_OID_RAW_LEN],
+                     const unsigned char upstream[GIT_OID_RAW_LEN], int *ahead,
+                     int *behind);
+
+/**
+ * Count the commits reachable from a commit
+ *
+ * @param db The database
+ * @param head Commit id
+ * @param limit Stop counting after this many commits
+ * @return Number of commits (at most limit), or -1 on error
+ */
+int git_count_commits(GitObjectDb *db, const unsigned char head[GIT_OID_RAW_LEN],
+                      int limit);
+
+/**
+ * List the most recent commits reachable from a commit, newest first (the
+ * order of git log)
+ *
+ * @param db The database
+ * @param head Commit id
+ * @param commits Receives up to max commits
+ * @param max Capacity of commits
+ * @return Number of commits listed, or -1 on error
+ */
+int git_recent_commits(GitObjectDb *db,
+                       const unsigned char head[GIT_OID_RAW_LEN],
+                       GitCommitSummary *commits, int max);
+
+#endif // GIT_OBJECT_H
@@ -0,0 +1,573 @@
+/**
+ * git_repo.c
+ * Implementation of the in-process Git repository reader
+ */
+
+#include "git_repo.h"
+
+#define GIT_REPO_CACHE_ENTRIES 16
+#define MAX_SYMREF_DEPTH 5
+
+// Modification times of the files a cached GitRepo was read from
+typedef struct {
+  FILETIME head;
+  FILETIME branch_ref;
+  FILETIME packed_refs;
+  FILETIME config;
+} GitRepoStamp;
+
+typedef struct {
+  GitRepo repo;
+  GitRepoStamp stamp;
+  ULONGLONG last_used;
+} GitRepoCacheEntry;
+
+static GitRepoCacheEntry repo_cache[GIT_REPO_CACHE_ENTRIES];
+static INIT_ONCE repo_cache_once = INIT_ONCE_STATIC_INIT;
+static CRITICAL_SECTION repo_cache_lock;
+
+static BOOL CALLBACK init_repo_cache(PINIT_ONCE once, PVOID param,
+                                     PVOID *context) {
+  InitializeCriticalSection(&repo_cache_lock);
+  return TRUE;
+}
+
+static int is_separator(char c) { return c == '\\' || c == '/'; }
+
+/**
+ * Join a directory and a relative path, using backslashes throughout
+ */
+static void join_path(char *out, size_t size, const char *dir,
+                      const char *rel) {
+  size_t len = strlen(dir);
+  int need_sep = len > 0 && !is_separator(dir[len - 1]);
+
+  snprintf(out, size, "%s%s%s", dir, need_sep ? "\\" : "", rel);
+  for (char *p = out; *p; p++) {
+    if (*p == '/') {
+      *p = '\\';
+    }
+  }
+}
+
+static int is_absolute_path(const char *path) {
+  return is_separator(path[0]) || (isalpha((unsigned char)path[0]) &&
+                                   path[1] == ':');
+}
+
+/**
+ * Read the first line of a small file without its line ending
+ */
+static int read_first_line(const char *path, char *line, size_t size) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return 0;
+  }
+
+  int ok = fgets(line, (int)size, file) != NULL;
+  fclose(file);
+
+  if (ok) {
+    line[strcspn(line, "\r\n")] = '\0';
+  }
+  return ok;
+}
+
+static int is_hex_oid(const char *text) {
+  for (int i = 0; i < GIT_OID_HEX_LEN; i++) {
+    if (!isxdigit((unsigned char)text[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void get_mtime(const char *path, FILETIME *mtime) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (GetFileAttributesEx(path, GetFileExInfoStandard, &data)) {
+    *mtime = data.ftLastWriteTime;
+  } else {
+    mtime->dwLowDateTime = 0;
+    mtime->dwHighDateTime = 0;
+  }
+}
+
+/**
+ * Check whether dir contains a .git entry and fill in the repository paths
+ */
+static int probe_git_entry(const char *dir, GitRepo *repo) {
+  char candidate[MAX_PATH];
+  char line[MAX_PATH + 16];
+
+  join_path(candidate, sizeof(candidate), dir, ".git");
+  DWORD attr = GetFileAttributes(candidate);
+  if (attr == INVALID_FILE_ATTRIBUTES) {
+    return 0;
+  }
+
+  if (attr & FILE_ATTRIBUTE_DIRECTORY) {
+    snprintf(repo->git_dir, sizeof(repo->git_dir), "%s", candidate);
+  } else {
+    // "gitdir: <path>" file, relative paths are relative to dir
+    if (!read_first_line(candidate, line, sizeof(line)) ||
+        strncmp(line, "gitdir: ", 8) != 0) {
+      return 0;
+    }
+
+    const char *target = line + 8;
+    if (is_absolute_path(target)) {
+      join_path(repo->git_dir, sizeof(repo->git_dir), target, "");
+    } else {
+      join_path(repo->git_dir, sizeof(repo->git_dir), dir, target);
+    }
+
+    // join_path leaves a trailing separator when rel is empty
+    size_t len = strlen(repo->git_dir);
+    if (len > 3 && is_separator(repo->git_dir[len - 1])) {
+      repo->git_dir[len - 1] = '\0';
+    }
+  }
+
+  // Linked worktrees keep refs, config and objects in the main repository
+  join_path(candidate, sizeof(candidate), repo->git_dir, "commondir");
+  if (read_first_line(candidate, line, sizeof(line)) && line[0]) {
+    if (is_absolute_path(line)) {
+      snprintf(repo->common_dir, sizeof(repo->common_dir), "%s", line);
+    } else {
+      join_path(repo->common_dir, sizeof(repo->common_dir), repo->git_dir,
+                line);
+    }
+  } else {
+    snprintf(repo->common_dir, sizeof(repo->common_dir), "%s",
+             repo->git_dir);
+  }
+
+  snprintf(repo->root, sizeof(repo->root), "%s", dir);
+  return 1;
+}
+
+/**
+ * Find the repository containing a directory
+ */
+int git_find_repository(const char *dir, GitRepo *repo) {
+  char path[MAX_PATH];
+
+  memset(repo, 0, sizeof(*repo));
+
+  if (dir && dir[0]) {
+    snprintf(path, sizeof(path), "%s", dir);
+  } else if (_getcwd(path, sizeof(path)) == NULL) {
+    return 0;
+  }
+
+  // Drop trailing separators, but keep the one in "C:\"
+  size_t len = strlen(path);
+  while (len > 3 && is_separator(path[len - 1])) {
+    path[--len] = '\0';
+  }
+
+  for (;;) {
+    if (probe_git_entry(path, repo)) {
+      return 1;
+    }
+
+    // Move to the parent directory
+    char *sep = strrchr(path, '\\');
+    char *slash = strrchr(path, '/');
+    if (!sep || (slash && slash > sep)) {
+      sep = slash;
+    }
+
+    if (!sep || sep[1] == '\0') {
+      return 0; // Already at the root
+    }
+    if (sep == path || (sep == path + 2 && path[1] == ':')) {
+      sep[1] = '\0'; // "C:\dir" -> "C:\"
+    } else {
+      *sep = '\0';
+    }
+  }
+}
+
+/**
+ * Look a ref up in packed-refs
+ */
+static int find_packed_ref(const GitRepo *repo, const char *refname,
+                           char oid[GIT_OID_HEX_LEN + 1]) {
+  char path[MAX_PATH];
+  char line[1024];
+  int found = 0;
+
+  join_path(path, sizeof(path), repo->common_dir, "packed-refs");
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return 0;
+  }
+
+  // Lines are "<oid> <refname>"; '#' starts the header and '^' lines hold
+  // peeled tag targets
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#' || line[0] == '^') {
+      continue;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (strlen(line) > GIT_OID_HEX_LEN + 1 && line[GIT_OID_HEX_LEN] == ' ' &&
+        strcmp(line + GIT_OID_HEX_LEN + 1, refname) == 0 && is_hex_oid(line)) {
+      memcpy(oid, line, GIT_OID_HEX_LEN);
+      oid[GIT_OID_HEX_LEN] = '\0';
+      found = 1;
+      break;
+    }
+  }
+
+  fclose(file);
+  return found;
+}
+
+/**
+ * Read a loose ref file. Per-worktree refs (HEAD) live in git_dir, shared
+ * ones in common_dir.
+ */
+static int read_loose_ref(const GitRepo *repo, const char *refname,
+                          char *line, size_t size) {
+  char path[MAX_PATH];
+
+  join_path(path, sizeof(path), repo->git_dir, refname);
+  if (read_first_line(path, line, size)) {
+    return 1;
+  }
+
+  if (strcmp(repo->git_dir, repo->common_dir) != 0) {
+    join_path(path, sizeof(path), repo->common_dir, refname);
+    return read_first_line(path, line, size);
+  }
+  return 0;
+}
+
+/**
+ * Resolve a ref name to a commit id
+ */
+int git_resolve_ref(const GitRepo *repo, const char *refname,
+                    char oid[GIT_OID_HEX_LEN + 1]) {
+  char name[512];
+  char line[512];
+
+  oid[0] = '\0';
+  snprintf(name, sizeof(name), "%s", refname);
+
+  for (int depth = 0; depth < MAX_SYMREF_DEPTH; depth++) {
+    if (!read_loose_ref(repo, name, line, sizeof(line))) {
+      return find_packed_ref(repo, name, oid);
+    }
+
+    if (strncmp(line, "ref: ", 5) == 0) {
+      snprintf(name, sizeof(name), "%s", line + 5);
+      continue;
+    }
+
+    if (strlen(line) >= GIT_OID_HEX_LEN && is_hex_oid(line)) {
+      memcpy(oid, line, GIT_OID_HEX_LEN);
+      oid[GIT_OID_HEX_LEN] = '\0';
+      return 1;
+    }
+    return 0;
+  }
+
+  return 0; // Symbolic ref loop
+}
+
+/**
+ * Parse a config value in place: strip quotes, escapes and trailing
+ * comments
+ */
+static void parse_config_value(const char *raw, char *value, size_t size) {
+  size_t out = 0;
+  size_t last_kept = 0; // Length up to the last non-space or quoted char
+  int quoted = 0;
+
+  while (*raw == ' ' || *raw == '\t') {
+    raw++;
+  }
+
+  for (const char *p = raw; *p && out + 1 < size; p++) {
+    if (*p == '"') {
+      quoted = !quoted;
+      last_kept = out;
+      continue;
+    }
+    if (!quoted && (*p == '#' || *p == ';')) {
+      break;
+    }
+    if (*p == '\\' && p[1]) {
+      p++;
+      value[out++] = (*p == 'n') ? '\n' : (*p == 't') ? '\t' : *p;
+      last_kept = out;
+      continue;
+    }
+
+    value[out++] = *p;
+    if (quoted || (*p != ' ' && *p != '\t')) {
+      last_kept = out;
+    }
+  }
+
+  value[last_kept] = '\0';
+}
+
+/**
+ * Parse a section header line ("[remote \"origin\"]" or the older
+ * "[remote.origin]")
+ */
+static int parse_section_header(const char *line, char *section,
+                                size_t section_size, char *subsection,
+                                size_t subsection_size) {
+  const char *p = line + 1;
+  size_t n = 0;
+
+  while (*p && *p != ']' && *p != ' ' && *p != '.' && n + 1 < section_size) {
+    section[n++] = *p++;
+  }
+  section[n] = '\0';
+  subsection[0] = '\0';
+
+  if (*p == '.') {
+    // Legacy form: subsection is case-insensitive, store it lowercased
+    p++;
+    n = 0;
+    while (*p && *p != ']' && n + 1 < subsection_size) {
+      subsection[n++] = (char)tolower((unsigned char)*p++);
+    }
+    subsection[n] = '\0';
+  } else if (*p == ' ') {
+    while (*p == ' ') {
+      p++;
+    }
+    if (*p != '"') {
+      return 0;
+    }
+    p++;
+    n = 0;
+    while (*p && *p != '"' && n + 1 < subsection_size) {
+      if (*p == '\\' && p[1]) {
+        p++;
+      }
+      subsection[n++] = *p++;
+    }
+    subsection[n] = '\0';
+  }
+
+  return strchr(p, ']') != NULL;
+}
+
+/**
+ * Read a value from the repository's config file
+ */
+int git_config_get(const GitRepo *repo, const char *section,
+                   const char *subsection, const char *key, char *value,
+                   size_t value_size) {
+  char path[MAX_PATH];
+  char line[2048];
+  char current_section[128] = "";
+  char current_subsection[256] = "";
+  int found = 0;
+
+  value[0] = '\0';
+
+  join_path(path, sizeof(path), repo->common_dir, "config");
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return 0;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    char *p = line;
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    p[strcspn(p, "\r\n")] = '\0';
+
+    if (*p == '\0' || *p == '#' || *p == ';') {
+      continue;
+    }
+
+    if (*p == '[') {
+      if (!parse_section_header(p, current_section, sizeof(current_section),
+                                current_subsection,
+                                sizeof(current_subsection))) {
+        current_section[0] = '\0';
+      }
+      continue;
+    }
+
+    if (_stricmp(current_section, section) != 0 ||
+        strcmp(current_subsection, subsection ? subsection : "") != 0) {
+      continue;
+    }
+
+    // "name = value", or a bare "name" meaning true
+    char *name_end = p;
+    while (isalnum((unsigned char)*name_end) || *name_end == '-') {
+      name_end++;
+    }
+    size_t name_len = name_end - p;
+    if (name_len != strlen(key) || _strnicmp(p, key, name_len) != 0) {
+      continue;
+    }
+
+    while (*name_end == ' ' || *name_end == '\t') {
+      name_end++;
+    }
+    if (*name_end == '=') {
+      // The last assignment wins, as with git config --get
+      parse_config_value(name_end + 1, value, value_size);
+    } else {
+      snprintf(value, value_size, "true");
+    }
+    found = 1;
+  }
+
+  fclose(file);
+  return found;
+}
+
+/**
+ * Work out the remote-tracking ref a branch is configured to follow
+ */
+int git_branch_upstream(const GitRepo *repo, const char *branch, char *ref,
+                        size_t ref_size, char *name, size_t name_size) {
+  char remote[256];
+  char merge[512];
+
+  if (!branch || !branch[0] ||
+      !git_config_get(repo, "branch", branch, "remote", remote,
+                      sizeof(remote)) ||
+      !git_config_get(repo, "branch", branch, "merge", merge, sizeof(merge))) {
+    return 0;
+  }
+
+  const char *merge_branch = merge;
+  if (strncmp(merge, "refs/heads/", 11) == 0) {
+    merge_branch = merge + 11;
+  }
+
+  if (strcmp(remote, ".") == 0) {
+    // Tracking another local branch
+    snprintf(ref, ref_size, "%s", merge);
+    snprintf(name, name_size, "%s", merge_branch);
+  } else {
+    // Assumes the default fetch refspec, refs/remotes/<remote>/*
+    snprintf(ref, ref_size, "refs/remotes/%s/%s", remote, merge_branch);
+    snprintf(name, name_size, "%s/%s", remote, merge_branch);
+  }
+  return 1;
+}
+
+/**
+ * Record the modification times that decide whether a cached GitRepo is
+ * stale
+ */
+static void read_repo_stamp(const GitRepo *repo, GitRepoStamp *stamp) {
+  char path[MAX_PATH];
+
+  join_path(path, sizeof(path), repo->git_dir, "HEAD");
+  get_mtime(path, &stamp->head);
+
+  if (repo->branch[0]) {
+    char refname[512];
+    snprintf(refname, sizeof(refname), "refs\\heads\\%s", repo->branch);
+    join_path(path, sizeof(path), repo->common_dir, refname);
+    get_mtime(path, &stamp->branch_ref);
+  } else {
+    stamp->branch_ref.dwLowDateTime = 0;
+    stamp->branch_ref.dwHighDateTime = 0;
+  }
+
+  join_path(path, sizeof(path), repo->common_dir, "packed-refs");
+  get_mtime(path, &stamp->packed_refs);
+
+  join_path(path, sizeof(path), repo->common_dir, "config");
+  get_mtime(path, &stamp->config);
+}
+
+/**
+ * Read the branch HEAD names, if it is not detached
+ */
+static void read_head_branch(GitRepo *repo) {
+  char line[512];
+
+  repo->branch[0] = '\0';
+  if (read_loose_ref(repo, "HEAD", line, sizeof(line)) &&
+      strncmp(line, "ref: refs/heads/", 16) == 0) {
+    snprintf(repo->branch, sizeof(repo->branch), "%s", line + 16);
+  }
+}
+
+/**
+ * Read the commit HEAD points at, the origin URL and the repository name
+ */
+static void read_repo_state(GitRepo *repo) {
+  git_resolve_ref(repo, "HEAD", repo->head_oid);
+
+  git_config_get(repo, "remote", "origin", "url", repo->origin_url,
+                 sizeof(repo->origin_url));
+
+  // The repository is named after the working tree's directory
+  const char *name = repo->root;
+  for (const char *p = repo->root; *p; p++) {
+    if (is_separator(*p) && p[1]) {
+      name = p + 1;
+    }
+  }
+  snprintf(repo->name, sizeof(repo->name), "%s", name);
+}
+
+/**
+ * Find the repository containing a directory and read its state, using the
+ * cached copy if nothing it depends on has changed
+ */
+int git_repo_open(const char *dir, GitRepo *repo) {
+  if (!git_find_repository(dir, repo)) {
+    return 0;
+  }
+
+  InitOnceExecuteOnce(&repo_cache_once, init_repo_cache, NULL, NULL);
+  EnterCriticalSection(&repo_cache_lock);
+
+  GitRepoCacheEntry *entry = NULL;
+  GitRepoCacheEntry *oldest = &repo_cache[0];
+  for (int i = 0; i < GIT_REPO_CACHE_ENTRIES; i++) {
+    if (repo_cache[i].repo.root[0] &&
+        _stricmp(repo_cache[i].repo.root, repo->root) == 0) {
+      entry = &repo_cache[i];
+      break;
+    }
+    if (repo_cache[i].last_used < oldest->last_used) {
+      oldest = &repo_cache[i];
+    }
+  }
+
+  if (entry) {
+    GitRepoStamp stamp;
+    read_repo_stamp(&entry->repo, &stamp);
+    if (memcmp(&stamp, &entry->stamp, sizeof(stamp)) == 0) {
+      *repo = entry->repo;
+      entry->last_used = GetTickCount64();
+      LeaveCriticalSection(&repo_cache_lock);
+      return 1;
+    }
+  } else {
+    entry = oldest;
+  }
+
+  // Stamp before reading the refs so a change made meanwhile is seen next
+  // time (the branch is needed to know which ref file to stamp)
+  read_head_branch(repo);
+  read_repo_stamp(repo, &entry->stamp);
+  read_repo_state(repo);
+
+  entry->repo = *repo;
+  entry->last_used = GetTickCount64();
+  LeaveCriticalSection(&repo_cache_lock);
+  return 1;
+}
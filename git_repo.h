@@ -0,0 +1,94 @@
+/**
+ * git_repo.h
+ * In-process reader for Git repository layout, refs and config
+ */
+
+#ifndef GIT_REPO_H
+#define GIT_REPO_H
+
+#include "common.h"
+
+#define GIT_OID_HEX_LEN 40
+
+// What the shell needs to know about a repository
+typedef struct {
+  char root[MAX_PATH];       // Working tree root
+  char git_dir[MAX_PATH];    // Per-worktree directory (HEAD, index)
+  char common_dir[MAX_PATH]; // Shared directory (refs, config, objects)
+  char name[256];            // Repository name (last component of root)
+  char branch[256];          // Current branch, empty when HEAD is detached
+  char head_oid[GIT_OID_HEX_LEN + 1]; // Commit HEAD points at, empty if
+                                      // the branch has no commits yet
+  char origin_url[1024];     // remote.origin.url as configured
+} GitRepo;
+
+/**
+ * Find the repository containing a directory
+ *
+ * Walks up from dir looking for .git, which is either the git directory
+ * itself or a file containing "gitdir: <path>" (linked worktrees and
+ * submodules). For worktrees the shared directory is read from the
+ * commondir file. Only root, git_dir and common_dir are filled in.
+ *
+ * @param dir Directory to start from, or NULL for the current directory
+ * @param repo Receives the repository paths
+ * @return 1 if a repository was found, 0 otherwise
+ */
+int git_find_repository(const char *dir, GitRepo *repo);
+
+/**
+ * Find the repository containing a directory and read its HEAD, branch and
+ * origin URL
+ *
+ * Results are cached per repository root and reused until HEAD, the current
+ * branch's ref, packed-refs or config change on disk.
+ *
+ * @param dir Directory to start from, or NULL for the current directory
+ * @param repo Receives the repository information
+ * @return 1 if a repository was found, 0 otherwise
+ */
+int git_repo_open(const char *dir, GitRepo *repo);
+
+/**
+ * Resolve a ref name (HEAD, refs/heads/main, ...) to a commit id, following
+ * symbolic refs and falling back to packed-refs
+ *
+ * @param repo Repository found by git_find_repository or git_repo_open
+ * @param refname Full ref name
+ * @param oid Receives the 40 character hex id
+ * @return 1 if the ref exists, 0 otherwise
+ */
+int git_resolve_ref(const GitRepo *repo, const char *refname,
+                    char oid[GIT_OID_HEX_LEN + 1]);
+
+/**
+ * Read a value from the repository's config file
+ *
+ * @param repo Repository found by git_find_repository or git_repo_open
+ * @param section Section name, e.g. "remote" (case-insensitive)
+ * @param subsection Subsection, e.g. "origin", or NULL for none
+ * @param key Variable name, e.g. "url" (case-insensitive)
+ * @param value Buffer for the value
+ * @param value_size Size of the value buffer
+ * @return 1 if the variable is set, 0 otherwise
+ */
+int git_config_get(const GitRepo *repo, const char *section,
+                   const char *subsection, const char *key, char *value,
+                   size_t value_size);
+
+/**
+ * Work out the remote-tracking ref a branch is configured to follow, from
+ * branch.<name>.remote and branch.<name>.merge (what @{upstream} means)
+ *
+ * @param repo Repository found by git_find_repository or git_repo_open
+ * @param branch Local branch name
+ * @param ref Receives the full ref name, e.g. "refs/remotes/origin/main"
+ * @param ref_size Size of the ref buffer
+ * @param name Receives the short display name, e.g. "origin/main"
+ * @param name_size Size of the name buffer
+ * @return 1 if the branch has an upstream configured, 0 otherwise
+ */
+int git_branch_upstream(const GitRepo *repo, const char *branch, char *ref,
+                        size_t ref_size, char *name, size_t name_size);
+
+#endif // GIT_REPO_H
@@ -1,16 +1,31 @@
 /**
  * grep.c
- * Fast implementation of text searching in files with Boyer-Moore algorithm
+ * Fast implementation of text searching in files
  */
 
 #include "grep.h"
 #include "builtins.h"
+#include "file_index.h"
+#include "fuzzy_match.h"
+#include "ignore_rules.h"
+#include "mapped_file.h"
+#include "pattern_set.h"
+#include "regex_engine.h"
+#include "thread_pool.h"
+#include "trigram_index.h"
 #include <ctype.h>
+#include <limits.h>
 #include <process.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) ||            \
+    defined(__SSE2__)
+#include <emmintrin.h>
+#define GREP_HAVE_SSE2 1
+#endif
+
 // Define color codes for highlighting matches
 #define COLOR_MATCH FOREGROUND_RED | FOREGROUND_INTENSITY
 #define COLOR_INFO FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY
@@ -19,25 +34,40 @@
   FOREGROUND_BLUE | FOREGROUND_GREEN | FOREGROUND_RED | FOREGROUND_INTENSITY
 
 // Configuration constants
-#define MAX_BUFFER_SIZE (1024 * 1024) // 1MB read buffer
 #define MAX_LINE_LENGTH 8192          // Max line length to process
 #define MAX_PREVIEW_LINES 10          // Number of context lines to show
-#define MAX_THREAD_COUNT 8            // Maximum number of threads to use
+#define FUZZY_MIN_SCORE 0.5           // Weaker fuzzy matches are not reported
+#define FUZZY_TOP_RESULTS 1000        // Fuzzy results kept by default
+#define OUTPUT_BATCH_BYTES 65536      // Streamed output is written this much
+#define OUTPUT_FLUSH_MS 100           // at a time, or at least this often
+#define GREP_COLUMNS 5                // File, Line, Column, Match, Text
+#define MAX_CONTEXT_LINES 10000       // Largest -A/-B/-C
+
+// Interactive search tuning
+#define INTERACTIVE_DEBOUNCE_MS 75    // Typing pause before a query is searched
+#define INTERACTIVE_POLL_MS 15        // How often streamed results are picked up
+#define INTERACTIVE_REDRAW_MS 100     // Minimum time between streamed redraws
+#define INTERACTIVE_CHUNK_LINES 4096  // Lines filtered per pool task
 
 // Search mode configuration
 typedef enum {
   SEARCH_MODE_PLAIN,       // Plain string matching (case sensitive)
   SEARCH_MODE_IGNORE_CASE, // String matching (case insensitive)
+  SEARCH_MODE_REGEX,       // Regular expression matching
+  SEARCH_MODE_PATTERNS,    // Any of several strings (-e, --pattern-file)
   SEARCH_MODE_FUZZY        // Fuzzy matching (for approximate matches)
 } SearchMode;
 
-// Structure to hold a single grep result
+// Structure to hold a single grep result. The path and the line's text are
+// looked up only when the result is displayed.
 typedef struct {
-  char filename[MAX_PATH];            // File containing the match
-  int line_number;                    // Line number in the file
-  char line_content[MAX_LINE_LENGTH]; // Content of the line
-  int match_start;                    // Position where match begins in the line
-  int match_length;                   // Length of the match
+  int file_id;       // Index into the interned paths
+  int line_number;   // Line number in the file
+  int line_offset;   // Byte offset of the line in the file
+  int line_length;   // Length of the line, without its line ending
+  int match_start;   // Position where match begins in the line
+  int match_length;  // Length of the match
+  int pattern_id;    // Which of several patterns matched, or -1
   double match_score; // Score for fuzzy matches (higher is better)
 } GrepResult;
 
@@ -46,241 +76,457 @@ typedef struct {
   GrepResult *results; // Array of results
   int count;           // Number of results
   int capacity;        // Allocated capacity
+  char **files;        // Interned paths, indexed by GrepResult.file_id
+  int file_count;
+  int file_capacity;
   int current_index;   // Currently displayed result index
   BOOL is_active;      // Whether results view is active
+  char **patterns;     // Patterns named by GrepResult.pattern_id, while shown
+  int pattern_count;
 } GrepResultList;
 
-// Thread-related structures
+// Results found by one thread, merged into grep_results after a search so
+// workers never contend on a shared list
+typedef struct {
+  GrepResult *results;
+  int count;
+  int capacity;
+  char **files;
+  int file_count;
+  int file_capacity;
+} ResultBuffer;
+
+// The file being searched; its path is interned on the first hit
+typedef struct {
+  const char *filename;
+  int file_id; // -1 until the first hit
+  ResultBuffer *buffer;
+  int top_k;   // When nonzero, the buffer is a min-heap of the best results
+  int limit;   // Stop after this many matching lines, or 0 for no limit
+  int matched; // Matching lines found so far
+  BOOL count_only; // Count matching lines without recording them
+  const char *data;        // The file's contents
+  struct RowBatch *rows;   // In a pipeline: rows are built here instead of
+                           // results
+  FuzzyPicker *picker;     // For a picker: matches become its candidates
+                           // instead of results
+} FileHits;
+
+// What a search prints for each file
+typedef enum {
+  OUTPUT_LINES, // Each matching line
+  OUTPUT_FILES, // -l: the path of each file with a match
+  OUTPUT_COUNT  // -c: the number of matching lines in each file
+} OutputMode;
+
+// Table rows found in one file, in order
+typedef struct RowBatch {
+  DataValue **rows; // GREP_COLUMNS values each
+  int count;
+  int capacity;
+} RowBatch;
+
+// A place in the streamed output, in traversal order: a file, holding its
+// formatted results once searched, or a directory, holding one node per
+// entry once enumerated. Files finish in any order on the pool; the output
+// is written up to the first node that has not.
+typedef struct OutputNode {
+  struct OutputNode **children; // Directories: entries in enumeration order
+  int child_count;
+  int flushed;   // Children already written
+  BOOL complete; // File searched, or directory enumerated
+  char *text;    // File: its output, or NULL if it printed nothing
+  size_t length;
+  RowBatch rows; // File, in a pipeline: its rows
+} OutputNode;
+
+// A growable run of output text
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} TextBuffer;
+
+// Output streamed while a search runs
+typedef struct {
+  CRITICAL_SECTION lock; // Held while nodes complete and output is written
+  OutputNode *root;      // The tree being searched, if any
+  BOOL color;            // Standard output is a console
+  TextBuffer pending;    // Output in order, not yet written
+  ULONGLONG last_write;
+  int matched_files;
+  int matched_lines;
+  TableData *table;       // In a pipeline: rows go here, not to the console
+  int row_limit;          // Rows the rest of the pipeline uses (0: all)
+  volatile LONG cancelled; // Set once the table holds row_limit rows
+  FuzzyPicker *picker;    // For a picker: matches go here as they are found,
+                          // until it closes
+} GrepOutput;
+
+// A literal pattern prepared once per search. Case folding is applied to
+// the text as it is compared, through fold and skip, so nothing is copied.
+typedef struct {
+  const unsigned char *pattern; // Lowercase when ignoring case
+  int length;
+  int anchor;                   // Offset of the rarest pattern byte
+  BOOL use_skip;                // Horspool skips instead of an anchor scan
+  unsigned char fold[256];      // Byte to compare with the pattern
+  int skip[256];                // Horspool shift for the window's last byte
+} LiteralMatcher;
+
+// A non-empty line of the interactive corpus
+typedef struct {
+  int file_id;     // Index into grep_results.files
+  int line_number;
+  int offset;      // Byte offset of the line in the file
+  int length;      // Length of the line, without its line ending
+  unsigned long long mask; // fuzzy_char_mask of the line
+} CorpusLine;
+
+// Every text file of an interactive session, mapped once and indexed by
+// line, so queries never touch the file system
+typedef struct {
+  MappedFile *maps; // Indexed like grep_results.files
+  int map_capacity;
+  CorpusLine *lines;
+  int line_count;
+  int line_capacity;
+  CRITICAL_SECTION lock; // Held by pool workers while adding files
+} Corpus;
+
+// Options shared by every task of one search
 typedef struct {
-  char filename[MAX_PATH];   // File to search
   const char *pattern;       // Pattern to search for
   const char *pattern_lower; // Lowercase pattern for case-insensitive search
   SearchMode mode;           // Search mode
   int line_numbers;          // Whether to show line numbers
   BOOL recursive;            // Whether to search recursively
-  HANDLE mutex;              // Mutex for thread synchronization
-} ThreadData;
+  BOOL ignore_case;          // SEARCH_MODE_REGEX: the pattern folds case
+  const Regex *regex;        // SEARCH_MODE_REGEX: the compiled pattern
+  RegexScratch **scratch;    // SEARCH_MODE_REGEX: per-thread matching state,
+                             // created on first use
+  const PatternSet *pattern_set; // SEARCH_MODE_PATTERNS: the strings
+  const FuzzyPattern *fuzzy; // SEARCH_MODE_FUZZY: the compiled query
+  int top_k;                 // SEARCH_MODE_FUZZY: how many of the best
+                             // results to keep (0 keeps all)
+  LiteralMatcher literal;    // The pattern, or the literal every regex match
+                             // contains (length 0 if there is none)
+  Corpus *corpus;            // When set, files are mapped into it instead
+                             // of being searched
+  OutputMode output_mode;    // What is printed per file
+  int max_count;             // -m: matching lines wanted per file (0: all)
+  int before_context;        // -B: lines printed before each match
+  int after_context;         // -A: lines printed after each match
+  GrepOutput *output;        // When set, results are printed as each file
+                             // completes
+  ThreadPoolGroup *tasks;    // The search's tasks on the shared pool
+} SearchContext;
+
+// Patterns given with -e or read with --pattern-file
+typedef struct {
+  char **items;
+  int count;
+  int capacity;
+} PatternList;
 
-// Global result list and mutex
+// A directory to enumerate or a file to search, queued on the grep pool
+typedef struct {
+  const SearchContext *context;
+  OutputNode *node;    // Where the output goes, when it is streamed
+  const char *root;    // Top of the walk; the caller's, kept until the
+                       // search finishes
+  BOOL is_directory;
+  char path[MAX_PATH];
+} SearchTask;
+
+// State shared by the interactive view and its search thread. The view
+// posts queries; the thread filters the corpus on the grep pool and streams
+// results back through found.
+typedef struct {
+  Corpus corpus;
+  CRITICAL_SECTION lock;
+  HANDLE thread;
+  HANDLE wakeup;            // Signalled when a query is posted or on exit
+  HANDLE idle;              // Set while the thread has nothing to do
+  volatile LONG generation; // Bumped to cancel the search in progress
+  volatile LONG stop;
+
+  // Guarded by lock
+  char query[256];          // Latest posted query
+  LONG query_generation;
+  BOOL query_posted;
+  BOOL corpus_changed;      // The candidates refer to a released corpus
+  GrepResult *found;        // Results streamed since the view took them
+  int found_count;
+  int found_capacity;
+  LONG found_generation;    // Search the streamed results belong to
+  LONG completed_generation;
+
+  // Owned by the thread
+  char *refined_query; // Query the candidates were filtered for
+  int *candidates;     // Lines containing refined_query, or NULL for all
+  int candidate_count;
+} InteractiveSession;
+
+// One slice of the lines filtered for an interactive query
+typedef struct {
+  InteractiveSession *session;
+  LONG generation;
+  const FuzzyPattern *fuzzy;
+  unsigned long long mask;  // The query's fuzzy_pattern_mask
+  const char *query_lower;
+  const int *lines; // Line indices, or NULL for the range from first
+  int first;
+  int count;
+  int *matches;     // Lines that still contain the query, in order
+  int match_count;
+  BOOL cancelled;
+} FilterChunk;
+
+// Global result list
 static GrepResultList grep_results = {0};
-static HANDLE result_mutex = NULL;
+
+// Whether the interactive view is still waiting for its query's results
+static BOOL interactive_searching = FALSE;
+
+// One buffer per pool worker, plus one for the thread that starts a search
+static ResultBuffer *thread_results = NULL;
+static int thread_result_count = 0;
+
+// The file whose lines are being displayed, kept mapped between redraws
+static MappedFile line_map;
+static int line_map_file = -1;
+
+// The shared pool, whose workers are kept between searches, so interactive
+// mode does not pay for thread creation on every keystroke
+static ThreadPool *grep_pool = NULL;
 
 // Forward declarations for all static functions
-static void search_file(const char *filename, const char *pattern,
-                        const char *pattern_lower, SearchMode mode,
-                        int line_numbers);
-static void search_directory(const char *directory, const char *pattern,
-                             const char *pattern_lower, SearchMode mode,
-                             int line_numbers, BOOL recursive);
-static BOOL is_text_file(const char *filename);
+static void search_file(const SearchContext *context, const char *filename,
+                        OutputNode *node);
+static void search_directory(const SearchContext *context,
+                             const char *directory);
+static void search_indexed(const SearchContext *context,
+                           const char *directory,
+                           const char *const *literals, int literal_count);
 static void display_grep_results(void);
-static void add_grep_result(const char *filename, int line_number,
-                            const char *line, int match_start, int match_length,
-                            double score);
+static void add_grep_result(FileHits *hits, int line_number, int line_offset,
+                            int line_length, int match_start, int match_length,
+                            int pattern_id, double score);
+static void add_grep_row(FileHits *hits, int line_number, int line_offset,
+                         int line_length, int match_start, int match_length);
+static void free_row_batch(RowBatch *batch);
+static void add_picker_candidate(FileHits *hits, int line_number,
+                                 int line_offset, int line_length,
+                                 int match_start);
+static BOOL output_cancelled(const GrepOutput *output);
 static void free_grep_results(void);
-static BOOL ends_with(const char *str, const char *suffix);
-static int boyer_moore_search(const char *text, int text_len,
-                              const char *pattern, int pattern_len);
-static int boyer_moore_case_insensitive(const char *text, int text_len,
-                                        const char *pattern_lower,
-                                        int pattern_len);
-static double fuzzy_search(const char *text, const char *pattern,
-                           int *match_start, int *match_length);
+static BOOL ranked_result_wanted(const GrepResult *results, int count,
+                                 int top_k, double score);
+static void insert_ranked_result(GrepResult *results, int *count, int top_k,
+                                 const GrepResult *result);
+static void keep_best_results(GrepResult *results, int *count, int top_k);
+static int current_thread_slot(void);
+static ResultBuffer *current_result_buffer(void);
+static int init_grep_workers(void);
+static void merge_thread_results(void);
+static const char *grep_result_path(const GrepResult *result);
+static void get_result_line(const GrepResult *result, char *line, size_t size);
+static void release_line_map(void);
+static void literal_matcher_init(LiteralMatcher *matcher, const char *pattern,
+                                 BOOL ignore_case);
+static int literal_matcher_find(const LiteralMatcher *matcher,
+                                const char *text, int text_len);
 static int open_file_in_editor(const char *file_path, int line_number);
 static void show_file_detail_view(GrepResult *result);
-static unsigned __stdcall search_thread(void *arg);
+static void run_search_task(void *arg);
+static void queue_search_task(const SearchContext *context, OutputNode *node,
+                              const char *root, const char *path,
+                              BOOL is_directory);
+static OutputNode *create_output_node(void);
+static void free_output_node(OutputNode *node);
+static void complete_output_node(GrepOutput *output, OutputNode *node,
+                                 char *text, size_t length, RowBatch *rows,
+                                 int matched);
+static void finish_output(GrepOutput *output);
+static BOOL file_hits_done(const FileHits *hits);
+static char *format_file_output(const SearchContext *context,
+                                const FileHits *hits, const char *data,
+                                int size, int first_result, size_t *length);
+static int previous_line_start(const char *data, int offset, int floor);
+static int line_extent(const char *data, int size, int offset, int *next);
 static int should_skip_file(const char *filename);
-static char *extract_line_from_buffer(const char *buffer, int buffer_size,
-                                      int line_start, int *line_length);
 static void run_grep_interactive_session(void);
+static void draw_interactive_header(const char *query, WORD attrs);
+static void load_corpus(Corpus *corpus);
+static void add_corpus_file(Corpus *corpus, const char *filename,
+                            MappedFile *file);
+static void release_corpus(Corpus *corpus);
+static BOOL start_interactive_session(InteractiveSession *session);
+static void stop_interactive_session(InteractiveSession *session);
+static LONG post_interactive_query(InteractiveSession *session,
+                                   const char *query);
+static void cancel_interactive_search(InteractiveSession *session);
+static void pause_interactive_search(InteractiveSession *session);
+static void mark_corpus_changed(InteractiveSession *session);
+static void take_streamed_results(InteractiveSession *session,
+                                  LONG generation, BOOL *searching);
 static void display_grep_results_interactive(const char *query,
                                              int selected_index,
                                              int results_count);
 static void update_selection_highlight(int new_index, int old_index,
                                        int results_count);
 
-/**
- * Boyer-Moore string search implementation
- * @return Index of the first occurrence, or -1 if not found
- */
-static int boyer_moore_search(const char *text, int text_len,
-                              const char *pattern, int pattern_len) {
-  if (pattern_len == 0)
-    return 0;
-  if (pattern_len > text_len)
-    return -1;
+// Bytes ordered from most to least common in source code and prose. The
+// pattern byte that comes latest here (or not at all) is the rarest, and
+// the search scans for it first.
+static const char common_bytes[] =
+    " etaoinsrlcdhumpf\n\t_.,;()=\"'-/:{}*<>[]0123456789gbywkvxqjz";
 
-  // Initialize bad character skip table
-  int bad_char_skip[256];
-  for (int i = 0; i < 256; i++) {
-    bad_char_skip[i] = pattern_len;
-  }
+// Anchors ranked among this many most common bytes would stop the scan too
+// often; such patterns use Horspool skips instead
+#define COMMON_ANCHOR_RANKS 8
 
-  // Fill the bad character skip table
-  for (int i = 0; i < pattern_len - 1; i++) {
-    bad_char_skip[(unsigned char)pattern[i]] = pattern_len - 1 - i;
-  }
+static int byte_rank(unsigned char c) {
+  const char *found = c ? strchr(common_bytes, c) : NULL;
+  return found ? (int)(found - common_bytes) : (int)sizeof(common_bytes);
+}
 
-  // Search for the pattern
-  int s = 0; // The shift of the pattern
-  while (s <= text_len - pattern_len) {
-    int j = pattern_len - 1;
+/**
+ * Prepare a literal for searching: the fold table, the Horspool skip table
+ * (holding both cases of each letter when ignoring case) and the anchor
+ * @param pattern The pattern, already lowercase when ignore_case is set;
+ *                must outlive the matcher
+ */
+static void literal_matcher_init(LiteralMatcher *matcher, const char *pattern,
+                                 BOOL ignore_case) {
+  int length = strlen(pattern);
+
+  matcher->pattern = (const unsigned char *)pattern;
+  matcher->length = length;
+  for (int c = 0; c < 256; c++) {
+    matcher->fold[c] = ignore_case ? (unsigned char)tolower(c)
+                                   : (unsigned char)c;
+    matcher->skip[c] = length;
+  }
 
-    // Match from right to left
-    while (j >= 0 && pattern[j] == text[s + j]) {
-      j--;
+  for (int i = 0; i < length - 1; i++) {
+    unsigned char c = matcher->pattern[i];
+    matcher->skip[c] = length - 1 - i;
+    if (ignore_case) {
+      matcher->skip[toupper(c)] = length - 1 - i;
     }
+  }
 
-    if (j < 0) {
-      // Pattern found
-      return s;
-    } else {
-      // Shift by bad character rule
-      s += bad_char_skip[(unsigned char)text[s + pattern_len - 1]];
+  matcher->anchor = 0;
+  for (int i = 1; i < length; i++) {
+    if (byte_rank(matcher->pattern[i]) >=
+        byte_rank(matcher->pattern[matcher->anchor])) {
+      matcher->anchor = i;
     }
   }
-
-  return -1; // Pattern not found
+  matcher->use_skip =
+      length > 1 &&
+      byte_rank(matcher->pattern[matcher->anchor]) < COMMON_ANCHOR_RANKS;
 }
 
 /**
- * Case-insensitive Boyer-Moore search
+ * Check whether the pattern occurs at a position
  */
-static int boyer_moore_case_insensitive(const char *text, int text_len,
-                                        const char *pattern_lower,
-                                        int pattern_len) {
-  if (pattern_len == 0)
-    return 0;
-  if (pattern_len > text_len)
-    return -1;
-
-  // Create lowercase copy of text for searching
-  char *text_lower = (char *)malloc(text_len + 1);
-  if (!text_lower) {
-    return -1; // Memory allocation failed
-  }
-
-  // Convert text to lowercase
-  for (int i = 0; i < text_len; i++) {
-    text_lower[i] = tolower(text[i]);
-  }
-  text_lower[text_len] = '\0';
-
-  // Initialize bad character skip table
-  int bad_char_skip[256];
-  for (int i = 0; i < 256; i++) {
-    bad_char_skip[i] = pattern_len;
+static BOOL literal_matches_at(const LiteralMatcher *matcher,
+                               const unsigned char *text) {
+  for (int i = 0; i < matcher->length; i++) {
+    if (matcher->fold[text[i]] != matcher->pattern[i]) {
+      return FALSE;
+    }
   }
+  return TRUE;
+}
 
-  // Fill the bad character skip table
-  for (int i = 0; i < pattern_len - 1; i++) {
-    bad_char_skip[(unsigned char)pattern_lower[i]] = pattern_len - 1 - i;
+/**
+ * Find the first position in [from, to) holding a byte that folds to c
+ * @return The position, or -1
+ */
+static int find_folded_byte(const LiteralMatcher *matcher,
+                            const unsigned char *text, int from, int to,
+                            unsigned char c) {
+  unsigned char upper = (unsigned char)toupper(c);
+
+  if (upper == c || matcher->fold[upper] != c) {
+    const unsigned char *found =
+        (const unsigned char *)memchr(text + from, c, to - from);
+    return found ? (int)(found - text) : -1;
   }
 
-  // Search for the pattern
-  int s = 0; // The shift of the pattern
-  int result = -1;
-
-  while (s <= text_len - pattern_len) {
-    int j = pattern_len - 1;
-
-    // Match from right to left
-    while (j >= 0 && pattern_lower[j] == text_lower[s + j]) {
-      j--;
+  int i = from;
+#ifdef GREP_HAVE_SSE2
+  // Both cases of an ASCII letter differ only in bit 0x20
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i target = _mm_set1_epi8((char)c);
+  for (; to - i >= 16; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+    int mask = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_or_si128(chunk, case_bit), target));
+    if (mask) {
+      int bit = 0;
+      while (!(mask & 1)) {
+        mask >>= 1;
+        bit++;
+      }
+      return i + bit;
     }
-
-    if (j < 0) {
-      // Pattern found
-      result = s;
-      break;
-    } else {
-      // Shift by bad character rule
-      s += bad_char_skip[(unsigned char)text_lower[s + pattern_len - 1]];
+  }
+#endif
+  for (; i < to; i++) {
+    if (matcher->fold[text[i]] == c) {
+      return i;
     }
   }
-
-  // Free the lowercase copy of text
-  free(text_lower);
-
-  return result; // Return match position or -1 if not found
+  return -1;
 }
 
 /**
- * Fuzzy search implementation
- * @return Score between 0.0 and 1.0, with higher being better match
+ * Find the first occurrence of a prepared literal
+ * @return Index of the first occurrence, or -1 if not found
  */
-static double fuzzy_search(const char *text, const char *pattern,
-                           int *match_start, int *match_length) {
-  int text_len = strlen(text);
-  int pattern_len = strlen(pattern);
-
-  if (pattern_len == 0)
-    return 0.0;
-  if (pattern_len > text_len)
-    return 0.0;
-
-  // Score variables
-  double best_score = 0.0;
-  int best_start = 0;
-  int best_length = 0;
-
-  // Try matching from each position in text
-  for (int i = 0; i <= text_len - pattern_len; i++) {
-    int match_pos = 0;   // Current position in pattern
-    int consecutive = 0; // Count of consecutive matches
-    double local_score = 0.0;
-    int matched_chars = 0;
-    int first_match = -1;
-    int last_match = -1;
+static int literal_matcher_find(const LiteralMatcher *matcher,
+                                const char *text, int text_len) {
+  const unsigned char *data = (const unsigned char *)text;
+  int length = matcher->length;
 
-    // Try to match pattern from current position
-    for (int j = i; j < text_len && match_pos < pattern_len; j++) {
-      if (tolower(text[j]) == tolower(pattern[match_pos])) {
-        if (first_match == -1)
-          first_match = j;
-        last_match = j;
-
-        // Give more weight to consecutive matches
-        consecutive++;
-        local_score += consecutive * 0.1;
+  if (length == 0)
+    return 0;
+  if (length > text_len)
+    return -1;
 
-        matched_chars++;
-        match_pos++;
-      } else {
-        // Penalize non-consecutive matches
-        consecutive = 0;
+  if (matcher->use_skip) {
+    unsigned char last = matcher->pattern[length - 1];
+    int s = 0; // The shift of the pattern
+    while (s <= text_len - length) {
+      unsigned char c = data[s + length - 1];
+      if (matcher->fold[c] == last && literal_matches_at(matcher, data + s)) {
+        return s;
       }
+      s += matcher->skip[c];
     }
+    return -1;
+  }
 
-    // Calculate final score based on matched chars and compactness
-    if (matched_chars == pattern_len) {
-      int match_span = last_match - first_match + 1;
-      double proximity = (double)pattern_len / match_span;
-
-      local_score += proximity * 0.5;
-
-      // Bonus for matching at start of words
-      if (i == 0 || !isalnum(text[i - 1])) {
-        local_score += 0.2;
-      }
-
-      // If this is the best score so far, save it
-      if (local_score > best_score) {
-        best_score = local_score;
-        best_start = first_match;
-        best_length = last_match - first_match + 1;
-      }
+  // Scan for the rare anchor byte and verify around each hit
+  int anchor = matcher->anchor;
+  int end = text_len - length + anchor + 1; // Past the last possible anchor
+  int pos = anchor;
+  while (pos < end) {
+    pos = find_folded_byte(matcher, data, pos, end, matcher->pattern[anchor]);
+    if (pos < 0) {
+      break;
     }
+    if (literal_matches_at(matcher, data + pos - anchor)) {
+      return pos - anchor;
+    }
+    pos++;
   }
-
-  // Normalize score to range [0,1]
-  best_score = best_score > 1.0 ? 1.0 : best_score;
-
-  // Set output parameters
-  *match_start = best_start;
-  *match_length = best_length;
-
-  return best_score;
+  return -1;
 }
 
 /**
@@ -326,7 +572,8 @@ static void display_grep_results_interactive(const char *query,
 
   // Show results count
   SetConsoleTextAttribute(hConsole, COLOR_INFO);
-  printf("Found %d matches", results_count);
+  printf("Found %d matches%s", results_count,
+         interactive_searching ? " (searching...)" : "");
   SetConsoleTextAttribute(hConsole, originalAttrs);
   printf("\n");
 
@@ -364,8 +611,8 @@ static void display_grep_results_interactive(const char *query,
     GrepResult *result = &grep_results.results[result_idx];
 
     // Extract just the filename from path
-    char *filename = result->filename;
-    char *last_slash = strrchr(filename, '\\');
+    const char *filename = grep_result_path(result);
+    const char *last_slash = strrchr(filename, '\\');
     if (last_slash) {
       filename = last_slash + 1;
     }
@@ -406,13 +653,14 @@ static void display_grep_results_interactive(const char *query,
     printf(" ");
 
     // Print match content with highlighting
-    char display_line[512] = {0};
-    strncpy(display_line, result->line_content, sizeof(display_line) - 1);
+    char display_line[512];
+    get_result_line(result, display_line, sizeof(display_line));
+    int match_start = result->match_start;
 
     // Truncate if too long
     if (strlen(display_line) > (size_t)(right_width - 2)) {
       // Center around the match if possible
-      int match_center = result->match_start + (result->match_length / 2);
+      int match_center = match_start + (result->match_length / 2);
       int half_width = (right_width - 2) / 2;
 
       if (match_center > half_width &&
@@ -426,9 +674,9 @@ static void display_grep_results_interactive(const char *query,
         display_line[2] = '.';
 
         // Adjust match position
-        result->match_start -= (start_pos - 3);
-        if (result->match_start < 0)
-          result->match_start = 0;
+        match_start -= (start_pos - 3);
+        if (match_start < 0)
+          match_start = 0;
 
         // Add ellipsis at end if needed
         if (strlen(display_line) > (size_t)(right_width - 2)) {
@@ -448,22 +696,22 @@ static void display_grep_results_interactive(const char *query,
 
     // Print match with highlighting
     // First part before match
-    printf("%.*s", result->match_start, display_line);
+    printf("%.*s", match_start, display_line);
 
     // Matched part
     SetConsoleTextAttribute(hConsole, COLOR_MATCH);
     int match_len = result->match_length;
-    if (result->match_start + match_len > (int)strlen(display_line)) {
-      match_len = strlen(display_line) - result->match_start;
+    if (match_start + match_len > (int)strlen(display_line)) {
+      match_len = strlen(display_line) - match_start;
     }
-    if (match_len > 0 && result->match_start < (int)strlen(display_line)) {
-      printf("%.*s", match_len, display_line + result->match_start);
+    if (match_len > 0 && match_start < (int)strlen(display_line)) {
+      printf("%.*s", match_len, display_line + match_start);
     }
 
     // Part after match
     SetConsoleTextAttribute(hConsole, originalAttrs);
-    if (result->match_start + match_len < (int)strlen(display_line)) {
-      printf("%s", display_line + result->match_start + match_len);
+    if (match_start + match_len < (int)strlen(display_line)) {
+      printf("%s", display_line + match_start + match_len);
     }
 
     printf("\n");
@@ -481,8 +729,7 @@ static void display_grep_results_interactive(const char *query,
   printf("Navigate: Ctrl+N (down), Ctrl+P (up), Enter (open), Ctrl+C (exit)\n");
 
   // Restore cursor position after the search prompt
-  SetConsoleCursorPosition(hConsole,
-                           (COORD){searchPos.X + strlen(query), searchPos.Y});
+  SetConsoleCursorPosition(hConsole, searchPos);
 }
 
 /**
@@ -575,8 +822,8 @@ static void update_selection_highlight(int new_index, int old_index,
     GrepResult *result = &grep_results.results[old_index];
 
     // Extract filename
-    char *filename = result->filename;
-    char *last_slash = strrchr(filename, '\\');
+    const char *filename = grep_result_path(result);
+    const char *last_slash = strrchr(filename, '\\');
     if (last_slash) {
       filename = last_slash + 1;
     }
@@ -613,8 +860,8 @@ static void update_selection_highlight(int new_index, int old_index,
     printf(" ");
 
     // Print match content with highlighting if needed
-    char display_line[512] = {0};
-    strncpy(display_line, result->line_content, sizeof(display_line) - 1);
+    char display_line[512];
+    get_result_line(result, display_line, sizeof(display_line));
 
     // Apply same truncation logic as in display function
     if (strlen(display_line) > (size_t)(console_width - left_width - 3)) {
@@ -693,8 +940,8 @@ static void update_selection_highlight(int new_index, int old_index,
     GrepResult *result = &grep_results.results[new_index];
 
     // Extract filename
-    char *filename = result->filename;
-    char *last_slash = strrchr(filename, '\\');
+    const char *filename = grep_result_path(result);
+    const char *last_slash = strrchr(filename, '\\');
     if (last_slash) {
       filename = last_slash + 1;
     }
@@ -731,8 +978,8 @@ static void update_selection_highlight(int new_index, int old_index,
     printf(" ");
 
     // Print match content with highlighting if needed
-    char display_line[512] = {0};
-    strncpy(display_line, result->line_content, sizeof(display_line) - 1);
+    char display_line[512];
+    get_result_line(result, display_line, sizeof(display_line));
 
     // Apply same truncation logic as in display function
     if (strlen(display_line) > (size_t)(console_width - left_width - 3)) {
@@ -811,14 +1058,31 @@ static void update_selection_highlight(int new_index, int old_index,
   SetConsoleTextAttribute(hConsole, originalAttrs);
 }
 
+/**
+ * Draw the interactive session's title, help line and search prompt
+ */
+static void draw_interactive_header(const char *query, WORD attrs) {
+  HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+
+  system("cls");
+  SetConsoleTextAttribute(hConsole, COLOR_RESULT_HIGHLIGHT);
+  printf("Interactive Grep Search (Recursive, Case-insensitive, Fuzzy)\n");
+  SetConsoleTextAttribute(hConsole, attrs);
+  printf(
+      "Type to filter | Ctrl+N/P: navigate | Enter: open | Ctrl+C: exit\n\n");
+  printf("Search: %s", query);
+}
+
 /**
  * Run an interactive grep session
- * Shows all files initially and allows filtering with real-time search
+ *
+ * The files under the current directory are mapped once. Each query is
+ * searched on a background thread once typing pauses, cancelled by the next
+ * keystroke, and its results are drawn as they arrive.
  */
 static void run_grep_interactive_session(void) {
-  // Initialize with empty search to show all files
   char search_query[256] = "";
-  char last_query[256] = "";
+  char last_query[256] = ""; // Query of the search being shown
 
   // Save original console mode to restore later
   HANDLE hStdin = GetStdHandle(STD_INPUT_HANDLE);
@@ -827,6 +1091,12 @@ static void run_grep_interactive_session(void) {
   CONSOLE_SCREEN_BUFFER_INFO csbi;
   WORD originalAttrs;
 
+  InteractiveSession session;
+  if (!start_interactive_session(&session)) {
+    printf("grep: could not start the search thread\n");
+    return;
+  }
+
   // Save original console settings
   GetConsoleMode(hStdin, &originalMode);
   GetConsoleScreenBufferInfo(hConsole, &csbi);
@@ -836,48 +1106,59 @@ static void run_grep_interactive_session(void) {
   DWORD newMode = ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT;
   SetConsoleMode(hStdin, newMode);
 
-  // Set up mutex for thread synchronization
-  if (result_mutex == NULL) {
-    result_mutex = CreateMutex(NULL, FALSE, NULL);
-  }
-
-  // Clear screen and show initial UI
   system("cls");
-  SetConsoleTextAttribute(hConsole, COLOR_RESULT_HIGHLIGHT);
-  printf("Interactive Grep Search (Recursive, Case-insensitive, Fuzzy)\n");
-  SetConsoleTextAttribute(hConsole, originalAttrs);
-  printf(
-      "Type to filter | Ctrl+N/P: navigate | Enter: open | Ctrl+C: exit\n\n");
-  printf("Search: ");
+  printf("Loading files...\n");
+  load_corpus(&session.corpus);
+  draw_interactive_header(search_query, originalAttrs);
 
   int running = 1;
   int selected_index = 0;
   int results_count = 0;
-  int first_run = 1;
-  int console_width = csbi.srWindow.Right - csbi.srWindow.Left + 1;
-  int console_height = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
-  int left_width = 30;
-  if (left_width > console_width / 3)
-    left_width = console_width / 3;
-  int right_width = console_width - left_width - 3;
-
-  // Initial search to populate results
-  char *pattern_lower = _strdup("");
-  if (pattern_lower) {
-    // Initially search the current directory recursively with default options
-    search_directory(".", "", pattern_lower, SEARCH_MODE_FUZZY, 1, TRUE);
-    free(pattern_lower);
-  }
-
-  // Get initial results count
-  results_count = grep_results.count;
-
-  // Draw the initial results view
+  LONG view_generation = 0;   // Search whose results are shown
+  BOOL query_dirty = FALSE;   // Typed since the last search was posted
+  DWORD query_changed_at = 0;
+  int shown_count = 0;
+  BOOL shown_searching = FALSE;
+  DWORD last_redraw = GetTickCount();
+
+  // The empty query matches nothing, so there is no need to search for it
+  interactive_searching = FALSE;
   display_grep_results_interactive(search_query, selected_index, results_count);
 
   // Main interaction loop
   while (running) {
-    // Process user input
+    if (!_kbhit()) {
+      // Search once typing pauses
+      if (query_dirty &&
+          GetTickCount() - query_changed_at >= INTERACTIVE_DEBOUNCE_MS) {
+        query_dirty = FALSE;
+        view_generation = post_interactive_query(&session, search_query);
+        strcpy(last_query, search_query);
+        grep_results.count = 0;
+        selected_index = 0;
+        shown_count = -1;
+      }
+
+      BOOL searching;
+      take_streamed_results(&session, view_generation, &searching);
+      results_count = grep_results.count;
+
+      // Redraw as results stream in, but not for every batch
+      if ((results_count != shown_count || searching != shown_searching) &&
+          (!searching ||
+           GetTickCount() - last_redraw >= INTERACTIVE_REDRAW_MS)) {
+        interactive_searching = searching;
+        display_grep_results_interactive(search_query, selected_index,
+                                         results_count);
+        shown_count = results_count;
+        shown_searching = searching;
+        last_redraw = GetTickCount();
+      }
+
+      Sleep(INTERACTIVE_POLL_MS);
+      continue;
+    }
+
     int c = _getch();
 
     if (c == 3) { // Ctrl+C
@@ -886,21 +1167,28 @@ static void run_grep_interactive_session(void) {
       // If we have search results and a selected index, open the file
       if (results_count > 0 && selected_index < results_count) {
         GrepResult *result = &grep_results.results[selected_index];
-        open_file_in_editor(result->filename, result->line_number);
+        char path[MAX_PATH];
+        int line_number = result->line_number;
+        snprintf(path, sizeof(path), "%s", grep_result_path(result));
 
-        // After returning from editor, refresh the UI
-        system("cls");
-        SetConsoleTextAttribute(hConsole, COLOR_RESULT_HIGHLIGHT);
-        printf(
-            "Interactive Grep Search (Recursive, Case-insensitive, Fuzzy)\n");
-        SetConsoleTextAttribute(hConsole, originalAttrs);
-        printf("Type to filter | Ctrl+N/P: navigate | Enter: open | Ctrl+C: "
-               "exit\n\n");
-        printf("Search: %s", search_query);
+        // The editor cannot save a file that is still mapped
+        pause_interactive_search(&session);
+        release_corpus(&session.corpus);
+        open_file_in_editor(path, line_number);
 
-        // Redraw results view
-        display_grep_results_interactive(search_query, selected_index,
-                                         results_count);
+        // Files may have changed, so map them again and repeat the search
+        system("cls");
+        printf("Loading files...\n");
+        load_corpus(&session.corpus);
+        mark_corpus_changed(&session);
+        draw_interactive_header(search_query, originalAttrs);
+
+        query_dirty = FALSE;
+        view_generation = post_interactive_query(&session, search_query);
+        strcpy(last_query, search_query);
+        selected_index = 0;
+        results_count = 0;
+        shown_count = -1;
       }
     } else if (c == 14) { // Ctrl+N
       if (results_count > 0) {
@@ -914,93 +1202,29 @@ static void run_grep_interactive_session(void) {
         selected_index = (selected_index - 1 + results_count) % results_count;
         update_selection_highlight(selected_index, prev_index, results_count);
       }
-    } else if (c == 8) { // Backspace
-      // Remove last character from search query
+    } else if (c == 8 || isprint(c)) { // Backspace or printable character
       size_t len = strlen(search_query);
-      if (len > 0) {
+      if (c == 8 && len > 0) {
         search_query[len - 1] = '\0';
-
-        // Check if the query has changed and we need to run search again
-        if (strcmp(search_query, last_query) != 0) {
-          // Reset results
-          free_grep_results();
-
-          // Create lowercase version of pattern for case-insensitive search
-          pattern_lower = _strdup(search_query);
-          if (pattern_lower) {
-            for (char *p = pattern_lower; *p; p++) {
-              *p = tolower(*p);
-            }
-
-            // Search the current directory recursively with the new query
-            search_directory(".", search_query, pattern_lower,
-                             SEARCH_MODE_FUZZY, 1, TRUE);
-            free(pattern_lower);
-          }
-
-          // Update results count and reset selection
-          results_count = grep_results.count;
-          selected_index = 0;
-          strcpy(last_query, search_query);
-
-          // Redraw the entire results view with the new search
-          printf("\rSearch: %s   ", search_query);
-          display_grep_results_interactive(search_query, selected_index,
-                                           results_count);
-        } else {
-          // Just update the search text if the actual search hasn't changed
-          printf("\rSearch: %s   ", search_query);
-        }
-      }
-    } else if (isprint(c)) { // Printable character
-      // Add character to search query
-      size_t len = strlen(search_query);
-      if (len < sizeof(search_query) - 1) {
+      } else if (c != 8 && len < sizeof(search_query) - 1) {
         search_query[len] = c;
         search_query[len + 1] = '\0';
-
-        // Check if the query has changed and we need to run search again
-        if (strcmp(search_query, last_query) != 0) {
-          // Reset results
-          free_grep_results();
-
-          // Create lowercase version of pattern for case-insensitive search
-          pattern_lower = _strdup(search_query);
-          if (pattern_lower) {
-            for (char *p = pattern_lower; *p; p++) {
-              *p = tolower(*p);
-            }
-
-            // Search the current directory recursively with the new query
-            search_directory(".", search_query, pattern_lower,
-                             SEARCH_MODE_FUZZY, 1, TRUE);
-            free(pattern_lower);
-          }
-
-          // Update results count and reset selection
-          results_count = grep_results.count;
-          selected_index = 0;
-          strcpy(last_query, search_query);
-
-          // Redraw the entire results view with the new search
-          printf("\rSearch: %s   ", search_query);
-          display_grep_results_interactive(search_query, selected_index,
-                                           results_count);
-        } else {
-          // Just update the search text if the actual search hasn't changed
-          printf("\rSearch: %s   ", search_query);
-        }
+      }
+      printf("\rSearch: %s   \b\b\b", search_query);
+
+      // Whatever is running is for an outdated query; stop it now and
+      // search again when typing pauses
+      if (strcmp(search_query, last_query) != 0 || query_dirty) {
+        cancel_interactive_search(&session);
+        query_dirty = TRUE;
+        query_changed_at = GetTickCount();
       }
     }
   }
 
   // Clean up
-  if (result_mutex) {
-    CloseHandle(result_mutex);
-    result_mutex = NULL;
-  }
-
-  free_grep_results();
+  stop_interactive_session(&session);
+  interactive_searching = FALSE;
 
   // Restore original console mode
   SetConsoleTextAttribute(hConsole, originalAttrs);
@@ -1011,424 +1235,1916 @@ static void run_grep_interactive_session(void) {
 }
 
 /**
- * Thread function for searching files in parallel
+ * Grow an array to hold at least needed items
+ * @return TRUE if it is large enough, FALSE on allocation failure
  */
-static unsigned __stdcall search_thread(void *arg) {
-  ThreadData *data = (ThreadData *)arg;
-
-  // Check if it's a directory or file
-  DWORD attr = GetFileAttributes(data->filename);
+static BOOL reserve_items(void **items, int *capacity, int needed,
+                          size_t item_size) {
+  if (needed <= *capacity) {
+    return TRUE;
+  }
 
-  if (attr != INVALID_FILE_ATTRIBUTES) {
-    if (attr & FILE_ATTRIBUTE_DIRECTORY) {
-      // It's a directory
-      search_directory(data->filename, data->pattern, data->pattern_lower,
-                       data->mode, data->line_numbers, data->recursive);
-    } else {
-      // It's a file
-      search_file(data->filename, data->pattern, data->pattern_lower,
-                  data->mode, data->line_numbers);
-    }
+  int new_capacity = *capacity ? *capacity : 256;
+  while (new_capacity < needed) {
+    new_capacity *= 2;
+  }
+  void *grown = realloc(*items, (size_t)new_capacity * item_size);
+  if (!grown) {
+    return FALSE;
   }
+  *items = grown;
+  *capacity = new_capacity;
+  return TRUE;
+}
 
-  // Thread cleanup
-  free(data);
-  return 0;
+/**
+ * Map every text file under the current directory into a corpus, on the
+ * grep pool. Paths go to grep_results.files, which result file ids index.
+ */
+static void load_corpus(Corpus *corpus) {
+  ThreadPoolGroup tasks = {0};
+  SearchContext context = {"", "", SEARCH_MODE_FUZZY, 1, TRUE,
+                           FALSE, NULL, NULL, NULL};
+  context.corpus = corpus;
+  context.tasks = &tasks;
+  search_directory(&context, ".");
 }
 
 /**
- * Check if a file should be skipped based on its extension or properties
+ * Index a mapped file's lines and add it to a corpus. Called by pool
+ * workers; takes over the mapping.
  */
-static int should_skip_file(const char *filename) {
-  // Skip hidden files (starting with .)
-  const char *base_name = strrchr(filename, '\\');
-  if (base_name) {
-    base_name++; // Move past the backslash
-  } else {
-    base_name = filename;
-  }
+static void add_corpus_file(Corpus *corpus, const char *filename,
+                            MappedFile *file) {
+  const char *data = (const char *)file->data;
+  int size = (int)file->size;
+  CorpusLine *lines = NULL;
+  int count = 0;
+  int capacity = 0;
+  int line_number = 1;
 
-  if (base_name[0] == '.') {
-    return 1;
-  }
+  // Index the lines before taking the lock
+  for (int pos = 0; pos < size; line_number++) {
+    const char *newline = (const char *)memchr(data + pos, '\n', size - pos);
+    int line_end = newline ? (int)(newline - data) : size;
+    int length = line_end - pos;
+    if (length > 0 && data[line_end - 1] == '\r') {
+      length--;
+    }
 
-  // Skip common version control directories
-  if (strstr(filename, "\\.git\\") || strstr(filename, "\\.svn\\") ||
-      strstr(filename, "\\.hg\\")) {
-    return 1;
+    if (length > 0) {
+      if (!reserve_items((void **)&lines, &capacity, count + 1,
+                         sizeof(CorpusLine))) {
+        free(lines);
+        return;
+      }
+      lines[count].file_id = -1;
+      lines[count].line_number = line_number;
+      lines[count].offset = pos;
+      lines[count].length = length;
+      lines[count].mask = fuzzy_char_mask(data + pos, length);
+      count++;
+    }
+    pos = line_end + 1;
   }
 
-  // Skip common binary file extensions
-  static const char *binary_exts[] = {
-      ".exe", ".dll",  ".obj", ".o",    ".lib", ".bin", ".dat", ".png",
-      ".jpg", ".jpeg", ".gif", ".bmp",  ".ico", ".zip", ".rar", ".7z",
-      ".gz",  ".tar",  ".mp3", ".mp4",  ".avi", ".mov", ".wav", ".pdf",
-      ".doc", ".docx", ".xls", ".xlsx", ".ppt", ".pptx"};
+  if (count == 0) {
+    return;
+  }
 
-  for (int i = 0; i < sizeof(binary_exts) / sizeof(binary_exts[0]); i++) {
-    if (ends_with(filename, binary_exts[i])) {
-      return 1;
+  char *path = _strdup(filename);
+  EnterCriticalSection(&corpus->lock);
+  int file_id = grep_results.file_count;
+  if (path &&
+      reserve_items((void **)&grep_results.files, &grep_results.file_capacity,
+                    file_id + 1, sizeof(char *)) &&
+      reserve_items((void **)&corpus->maps, &corpus->map_capacity,
+                    file_id + 1, sizeof(MappedFile)) &&
+      reserve_items((void **)&corpus->lines, &corpus->line_capacity,
+                    corpus->line_count + count, sizeof(CorpusLine))) {
+    for (int i = 0; i < count; i++) {
+      lines[i].file_id = file_id;
     }
+    memcpy(corpus->lines + corpus->line_count, lines,
+           count * sizeof(CorpusLine));
+    corpus->line_count += count;
+    corpus->maps[file_id] = *file;
+    grep_results.files[file_id] = path;
+    grep_results.file_count++;
+    memset(file, 0, sizeof(*file));
+    path = NULL;
   }
+  LeaveCriticalSection(&corpus->lock);
 
-  return 0;
+  free(path);
+  free(lines);
 }
 
 /**
- * Check if a string ends with a specific suffix
+ * Unmap a corpus and forget its files, along with any results in them
  */
-static BOOL ends_with(const char *str, const char *suffix) {
-  if (!str || !suffix)
-    return FALSE;
-
-  size_t str_len = strlen(str);
-  size_t suffix_len = strlen(suffix);
-
-  if (suffix_len > str_len)
-    return FALSE;
+static void release_corpus(Corpus *corpus) {
+  for (int i = 0; i < grep_results.file_count && i < corpus->map_capacity;
+       i++) {
+    unmap_file(&corpus->maps[i]);
+  }
+  free(corpus->maps);
+  free(corpus->lines);
+  corpus->maps = NULL;
+  corpus->map_capacity = 0;
+  corpus->lines = NULL;
+  corpus->line_count = 0;
+  corpus->line_capacity = 0;
 
-  return _stricmp(str + str_len - suffix_len, suffix) == 0;
+  free_grep_results();
 }
 
 /**
- * Search a directory for files containing a pattern
+ * Check whether a pattern's characters occur in order in a text, ignoring
+ * case. A line can only have a fuzzy match if they do.
  */
-static void search_directory(const char *directory, const char *pattern,
-                             const char *pattern_lower, SearchMode mode,
-                             int line_numbers, BOOL recursive) {
-  char search_path[MAX_PATH];
-  WIN32_FIND_DATA findData;
-  HANDLE hFind;
-
-  // Prepare search pattern for all files in directory
-  snprintf(search_path, sizeof(search_path), "%s\\*", directory);
-
-  // Start finding files
-  hFind = FindFirstFile(search_path, &findData);
+static BOOL contains_subsequence(const char *text, int text_len,
+                                 const char *pattern_lower) {
+  for (int i = 0; i < text_len && *pattern_lower; i++) {
+    if (tolower((unsigned char)text[i]) == (unsigned char)*pattern_lower) {
+      pattern_lower++;
+    }
+  }
+  return *pattern_lower == '\0';
+}
 
-  if (hFind == INVALID_HANDLE_VALUE) {
+/**
+ * Hand results of the current search to the view
+ */
+static void publish_results(InteractiveSession *session, LONG generation,
+                            const GrepResult *results, int count) {
+  if (count == 0) {
     return;
   }
 
-  // Thread handles and count for parallel processing
-  HANDLE thread_handles[MAX_THREAD_COUNT] = {0};
-  int thread_count = 0;
-
-  // Queue for pending directories (for recursive search)
-  char **dir_queue = NULL;
-  int dir_queue_size = 0;
-  int dir_queue_capacity = 0;
+  EnterCriticalSection(&session->lock);
+  if (generation == session->generation) {
+    if (session->found_generation != generation) {
+      session->found_count = 0;
+      session->found_generation = generation;
+    }
+    if (reserve_items((void **)&session->found, &session->found_capacity,
+                      session->found_count + count, sizeof(GrepResult))) {
+      memcpy(session->found + session->found_count, results,
+             count * sizeof(GrepResult));
+      session->found_count += count;
+    }
+  }
+  LeaveCriticalSection(&session->lock);
+}
 
-  if (recursive) {
-    // Initialize directory queue
-    dir_queue_capacity = 100;
-    dir_queue = (char **)malloc(dir_queue_capacity * sizeof(char *));
+/**
+ * Pool task: filter one slice of lines, publishing its results when done.
+ * Gives up as soon as a newer search starts.
+ */
+static void run_filter_chunk(void *arg) {
+  FilterChunk *chunk = (FilterChunk *)arg;
+  InteractiveSession *session = chunk->session;
+  const Corpus *corpus = &session->corpus;
+  GrepResult *results = NULL;
+  int result_count = 0;
+  int result_capacity = 0;
+
+  chunk->matches = (int *)malloc(chunk->count * sizeof(int));
+  if (!chunk->matches) {
+    chunk->cancelled = TRUE;
+    return;
   }
 
-  do {
-    // Skip "." and ".." directories
-    if (strcmp(findData.cFileName, ".") == 0 ||
-        strcmp(findData.cFileName, "..") == 0) {
-      continue;
+  for (int i = 0; i < chunk->count; i++) {
+    if ((i & 1023) == 0 && session->generation != chunk->generation) {
+      chunk->cancelled = TRUE;
+      break;
     }
 
-    // Build full path
-    char full_path[MAX_PATH];
-    snprintf(full_path, sizeof(full_path), "%s\\%s", directory,
-             findData.cFileName);
-
-    // Skip files that should be ignored
-    if (should_skip_file(full_path)) {
+    int index = chunk->lines ? chunk->lines[chunk->first + i]
+                             : chunk->first + i;
+    const CorpusLine *line = &corpus->lines[index];
+    if ((line->mask & chunk->mask) != chunk->mask) {
       continue;
     }
-
-    if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-      // It's a directory - save for later recursive search if needed
-      if (recursive && dir_queue) {
-        // Add to directory queue
-        if (dir_queue_size >= dir_queue_capacity) {
-          dir_queue_capacity *= 2;
-          dir_queue =
-              (char **)realloc(dir_queue, dir_queue_capacity * sizeof(char *));
-        }
-        dir_queue[dir_queue_size++] = _strdup(full_path);
-      }
-    } else {
-      // It's a file - search it (potentially in a new thread)
-      if (thread_count < MAX_THREAD_COUNT) {
-        // Create a new thread to search this file
-        ThreadData *thread_data = (ThreadData *)malloc(sizeof(ThreadData));
-        if (thread_data) {
-          strcpy(thread_data->filename, full_path);
-          thread_data->pattern = pattern;
-          thread_data->pattern_lower = pattern_lower;
-          thread_data->mode = mode;
-          thread_data->line_numbers = line_numbers;
-          thread_data->recursive = recursive;
-          thread_data->mutex = result_mutex;
-
-          // Create thread
-          thread_handles[thread_count] = (HANDLE)_beginthreadex(
-              NULL, 0, search_thread, thread_data, 0, NULL);
-          if (thread_handles[thread_count]) {
-            thread_count++;
-          } else {
-            // Thread creation failed, search in current thread
-            free(thread_data);
-            search_file(full_path, pattern, pattern_lower, mode, line_numbers);
-          }
-        } else {
-          // Memory allocation failed, search in current thread
-          search_file(full_path, pattern, pattern_lower, mode, line_numbers);
-        }
-      } else {
-        // Too many threads active, search in current thread
-        search_file(full_path, pattern, pattern_lower, mode, line_numbers);
-      }
+    const char *text =
+        (const char *)corpus->maps[line->file_id].data + line->offset;
+    if (!contains_subsequence(text, line->length, chunk->query_lower)) {
+      continue;
     }
-  } while (FindNextFile(hFind, &findData));
-
-  // Wait for all threads to complete
-  if (thread_count > 0) {
-    WaitForMultipleObjects(thread_count, thread_handles, TRUE, INFINITE);
-
-    // Close thread handles
-    for (int i = 0; i < thread_count; i++) {
-      CloseHandle(thread_handles[i]);
+    chunk->matches[chunk->match_count++] = index;
+
+    GrepResult result;
+    result.match_score = fuzzy_match(chunk->fuzzy, text, line->length,
+                                     &result.match_start,
+                                     &result.match_length);
+    if (result.match_score <= FUZZY_MIN_SCORE ||
+        !ranked_result_wanted(results, result_count, FUZZY_TOP_RESULTS,
+                              result.match_score)) {
+      continue;
     }
-  }
-
-  // Process directory queue for recursive search
-  if (recursive && dir_queue) {
-    for (int i = 0; i < dir_queue_size; i++) {
-      // Search each directory recursively
-      search_directory(dir_queue[i], pattern, pattern_lower, mode, line_numbers,
-                       recursive);
-      free(dir_queue[i]);
+    if (result_count < FUZZY_TOP_RESULTS &&
+        !reserve_items((void **)&results, &result_capacity, result_count + 1,
+                       sizeof(GrepResult))) {
+      break;
     }
-    free(dir_queue);
+    result.file_id = line->file_id;
+    result.line_number = line->line_number;
+    result.line_offset = line->offset;
+    result.line_length = line->length;
+    result.pattern_id = -1;
+    insert_ranked_result(results, &result_count, FUZZY_TOP_RESULTS, &result);
   }
 
-  FindClose(hFind);
+  if (!chunk->cancelled) {
+    publish_results(session, chunk->generation, results, result_count);
+  }
+  free(results);
 }
 
 /**
- * Extract a line from a buffer starting at a given position
+ * Search the corpus for a query on the grep pool. A line containing a query
+ * contains every prefix of it too, so when the query extends the last one
+ * searched to completion, only that search's candidate lines are filtered.
  */
-static char *extract_line_from_buffer(const char *buffer, int buffer_size,
-                                      int line_start, int *line_length) {
-  int i = line_start;
+static void filter_corpus(InteractiveSession *session, const char *query,
+                          LONG generation) {
+  FilterChunk *chunks = NULL;
+  int chunk_count = 0;
+  ThreadPoolGroup tasks = {0};
+  char *query_lower = NULL;
+  FuzzyPattern *fuzzy = NULL;
+
+  // The empty query matches nothing, and every line is a candidate for it
+  if (query[0] == '\0') {
+    free(session->candidates);
+    free(session->refined_query);
+    session->candidates = NULL;
+    session->refined_query = NULL;
+    session->candidate_count = 0;
+    goto done;
+  }
 
-  // Find the end of the line (newline or buffer end)
-  while (i < buffer_size && buffer[i] != '\n' && buffer[i] != '\r') {
-    i++;
+  BOOL refine = session->refined_query &&
+                strncmp(query, session->refined_query,
+                        strlen(session->refined_query)) == 0;
+  const int *lines = refine ? session->candidates : NULL;
+  int count = refine ? session->candidate_count : session->corpus.line_count;
+
+  query_lower = _strdup(query);
+  fuzzy = fuzzy_pattern_create(query);
+  if (!query_lower || !fuzzy) {
+    goto done;
+  }
+  for (char *p = query_lower; *p; p++) {
+    *p = tolower((unsigned char)*p);
   }
 
-  // Calculate line length
-  *line_length = i - line_start;
+  chunk_count = (count + INTERACTIVE_CHUNK_LINES - 1) / INTERACTIVE_CHUNK_LINES;
+  chunks = (FilterChunk *)calloc(chunk_count ? chunk_count : 1,
+                                 sizeof(FilterChunk));
+  if (!chunks) {
+    goto done;
+  }
 
-  // Copy the line to a new buffer
-  char *line = (char *)malloc(*line_length + 1);
-  if (!line)
-    return NULL;
+  for (int i = 0; i < chunk_count; i++) {
+    FilterChunk *chunk = &chunks[i];
+    chunk->session = session;
+    chunk->generation = generation;
+    chunk->fuzzy = fuzzy;
+    chunk->mask = fuzzy_pattern_mask(fuzzy);
+    chunk->query_lower = query_lower;
+    chunk->lines = lines;
+    chunk->first = i * INTERACTIVE_CHUNK_LINES;
+    chunk->count = count - chunk->first < INTERACTIVE_CHUNK_LINES
+                       ? count - chunk->first
+                       : INTERACTIVE_CHUNK_LINES;
+    if (!thread_pool_submit_group(grep_pool, &tasks, run_filter_chunk,
+                                  chunk)) {
+      run_filter_chunk(chunk);
+    }
+  }
+  thread_pool_wait_group(grep_pool, &tasks);
+
+  // A finished search's lines become the candidates for the next keystroke
+  BOOL complete = session->generation == generation;
+  int total = 0;
+  for (int i = 0; i < chunk_count; i++) {
+    complete = complete && !chunks[i].cancelled;
+    total += chunks[i].match_count;
+  }
+  if (complete) {
+    int *candidates = (int *)malloc((total ? total : 1) * sizeof(int));
+    char *refined_query = _strdup(query);
+    if (candidates && refined_query) {
+      int next = 0;
+      for (int i = 0; i < chunk_count; i++) {
+        memcpy(candidates + next, chunks[i].matches,
+               chunks[i].match_count * sizeof(int));
+        next += chunks[i].match_count;
+      }
+      free(session->candidates);
+      free(session->refined_query);
+      session->candidates = candidates;
+      session->refined_query = refined_query;
+      session->candidate_count = total;
+    } else {
+      free(candidates);
+      free(refined_query);
+    }
+  }
+
+  for (int i = 0; i < chunk_count; i++) {
+    free(chunks[i].matches);
+  }
 
-  memcpy(line, buffer + line_start, *line_length);
-  line[*line_length] = '\0';
+done:
+  free(chunks);
+  free(query_lower);
+  fuzzy_pattern_free(fuzzy);
 
-  return line;
+  EnterCriticalSection(&session->lock);
+  session->completed_generation = generation;
+  LeaveCriticalSection(&session->lock);
 }
 
 /**
- * Search a file for a pattern using Boyer-Moore algorithm
+ * Search thread: run the most recently posted query until none is pending
  */
-static void search_file(const char *filename, const char *pattern,
-                        const char *pattern_lower, SearchMode mode,
-                        int line_numbers) {
-  // Skip non-text files based on extension
-  if (!is_text_file(filename)) {
-    return;
-  }
+static unsigned __stdcall interactive_search_worker(void *arg) {
+  InteractiveSession *session = (InteractiveSession *)arg;
+  char query[sizeof(session->query)];
+
+  while (WaitForSingleObject(session->wakeup, INFINITE) == WAIT_OBJECT_0 &&
+         !session->stop) {
+    for (;;) {
+      EnterCriticalSection(&session->lock);
+      if (!session->query_posted || session->stop) {
+        SetEvent(session->idle);
+        LeaveCriticalSection(&session->lock);
+        break;
+      }
+      memcpy(query, session->query, sizeof(query));
+      LONG generation = session->query_generation;
+      BOOL corpus_changed = session->corpus_changed;
+      session->query_posted = FALSE;
+      session->corpus_changed = FALSE;
+      LeaveCriticalSection(&session->lock);
+
+      if (corpus_changed) {
+        free(session->candidates);
+        free(session->refined_query);
+        session->candidates = NULL;
+        session->refined_query = NULL;
+        session->candidate_count = 0;
+      }
 
-  FILE *file = fopen(filename, "rb");
-  if (!file) {
-    return;
+      filter_corpus(session, query, generation);
+    }
   }
 
-  // Get file size
-  fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
-  fseek(file, 0, SEEK_SET);
+  return 0;
+}
 
-  // Skip empty files
-  if (file_size == 0) {
-    fclose(file);
-    return;
+/**
+ * Set up an interactive session and start its search thread
+ * @return TRUE on success
+ */
+static BOOL start_interactive_session(InteractiveSession *session) {
+  memset(session, 0, sizeof(*session));
+  if (!init_grep_workers()) {
+    return FALSE;
   }
 
-  // Allocate a buffer for the file content
-  int buffer_size = (file_size < MAX_BUFFER_SIZE) ? file_size : MAX_BUFFER_SIZE;
-  char *buffer = (char *)malloc(buffer_size + 1); // +1 for null terminator
-
-  if (!buffer) {
-    fclose(file);
-    return;
+  InitializeCriticalSection(&session->lock);
+  InitializeCriticalSection(&session->corpus.lock);
+  session->wakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+  session->idle = CreateEvent(NULL, TRUE, TRUE, NULL);
+  if (session->wakeup && session->idle) {
+    session->thread = (HANDLE)_beginthreadex(
+        NULL, 0, interactive_search_worker, session, 0, NULL);
   }
 
-  int pattern_len = strlen(pattern);
-  int line_number = 1;
-  long bytes_read_total = 0;
-
-  // Process the file in chunks
-  while (bytes_read_total < file_size) {
-    // Read a chunk of the file
-    int bytes_to_read = buffer_size;
-    if (bytes_read_total + bytes_to_read > file_size) {
-      bytes_to_read = file_size - bytes_read_total;
-    }
+  if (!session->thread) {
+    stop_interactive_session(session);
+    return FALSE;
+  }
+  return TRUE;
+}
 
-    int bytes_read = fread(buffer, 1, bytes_to_read, file);
-    if (bytes_read <= 0) {
-      break;
+/**
+ * Stop the search thread and free everything the session holds
+ */
+static void stop_interactive_session(InteractiveSession *session) {
+  if (session->thread) {
+    InterlockedExchange(&session->stop, 1);
+    InterlockedIncrement(&session->generation);
+    SetEvent(session->wakeup);
+    WaitForSingleObject(session->thread, INFINITE);
+    CloseHandle(session->thread);
+    session->thread = NULL;
+  }
+  if (session->wakeup) {
+    CloseHandle(session->wakeup);
+  }
+  if (session->idle) {
+    CloseHandle(session->idle);
+  }
+
+  release_corpus(&session->corpus);
+  DeleteCriticalSection(&session->corpus.lock);
+  DeleteCriticalSection(&session->lock);
+  free(session->found);
+  free(session->candidates);
+  free(session->refined_query);
+}
+
+/**
+ * Start searching for a query, cancelling any search in progress
+ * @return The generation its results are published under
+ */
+static LONG post_interactive_query(InteractiveSession *session,
+                                   const char *query) {
+  EnterCriticalSection(&session->lock);
+  LONG generation = InterlockedIncrement(&session->generation);
+  snprintf(session->query, sizeof(session->query), "%s", query);
+  session->query_generation = generation;
+  session->query_posted = TRUE;
+  ResetEvent(session->idle);
+  LeaveCriticalSection(&session->lock);
+
+  SetEvent(session->wakeup);
+  return generation;
+}
+
+/**
+ * Make the search in progress give up
+ */
+static void cancel_interactive_search(InteractiveSession *session) {
+  InterlockedIncrement(&session->generation);
+}
+
+/**
+ * Cancel any search and wait until the thread leaves the corpus alone
+ */
+static void pause_interactive_search(InteractiveSession *session) {
+  cancel_interactive_search(session);
+  WaitForSingleObject(session->idle, INFINITE);
+}
+
+/**
+ * Tell the search thread its candidate lines refer to a corpus that has
+ * since been mapped again
+ */
+static void mark_corpus_changed(InteractiveSession *session) {
+  EnterCriticalSection(&session->lock);
+  session->corpus_changed = TRUE;
+  LeaveCriticalSection(&session->lock);
+}
+
+/**
+ * Append results streamed for a search to grep_results
+ * @param searching Receives whether that search is still running
+ */
+static void take_streamed_results(InteractiveSession *session,
+                                  LONG generation, BOOL *searching) {
+  EnterCriticalSection(&session->lock);
+  if (session->found_generation == generation && session->found_count > 0 &&
+      reserve_items((void **)&grep_results.results, &grep_results.capacity,
+                    grep_results.count + session->found_count,
+                    sizeof(GrepResult))) {
+    memcpy(grep_results.results + grep_results.count, session->found,
+           session->found_count * sizeof(GrepResult));
+    grep_results.count += session->found_count;
+    keep_best_results(grep_results.results, &grep_results.count,
+                      FUZZY_TOP_RESULTS);
+  }
+  session->found_count = 0;
+  *searching = session->completed_generation != generation;
+  LeaveCriticalSection(&session->lock);
+}
+
+/**
+ * Check if a file or directory is hidden or belongs to version control.
+ * Binary files are told apart by their contents once mapped.
+ */
+static int should_skip_file(const char *filename) {
+  // Skip hidden files (starting with .)
+  const char *base_name = strrchr(filename, '\\');
+  if (base_name) {
+    base_name++; // Move past the backslash
+  } else {
+    base_name = filename;
+  }
+
+  if (base_name[0] == '.') {
+    return 1;
+  }
+
+  // Skip common version control directories
+  if (strstr(filename, "\\.git\\") || strstr(filename, "\\.svn\\") ||
+      strstr(filename, "\\.hg\\")) {
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Run one queued task: search a file, or enumerate a directory and queue
+ * its files and (when recursive) subdirectories as further tasks. When
+ * output is streamed, a directory's entries get their output nodes, in
+ * enumeration order, before any of them is queued.
+ */
+static void run_search_task(void *arg) {
+  SearchTask *task = (SearchTask *)arg;
+  const SearchContext *context = task->context;
+
+  // A pipeline that has every row it uses, or a closed picker, needs no
+  // more searching; the task's node is left incomplete and dropped when the
+  // output is finished
+  if (output_cancelled(context->output)) {
+    free(task);
+    return;
+  }
+
+  if (!task->is_directory) {
+    search_file(context, task->path, task->node);
+    free(task);
+    return;
+  }
+
+  // The shared file index serves the entries, with their ignore status,
+  // from memory when the directory has not changed since it was last read
+  FileIndexEntry *entries = NULL;
+  int entry_count = file_index_list(context->recursive ? task->root : NULL,
+                                    task->path, &entries);
+  char **paths = NULL;
+  BOOL *directories = NULL;
+  int count = 0;
+
+  if (entry_count > 0) {
+    paths = (char **)malloc(entry_count * sizeof(char *));
+    directories = (BOOL *)malloc(entry_count * sizeof(BOOL));
+  }
+  for (int i = 0; paths && directories && i < entry_count; i++) {
+    // Build full path
+    char full_path[MAX_PATH];
+    snprintf(full_path, sizeof(full_path), "%s\\%s", task->path,
+             entries[i].name);
+
+    // Skip files that should be ignored; an ignored directory is never
+    // opened, so nothing below it costs anything
+    BOOL is_directory =
+        (entries[i].attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    if (should_skip_file(full_path) || entries[i].ignored ||
+        (is_directory && !context->recursive)) {
+      continue;
+    }
+
+    paths[count] = _strdup(full_path);
+    if (paths[count]) {
+      directories[count++] = is_directory;
+    }
+  }
+  free(entries);
+
+  // Publish the entries' nodes together, then queue them
+  OutputNode **nodes = NULL;
+  if (task->node) {
+    nodes = (OutputNode **)calloc(count + 1, sizeof(OutputNode *));
+    for (int i = 0; nodes && i < count; i++) {
+      nodes[i] = create_output_node();
+    }
+    EnterCriticalSection(&context->output->lock);
+    task->node->children = nodes;
+    task->node->child_count = nodes ? count : 0;
+    task->node->complete = TRUE;
+    LeaveCriticalSection(&context->output->lock);
+  }
+
+  for (int i = 0; i < count; i++) {
+    queue_search_task(context, nodes ? nodes[i] : NULL, task->root, paths[i],
+                      directories[i]);
+    free(paths[i]);
+  }
+
+  free(paths);
+  free(directories);
+  free(task);
+}
+
+/**
+ * Queue a file or directory on the grep pool. Tasks queued by a worker go
+ * to its own deque, and idle workers steal the oldest ones, so enumerating
+ * directories and searching files overlap across the whole tree. Without a
+ * pool the task runs immediately on the calling thread.
+ */
+static void queue_search_task(const SearchContext *context, OutputNode *node,
+                              const char *root, const char *path,
+                              BOOL is_directory) {
+  SearchTask *task = (SearchTask *)malloc(sizeof(SearchTask));
+  if (!task) {
+    return;
+  }
+  task->context = context;
+  task->node = node;
+  task->root = root;
+  task->is_directory = is_directory;
+  strncpy(task->path, path, MAX_PATH - 1);
+  task->path[MAX_PATH - 1] = '\0';
+
+  if (!grep_pool || !thread_pool_submit_group(grep_pool, context->tasks,
+                                              run_search_task, task)) {
+    run_search_task(task);
+  }
+}
+
+/**
+ * Search a directory for files containing a pattern
+ */
+static void search_directory(const SearchContext *context,
+                             const char *directory) {
+  if (!init_grep_workers()) {
+    return;
+  }
+
+  OutputNode *root = NULL;
+  if (context->output) {
+    root = create_output_node();
+    context->output->root = root;
+  }
+  queue_search_task(context, root, directory, directory, TRUE);
+
+  // The context belongs to the caller, so every task must finish first
+  thread_pool_wait_group(grep_pool, context->tasks);
+  finish_output(context->output);
+  merge_thread_results();
+}
+
+/**
+ * Search a directory tree through its trigram index: bring the index up to
+ * date, then search only the files holding every trigram of one of the
+ * literals. With no literals (or only short ones) every indexed file is
+ * searched, which still saves the directory walk's reads.
+ */
+static void search_indexed(const SearchContext *context,
+                           const char *directory,
+                           const char *const *literals, int literal_count) {
+  if (!init_grep_workers()) {
+    return;
+  }
+
+  TrigramIndexStats stats;
+  TrigramIndex *index = trigram_index_update(directory, grep_pool, &stats);
+  if (!index) {
+    printf("grep: could not write the index for %s, searching without it\n",
+           directory);
+    search_directory(context, directory);
+    return;
+  }
+
+  int file_count = trigram_index_file_count(index);
+  unsigned char *candidates = (unsigned char *)calloc(file_count + 1, 1);
+  if (!candidates) {
+    printf("grep: memory allocation error\n");
+    trigram_index_close(index);
+    return;
+  }
+
+  // A match of any literal makes a file a candidate, so marks add up; one
+  // literal that cannot narrow the search means every file is a candidate
+  BOOL narrowed = literal_count > 0;
+  for (int i = 0; i < literal_count && narrowed; i++) {
+    if (!trigram_index_mark(index, literals[i], context->ignore_case,
+                            candidates)) {
+      narrowed = FALSE;
+    }
+  }
+
+  int searched = 0;
+  for (int i = 0; i < file_count; i++) {
+    searched += !narrowed || candidates[i];
+  }
+
+  // Files are streamed in index order, which is sorted by path
+  OutputNode *root = context->output ? create_output_node() : NULL;
+  if (root) {
+    root->children = (OutputNode **)calloc(searched + 1, sizeof(OutputNode *));
+    for (int i = 0; root->children && i < searched; i++) {
+      root->children[i] = create_output_node();
     }
+    root->child_count = root->children ? searched : 0;
+    root->complete = TRUE;
+    context->output->root = root;
+  }
 
-    // Null-terminate the buffer
-    buffer[bytes_read] = '\0';
+  int queued = 0;
+  for (int i = 0; i < file_count; i++) {
+    if (narrowed && !candidates[i]) {
+      continue;
+    }
+    char path[MAX_PATH];
+    trigram_index_file_path(index, i, path, sizeof(path));
+    queue_search_task(context,
+                      root && root->children ? root->children[queued] : NULL,
+                      NULL, path, FALSE);
+    queued++;
+  }
+
+  thread_pool_wait_group(grep_pool, context->tasks);
+  finish_output(context->output);
+  merge_thread_results();
+
+  if (!context->output ||
+      (!context->output->table && !context->output->picker)) {
+    printf("Index: %d files (%d reindexed, %d removed), %d searched\n",
+           stats.files, stats.reindexed, stats.removed, searched);
+  }
+
+  free(candidates);
+  trigram_index_close(index);
+}
+
+/**
+ * Count the newlines in a buffer, 16 bytes at a time where SSE2 is available
+ */
+static int count_newlines(const char *data, int size) {
+  int count = 0;
+  int i = 0;
+
+#ifdef GREP_HAVE_SSE2
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i zero = _mm_setzero_si128();
+
+  while (size - i >= 16) {
+    // Per-byte counters, summed before any of them can overflow
+    __m128i counts = zero;
+    int blocks = (size - i) / 16;
+    if (blocks > 255) {
+      blocks = 255;
+    }
+    for (int b = 0; b < blocks; b++, i += 16) {
+      __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+      counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(chunk, newline));
+    }
+    __m128i sums = _mm_sad_epu8(counts, zero);
+    count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+  }
+#endif
+
+  for (; i < size; i++) {
+    count += data[i] == '\n';
+  }
+  return count;
+}
+
+/**
+ * Run the matcher over the whole buffer at once. Line boundaries and line
+ * numbers are only worked out around hits, so text without matches costs no
+ * more than the matcher's own scan.
+ */
+static void search_buffer_hits(FileHits *hits, const char *data,
+                               int size, const LiteralMatcher *literal) {
+  int pattern_len = literal->length;
+  int line_number = 1;
+  int counted_to = 0; // Newlines before this offset are in line_number
+  int pos = 0;        // Always the start of a line
+
+  while (pos < size) {
+    int hit = literal_matcher_find(literal, data + pos, size - pos);
+    if (hit < 0) {
+      break;
+    }
+    hit += pos;
+
+    int line_start = hit;
+    while (line_start > pos && data[line_start - 1] != '\n') {
+      line_start--;
+    }
+    const char *newline =
+        (const char *)memchr(data + hit, '\n', size - hit);
+    int line_end = newline ? (int)(newline - data) : size;
+
+    line_number += count_newlines(data + counted_to, line_start - counted_to);
+    counted_to = line_start;
+
+    int line_length = line_end - line_start;
+    if (line_length > 0 && data[line_end - 1] == '\r') {
+      line_length--;
+    }
+
+    // A match in the line's '\r' is not a match in the text
+    if (hit - line_start + pattern_len <= line_length) {
+      add_grep_result(hits, line_number, line_start, line_length,
+                      hit - line_start, pattern_len, -1, 1.0);
+      if (file_hits_done(hits)) {
+        break;
+      }
+    }
+
+    // One result per line
+    pos = line_end + 1;
+  }
+}
+
+/**
+ * Score every line on its own; used for fuzzy matching, where the score
+ * depends on the whole line
+ */
+static void search_buffer_lines(FileHits *hits, const char *data,
+                                int size, const SearchContext *context) {
+  int line_number = 1;
+  int pos = 0;
+
+  while (pos < size) {
+    const char *newline = (const char *)memchr(data + pos, '\n', size - pos);
+    int line_end = newline ? (int)(newline - data) : size;
+    int line_length = line_end - pos;
+    if (line_length > 0 && data[line_end - 1] == '\r') {
+      line_length--;
+    }
+
+    // Process the line if it's not empty
+    if (line_length > 0) {
+      BOOL found_match = FALSE;
+      int match_start = 0;
+      int match_length = 0;
+      double match_score = 0.0;
+
+      if (context->mode == SEARCH_MODE_FUZZY) {
+        match_score = fuzzy_match(context->fuzzy, data + pos, line_length,
+                                  &match_start, &match_length);
+        found_match = match_score > FUZZY_MIN_SCORE;
+      } else {
+        match_start =
+            literal_matcher_find(&context->literal, data + pos, line_length);
+        if (match_start >= 0) {
+          found_match = TRUE;
+          match_length = context->literal.length;
+          match_score = 1.0;
+        }
+      }
+
+      // Report the match if found
+      if (found_match) {
+        add_grep_result(hits, line_number, pos, line_length, match_start,
+                        match_length, -1, match_score);
+        if (file_hits_done(hits)) {
+          break;
+        }
+      }
+    }
+
+    pos = line_end + 1;
+    line_number++;
+  }
+}
+
+/**
+ * Get the calling thread's regex scratch, creating it on first use
+ */
+static RegexScratch *current_regex_scratch(const SearchContext *context) {
+  RegexScratch **scratch = &context->scratch[current_thread_slot()];
+  if (!*scratch) {
+    *scratch = regex_scratch_create(context->regex);
+  }
+  return *scratch;
+}
+
+/**
+ * Run a regular expression over the whole buffer. When the pattern has a
+ * literal every match must contain, the literal matcher finds candidate lines
+ * and only those are run through the regex; otherwise the DFA scans the
+ * buffer directly. Either way the match span is computed only for matching
+ * lines.
+ */
+static void search_buffer_regex(FileHits *hits, const char *data, int size,
+                                const SearchContext *context) {
+  RegexScratch *scratch = current_regex_scratch(context);
+  if (!scratch) {
+    return;
+  }
+
+  const Regex *regex = context->regex;
+  const LiteralMatcher *literal =
+      context->literal.length > 0 ? &context->literal : NULL;
+  int line_number = 1;
+  int counted_to = 0; // Newlines before this offset are in line_number
+  int pos = 0;        // Always the start of a line
+
+  while (pos < size) {
+    int hit = literal ? literal_matcher_find(literal, data + pos, size - pos)
+                      : regex_scan(regex, scratch, data + pos, size - pos);
+    if (hit < 0) {
+      break;
+    }
+    hit += pos;
+
+    int line_start = hit;
+    while (line_start > pos && data[line_start - 1] != '\n') {
+      line_start--;
+    }
+    const char *newline =
+        (const char *)memchr(data + hit, '\n', size - hit);
+    int line_end = newline ? (int)(newline - data) : size;
+
+    int line_length = line_end - line_start;
+    if (line_length > 0 && data[line_end - 1] == '\r') {
+      line_length--;
+    }
+
+    // A literal hit only makes the line a candidate
+    int match_start;
+    int match_length;
+    if ((!literal || regex_scan(regex, scratch, data + line_start,
+                                line_end - line_start) >= 0) &&
+        regex_match_line(regex, scratch, data + line_start, line_length,
+                         &match_start, &match_length)) {
+      line_number +=
+          count_newlines(data + counted_to, line_start - counted_to);
+      counted_to = line_start;
+      add_grep_result(hits, line_number, line_start, line_length, match_start,
+                      match_length, -1, 1.0);
+      if (file_hits_done(hits)) {
+        break;
+      }
+    }
+
+    pos = line_end + 1;
+  }
+}
+
+/**
+ * Search for several strings in one pass over the buffer, tagging each
+ * result with the pattern that matched
+ */
+static void search_buffer_patterns(FileHits *hits, const char *data, int size,
+                                   const PatternSet *pattern_set) {
+  int line_number = 1;
+  int counted_to = 0; // Newlines before this offset are in line_number
+  int pos = 0;        // Always the start of a line
+
+  while (pos < size) {
+    int pattern_id;
+    int match_length;
+    int hit = pattern_set_find(pattern_set, data + pos, size - pos,
+                               &pattern_id, &match_length);
+    if (hit < 0) {
+      break;
+    }
+    hit += pos;
+
+    int line_start = hit;
+    while (line_start > pos && data[line_start - 1] != '\n') {
+      line_start--;
+    }
+    const char *newline =
+        (const char *)memchr(data + hit, '\n', size - hit);
+    int line_end = newline ? (int)(newline - data) : size;
+
+    int line_length = line_end - line_start;
+    if (line_length > 0 && data[line_end - 1] == '\r') {
+      line_length--;
+    }
+
+    // A pattern containing a line ending never matches within a line
+    if (hit - line_start + match_length <= line_length) {
+      line_number +=
+          count_newlines(data + counted_to, line_start - counted_to);
+      counted_to = line_start;
+      add_grep_result(hits, line_number, line_start, line_length,
+                      hit - line_start, match_length, pattern_id, 1.0);
+      if (file_hits_done(hits)) {
+        break;
+      }
+    }
+
+    pos = line_end + 1;
+  }
+}
+
+/**
+ * Search a file for the context's pattern: literals scan for their rarest
+ * byte (or use Horspool skips), regexes run the regex engine, and several
+ * patterns and fuzzy queries go line by line
+ *
+ * The file is mapped and searched as one buffer, so lines never straddle a
+ * read boundary. When output is streamed, the file's output is formatted
+ * while it is still mapped and handed to its node.
+ */
+static void search_file(const SearchContext *context, const char *filename,
+                        OutputNode *node) {
+  char *text = NULL;
+  size_t length = 0;
+  RowBatch rows = {NULL, 0, 0};
+  int matched = 0;
+
+  // Empty files cannot be mapped and have nothing to find; a NUL byte near
+  // the start marks a binary file, whatever its name
+  MappedFile file;
+  BOOL mapped = map_file(filename, &file);
+
+  // Offsets are ints, like the line numbers and match positions they feed
+  if (mapped && !looks_binary(file.data, file.size) &&
+      file.size <= INT_MAX) {
+    const char *data = (const char *)file.data;
+    int size = (int)file.size;
+    FileHits hits = {filename, -1, current_result_buffer(), context->top_k};
+    const char *pattern = context->pattern;
+    SearchMode mode = context->mode;
+
+    // -l knows its answer at the first match, -m at the Nth
+    hits.limit =
+        context->output_mode == OUTPUT_FILES ? 1 : context->max_count;
+    hits.count_only = context->output_mode != OUTPUT_LINES;
+    hits.data = data;
+    int first_result = hits.buffer->count;
+
+    // In a pipeline each match becomes a row as it is found, and no file
+    // needs more rows than the whole pipeline uses
+    const GrepOutput *output = context->output;
+    if (output && output->table) {
+      hits.rows = &rows;
+      if (output->row_limit > 0 &&
+          (hits.limit == 0 || output->row_limit < hits.limit)) {
+        hits.limit = output->row_limit;
+      }
+    }
+    if (output && output->picker) {
+      hits.picker = output->picker;
+    }
+
+    if (context->corpus) {
+      add_corpus_file(context->corpus, filename, &file);
+    } else if (mode == SEARCH_MODE_REGEX) {
+      search_buffer_regex(&hits, data, size, context);
+    } else if (mode == SEARCH_MODE_PATTERNS) {
+      search_buffer_patterns(&hits, data, size, context->pattern_set);
+    } else if (mode == SEARCH_MODE_FUZZY || pattern[0] == '\0') {
+      search_buffer_lines(&hits, data, size, context);
+    } else {
+      search_buffer_hits(&hits, data, size, &context->literal);
+    }
+
+    matched = hits.matched;
+    if (output && !output->table && !output->picker) {
+      if (matched > 0) {
+        text = format_file_output(context, &hits, data, size, first_result,
+                                  &length);
+      }
+      // Printed lines are not kept, so memory stays flat however many
+      // lines match: the buffer goes back to where this file started
+      hits.buffer->count = first_result;
+      if (hits.file_id >= 0) {
+        free(hits.buffer->files[hits.file_id]);
+        hits.buffer->file_count = hits.file_id;
+      }
+    }
+  }
+
+  if (mapped) {
+    unmap_file(&file);
+  }
+  if (context->output) {
+    complete_output_node(context->output, node, text, length, &rows, matched);
+  }
+}
+
+/**
+ * Check whether a file's search has its answer: -l's first match, or -m's
+ * limit
+ */
+static BOOL file_hits_done(const FileHits *hits) {
+  return hits->limit > 0 && hits->matched >= hits->limit;
+}
+
+/**
+ * Append text to a buffer
+ * @return FALSE on allocation failure
+ */
+static BOOL append_text(TextBuffer *buffer, const char *text, size_t length) {
+  if (buffer->length + length + 1 > buffer->capacity) {
+    size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+    while (capacity < buffer->length + length + 1) {
+      capacity *= 2;
+    }
+    char *data = (char *)realloc(buffer->data, capacity);
+    if (!data) {
+      return FALSE;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->data + buffer->length, text, length);
+  buffer->length += length;
+  buffer->data[buffer->length] = '\0';
+  return TRUE;
+}
+
+static void append_string(TextBuffer *buffer, const char *text) {
+  append_text(buffer, text, strlen(text));
+}
+
+/**
+ * Find the start of the line before the one starting at offset
+ * @param floor Offset the search does not go below
+ * @return The line's start, or -1 if offset is already at floor
+ */
+static int previous_line_start(const char *data, int offset, int floor) {
+  if (offset <= floor) {
+    return -1;
+  }
+  int start = offset - 1; // The previous line's '\n'
+  while (start > floor && data[start - 1] != '\n') {
+    start--;
+  }
+  return start;
+}
+
+/**
+ * Measure the line starting at offset
+ * @param next Receives the offset of the line after it
+ * @return The line's length, without its line ending
+ */
+static int line_extent(const char *data, int size, int offset, int *next) {
+  const char *newline =
+      (const char *)memchr(data + offset, '\n', size - offset);
+  int end = newline ? (int)(newline - data) : size;
+  *next = newline ? end + 1 : size;
+  if (end > offset && data[end - 1] == '\r') {
+    end--;
+  }
+  return end - offset;
+}
+
+/**
+ * Start an output line: the path and, with -n, the line number, each
+ * followed by ':' for a matching line or '-' for a context line
+ */
+static void append_line_prefix(TextBuffer *text, const SearchContext *context,
+                               const char *path, int line_number,
+                               char separator) {
+  BOOL color = context->output->color;
+  char number[48];
+
+  append_string(text, color ? "\033[35m" : "");
+  append_string(text, path);
+  append_string(text, color ? "\033[0m" : "");
+  append_text(text, &separator, 1);
+  if (context->line_numbers) {
+    snprintf(number, sizeof(number), color ? "\033[32m%d\033[0m%c" : "%d%c",
+             line_number, separator);
+    append_string(text, number);
+  }
+}
+
+// Where a file's context output has got to
+typedef struct {
+  int printed_to;   // Offset of the first line not yet printed
+  int printed_line; // Its line number
+  int after_left;   // Lines of -A context still owed to the last match
+  BOOL printed;     // Anything printed, so a gap needs a "--" separator
+} ContextCursor;
+
+/**
+ * Print the -A context still owed, stopping short of limit (the next
+ * match's line, or the end of the file). Lines are sliced straight out of
+ * the mapped file.
+ */
+static void append_after_context(TextBuffer *text, const SearchContext *context,
+                                 const char *path, const char *data, int size,
+                                 ContextCursor *cursor, int limit) {
+  while (cursor->after_left > 0 && cursor->printed_to < limit) {
+    int next;
+    int length = line_extent(data, size, cursor->printed_to, &next);
+    append_line_prefix(text, context, path, cursor->printed_line, '-');
+    append_text(text, data + cursor->printed_to,
+                length < MAX_LINE_LENGTH ? length : MAX_LINE_LENGTH);
+    append_string(text, "\n");
+    cursor->printed_to = next;
+    cursor->printed_line++;
+    cursor->after_left--;
+  }
+}
+
+/**
+ * Print the -B context of a match's line, leaving out lines already
+ * printed. The starts of the lines before the match are collected walking
+ * back from it into starts, which has room for -B offsets, so only the
+ * lines shown are ever scanned.
+ */
+static void append_before_context(TextBuffer *text,
+                                  const SearchContext *context,
+                                  const char *path, const char *data,
+                                  int size, ContextCursor *cursor,
+                                  int *starts, const GrepResult *result) {
+  int count = 0;
+  int start = result->line_offset;
+  while (count < context->before_context &&
+         (start = previous_line_start(data, start, cursor->printed_to)) >=
+             0) {
+    starts[count++] = start;
+  }
+
+  // Context that does not follow on from what was printed gets a separator
+  int first = count > 0 ? starts[count - 1] : result->line_offset;
+  if (cursor->printed && first > cursor->printed_to) {
+    append_string(text, context->output->color ? "\033[36m--\033[0m\n"
+                                               : "--\n");
+  }
+
+  for (int i = count - 1; i >= 0; i--) {
+    int next;
+    int length = line_extent(data, size, starts[i], &next);
+    append_line_prefix(text, context, path, result->line_number - i - 1,
+                       '-');
+    append_text(text, data + starts[i],
+                length < MAX_LINE_LENGTH ? length : MAX_LINE_LENGTH);
+    append_string(text, "\n");
+  }
+}
+
+/**
+ * Format what a file prints: its matching lines (in the order found, so by
+ * line) with any -A/-B context, its path, or its count. Context that
+ * overlaps or touches the next match's is merged into one run; runs that
+ * do not meet are separated by "--". Paths, line numbers and matches are
+ * colored with escape sequences when the output is a console.
+ */
+static char *format_file_output(const SearchContext *context,
+                                const FileHits *hits, const char *data,
+                                int size, int first_result, size_t *length) {
+  BOOL color = context->output->color;
+  TextBuffer text = {NULL, 0, 0};
+  char number[32];
+
+  const char *path = hits->filename;
+  if (strncmp(path, ".\\", 2) == 0) {
+    path += 2;
+  }
+
+  if (context->output_mode != OUTPUT_LINES) {
+    append_string(&text, color ? "\033[35m" : "");
+    append_string(&text, path);
+    append_string(&text, color ? "\033[0m" : "");
+    if (context->output_mode == OUTPUT_COUNT) {
+      snprintf(number, sizeof(number), ":%d", hits->matched);
+      append_string(&text, number);
+    }
+    append_string(&text, "\n");
+    *length = text.length;
+    return text.data;
+  }
+
+  BOOL with_context =
+      context->before_context > 0 || context->after_context > 0;
+  ContextCursor cursor = {0, 1, 0, FALSE};
+  int *starts = NULL;
+  if (context->before_context > 0) {
+    starts = (int *)malloc(context->before_context * sizeof(int));
+    if (!starts) {
+      with_context = FALSE;
+    }
+  }
+
+  const ResultBuffer *buffer = hits->buffer;
+  for (int i = first_result; i < buffer->count; i++) {
+    const GrepResult *result = &buffer->results[i];
+    const char *line = data + result->line_offset;
+    int line_length = result->line_length < MAX_LINE_LENGTH
+                          ? result->line_length
+                          : MAX_LINE_LENGTH;
+    int match_start =
+        result->match_start < line_length ? result->match_start : line_length;
+    int match_length = result->match_length < line_length - match_start
+                           ? result->match_length
+                           : line_length - match_start;
+
+    if (with_context) {
+      append_after_context(&text, context, path, data, size, &cursor,
+                           result->line_offset);
+      append_before_context(&text, context, path, data, size, &cursor,
+                            starts, result);
+    }
+
+    append_line_prefix(&text, context, path, result->line_number, ':');
+    append_text(&text, line, match_start);
+    append_string(&text, color ? "\033[1;31m" : "");
+    append_text(&text, line + match_start, match_length);
+    append_string(&text, color ? "\033[0m" : "");
+    append_text(&text, line + match_start + match_length,
+                line_length - match_start - match_length);
+    append_string(&text, "\n");
+
+    if (with_context) {
+      line_extent(data, size, result->line_offset, &cursor.printed_to);
+      cursor.printed_line = result->line_number + 1;
+      cursor.after_left = context->after_context;
+      cursor.printed = TRUE;
+    }
+  }
+
+  if (with_context) {
+    append_after_context(&text, context, path, data, size, &cursor, size);
+  }
+  free(starts);
+
+  *length = text.length;
+  return text.data;
+}
+
+static OutputNode *create_output_node(void) {
+  return (OutputNode *)calloc(1, sizeof(OutputNode));
+}
+
+static void free_output_node(OutputNode *node) {
+  if (!node) {
+    return;
+  }
+  for (int i = node->flushed; i < node->child_count; i++) {
+    free_output_node(node->children[i]);
+  }
+  free(node->children);
+  free(node->text);
+  free_row_batch(&node->rows);
+  free(node);
+}
+
+/**
+ * Move a file's rows into the pipeline's table, up to its row limit, and
+ * cancel the search once the limit is reached
+ */
+static void append_rows(GrepOutput *output, RowBatch *batch) {
+  if (batch->count == 0) {
+    return;
+  }
+  for (int i = 0; i < batch->count; i++) {
+    if (output->row_limit == 0 ||
+        output->table->row_count < output->row_limit) {
+      add_table_row(output->table, batch->rows[i]);
+      batch->rows[i] = NULL;
+    }
+  }
+  if (output->row_limit > 0 &&
+      output->table->row_count >= output->row_limit) {
+    InterlockedExchange(&output->cancelled, 1);
+  }
+  free_row_batch(batch);
+}
+
+/**
+ * Move a node's output, and its children's in order, into the pending
+ * output, freeing what has been moved. With force, nodes whose task never
+ * ran count as complete.
+ * @return TRUE if the whole subtree has been written
+ */
+static BOOL flush_output_node(GrepOutput *output, OutputNode *node,
+                              BOOL force) {
+  if (!node) {
+    return TRUE;
+  }
+  if (!node->complete && !force) {
+    return FALSE;
+  }
+  if (node->text) {
+    append_text(&output->pending, node->text, node->length);
+    free(node->text);
+    node->text = NULL;
+  }
+  if (node->rows.count > 0) {
+    append_rows(output, &node->rows);
+  }
+  while (node->flushed < node->child_count) {
+    OutputNode *child = node->children[node->flushed];
+    if (!flush_output_node(output, child, force)) {
+      return FALSE;
+    }
+    free_output_node(child);
+    node->children[node->flushed++] = NULL;
+  }
+  return TRUE;
+}
+
+/**
+ * Hand the pending output to the console in one write
+ */
+static void write_pending_output(GrepOutput *output) {
+  if (output->pending.length > 0) {
+    fwrite(output->pending.data, 1, output->pending.length, stdout);
+    fflush(stdout);
+    output->pending.length = 0;
+  }
+  output->last_write = GetTickCount64();
+}
+
+/**
+ * Check whether a search can stop: its pipeline has every row it uses, or
+ * the picker it feeds has closed
+ */
+static BOOL output_cancelled(const GrepOutput *output) {
+  return output && (output->cancelled ||
+                    (output->picker && fuzzy_picker_closed(output->picker)));
+}
+
+/**
+ * Record a searched file's output and write whatever is now in order. A
+ * file searched outside any tree (node NULL) is written as it comes.
+ */
+static void complete_output_node(GrepOutput *output, OutputNode *node,
+                                 char *text, size_t length, RowBatch *rows,
+                                 int matched) {
+  EnterCriticalSection(&output->lock);
+  if (matched > 0) {
+    output->matched_files++;
+    output->matched_lines += matched;
+  }
+
+  if (node) {
+    node->text = text;
+    node->length = length;
+    node->rows = *rows;
+    node->complete = TRUE;
+    flush_output_node(output, output->root, FALSE);
+  } else {
+    if (text) {
+      append_text(&output->pending, text, length);
+    }
+    free(text);
+    append_rows(output, rows);
+  }
+
+  // Large writes, but never holding finished output back for long
+  if (output->pending.length >= OUTPUT_BATCH_BYTES ||
+      (output->pending.length > 0 &&
+       GetTickCount64() - output->last_write >= OUTPUT_FLUSH_MS)) {
+    write_pending_output(output);
+  }
+  LeaveCriticalSection(&output->lock);
+}
+
+/**
+ * Write all remaining output once every task of a search has finished
+ */
+static void finish_output(GrepOutput *output) {
+  if (!output) {
+    return;
+  }
+  EnterCriticalSection(&output->lock);
+  if (output->root) {
+    flush_output_node(output, output->root, TRUE);
+    free_output_node(output->root);
+    output->root = NULL;
+  }
+  write_pending_output(output);
+  LeaveCriticalSection(&output->lock);
+}
+
+/**
+ * Get the calling thread's slot in the per-thread arrays: a pool worker's
+ * own, or the spare last one for the thread running the search
+ */
+static int current_thread_slot(void) {
+  int slot = thread_pool_worker_index();
+  if (slot < 0 || slot >= thread_result_count - 1) {
+    slot = thread_result_count - 1;
+  }
+  return slot;
+}
+
+/**
+ * Get the result buffer of the calling thread
+ */
+static ResultBuffer *current_result_buffer(void) {
+  return &thread_results[current_thread_slot()];
+}
+
+/**
+ * Make sure the grep pool and the per-thread result buffers exist
+ */
+static int init_grep_workers(void) {
+  if (!grep_pool) {
+    grep_pool = thread_pool_shared();
+  }
+
+  int count = thread_pool_size(grep_pool) + 1;
+  if (thread_results && thread_result_count == count) {
+    return 1;
+  }
+
+  free(thread_results);
+  thread_results = (ResultBuffer *)calloc(count, sizeof(ResultBuffer));
+  thread_result_count = thread_results ? count : 0;
+  return thread_results != NULL;
+}
+
+/**
+ * Intern a path in a buffer
+ * @return Its id within the buffer, or -1 on allocation failure
+ */
+static int intern_result_file(ResultBuffer *buffer, const char *filename) {
+  if (buffer->file_count >= buffer->file_capacity) {
+    int capacity = buffer->file_capacity == 0 ? 64 : buffer->file_capacity * 2;
+    char **files = (char **)realloc(buffer->files, capacity * sizeof(char *));
+    if (!files) {
+      return -1;
+    }
+    buffer->files = files;
+    buffer->file_capacity = capacity;
+  }
+
+  char *copy = _strdup(filename);
+  if (!copy) {
+    return -1;
+  }
+  buffer->files[buffer->file_count] = copy;
+  return buffer->file_count++;
+}
+
+/**
+ * Add a grep result to the calling thread's buffer
+ */
+static void add_grep_result(FileHits *hits, int line_number, int line_offset,
+                            int line_length, int match_start, int match_length,
+                            int pattern_id, double score) {
+  ResultBuffer *buffer = hits->buffer;
+
+  hits->matched++;
+  if (hits->count_only) {
+    return;
+  }
+  if (hits->rows) {
+    add_grep_row(hits, line_number, line_offset, line_length, match_start,
+                 match_length);
+    return;
+  }
+  if (hits->picker) {
+    add_picker_candidate(hits, line_number, line_offset, line_length,
+                         match_start);
+    return;
+  }
+
+  // A result that would not make the best top_k is dropped before its path
+  // is interned
+  if (hits->top_k > 0 && !ranked_result_wanted(buffer->results, buffer->count,
+                                               hits->top_k, score)) {
+    return;
+  }
+
+  if (hits->file_id < 0) {
+    hits->file_id = intern_result_file(buffer, hits->filename);
+    if (hits->file_id < 0) {
+      fprintf(stderr, "grep: memory allocation error\n");
+      return;
+    }
+  }
+
+  // Resize if needed; a full heap replaces its worst result instead
+  if (buffer->count >= buffer->capacity &&
+      (hits->top_k == 0 || buffer->count < hits->top_k)) {
+    int capacity = buffer->capacity == 0 ? 256 : buffer->capacity * 2;
+    GrepResult *results =
+        (GrepResult *)realloc(buffer->results, capacity * sizeof(GrepResult));
+    if (!results) {
+      fprintf(stderr, "grep: memory allocation error\n");
+      return;
+    }
+    buffer->results = results;
+    buffer->capacity = capacity;
+  }
+
+  // Add the result
+  GrepResult result;
+  result.file_id = hits->file_id;
+  result.line_number = line_number;
+  result.line_offset = line_offset;
+  result.line_length = line_length;
+  result.match_start = match_start;
+  result.match_length = match_length;
+  result.pattern_id = pattern_id;
+  result.match_score = score;
+
+  if (hits->top_k > 0) {
+    insert_ranked_result(buffer->results, &buffer->count, hits->top_k,
+                         &result);
+  } else {
+    buffer->results[buffer->count++] = result;
+  }
+}
+
+/**
+ * Copy part of a line into a string of its own
+ */
+static char *copy_text(const char *text, int length) {
+  char *copy = (char *)malloc(length + 1);
+  if (copy) {
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+  }
+  return copy;
+}
+
+/**
+ * Build a row for a match: the file, the line and column (both from 1),
+ * the matched text and the whole line
+ */
+static void add_grep_row(FileHits *hits, int line_number, int line_offset,
+                         int line_length, int match_start, int match_length) {
+  RowBatch *batch = hits->rows;
+  if (batch->count == batch->capacity) {
+    int capacity = batch->capacity ? batch->capacity * 2 : 16;
+    DataValue **rows =
+        (DataValue **)realloc(batch->rows, capacity * sizeof(DataValue *));
+    if (!rows) {
+      fprintf(stderr, "grep: memory allocation error\n");
+      return;
+    }
+    batch->rows = rows;
+    batch->capacity = capacity;
+  }
+
+  DataValue *row = (DataValue *)calloc(GREP_COLUMNS, sizeof(DataValue));
+  if (!row) {
+    fprintf(stderr, "grep: memory allocation error\n");
+    return;
+  }
+
+  const char *path = hits->filename;
+  if (strncmp(path, ".\\", 2) == 0) {
+    path += 2;
+  }
+  const char *line = hits->data + line_offset;
+  if (line_length > MAX_LINE_LENGTH) {
+    line_length = MAX_LINE_LENGTH;
+  }
+  if (match_start > line_length) {
+    match_start = line_length;
+  }
+  if (match_length > line_length - match_start) {
+    match_length = line_length - match_start;
+  }
+
+  row[0].type = TYPE_STRING;
+  row[0].value.str_val = _strdup(path);
+  row[1].type = TYPE_INT;
+  row[1].value.int_val = line_number;
+  row[2].type = TYPE_INT;
+  row[2].value.int_val = match_start + 1;
+  row[3].type = TYPE_STRING;
+  row[3].value.str_val = copy_text(line + match_start, match_length);
+  row[3].is_highlighted = 1;
+  row[4].type = TYPE_STRING;
+  row[4].value.str_val = copy_text(line, line_length);
+
+  batch->rows[batch->count++] = row;
+}
+
+/**
+ * Hand a match to the picker as a "path:line:column:text" candidate
+ */
+static void add_picker_candidate(FileHits *hits, int line_number,
+                                 int line_offset, int line_length,
+                                 int match_start) {
+  char candidate[MAX_PATH + 32 + MAX_LINE_LENGTH];
+
+  const char *path = hits->filename;
+  if (strncmp(path, ".\\", 2) == 0) {
+    path += 2;
+  }
+  const char *line = hits->data + line_offset;
+  if (line_length > MAX_LINE_LENGTH) {
+    line_length = MAX_LINE_LENGTH;
+  }
+  if (line_length > 0 && line[line_length - 1] == '\r') {
+    line_length--;
+  }
+
+  int length = snprintf(candidate, sizeof(candidate), "%s:%d:%d:%.*s", path,
+                        line_number, match_start + 1, line_length, line);
+  if (length > (int)sizeof(candidate) - 1) {
+    length = (int)sizeof(candidate) - 1;
+  }
+  if (length > 0) {
+    fuzzy_picker_add(hits->picker, candidate, length);
+  }
+}
+
+/**
+ * Free the rows of a batch that were not moved into a table
+ */
+static void free_row_batch(RowBatch *batch) {
+  for (int i = 0; i < batch->count; i++) {
+    if (batch->rows[i]) {
+      for (int j = 0; j < GREP_COLUMNS; j++) {
+        free_data_value(&batch->rows[i][j]);
+      }
+      free(batch->rows[i]);
+    }
+  }
+  free(batch->rows);
+  batch->rows = NULL;
+  batch->count = 0;
+  batch->capacity = 0;
+}
+
+/**
+ * Check whether a result would make the best top_k of a min-heap of results
+ */
+static BOOL ranked_result_wanted(const GrepResult *results, int count,
+                                 int top_k, double score) {
+  return count < top_k || score > results[0].match_score;
+}
+
+/**
+ * Insert a result into a min-heap of the best top_k results by score,
+ * replacing the worst one when the heap is full. The array must have room
+ * for min(count + 1, top_k) results.
+ */
+static void insert_ranked_result(GrepResult *results, int *count, int top_k,
+                                 const GrepResult *result) {
+  int i;
+
+  if (*count < top_k) {
+    // Sift up from the new leaf
+    i = (*count)++;
+    while (i > 0 && results[(i - 1) / 2].match_score > result->match_score) {
+      results[i] = results[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    results[i] = *result;
+    return;
+  }
 
-    // Count newlines before current position to maintain correct line numbers
-    if (bytes_read_total > 0) {
-      for (int i = 0; i < bytes_read; i++) {
-        if (buffer[i] == '\n') {
-          line_number++;
-        }
-      }
+  // Sift down from the root, which held the worst result
+  i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= *count) {
+      break;
     }
+    if (child + 1 < *count &&
+        results[child + 1].match_score < results[child].match_score) {
+      child++;
+    }
+    if (results[child].match_score >= result->match_score) {
+      break;
+    }
+    results[i] = results[child];
+    i = child;
+  }
+  results[i] = *result;
+}
 
-    // Process each line in the buffer
-    int pos = 0;
-    while (pos < bytes_read) {
-      // Find the start of the next line
-      int line_start = pos;
+static int compare_result_scores(const void *a, const void *b) {
+  const GrepResult *left = (const GrepResult *)a;
+  const GrepResult *right = (const GrepResult *)b;
 
-      // Find the end of the current line
-      while (pos < bytes_read && buffer[pos] != '\n' && buffer[pos] != '\r') {
-        pos++;
-      }
+  if (left->match_score != right->match_score) {
+    return left->match_score < right->match_score ? 1 : -1;
+  }
+  if (left->file_id != right->file_id) {
+    return left->file_id < right->file_id ? -1 : 1;
+  }
+  return left->line_number - right->line_number;
+}
 
-      // Extract the line
-      int line_length = pos - line_start;
-
-      // Process the line if it's not empty
-      if (line_length > 0) {
-        // Null-terminate the line (temporarily)
-        char original_char = buffer[pos];
-        buffer[pos] = '\0';
-
-        BOOL found_match = FALSE;
-        int match_start = 0;
-        int match_length = 0;
-        double match_score = 0.0;
-
-        // Match according to mode
-        if (mode == SEARCH_MODE_PLAIN) {
-          // Case sensitive Boyer-Moore search
-          match_start = boyer_moore_search(buffer + line_start, line_length,
-                                           pattern, pattern_len);
-
-          if (match_start >= 0) {
-            found_match = TRUE;
-            match_length = pattern_len;
-            match_score = 1.0;
-          }
-        } else if (mode == SEARCH_MODE_IGNORE_CASE) {
-          // Case insensitive search
-          if (pattern_lower) {
-            match_start = boyer_moore_case_insensitive(
-                buffer + line_start, line_length, pattern_lower, pattern_len);
-
-            if (match_start >= 0) {
-              found_match = TRUE;
-              match_length = pattern_len;
-              match_score = 1.0;
-            }
-          }
-        } else if (mode == SEARCH_MODE_FUZZY) {
-          // Fuzzy matching
-          match_score = fuzzy_search(buffer + line_start, pattern, &match_start,
-                                     &match_length);
+/**
+ * Sort results best first and drop all but the top_k best (0 keeps all)
+ */
+static void keep_best_results(GrepResult *results, int *count, int top_k) {
+  qsort(results, *count, sizeof(GrepResult), compare_result_scores);
+  if (top_k > 0 && *count > top_k) {
+    *count = top_k;
+  }
+}
 
-          if (match_score > 0.5) { // Adjust threshold as needed
-            found_match = TRUE;
-          }
-        }
+/**
+ * Move every thread's results into grep_results, renumbering their paths
+ */
+static void merge_thread_results(void) {
+  int total = grep_results.count;
+  int total_files = grep_results.file_count;
+  for (int i = 0; i < thread_result_count; i++) {
+    total += thread_results[i].count;
+    total_files += thread_results[i].file_count;
+  }
 
-        // Report the match if found
-        if (found_match) {
-          WaitForSingleObject(result_mutex, INFINITE);
-          add_grep_result(filename, line_number, buffer + line_start,
-                          match_start, match_length, match_score);
-          ReleaseMutex(result_mutex);
-        }
+  if (total > grep_results.capacity) {
+    GrepResult *results = (GrepResult *)realloc(
+        grep_results.results, total * sizeof(GrepResult));
+    if (results) {
+      grep_results.results = results;
+      grep_results.capacity = total;
+    }
+  }
+  if (total_files > grep_results.file_capacity) {
+    char **files =
+        (char **)realloc(grep_results.files, total_files * sizeof(char *));
+    if (files) {
+      grep_results.files = files;
+      grep_results.file_capacity = total_files;
+    }
+  }
 
-        // Restore the original character
-        buffer[pos] = original_char;
-      }
+  for (int i = 0; i < thread_result_count; i++) {
+    ResultBuffer *buffer = &thread_results[i];
 
-      // Move past newline characters
-      if (pos < bytes_read && buffer[pos] == '\r') {
-        pos++;
+    if (grep_results.capacity >= total &&
+        grep_results.file_capacity >= total_files) {
+      int file_base = grep_results.file_count;
+      memcpy(grep_results.files + file_base, buffer->files,
+             buffer->file_count * sizeof(char *));
+      grep_results.file_count += buffer->file_count;
+
+      for (int j = 0; j < buffer->count; j++) {
+        GrepResult *result = &grep_results.results[grep_results.count++];
+        *result = buffer->results[j];
+        result->file_id += file_base;
       }
-      if (pos < bytes_read && buffer[pos] == '\n') {
-        pos++;
-        line_number++;
+    } else {
+      fprintf(stderr, "grep: memory allocation error\n");
+      for (int j = 0; j < buffer->file_count; j++) {
+        free(buffer->files[j]);
       }
     }
 
-    bytes_read_total += bytes_read;
+    free(buffer->results);
+    free(buffer->files);
+    memset(buffer, 0, sizeof(*buffer));
   }
+}
 
-  // Clean up
-  free(buffer);
-  fclose(file);
+/**
+ * Get the path of a result
+ */
+static const char *grep_result_path(const GrepResult *result) {
+  return grep_results.files[result->file_id];
 }
 
 /**
- * Add a grep result to the results list
+ * Unmap the file held for displaying lines, so an editor can save it
  */
-static void add_grep_result(const char *filename, int line_number,
-                            const char *line, int match_start, int match_length,
-                            double score) {
-  // Resize if needed
-  if (grep_results.count >= grep_results.capacity) {
-    grep_results.capacity =
-        grep_results.capacity == 0 ? 100 : grep_results.capacity * 2;
-    grep_results.results = (GrepResult *)realloc(
-        grep_results.results, grep_results.capacity * sizeof(GrepResult));
-    if (!grep_results.results) {
-      fprintf(stderr, "grep: memory allocation error\n");
-      return;
+static void release_line_map(void) {
+  unmap_file(&line_map);
+  line_map_file = -1;
+}
+
+/**
+ * Map a result's file for displaying its lines, keeping the last one mapped
+ * @return FALSE if it could not be mapped
+ */
+static BOOL map_result_file(const GrepResult *result) {
+  if (result->file_id != line_map_file) {
+    release_line_map();
+    if (!map_file(grep_result_path(result), &line_map)) {
+      return FALSE;
     }
+    line_map_file = result->file_id;
   }
+  return TRUE;
+}
 
-  // Add the result
-  GrepResult *result = &grep_results.results[grep_results.count++];
-  strncpy(result->filename, filename, MAX_PATH - 1);
-  result->filename[MAX_PATH - 1] = '\0';
-  result->line_number = line_number;
-  strncpy(result->line_content, line, sizeof(result->line_content) - 1);
-  result->line_content[sizeof(result->line_content) - 1] = '\0';
-  result->match_start = match_start;
-  result->match_length = match_length;
-  result->match_score = score;
+/**
+ * Copy the text of a result's line from its file into a buffer, truncating
+ * it to fit. Gives an empty line if the file has since shrunk.
+ */
+static void get_result_line(const GrepResult *result, char *line,
+                            size_t size) {
+  line[0] = '\0';
+
+  if (!map_result_file(result)) {
+    return;
+  }
+
+  size_t length = result->line_length;
+  if ((size_t)result->line_offset + length > line_map.size) {
+    return;
+  }
+  if (length > size - 1) {
+    length = size - 1;
+  }
+  memcpy(line, line_map.data + result->line_offset, length);
+  line[length] = '\0';
 }
 
 /**
  * Free the grep results list
  */
 static void free_grep_results() {
+  release_line_map();
+
   if (grep_results.results) {
     free(grep_results.results);
     grep_results.results = NULL;
   }
+  for (int i = 0; i < grep_results.file_count; i++) {
+    free(grep_results.files[i]);
+  }
+  free(grep_results.files);
+  grep_results.files = NULL;
+  grep_results.file_count = 0;
+  grep_results.file_capacity = 0;
   grep_results.count = 0;
   grep_results.capacity = 0;
   grep_results.current_index = 0;
@@ -1544,8 +3260,8 @@ static void display_grep_results(void) {
       SetConsoleCursorPosition(hConsole, (COORD){0, 2 + i});
 
       // Extract just the filename from path
-      char *filename = result->filename;
-      char *last_slash = strrchr(filename, '\\');
+      const char *filename = grep_result_path(result);
+      const char *last_slash = strrchr(filename, '\\');
       if (last_slash) {
         filename = last_slash + 1;
       }
@@ -1589,31 +3305,43 @@ static void display_grep_results(void) {
 
       // First line: File path and line info - exact match for screenshot
       SetConsoleCursorPosition(hConsole, (COORD){left_width + 3, 2});
-      printf("File: %s (Line %d)", current->filename, current->line_number);
+      printf("File: %s (Line %d)", grep_result_path(current),
+             current->line_number);
+      if (current->pattern_id >= 0 &&
+          current->pattern_id < grep_results.pattern_count) {
+        printf(" [%s]", grep_results.patterns[current->pattern_id]);
+      }
 
       // Second line: Match line with highlighting
       SetConsoleCursorPosition(hConsole, (COORD){left_width + 3, 3});
       printf("Match: ");
 
+      char line_content[MAX_LINE_LENGTH];
+      get_result_line(current, line_content, sizeof(line_content));
+      int line_length = strlen(line_content);
+      int match_start =
+          current->match_start < line_length ? current->match_start : line_length;
+      int match_length = current->match_length < line_length - match_start
+                             ? current->match_length
+                             : line_length - match_start;
+
       // First part before match
-      printf("%.*s", current->match_start, current->line_content);
+      printf("%.*s", match_start, line_content);
 
       // Matched part - highlight in red
       SetConsoleTextAttribute(hConsole, COLOR_MATCH);
-      printf("%.*s", current->match_length,
-             current->line_content + current->match_start);
+      printf("%.*s", match_length, line_content + match_start);
 
       // Reset color and print the rest
       SetConsoleTextAttribute(hConsole, originalAttrs);
-      printf("%s", current->line_content + current->match_start +
-                       current->match_length);
+      printf("%s", line_content + match_start + match_length);
 
       // Print "Context:" label
       SetConsoleCursorPosition(hConsole, (COORD){left_width + 3, 4});
       printf("Context:");
 
       // Show file content with context lines
-      FILE *preview_file = fopen(current->filename, "r");
+      FILE *preview_file = fopen(grep_result_path(current), "r");
       if (preview_file) {
         // Define how many context lines to show before and after
         int context_lines = MAX_PREVIEW_LINES;
@@ -1717,7 +3445,8 @@ static void display_grep_results(void) {
       } else if (keyCode == VK_RETURN) {
         // Enter - Open in editor
         open_file_in_editor(
-            grep_results.results[grep_results.current_index].filename,
+            grep_result_path(
+                &grep_results.results[grep_results.current_index]),
             grep_results.results[grep_results.current_index].line_number);
 
         // Redraw everything after returning from editor
@@ -1771,36 +3500,37 @@ static void show_file_detail_view(GrepResult *result) {
 
   // Show file information header
   SetConsoleTextAttribute(hConsole, COLOR_RESULT_HIGHLIGHT);
-  printf("File: %s (line %d)\n\n", result->filename, result->line_number);
-
-  // Show file content with context
-  FILE *file = fopen(result->filename, "r");
-  if (file) {
-    // Show more context in the detail view
+  printf("File: %s (line %d)\n\n", grep_result_path(result),
+         result->line_number);
+
+  // Show the lines around the match, sliced out of the mapped file; the
+  // file may have changed since the search, so offsets are checked
+  if (map_result_file(result) && line_map.size <= INT_MAX &&
+      (size_t)result->line_offset <= line_map.size) {
+    const char *data = (const char *)line_map.data;
+    int size = (int)line_map.size;
     int context_lines = 20; // Increased context in detail view
-    int start_line = (result->line_number <= context_lines)
-                         ? 1
-                         : result->line_number - context_lines;
-    int end_line = result->line_number + context_lines;
-    int current_line = 1;
-    char line[1024];
+    int start = result->line_offset;
+    int current_line = result->line_number;
 
-    // Skip to start line
-    while (current_line < start_line && fgets(line, sizeof(line), file)) {
-      current_line++;
+    // Walk back to the first line shown
+    for (int i = 0; i < context_lines; i++) {
+      int previous = previous_line_start(data, start, 0);
+      if (previous < 0) {
+        break;
+      }
+      start = previous;
+      current_line--;
     }
 
-    // Read and display lines with context
     SetConsoleTextAttribute(hConsole, originalAttrs);
     printf("Content preview:\n\n");
 
-    while (current_line <= end_line && fgets(line, sizeof(line), file)) {
-      // Remove newline if present
-      size_t len = strlen(line);
-      if (len > 0 && line[len - 1] == '\n') {
-        line[len - 1] = '\0';
-        len--;
-      }
+    int end_line = result->line_number + context_lines;
+    while (current_line <= end_line && start < size) {
+      int next;
+      int len = line_extent(data, size, start, &next);
+      const char *line = data + start;
 
       // Show line with appropriate highlighting
       if (current_line == result->line_number) {
@@ -1809,8 +3539,8 @@ static void show_file_detail_view(GrepResult *result) {
         printf("%4d -> ", current_line);
 
         // Try to highlight the match within the line
-        if (result->match_start >= 0 && result->match_start < (int)len &&
-            result->match_length > 0) {
+        if (result->match_start >= 0 && result->match_length > 0 &&
+            result->match_start + result->match_length <= len) {
           // Print parts before match
           SetConsoleTextAttribute(hConsole, originalAttrs);
           printf("%.*s", result->match_start, line);
@@ -1821,22 +3551,22 @@ static void show_file_detail_view(GrepResult *result) {
 
           // Print after match
           SetConsoleTextAttribute(hConsole, originalAttrs);
-          printf("%s\n", line + result->match_start + result->match_length);
+          printf("%.*s\n", len - result->match_start - result->match_length,
+                 line + result->match_start + result->match_length);
         } else {
           // Fallback if match position is not correct
           SetConsoleTextAttribute(hConsole, originalAttrs);
-          printf("%s\n", line);
+          printf("%.*s\n", len, line);
         }
       } else {
         // Regular line
         SetConsoleTextAttribute(hConsole, originalAttrs);
-        printf("%4d | %s\n", current_line, line);
+        printf("%4d | %.*s\n", current_line, len, line);
       }
 
+      start = next;
       current_line++;
     }
-
-    fclose(file);
   } else {
     // Could not open file
     SetConsoleTextAttribute(hConsole, COLOR_MATCH);
@@ -1854,114 +3584,13 @@ static void show_file_detail_view(GrepResult *result) {
 
   // If ENTER pressed, open in editor
   if (key == 13) {
-    open_file_in_editor(result->filename, result->line_number);
+    open_file_in_editor(grep_result_path(result), result->line_number);
   }
 
   // Reset console color
   SetConsoleTextAttribute(hConsole, originalAttrs);
 }
 
-/**
- * Check if a file is likely to be a text file
- * Uses smarter heuristics to avoid reading binary files
- */
-static BOOL is_text_file(const char *filename) {
-  // Skip files that should be ignored
-  if (should_skip_file(filename)) {
-    return FALSE;
-  }
-
-  // Check extensions first (most efficient)
-  const char *ext = strrchr(filename, '.');
-  if (ext) {
-    // Skip common binary file extensions
-    static const char *binary_exts[] = {
-        ".exe", ".dll",  ".obj", ".o",    ".lib", ".bin", ".dat", ".png",
-        ".jpg", ".jpeg", ".gif", ".bmp",  ".ico", ".zip", ".rar", ".7z",
-        ".gz",  ".tar",  ".mp3", ".mp4",  ".avi", ".mov", ".wav", ".pdf",
-        ".doc", ".docx", ".xls", ".xlsx", ".ppt", ".pptx"};
-
-    for (int i = 0; i < sizeof(binary_exts) / sizeof(binary_exts[0]); i++) {
-      if (_stricmp(ext, binary_exts[i]) == 0) {
-        return FALSE; // Binary file
-      }
-    }
-
-    // Check for common text file extensions
-    static const char *text_exts[] = {
-        ".txt", ".c",    ".cpp", ".h",   ".hpp",  ".cs",  ".js",
-        ".py",  ".html", ".css", ".xml", ".json", ".md",  ".log",
-        ".sh",  ".bat",  ".cmd", ".ini", ".conf", ".cfg", ".sql"};
-
-    for (int i = 0; i < sizeof(text_exts) / sizeof(text_exts[0]); i++) {
-      if (_stricmp(ext, text_exts[i]) == 0) {
-        return TRUE; // Text file
-      }
-    }
-  }
-
-  // If we can't determine by extension, check the first few bytes
-  FILE *file = fopen(filename, "rb");
-  if (!file) {
-    return FALSE; // Can't open, assume it's not text
-  }
-
-  // Read the first 512 bytes
-  unsigned char buffer[512];
-  size_t bytes_read = fread(buffer, 1, sizeof(buffer), file);
-  fclose(file);
-
-  if (bytes_read == 0) {
-    return TRUE; // Empty file, consider it text
-  }
-
-  // Check for binary content
-  int binary_chars = 0;
-  int text_chars = 0;
-
-  for (size_t i = 0; i < bytes_read; i++) {
-    // Null bytes, control chars (except tab, CR, LF)
-    if (buffer[i] == 0 || (buffer[i] < 32 && buffer[i] != '\t' &&
-                           buffer[i] != '\n' && buffer[i] != '\r')) {
-      binary_chars++;
-    } else if (buffer[i] >= 32 && buffer[i] < 127) {
-      // Printable ASCII chars
-      text_chars++;
-    }
-
-    // Early detection for common binary file signatures
-    if (i == 0) {
-      // Check for executable/library signatures
-      if (buffer[0] == 'M' && buffer[1] == 'Z') { // EXE/DLL
-        return FALSE;
-      }
-      // Check for image signatures
-      if (buffer[0] == 0xFF && buffer[1] == 0xD8 && buffer[2] == 0xFF) { // JPEG
-        return FALSE;
-      }
-      if (buffer[0] == 0x89 && buffer[1] == 'P' && buffer[2] == 'N' &&
-          buffer[3] == 'G') { // PNG
-        return FALSE;
-      }
-      if (buffer[0] == 'G' && buffer[1] == 'I' && buffer[2] == 'F' &&
-          buffer[3] == '8') { // GIF
-        return FALSE;
-      }
-      // Check for archive signatures
-      if (buffer[0] == 'P' && buffer[1] == 'K') { // ZIP
-        return FALSE;
-      }
-      if (buffer[0] == 0x52 && buffer[1] == 0x61 && buffer[2] == 0x72 &&
-          buffer[3] == 0x21) { // RAR
-        return FALSE;
-      }
-    }
-  }
-
-  // If more than 10% binary or less than 50% text, consider it binary
-  return (binary_chars < bytes_read / 10 && text_chars > bytes_read / 2);
-}
-
 /**
  * Open the file in an appropriate editor at the specified line
  */
@@ -1969,6 +3598,9 @@ static int open_file_in_editor(const char *file_path, int line_number) {
   char command[2048] = {0};
   int success = 0;
 
+  // A mapped file cannot be truncated, which would break saving it
+  release_line_map();
+
   // Try to detect available editors (in order of preference)
   FILE *test_nvim = _popen("nvim --version 2>nul", "r");
   if (test_nvim != NULL) {
@@ -2017,26 +3649,144 @@ static int open_file_in_editor(const char *file_path, int line_number) {
 }
 
 /**
- * Command handler for the "grep" command
+ * Add a copy of a pattern to a list
+ * @return 1 on success, 0 on allocation failure
+ */
+static int add_pattern(PatternList *list, const char *pattern) {
+  if (list->count >= list->capacity) {
+    int capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+    char **items = (char **)realloc(list->items, capacity * sizeof(char *));
+    if (!items) {
+      return 0;
+    }
+    list->items = items;
+    list->capacity = capacity;
+  }
+
+  char *copy = _strdup(pattern);
+  if (!copy) {
+    return 0;
+  }
+  list->items[list->count++] = copy;
+  return 1;
+}
+
+/**
+ * Add every non-empty line of a file to a pattern list
+ * @return 1 on success, 0 if the file cannot be read or has no patterns
+ */
+static int read_pattern_file(PatternList *list, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    printf("grep: %s: No such file or directory\n", path);
+    return 0;
+  }
+
+  char line[4096];
+  int added = 0;
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    // A blank line would match everything, which a list never means
+    if (line[0] == '\0') {
+      continue;
+    }
+    if (!add_pattern(list, line)) {
+      printf("grep: memory allocation error\n");
+      fclose(file);
+      return 0;
+    }
+    added++;
+  }
+  fclose(file);
+
+  if (added == 0) {
+    printf("grep: %s: no patterns\n", path);
+    return 0;
+  }
+  return 1;
+}
+
+static void free_pattern_list(PatternList *list) {
+  for (int i = 0; i < list->count; i++) {
+    free(list->items[i]);
+  }
+  free(list->items);
+  list->items = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+/**
+ * Join patterns into one regular expression matching any of them
+ * @return The expression (caller frees), or NULL on allocation failure
+ */
+static char *join_regex_alternatives(const PatternList *list) {
+  size_t length = 1;
+  for (int i = 0; i < list->count; i++) {
+    length += strlen(list->items[i]) + 6; // "(?:" ")" "|"
+  }
+
+  char *joined = (char *)malloc(length);
+  if (!joined) {
+    return NULL;
+  }
+  joined[0] = '\0';
+  for (int i = 0; i < list->count; i++) {
+    if (i > 0) {
+      strcat(joined, "|");
+    }
+    strcat(joined, "(?:");
+    strcat(joined, list->items[i]);
+    strcat(joined, ")");
+  }
+  return joined;
+}
+
+/**
+ * Run a grep command line: print its results, or with table set, add one
+ * row per matching line to it, stopping once it holds row_limit rows, or
+ * with picker set, stream each matching line into it until it closes
  * Usage: grep [options] pattern [file/directory]
+ *        grep [options] -e pattern [-e pattern...] [file/directory...]
  * Options:
  *   -n, --line-numbers  Show line numbers
  *   -i, --ignore-case   Ignore case distinctions
  *   -r, --recursive     Search directories recursively
+ *   -E, --regex         Treat the pattern as a regular expression
  *   -f, --fuzzy         Use fuzzy matching instead of exact
+ *   --top N             Keep the N best fuzzy matches (0 keeps all)
+ *   --index             Search trees through a persistent trigram index
+ *   -l, --files-with-matches  Print only the paths of files with a match
+ *   -c, --count         Print the number of matching lines in each file
+ *   -m, --max-count N   Stop searching a file after N matching lines
+ *   -A N, -B N, -C N    Print N lines after, before, or around each match
+ *   -e PATTERN          Search for PATTERN; may be repeated
+ *   --pattern-file FILE Search for each line of FILE
+ * @return FALSE if the command line was rejected
  */
-int lsh_grep(char **args) {
-  if (args[1] == NULL) {
+static BOOL run_grep(char **args, TableData *table, int row_limit,
+                     FuzzyPicker *picker) {
+  if (args[1] == NULL && !table && !picker) {
     // No arguments provided, launch interactive mode
     run_grep_interactive_session();
-    return 1;
+    return TRUE;
   }
 
   // Parse options
   int arg_index = 1;
   int line_numbers = 0;
   BOOL recursive = FALSE;
-  SearchMode mode = SEARCH_MODE_PLAIN;
+  BOOL ignore_case = FALSE;
+  BOOL use_regex = FALSE;
+  BOOL fuzzy = FALSE;
+  BOOL use_index = FALSE;
+  int top_k = FUZZY_TOP_RESULTS;
+  int max_count = 0;
+  int before_context = 0;
+  int after_context = 0;
+  OutputMode output_mode = OUTPUT_LINES;
+  PatternList pattern_list = {NULL, 0, 0};
 
   // Process options
   while (args[arg_index] != NULL && args[arg_index][0] == '-') {
@@ -2046,7 +3796,7 @@ int lsh_grep(char **args) {
       arg_index++;
     } else if (strcmp(args[arg_index], "-i") == 0 ||
                strcmp(args[arg_index], "--ignore-case") == 0) {
-      mode = SEARCH_MODE_IGNORE_CASE;
+      ignore_case = TRUE;
       arg_index++;
     } else if (strcmp(args[arg_index], "-r") == 0 ||
                strcmp(args[arg_index], "--recursive") == 0) {
@@ -2054,94 +3804,336 @@ int lsh_grep(char **args) {
       arg_index++;
     } else if (strcmp(args[arg_index], "-f") == 0 ||
                strcmp(args[arg_index], "--fuzzy") == 0) {
-      mode = SEARCH_MODE_FUZZY;
+      fuzzy = TRUE;
+      arg_index++;
+    } else if (strcmp(args[arg_index], "-E") == 0 ||
+               strcmp(args[arg_index], "--regex") == 0) {
+      use_regex = TRUE;
+      arg_index++;
+    } else if (strcmp(args[arg_index], "-l") == 0 ||
+               strcmp(args[arg_index], "--files-with-matches") == 0) {
+      output_mode = OUTPUT_FILES;
+      arg_index++;
+    } else if (strcmp(args[arg_index], "-c") == 0 ||
+               strcmp(args[arg_index], "--count") == 0) {
+      output_mode = OUTPUT_COUNT;
+      arg_index++;
+    } else if (strcmp(args[arg_index], "-m") == 0 ||
+               strcmp(args[arg_index], "--max-count") == 0) {
+      char *end = NULL;
+      const char *value = args[arg_index + 1];
+      long count = value ? strtol(value, &end, 10) : -1;
+      if (!value || *end != '\0' || count <= 0 || count > INT_MAX) {
+        printf("grep: %s requires a positive count\n", args[arg_index]);
+        free_pattern_list(&pattern_list);
+        return FALSE;
+      }
+      max_count = (int)count;
+      arg_index += 2;
+    } else if (strcmp(args[arg_index], "-A") == 0 ||
+               strcmp(args[arg_index], "-B") == 0 ||
+               strcmp(args[arg_index], "-C") == 0) {
+      char *end = NULL;
+      const char *value = args[arg_index + 1];
+      long count = value ? strtol(value, &end, 10) : -1;
+      if (!value || *end != '\0' || count < 0 || count > MAX_CONTEXT_LINES) {
+        printf("grep: %s requires a line count up to %d\n", args[arg_index],
+               MAX_CONTEXT_LINES);
+        free_pattern_list(&pattern_list);
+        return FALSE;
+      }
+      char option = args[arg_index][1];
+      if (option != 'A') {
+        before_context = (int)count;
+      }
+      if (option != 'B') {
+        after_context = (int)count;
+      }
+      arg_index += 2;
+    } else if (strcmp(args[arg_index], "--index") == 0) {
+      // The index covers whole trees
+      use_index = TRUE;
+      recursive = TRUE;
       arg_index++;
+    } else if (strcmp(args[arg_index], "--top") == 0) {
+      char *end = NULL;
+      const char *value = args[arg_index + 1];
+      long count = value ? strtol(value, &end, 10) : -1;
+      if (!value || *end != '\0' || count < 0 || count > INT_MAX) {
+        printf("grep: --top requires a count\n");
+        free_pattern_list(&pattern_list);
+        return FALSE;
+      }
+      top_k = (int)count;
+      arg_index += 2;
+    } else if (strcmp(args[arg_index], "-e") == 0 ||
+               strcmp(args[arg_index], "--pattern-file") == 0) {
+      const char *option = args[arg_index];
+      const char *value = args[arg_index + 1];
+      if (value == NULL) {
+        printf("grep: option requires an argument: %s\n", option);
+        free_pattern_list(&pattern_list);
+        return FALSE;
+      }
+      if (strcmp(option, "-e") == 0) {
+        if (!add_pattern(&pattern_list, value)) {
+          printf("grep: memory allocation error\n");
+          free_pattern_list(&pattern_list);
+          return FALSE;
+        }
+      } else if (!read_pattern_file(&pattern_list, value)) {
+        free_pattern_list(&pattern_list);
+        return FALSE;
+      }
+      arg_index += 2;
     } else if (strcmp(args[arg_index], "--file") == 0) {
       // Stop here - this marks the beginning of file arguments
       break;
     } else {
       printf("grep: unknown option: %s\n", args[arg_index]);
-      return 1;
+      free_pattern_list(&pattern_list);
+      return FALSE;
     }
   }
 
-  // Check if we have any arguments left for the pattern
-  if (args[arg_index] == NULL) {
-    printf("grep: missing pattern\n");
-    return 1;
+  // A pipeline gets one row per matching line, a picker one candidate
+  if ((table || picker) && output_mode != OUTPUT_LINES) {
+    printf(table ? "grep: %s does not apply in a pipeline; use group-by "
+                   "File\n"
+                 : "grep: %s does not apply to picked matches\n",
+           output_mode == OUTPUT_FILES ? "-l" : "-c");
+    free_pattern_list(&pattern_list);
+    return FALSE;
   }
 
-  // Collect all arguments into the pattern until we hit --file or end of args
   char pattern_buffer[4096] = "";
-  int pattern_start_index = arg_index;
-
-  // Find where the file args start (if any)
+  const char *pattern = pattern_buffer;
   int file_args_start = -1;
-  for (int i = arg_index; args[i] != NULL; i++) {
-    if (strcmp(args[i], "--file") == 0) {
-      file_args_start = i + 1; // Start right after the --file flag
-      break;
+
+  if (pattern_list.count > 0) {
+    // With -e or --pattern-file every remaining argument is a path
+    if (args[arg_index] != NULL && strcmp(args[arg_index], "--file") == 0) {
+      arg_index++;
+    }
+    file_args_start = arg_index;
+    pattern = pattern_list.items[0];
+  } else {
+    // Check if we have any arguments left for the pattern
+    if (args[arg_index] == NULL) {
+      printf("grep: missing pattern\n");
+      return FALSE;
     }
-  }
 
-  // If we found --file, only use args up to that point for the pattern
-  int pattern_end_index = (file_args_start > 0) ? file_args_start - 2 : -1;
+    // Collect all arguments into the pattern until we hit --file or end of
+    // args
+    int pattern_start_index = arg_index;
 
-  // If we didn't find --file, use all remaining args for the pattern
-  if (pattern_end_index < 0) {
-    while (args[arg_index] != NULL) {
-      // Add space between pattern parts except before the first one
-      if (arg_index > pattern_start_index) {
-        strcat(pattern_buffer, " ");
+    // Find where the file args start (if any)
+    for (int i = arg_index; args[i] != NULL; i++) {
+      if (strcmp(args[i], "--file") == 0) {
+        file_args_start = i + 1; // Start right after the --file flag
+        break;
       }
-      strcat(pattern_buffer, args[arg_index]);
-      arg_index++;
     }
-  } else {
-    // Use only args up to the --file flag for the pattern
-    for (int i = pattern_start_index; i <= pattern_end_index; i++) {
-      // Add space between pattern parts except before the first one
-      if (i > pattern_start_index) {
-        strcat(pattern_buffer, " ");
+
+    // If we found --file, only use args up to that point for the pattern
+    int pattern_end_index = (file_args_start > 0) ? file_args_start - 2 : -1;
+
+    // If we didn't find --file, use all remaining args for the pattern
+    if (pattern_end_index < 0) {
+      while (args[arg_index] != NULL) {
+        // Add space between pattern parts except before the first one
+        if (arg_index > pattern_start_index) {
+          strcat(pattern_buffer, " ");
+        }
+        strcat(pattern_buffer, args[arg_index]);
+        arg_index++;
+      }
+    } else {
+      // Use only args up to the --file flag for the pattern
+      for (int i = pattern_start_index; i <= pattern_end_index; i++) {
+        // Add space between pattern parts except before the first one
+        if (i > pattern_start_index) {
+          strcat(pattern_buffer, " ");
+        }
+        strcat(pattern_buffer, args[i]);
       }
-      strcat(pattern_buffer, args[i]);
+      arg_index = file_args_start; // Move to the file arguments
     }
-    arg_index = file_args_start; // Move to the file arguments
   }
 
-  const char *pattern = pattern_buffer;
+  // Fuzzy matching ignores case by itself; a regex folds case when compiled.
+  // Several regular expressions become one alternation; several strings are
+  // searched together by a pattern set.
+  SearchMode mode = SEARCH_MODE_PLAIN;
+  char *joined_pattern = NULL;
+  if (fuzzy) {
+    if (pattern_list.count > 1) {
+      printf("grep: fuzzy matching takes a single pattern\n");
+      free_pattern_list(&pattern_list);
+      return FALSE;
+    }
+    mode = SEARCH_MODE_FUZZY;
+  } else if (use_regex) {
+    mode = SEARCH_MODE_REGEX;
+    if (pattern_list.count > 1) {
+      joined_pattern = join_regex_alternatives(&pattern_list);
+      if (!joined_pattern) {
+        printf("grep: memory allocation error\n");
+        free_pattern_list(&pattern_list);
+        return FALSE;
+      }
+      pattern = joined_pattern;
+    }
+  } else if (pattern_list.count > 1) {
+    mode = SEARCH_MODE_PATTERNS;
+  } else if (ignore_case) {
+    mode = SEARCH_MODE_IGNORE_CASE;
+  }
 
-  // Create mutex for thread synchronization
-  result_mutex = CreateMutex(NULL, FALSE, NULL);
-  if (result_mutex == NULL) {
-    printf("grep: failed to create mutex\n");
-    return 1;
+  BOOL status = FALSE;
+  Regex *regex = NULL;
+  RegexScratch **scratch = NULL;
+  PatternSet *pattern_set = NULL;
+  FuzzyPattern *fuzzy_pattern = NULL;
+  char *pattern_lower = NULL;
+
+  if (!init_grep_workers()) {
+    printf("grep: memory allocation error\n");
+    goto cleanup;
+  }
+
+  if (mode == SEARCH_MODE_REGEX) {
+    char error[128];
+    regex = regex_compile(pattern, ignore_case ? REGEX_IGNORE_CASE : 0, error,
+                          sizeof(error));
+    if (!regex) {
+      printf("grep: invalid regular expression: %s\n", error);
+      goto cleanup;
+    }
+    scratch =
+        (RegexScratch **)calloc(thread_result_count, sizeof(RegexScratch *));
+    if (!scratch) {
+      printf("grep: memory allocation error\n");
+      goto cleanup;
+    }
+  } else if (mode == SEARCH_MODE_FUZZY) {
+    fuzzy_pattern = fuzzy_pattern_create(pattern);
+    if (!fuzzy_pattern) {
+      printf("grep: fuzzy pattern longer than %d characters\n",
+             FUZZY_MAX_PATTERN);
+      goto cleanup;
+    }
+  } else if (mode == SEARCH_MODE_PATTERNS) {
+    pattern_set =
+        pattern_set_create((const char *const *)pattern_list.items,
+                           pattern_list.count, ignore_case);
+    if (!pattern_set) {
+      printf("grep: memory allocation error\n");
+      goto cleanup;
+    }
   }
 
   // Reset grep results if any previous search was done
   free_grep_results();
 
   // Convert pattern to lowercase for case-insensitive search if needed
-  char *pattern_lower = NULL;
   if (mode == SEARCH_MODE_IGNORE_CASE) {
     pattern_lower = _strdup(pattern);
-    if (pattern_lower) {
-      for (char *p = pattern_lower; *p; p++) {
-        *p = tolower(*p);
-      }
+    if (!pattern_lower) {
+      printf("grep: memory allocation error\n");
+      goto cleanup;
+    }
+    for (char *p = pattern_lower; *p; p++) {
+      *p = tolower(*p);
+    }
+  }
+
+  // Display search mode info; a pipeline's output is its table alone, and
+  // a picker owns the console
+  if (!table && !picker) {
+    if (mode == SEARCH_MODE_PATTERNS) {
+      printf("Searching for any of %d patterns (", pattern_list.count);
+    } else {
+      printf("Searching for: \"%s\" (", pattern);
+    }
+    if (mode == SEARCH_MODE_FUZZY) {
+      printf(top_k > 0 ? "fuzzy matching, best %d" : "fuzzy matching",
+             top_k);
+    } else if (mode == SEARCH_MODE_REGEX) {
+      printf(ignore_case ? "regular expression, case insensitive"
+                         : "regular expression");
+    } else if (mode == SEARCH_MODE_IGNORE_CASE ||
+               (mode == SEARCH_MODE_PATTERNS && ignore_case)) {
+      printf("case insensitive");
+    } else {
+      printf("exact matching");
     }
+    printf(")\n");
   }
 
-  // Display search mode info
-  printf("Searching for: \"%s\" (", pattern);
+  SearchContext context = {pattern,   pattern_lower, mode,   line_numbers,
+                           recursive, ignore_case,   regex,  scratch,
+                           pattern_set};
   if (mode == SEARCH_MODE_FUZZY) {
-    printf("fuzzy matching");
+    context.fuzzy = fuzzy_pattern;
+    context.top_k =
+        output_mode == OUTPUT_LINES && !table && !picker ? top_k : 0;
+  }
+  ThreadPoolGroup tasks = {0};
+  context.tasks = &tasks;
+  context.output_mode = output_mode;
+  context.max_count = max_count;
+  context.before_context = before_context;
+  context.after_context = after_context;
+
+  // Results are printed as files complete, in traversal order, except for
+  // fuzzy matches, which are only ranked once every file has been searched.
+  // In a pipeline they become table rows in the same order, fuzzy matches
+  // included; a picker gets them as they are found, and ranks them itself.
+  GrepOutput output;
+  memset(&output, 0, sizeof(output));
+  InitializeCriticalSection(&output.lock);
+  DWORD console_mode;
+  output.color =
+      GetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), &console_mode) != 0;
+  output.table = table;
+  output.row_limit = row_limit;
+  output.picker = picker;
+  if (mode != SEARCH_MODE_FUZZY || output_mode != OUTPUT_LINES || table ||
+      picker) {
+    context.output = &output;
+  }
+
+  // Skip tables and the anchor byte are worked out once for the whole search
+  if (mode == SEARCH_MODE_PLAIN) {
+    literal_matcher_init(&context.literal, pattern, FALSE);
   } else if (mode == SEARCH_MODE_IGNORE_CASE) {
-    printf("case insensitive");
+    literal_matcher_init(&context.literal, pattern_lower, TRUE);
+  } else if (mode == SEARCH_MODE_REGEX && regex_required_literal(regex)) {
+    literal_matcher_init(&context.literal, regex_required_literal(regex),
+                         ignore_case);
+  }
+
+  // Strings the index narrows the search with: the pattern, the literal
+  // every regex match contains, or each of several patterns. Fuzzy matches
+  // need not contain any of the query's trigrams, so they search every file.
+  const char *const *index_literals = NULL;
+  int index_literal_count = 0;
+  const char *regex_literal = NULL;
+  if (use_index && mode == SEARCH_MODE_FUZZY) {
+    use_index = FALSE;
+  } else if (mode == SEARCH_MODE_PATTERNS) {
+    index_literals = (const char *const *)pattern_list.items;
+    index_literal_count = pattern_list.count;
+  } else if (mode == SEARCH_MODE_REGEX) {
+    regex_literal = regex_required_literal(regex);
+    index_literals = &regex_literal;
+    index_literal_count = regex_literal ? 1 : 0;
   } else {
-    printf("exact matching");
+    index_literals = &pattern;
+    index_literal_count = 1;
   }
-  printf(")\n");
 
   // Start time measurement
   clock_t start_time = clock();
@@ -2149,8 +4141,11 @@ int lsh_grep(char **args) {
   // Check if specific files/directories were specified
   if (file_args_start < 0 || args[file_args_start] == NULL) {
     // No files specified, search current directory
-    search_directory(".", pattern, pattern_lower, mode, line_numbers,
-                     recursive);
+    if (use_index) {
+      search_indexed(&context, ".", index_literals, index_literal_count);
+    } else {
+      search_directory(&context, ".");
+    }
   } else {
     // Process each specified file/directory
     while (args[arg_index] != NULL) {
@@ -2161,47 +4156,126 @@ int lsh_grep(char **args) {
         printf("grep: %s: No such file or directory\n", args[arg_index]);
       } else if (attr & FILE_ATTRIBUTE_DIRECTORY) {
         // It's a directory
-        search_directory(args[arg_index], pattern, pattern_lower, mode,
-                         line_numbers, recursive);
+        if (use_index) {
+          search_indexed(&context, args[arg_index], index_literals,
+                         index_literal_count);
+        } else {
+          search_directory(&context, args[arg_index]);
+        }
       } else {
         // It's a file
-        search_file(args[arg_index], pattern, pattern_lower, mode,
-                    line_numbers);
+        search_file(&context, args[arg_index], NULL);
+        merge_thread_results();
       }
 
       arg_index++;
     }
   }
 
+  // Files searched on their own may have left output pending
+  finish_output(context.output);
+
+  // Each thread kept its own best matches; rank them all together
+  if (mode == SEARCH_MODE_FUZZY && !table && !picker) {
+    keep_best_results(grep_results.results, &grep_results.count, top_k);
+  }
+
   // End time measurement
   clock_t end_time = clock();
   double search_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
 
-  // Clean up mutex and pattern
-  CloseHandle(result_mutex);
-  result_mutex = NULL;
-
-  if (pattern_lower) {
-    free(pattern_lower);
-  }
-
-  // Display the interactive results if any were found
-  if (grep_results.count > 0) {
+  // Streamed lines, -l and -c are printed while searching, so only a
+  // summary follows; fuzzy matches, ranked at the end, open the viewer
+  if (table || picker) {
+    // The pipeline prints the table; the picker shows the matches
+  } else if (output_mode != OUTPUT_LINES) {
+    printf("%d matching lines in %d files (search completed in %.2f "
+           "seconds)\n",
+           output.matched_lines, output.matched_files, search_time);
+  } else if (context.output && output.matched_lines > 0) {
+    printf("Found %d matches in %d files in %.2f seconds\n",
+           output.matched_lines, output.matched_files, search_time);
+  } else if (!context.output && grep_results.count > 0) {
     printf("Found %d matches in %.2f seconds\n", grep_results.count,
            search_time);
+    if (mode == SEARCH_MODE_PATTERNS) {
+      grep_results.patterns = pattern_list.items;
+      grep_results.pattern_count = pattern_list.count;
+    }
     display_grep_results();
+    grep_results.patterns = NULL;
+    grep_results.pattern_count = 0;
+  } else if (mode == SEARCH_MODE_PATTERNS) {
+    printf("No matches found for any of %d patterns (search completed in "
+           "%.2f seconds)\n",
+           pattern_list.count, search_time);
   } else {
     printf("No matches found for pattern: \"%s\" (search completed in %.2f "
            "seconds)\n",
            pattern, search_time);
   }
 
+  // As with grep, finding nothing fails, so "grep x f && ..." stops
+  if (!table && !picker && output.matched_lines == 0 &&
+      grep_results.count == 0) {
+    lsh_builtin_failed();
+  }
+
   // Clean up
   free_grep_results();
+  free(output.pending.data);
+  DeleteCriticalSection(&output.lock);
+  status = TRUE;
+
+cleanup:
+  free(pattern_lower);
+  if (scratch) {
+    for (int i = 0; i < thread_result_count; i++) {
+      regex_scratch_free(scratch[i]);
+    }
+    free(scratch);
+  }
+  regex_free(regex);
+  pattern_set_free(pattern_set);
+  fuzzy_pattern_free(fuzzy_pattern);
+  free(joined_pattern);
+  free_pattern_list(&pattern_list);
+  return status;
+}
 
+/**
+ * Command handler for the "grep" command
+ */
+int lsh_grep(char **args) {
+  if (!run_grep(args, NULL, 0, NULL)) {
+    return lsh_builtin_failed();
+  }
   return 1;
 }
 
+/**
+ * Run "grep" as the first stage of a pipeline
+ */
+TableData *lsh_grep_structured(char **args, int row_limit) {
+  char *headers[] = {"File", "Line", "Column", "Match", "Text"};
+  TableData *table = create_table(headers, GREP_COLUMNS);
+  if (!table) {
+    return NULL;
+  }
+  if (!run_grep(args, table, row_limit, NULL)) {
+    free_table(table);
+    return NULL;
+  }
+  return table;
+}
+
+/**
+ * Run "grep" with its matching lines streamed into a picker
+ */
+BOOL lsh_grep_to_picker(char **args, FuzzyPicker *picker) {
+  return run_grep(args, NULL, 0, picker);
+}
+
 /**
  * Actual grep implementation with simpler interface
  */
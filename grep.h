@@ -7,6 +7,8 @@
 #define GREP_H
 
 #include "common.h"
+#include "fuzzy_picker.h"
+#include "structured_data.h"
 
 /**
  * Command handler for the "grep" command
@@ -16,13 +18,64 @@
  *   -n, --line-numbers  Show line numbers
  *   -i, --ignore-case   Ignore case distinctions
  *   -r, --recursive     Search directories recursively
- *   -f, --fuzzy         Use fuzzy matching instead of exact
+ *   -E, --regex         Treat the pattern as a regular expression
+ *   -f, --fuzzy         Use fuzzy matching instead of exact, best match first
+ *   --top N             Keep the N best fuzzy matches (default 1000, 0 for
+ *                       all)
+ *   --index             Search directories recursively through a trigram
+ *                       index kept in %USERPROFILE%\.lsh_grep_index, which
+ *                       only rereads files changed since the last search
+ *   -l, --files-with-matches
+ *                       Print only the paths of files with a match
+ *   -c, --count         Print the number of matching lines in each file
+ *   -m, --max-count N   Stop searching a file after N matching lines
+ *   -A N, -B N, -C N    Print N lines of context after, before, or around
+ *                       each matching line; runs that overlap are merged
+ *                       and runs that do not meet are separated by "--"
+ *   -e PATTERN          Search for PATTERN; may be repeated, and then the
+ *                       remaining arguments are files/directories
+ *   --pattern-file FILE Search for each non-empty line of FILE
  *   --file              Specify files/directories to search (otherwise searches
  * current dir)
  *
+ * Matching lines (or, with -l and -c, paths and counts) are printed as each
+ * file finishes, in traversal order, before the interactive results view
+ * opens; fuzzy matches are ranked first and only shown in the view.
+ *
+ * Directory searches skip hidden entries, whatever .gitignore, .ignore,
+ * info/exclude and the global excludes file exclude, and binary files
+ * (those with a NUL byte near the start).
+ *
  * @param args Command arguments
  * @return 1 to continue shell execution, 0 to exit shell
  */
 int lsh_grep(char **args);
 
+/**
+ * Run "grep" as the first stage of a pipeline
+ * (e.g. grep TODO | group-by File | sort-by Count desc)
+ *
+ * Each matching line becomes a row as the search finds it, in traversal
+ * order. -l and -c are rejected; group-by File gives the same answers.
+ *
+ * @param args Command arguments, as for lsh_grep
+ * @param row_limit Rows the rest of the pipeline uses (a limit right after
+ *                  grep), or 0 for all; the search stops once it has them
+ * @return Table with File, Line, Column, Match and Text columns, or NULL on
+ *         error
+ */
+TableData *lsh_grep_structured(char **args, int row_limit);
+
+/**
+ * Run "grep" with each matching line streamed into a picker, as a
+ * "path:line:column:text" candidate, while the search runs on the grep pool.
+ * Nothing is printed once the command line is accepted, and the search
+ * stops early when the picker closes. The picker's input is left open.
+ *
+ * @param args Command arguments, as for lsh_grep; -l and -c are rejected
+ * @param picker The picker to feed
+ * @return FALSE if the command line was rejected
+ */
+BOOL lsh_grep_to_picker(char **args, FuzzyPicker *picker);
+
 #endif // GREP_H
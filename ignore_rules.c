@@ -0,0 +1,624 @@
+/**
+ * ignore_rules.c
+ * Implementation of ignore rules: gitignore patterns compiled into glob
+ * programs, stacked per directory as a traversal descends
+ */
+
+#include "ignore_rules.h"
+#include "git_repo.h"
+
+typedef enum {
+  GLOB_LITERAL,      // Text, compared ignoring case
+  GLOB_ANY,          // '?': one character other than '/'
+  GLOB_CLASS,        // [...]: one character from a set, other than '/'
+  GLOB_STAR,         // '*': any run of characters other than '/'
+  GLOB_GLOBSTAR,     // "**/": zero or more whole directories
+  GLOB_GLOBSTAR_TAIL // Trailing "/**": everything inside a directory
+} GlobOp;
+
+typedef struct {
+  GlobOp op;
+  int offset; // GLOB_LITERAL: position in the rule's text
+  int length; // GLOB_LITERAL: length of the text
+  int negate; // GLOB_CLASS: matches characters outside the set
+  unsigned char set[32]; // GLOB_CLASS: bit per byte, both cases of letters
+} GlobToken;
+
+// Most patterns are plain names ("node_modules") or extensions ("*.obj"),
+// which are compared directly instead of running the glob program
+typedef enum {
+  RULE_NAME,   // The entry's name equals text
+  RULE_SUFFIX, // The entry's name ends with text
+  RULE_GLOB    // The glob program matches
+} RuleKind;
+
+typedef struct {
+  RuleKind kind;
+  int negate;   // "!pattern": re-include matching entries
+  int dir_only; // "pattern/": match directories only
+  int anchored; // Contains a '/': matched against the path relative to the
+                // ignore file's directory instead of the entry's name
+  char *text;   // RULE_NAME and RULE_SUFFIX text, or GLOB_LITERAL storage
+  GlobToken *tokens;
+  int token_count;
+} IgnoreRule;
+
+struct IgnoreStack {
+  IgnoreStack *parent;
+  volatile LONG refs;
+  char *prefix; // Path of the traversal root relative to the rules'
+                // directory, with a trailing '/'; NULL below the root
+  int skip;     // Length of the rules' directory path plus its separator
+  IgnoreRule *rules;
+  int rule_count;
+  int rule_capacity;
+};
+
+// ---------------------------------------------------------------------------
+// Compiling patterns
+// ---------------------------------------------------------------------------
+
+static void set_class_byte(GlobToken *token, unsigned char c) {
+  token->set[c >> 3] |= (unsigned char)(1 << (c & 7));
+  if (isalpha(c)) {
+    unsigned char other = islower(c) ? (unsigned char)toupper(c)
+                                     : (unsigned char)tolower(c);
+    token->set[other >> 3] |= (unsigned char)(1 << (other & 7));
+  }
+}
+
+/**
+ * Parse a [...] class starting at p
+ * @return Position after the closing ']', or NULL if the class is not
+ *         closed (the '[' is then a literal)
+ */
+static const char *parse_class(const char *p, GlobToken *token) {
+  memset(token, 0, sizeof(*token));
+  token->op = GLOB_CLASS;
+  p++;
+  if (*p == '!' || *p == '^') {
+    token->negate = 1;
+    p++;
+  }
+
+  // A ']' right after the opening bracket is part of the set
+  int first = 1;
+  while (*p && (*p != ']' || first)) {
+    unsigned char low = (unsigned char)*p;
+    if (low == '\\' && p[1]) {
+      low = (unsigned char)*++p;
+    }
+    p++;
+
+    unsigned char high = low;
+    if (p[0] == '-' && p[1] && p[1] != ']') {
+      p++;
+      if (*p == '\\' && p[1]) {
+        p++;
+      }
+      high = (unsigned char)*p++;
+    }
+    for (int c = low; c <= high; c++) {
+      set_class_byte(token, (unsigned char)c);
+    }
+    first = 0;
+  }
+  return *p == ']' ? p + 1 : NULL;
+}
+
+static int add_token(IgnoreRule *rule, int *capacity, const GlobToken *token) {
+  if (rule->token_count == *capacity) {
+    int new_capacity = *capacity ? *capacity * 2 : 8;
+    GlobToken *tokens = (GlobToken *)realloc(
+        rule->tokens, new_capacity * sizeof(GlobToken));
+    if (!tokens) {
+      return 0;
+    }
+    rule->tokens = tokens;
+    *capacity = new_capacity;
+  }
+  rule->tokens[rule->token_count++] = *token;
+  return 1;
+}
+
+/**
+ * Compile a pattern into a glob program. Literal runs are unescaped into
+ * rule->text, which must be at least as long as the pattern.
+ */
+static int compile_glob(IgnoreRule *rule, const char *pattern) {
+  int capacity = 0;
+  int text_length = 0;
+  const char *p = pattern;
+
+  while (*p) {
+    GlobToken token;
+    memset(&token, 0, sizeof(token));
+    const char *class_end = NULL;
+
+    if (p[0] == '*' && p[1] == '*' && (p == pattern || p[-1] == '/') &&
+        (p[2] == '/' || p[2] == '\0')) {
+      token.op = p[2] == '/' ? GLOB_GLOBSTAR : GLOB_GLOBSTAR_TAIL;
+      p += p[2] == '/' ? 3 : 2;
+    } else if (*p == '*') {
+      token.op = GLOB_STAR;
+      while (*p == '*') {
+        p++;
+      }
+    } else if (*p == '?') {
+      token.op = GLOB_ANY;
+      p++;
+    } else if (*p == '[' && (class_end = parse_class(p, &token)) != NULL) {
+      p = class_end;
+    } else {
+      // Everything else, including an unclosed '[', is literal
+      memset(&token, 0, sizeof(token));
+      char c = *p++;
+      if (c == '\\' && *p) {
+        c = *p++;
+      }
+
+      // Extend the previous literal if there is one
+      GlobToken *last =
+          rule->token_count ? &rule->tokens[rule->token_count - 1] : NULL;
+      rule->text[text_length++] = c;
+      if (last && last->op == GLOB_LITERAL &&
+          last->offset + last->length == text_length - 1) {
+        last->length++;
+        continue;
+      }
+      token.op = GLOB_LITERAL;
+      token.offset = text_length - 1;
+      token.length = 1;
+    }
+
+    if (!add_token(rule, &capacity, &token)) {
+      return 0;
+    }
+  }
+
+  rule->text[text_length] = '\0';
+  return 1;
+}
+
+static int has_glob_chars(const char *text) {
+  return strpbrk(text, "*?[\\") != NULL;
+}
+
+/**
+ * Parse one line of an ignore file
+ * @return 1 if it holds a rule, 0 for blank lines, comments and
+ *         allocation failures
+ */
+static int parse_rule(char *line, IgnoreRule *rule) {
+  memset(rule, 0, sizeof(*rule));
+  line[strcspn(line, "\r\n")] = '\0';
+
+  // Trailing spaces are dropped unless escaped
+  size_t length = strlen(line);
+  while (length > 0 && line[length - 1] == ' ' &&
+         (length < 2 || line[length - 2] != '\\')) {
+    line[--length] = '\0';
+  }
+  if (length == 0 || line[0] == '#') {
+    return 0;
+  }
+
+  char *pattern = line;
+  if (*pattern == '!') {
+    rule->negate = 1;
+    pattern++;
+  } else if (pattern[0] == '\\' && (pattern[1] == '!' || pattern[1] == '#')) {
+    pattern++;
+  }
+
+  length = strlen(pattern);
+  if (length > 0 && pattern[length - 1] == '/') {
+    rule->dir_only = 1;
+    pattern[--length] = '\0';
+  }
+  if (length == 0) {
+    return 0;
+  }
+
+  rule->anchored = strchr(pattern, '/') != NULL;
+  if (*pattern == '/') {
+    pattern++;
+  }
+  if (*pattern == '\0') {
+    return 0;
+  }
+
+  if (!rule->anchored && !has_glob_chars(pattern)) {
+    rule->kind = RULE_NAME;
+    rule->text = _strdup(pattern);
+  } else if (!rule->anchored && pattern[0] == '*' &&
+             !has_glob_chars(pattern + 1)) {
+    rule->kind = RULE_SUFFIX;
+    rule->text = _strdup(pattern + 1);
+  } else {
+    rule->kind = RULE_GLOB;
+    rule->text = (char *)malloc(strlen(pattern) + 1);
+    if (rule->text && !compile_glob(rule, pattern)) {
+      free(rule->text);
+      rule->text = NULL;
+    }
+  }
+
+  if (!rule->text) {
+    free(rule->tokens);
+    return 0;
+  }
+  return 1;
+}
+
+static void free_rule(IgnoreRule *rule) {
+  free(rule->text);
+  free(rule->tokens);
+}
+
+/**
+ * Add the rules of an ignore file to a stack frame
+ * @return 1 if the file exists
+ */
+static int load_rules(IgnoreStack *frame, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return 0;
+  }
+
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    IgnoreRule rule;
+    if (!parse_rule(line, &rule)) {
+      continue;
+    }
+    if (frame->rule_count == frame->rule_capacity) {
+      int capacity = frame->rule_capacity ? frame->rule_capacity * 2 : 16;
+      IgnoreRule *rules = (IgnoreRule *)realloc(
+          frame->rules, capacity * sizeof(IgnoreRule));
+      if (!rules) {
+        free_rule(&rule);
+        break;
+      }
+      frame->rules = rules;
+      frame->rule_capacity = capacity;
+    }
+    frame->rules[frame->rule_count++] = rule;
+  }
+
+  fclose(file);
+  return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Matching
+// ---------------------------------------------------------------------------
+
+/**
+ * Run a glob program from token t against text, which uses '/' separators
+ */
+static int glob_match(const IgnoreRule *rule, int t, const char *text) {
+  for (; t < rule->token_count; t++) {
+    const GlobToken *token = &rule->tokens[t];
+    unsigned char c = (unsigned char)*text;
+
+    switch (token->op) {
+    case GLOB_LITERAL:
+      if (_strnicmp(text, rule->text + token->offset, token->length) != 0) {
+        return 0;
+      }
+      text += token->length;
+      break;
+
+    case GLOB_ANY:
+      if (c == '\0' || c == '/') {
+        return 0;
+      }
+      text++;
+      break;
+
+    case GLOB_CLASS:
+      if (c == '\0' || c == '/' ||
+          !(token->set[c >> 3] & (1 << (c & 7))) != token->negate) {
+        return 0;
+      }
+      text++;
+      break;
+
+    case GLOB_STAR:
+      // Try every length that stays within the current path component
+      for (;;) {
+        if (glob_match(rule, t + 1, text)) {
+          return 1;
+        }
+        if (*text == '\0' || *text == '/') {
+          return 0;
+        }
+        text++;
+      }
+
+    case GLOB_GLOBSTAR:
+      // Try skipping zero, one, two... leading directories
+      for (;;) {
+        if (glob_match(rule, t + 1, text)) {
+          return 1;
+        }
+        const char *slash = strchr(text, '/');
+        if (!slash) {
+          return 0;
+        }
+        text = slash + 1;
+      }
+
+    case GLOB_GLOBSTAR_TAIL:
+      return *text != '\0';
+    }
+  }
+  return *text == '\0';
+}
+
+static int rule_matches(const IgnoreRule *rule, const char *relative,
+                        const char *name, int is_directory) {
+  if (rule->dir_only && !is_directory) {
+    return 0;
+  }
+
+  const char *target = rule->anchored ? relative : name;
+  switch (rule->kind) {
+  case RULE_NAME:
+    return _stricmp(target, rule->text) == 0;
+  case RULE_SUFFIX: {
+    size_t target_length = strlen(target);
+    size_t suffix_length = strlen(rule->text);
+    return target_length >= suffix_length &&
+           _stricmp(target + target_length - suffix_length, rule->text) == 0;
+  }
+  default:
+    return glob_match(rule, 0, target);
+  }
+}
+
+/**
+ * Check whether an entry is ignored
+ */
+int ignore_stack_match(const IgnoreStack *stack, const char *path,
+                       int is_directory) {
+  if (!stack) {
+    return 0;
+  }
+
+  // Rules use '/' whatever the platform
+  char normalized[MAX_PATH];
+  snprintf(normalized, sizeof(normalized), "%s", path);
+  for (char *p = normalized; *p; p++) {
+    if (*p == '\\') {
+      *p = '/';
+    }
+  }
+  const char *name = strrchr(normalized, '/');
+  name = name ? name + 1 : normalized;
+  size_t length = strlen(normalized);
+
+  for (const IgnoreStack *frame = stack; frame; frame = frame->parent) {
+    if (frame->rule_count == 0 || (size_t)frame->skip > length) {
+      continue;
+    }
+
+    const char *relative = normalized + frame->skip;
+    char joined[MAX_PATH * 2];
+    if (frame->prefix) {
+      snprintf(joined, sizeof(joined), "%s%s", frame->prefix, relative);
+      relative = joined;
+    }
+
+    for (int i = frame->rule_count - 1; i >= 0; i--) {
+      const IgnoreRule *rule = &frame->rules[i];
+      if (rule_matches(rule, relative, name, is_directory)) {
+        return !rule->negate;
+      }
+    }
+  }
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Stacks
+// ---------------------------------------------------------------------------
+
+static IgnoreStack *new_frame(IgnoreStack *parent, const char *prefix,
+                              int skip) {
+  IgnoreStack *frame = (IgnoreStack *)calloc(1, sizeof(IgnoreStack));
+  if (!frame) {
+    return NULL;
+  }
+  frame->refs = 1;
+  frame->skip = skip;
+  if (prefix) {
+    frame->prefix = _strdup(prefix);
+    if (!frame->prefix) {
+      free(frame);
+      return NULL;
+    }
+  }
+  frame->parent = ignore_stack_retain(parent);
+  return frame;
+}
+
+/**
+ * Push a frame with the rules of the given files, or return the stack
+ * unchanged (with a new reference) if none of them has any
+ */
+static IgnoreStack *push_files(IgnoreStack *stack, const char *prefix,
+                               int skip, const char *const *files,
+                               int file_count) {
+  IgnoreStack *frame = new_frame(stack, prefix, skip);
+  if (!frame) {
+    return ignore_stack_retain(stack);
+  }
+
+  for (int i = 0; i < file_count; i++) {
+    if (files[i]) {
+      load_rules(frame, files[i]);
+    }
+  }
+
+  if (frame->rule_count == 0) {
+    ignore_stack_release(frame);
+    return ignore_stack_retain(stack);
+  }
+  return frame;
+}
+
+/**
+ * Enter a directory
+ */
+IgnoreStack *ignore_stack_enter(IgnoreStack *stack, const char *directory) {
+  char gitignore[MAX_PATH];
+  char ignore[MAX_PATH];
+  snprintf(gitignore, sizeof(gitignore), "%s\\.gitignore", directory);
+  snprintf(ignore, sizeof(ignore), "%s\\.ignore", directory);
+
+  const char *files[] = {gitignore, ignore};
+  return push_files(stack, NULL, (int)strlen(directory) + 1, files, 2);
+}
+
+/**
+ * Find the global excludes file: core.excludesFile, or the XDG default
+ */
+static int global_excludes_path(const GitRepo *repo, char *path,
+                                size_t size) {
+  char value[MAX_PATH];
+  if (repo && git_config_get(repo, "core", NULL, "excludesfile", value,
+                             sizeof(value))) {
+    if (value[0] == '~' && getenv("USERPROFILE")) {
+      snprintf(path, size, "%s%s", getenv("USERPROFILE"), value + 1);
+    } else {
+      snprintf(path, size, "%s", value);
+    }
+    return 1;
+  }
+
+  const char *config_home = getenv("XDG_CONFIG_HOME");
+  if (config_home && config_home[0]) {
+    snprintf(path, size, "%s\\git\\ignore", config_home);
+    return 1;
+  }
+  const char *home = getenv("USERPROFILE");
+  if (home) {
+    snprintf(path, size, "%s\\.config\\git\\ignore", home);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Build the stack for a traversal rooted at a directory
+ */
+IgnoreStack *ignore_stack_open(const char *root) {
+  char full_root[MAX_PATH];
+  DWORD length = GetFullPathName(root, sizeof(full_root), full_root, NULL);
+  if (length == 0 || length >= sizeof(full_root)) {
+    return NULL;
+  }
+  while (length > 3 && (full_root[length - 1] == '\\' ||
+                        full_root[length - 1] == '/')) {
+    full_root[--length] = '\0';
+  }
+
+  GitRepo repo;
+  int in_repo = git_find_repository(full_root, &repo);
+  size_t repo_length = in_repo ? strlen(repo.root) : 0;
+  if (in_repo && (_strnicmp(full_root, repo.root, repo_length) != 0 ||
+                  (full_root[repo_length] != '\0' &&
+                   full_root[repo_length] != '\\'))) {
+    in_repo = 0; // The root is inside the .git directory or not a subpath
+  }
+
+  // Paths below the root are matched from the root onwards; rules from
+  // above it see them through the root's path relative to their directory
+  char relative_root[MAX_PATH] = "";
+  if (in_repo && full_root[repo_length] == '\\') {
+    snprintf(relative_root, sizeof(relative_root), "%s/",
+             full_root + repo_length + 1);
+    for (char *p = relative_root; *p; p++) {
+      if (*p == '\\') {
+        *p = '/';
+      }
+    }
+  }
+  int skip = (int)strlen(root) + 1;
+
+  char excludes[MAX_PATH];
+  char info_exclude[MAX_PATH];
+  const char *files[2] = {NULL, NULL};
+  if (global_excludes_path(in_repo ? &repo : NULL, excludes,
+                           sizeof(excludes))) {
+    files[0] = excludes;
+  }
+  if (in_repo) {
+    snprintf(info_exclude, sizeof(info_exclude), "%s\\info\\exclude",
+             repo.common_dir);
+    files[1] = info_exclude;
+  }
+  IgnoreStack *stack = push_files(NULL, in_repo ? relative_root : NULL, skip,
+                                  files, 2);
+
+  // Ignore files of the directories from the repository root down to the
+  // traversal root's parent
+  if (in_repo && relative_root[0]) {
+    char directory[MAX_PATH];
+    snprintf(directory, sizeof(directory), "%s", repo.root);
+    const char *rest = relative_root;
+
+    while (*rest) {
+      char gitignore[MAX_PATH];
+      char ignore[MAX_PATH];
+      snprintf(gitignore, sizeof(gitignore), "%s\\.gitignore", directory);
+      snprintf(ignore, sizeof(ignore), "%s\\.ignore", directory);
+      const char *dir_files[] = {gitignore, ignore};
+
+      IgnoreStack *pushed = push_files(stack, rest, skip, dir_files, 2);
+      ignore_stack_release(stack);
+      stack = pushed;
+
+      // Descend one component
+      const char *slash = strchr(rest, '/');
+      size_t used = strlen(directory);
+      snprintf(directory + used, sizeof(directory) - used, "\\%.*s",
+               (int)(slash - rest), rest);
+      rest = slash + 1;
+    }
+  }
+
+  return stack;
+}
+
+IgnoreStack *ignore_stack_retain(IgnoreStack *stack) {
+  if (stack) {
+    InterlockedIncrement(&stack->refs);
+  }
+  return stack;
+}
+
+void ignore_stack_release(IgnoreStack *stack) {
+  while (stack && InterlockedDecrement(&stack->refs) == 0) {
+    IgnoreStack *parent = stack->parent;
+    for (int i = 0; i < stack->rule_count; i++) {
+      free_rule(&stack->rules[i]);
+    }
+    free(stack->rules);
+    free(stack->prefix);
+    free(stack);
+    stack = parent;
+  }
+}
+
+/**
+ * Check a file's contents for NUL bytes
+ */
+int looks_binary(const void *data, size_t size) {
+  if (size > BINARY_SNIFF_BYTES) {
+    size = BINARY_SNIFF_BYTES;
+  }
+  return memchr(data, '\0', size) != NULL;
+}
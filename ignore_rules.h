@@ -0,0 +1,83 @@
+/**
+ * ignore_rules.h
+ * .gitignore, .ignore and global exclude rules for directory traversal
+ */
+
+#ifndef IGNORE_RULES_H
+#define IGNORE_RULES_H
+
+#include "common.h"
+
+// Bytes of a file checked for NUL bytes to tell binary files from text
+#define BINARY_SNIFF_BYTES 8192
+
+// The rules in effect in one directory: its own .gitignore and .ignore
+// files on top of those of the directories above it. Stacks are reference
+// counted and read-only once built, so one can be shared by tasks running
+// on different threads. NULL is a valid stack with no rules.
+typedef struct IgnoreStack IgnoreStack;
+
+/**
+ * Build the stack for a traversal rooted at a directory: the global
+ * excludes file (core.excludesFile, or the XDG default), the repository's
+ * info/exclude, and the ignore files of the directories between the
+ * repository root and the traversal root. The root's own files are added
+ * by ignore_stack_enter, like those of every other directory.
+ *
+ * @param root Directory the traversal starts at
+ * @return New stack (release with ignore_stack_release), or NULL if no
+ *         rules apply
+ */
+IgnoreStack *ignore_stack_open(const char *root);
+
+/**
+ * Enter a directory, pushing the rules of its .gitignore and .ignore files
+ * (the latter taking precedence)
+ *
+ * @param stack Stack in effect for the directory's parent
+ * @param directory Path of the directory, as built by the traversal
+ * @return New reference to the directory's stack
+ */
+IgnoreStack *ignore_stack_enter(IgnoreStack *stack, const char *directory);
+
+/**
+ * Take another reference to a stack
+ *
+ * @param stack The stack, or NULL
+ * @return The same stack
+ */
+IgnoreStack *ignore_stack_retain(IgnoreStack *stack);
+
+/**
+ * Drop a reference to a stack
+ *
+ * @param stack The stack, or NULL
+ */
+void ignore_stack_release(IgnoreStack *stack);
+
+/**
+ * Check whether an entry of a directory is ignored. The last matching rule
+ * of the deepest directory decides, so "!" rules can re-include entries.
+ * Matching ignores case, as Windows file names do.
+ *
+ * @param stack Stack returned by ignore_stack_enter for the entry's
+ *              directory
+ * @param path Path of the entry: the directory's path, a backslash and the
+ *             entry's name
+ * @param is_directory Nonzero if the entry is a directory
+ * @return 1 if ignored, 0 otherwise
+ */
+int ignore_stack_match(const IgnoreStack *stack, const char *path,
+                       int is_directory);
+
+/**
+ * Check a file's contents for NUL bytes in the first BINARY_SNIFF_BYTES,
+ * the test git and ripgrep use to tell binary files from text
+ *
+ * @param data Start of the contents
+ * @param size Size of the contents
+ * @return 1 if the contents look binary, 0 otherwise
+ */
+int looks_binary(const void *data, size_t size);
+
+#endif // IGNORE_RULES_H
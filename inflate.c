@@ -0,0 +1,391 @@
+/**
+ * inflate.c
+ * Implementation of zlib/DEFLATE decompression
+ */
+
+#include "inflate.h"
+
+#define MAX_CODE_BITS 15
+#define MAX_LITLEN_CODES 288
+#define MAX_DIST_CODES 30
+
+// Canonical Huffman code: number of codes of each length, then the symbols
+// ordered by code
+typedef struct {
+  short count[MAX_CODE_BITS + 1];
+  short symbol[MAX_LITLEN_CODES];
+} Huffman;
+
+typedef struct {
+  const unsigned char *in;
+  size_t in_size;
+  size_t in_pos;
+  unsigned int bit_buffer;
+  int bit_count;
+
+  unsigned char *out;
+  size_t out_size;
+  size_t out_capacity;
+} InflateState;
+
+static const short length_base[29] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                      11, 13, 15, 17,  19,  23,  27,  31,
+                                      35, 43, 51, 59,  67,  83,  99,  115,
+                                      131, 163, 195, 227, 258};
+static const short length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                       1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                       4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const short dist_base[30] = {
+    1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,
+    65,  97,  129, 193, 257, 385,  513,  769,  1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577};
+static const short dist_extra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                     4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                     9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order in which code length code lengths are stored
+static const unsigned char code_length_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static Huffman fixed_litlen;
+static Huffman fixed_dist;
+static INIT_ONCE fixed_once = INIT_ONCE_STATIC_INIT;
+
+/**
+ * Read count bits, least significant first. Returns -1 past the end.
+ */
+static int get_bits(InflateState *s, int count) {
+  while (s->bit_count < count) {
+    if (s->in_pos >= s->in_size) {
+      return -1;
+    }
+    s->bit_buffer |= (unsigned int)s->in[s->in_pos++] << s->bit_count;
+    s->bit_count += 8;
+  }
+
+  int value = (int)(s->bit_buffer & ((1u << count) - 1));
+  s->bit_buffer >>= count;
+  s->bit_count -= count;
+  return value;
+}
+
+static int ensure_output(InflateState *s, size_t extra) {
+  if (s->out_size + extra < s->out_capacity) {
+    return 1;
+  }
+
+  size_t capacity = s->out_capacity ? s->out_capacity : 4096;
+  while (capacity <= s->out_size + extra) {
+    capacity *= 2;
+  }
+
+  unsigned char *grown = (unsigned char *)realloc(s->out, capacity);
+  if (!grown) {
+    return 0;
+  }
+  s->out = grown;
+  s->out_capacity = capacity;
+  return 1;
+}
+
+/**
+ * Build a canonical Huffman code from a list of code lengths
+ *
+ * @return 0 if the lengths describe a valid (possibly incomplete) code
+ */
+static int build_huffman(Huffman *h, const short *lengths, int count) {
+  short offsets[MAX_CODE_BITS + 1];
+
+  memset(h->count, 0, sizeof(h->count));
+  for (int i = 0; i < count; i++) {
+    h->count[lengths[i]]++;
+  }
+  if (h->count[0] == count) {
+    return 0; // No codes - only valid for an unused distance code
+  }
+
+  int left = 1;
+  for (int len = 1; len <= MAX_CODE_BITS; len++) {
+    left <<= 1;
+    left -= h->count[len];
+    if (left < 0) {
+      return -1; // Over-subscribed
+    }
+  }
+
+  offsets[1] = 0;
+  for (int len = 1; len < MAX_CODE_BITS; len++) {
+    offsets[len + 1] = offsets[len] + h->count[len];
+  }
+  for (int i = 0; i < count; i++) {
+    if (lengths[i] != 0) {
+      h->symbol[offsets[lengths[i]]++] = (short)i;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Decode one symbol, reading the code a bit at a time
+ */
+static int decode_symbol(InflateState *s, const Huffman *h) {
+  int code = 0;
+  int first = 0;
+  int index = 0;
+
+  for (int len = 1; len <= MAX_CODE_BITS; len++) {
+    int bit = get_bits(s, 1);
+    if (bit < 0) {
+      return -1;
+    }
+    code |= bit;
+
+    int count = h->count[len];
+    if (code - count < first) {
+      return h->symbol[index + (code - first)];
+    }
+    index += count;
+    first += count;
+    first <<= 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+static BOOL CALLBACK init_fixed_codes(PINIT_ONCE once, PVOID param,
+                                      PVOID *context) {
+  short lengths[MAX_LITLEN_CODES];
+  int i;
+
+  for (i = 0; i < 144; i++) {
+    lengths[i] = 8;
+  }
+  for (; i < 256; i++) {
+    lengths[i] = 9;
+  }
+  for (; i < 280; i++) {
+    lengths[i] = 7;
+  }
+  for (; i < MAX_LITLEN_CODES; i++) {
+    lengths[i] = 8;
+  }
+  build_huffman(&fixed_litlen, lengths, MAX_LITLEN_CODES);
+
+  for (i = 0; i < MAX_DIST_CODES; i++) {
+    lengths[i] = 5;
+  }
+  build_huffman(&fixed_dist, lengths, MAX_DIST_CODES);
+  return TRUE;
+}
+
+/**
+ * Decode the literals and matches of a compressed block
+ */
+static int inflate_codes(InflateState *s, const Huffman *litlen,
+                         const Huffman *dist) {
+  for (;;) {
+    int symbol = decode_symbol(s, litlen);
+    if (symbol < 0) {
+      return 0;
+    }
+
+    if (symbol < 256) {
+      if (!ensure_output(s, 1)) {
+        return 0;
+      }
+      s->out[s->out_size++] = (unsigned char)symbol;
+      continue;
+    }
+    if (symbol == 256) {
+      return 1; // End of block
+    }
+
+    symbol -= 257;
+    if (symbol >= 29) {
+      return 0;
+    }
+    int extra = get_bits(s, length_extra[symbol]);
+    if (extra < 0) {
+      return 0;
+    }
+    size_t length = (size_t)(length_base[symbol] + extra);
+
+    symbol = decode_symbol(s, dist);
+    if (symbol < 0 || symbol >= MAX_DIST_CODES) {
+      return 0;
+    }
+    extra = get_bits(s, dist_extra[symbol]);
+    if (extra < 0) {
+      return 0;
+    }
+    size_t distance = (size_t)(dist_base[symbol] + extra);
+    if (distance > s->out_size || !ensure_output(s, length)) {
+      return 0;
+    }
+
+    // Byte by byte, since the match may overlap the bytes being written
+    unsigned char *from = s->out + s->out_size - distance;
+    unsigned char *to = s->out + s->out_size;
+    for (size_t i = 0; i < length; i++) {
+      to[i] = from[i];
+    }
+    s->out_size += length;
+  }
+}
+
+static int inflate_stored(InflateState *s) {
+  // Stored blocks start on a byte boundary
+  s->bit_buffer = 0;
+  s->bit_count = 0;
+
+  if (s->in_pos + 4 > s->in_size) {
+    return 0;
+  }
+  const unsigned char *p = s->in + s->in_pos;
+  unsigned int length = p[0] | (p[1] << 8);
+  unsigned int complement = p[2] | (p[3] << 8);
+  if (length != (~complement & 0xFFFF)) {
+    return 0;
+  }
+  s->in_pos += 4;
+
+  if (s->in_pos + length > s->in_size || !ensure_output(s, length)) {
+    return 0;
+  }
+  memcpy(s->out + s->out_size, s->in + s->in_pos, length);
+  s->out_size += length;
+  s->in_pos += length;
+  return 1;
+}
+
+static int inflate_dynamic(InflateState *s) {
+  Huffman litlen, dist, code_lengths;
+  short lengths[MAX_LITLEN_CODES + MAX_DIST_CODES];
+
+  int litlen_count = get_bits(s, 5);
+  int dist_count = get_bits(s, 5);
+  int code_count = get_bits(s, 4);
+  if (litlen_count < 0 || dist_count < 0 || code_count < 0) {
+    return 0;
+  }
+  litlen_count += 257;
+  dist_count += 1;
+  code_count += 4;
+  if (litlen_count > 286 || dist_count > MAX_DIST_CODES) {
+    return 0;
+  }
+
+  memset(lengths, 0, sizeof(lengths));
+  for (int i = 0; i < code_count; i++) {
+    int length = get_bits(s, 3);
+    if (length < 0) {
+      return 0;
+    }
+    lengths[code_length_order[i]] = (short)length;
+  }
+  if (build_huffman(&code_lengths, lengths, 19) != 0) {
+    return 0;
+  }
+
+  // Literal/length and distance code lengths share one run-length stream
+  int i = 0;
+  while (i < litlen_count + dist_count) {
+    int symbol = decode_symbol(s, &code_lengths);
+    if (symbol < 0) {
+      return 0;
+    }
+    if (symbol < 16) {
+      lengths[i++] = (short)symbol;
+      continue;
+    }
+
+    short repeat_length = 0;
+    int repeat;
+    if (symbol == 16) {
+      if (i == 0) {
+        return 0;
+      }
+      repeat_length = lengths[i - 1];
+      repeat = get_bits(s, 2);
+      repeat = repeat < 0 ? -1 : repeat + 3;
+    } else if (symbol == 17) {
+      repeat = get_bits(s, 3);
+      repeat = repeat < 0 ? -1 : repeat + 3;
+    } else {
+      repeat = get_bits(s, 7);
+      repeat = repeat < 0 ? -1 : repeat + 11;
+    }
+    if (repeat < 0 || i + repeat > litlen_count + dist_count) {
+      return 0;
+    }
+    while (repeat-- > 0) {
+      lengths[i++] = repeat_length;
+    }
+  }
+
+  if (lengths[256] == 0 || build_huffman(&litlen, lengths, litlen_count) != 0 ||
+      build_huffman(&dist, lengths + litlen_count, dist_count) != 0) {
+    return 0;
+  }
+  return inflate_codes(s, &litlen, &dist);
+}
+
+/**
+ * Decompress a zlib stream into a newly allocated buffer
+ */
+unsigned char *inflate_zlib(const unsigned char *in, size_t in_size,
+                            size_t size_hint, size_t *out_size,
+                            size_t *consumed) {
+  InflateState s;
+
+  *out_size = 0;
+  if (in_size < 2) {
+    return NULL;
+  }
+
+  // zlib header: deflate method, no preset dictionary, valid check bits
+  if ((in[0] & 0x0F) != 8 || (in[1] & 0x20) ||
+      ((in[0] << 8) | in[1]) % 31 != 0) {
+    return NULL;
+  }
+
+  InitOnceExecuteOnce(&fixed_once, init_fixed_codes, NULL, NULL);
+
+  memset(&s, 0, sizeof(s));
+  s.in = in;
+  s.in_size = in_size;
+  s.in_pos = 2;
+  if (!ensure_output(&s, size_hint)) {
+    return NULL;
+  }
+
+  int last;
+  do {
+    last = get_bits(&s, 1);
+    int type = get_bits(&s, 2);
+    int ok = 0;
+
+    if (type == 0) {
+      ok = inflate_stored(&s);
+    } else if (type == 1) {
+      ok = inflate_codes(&s, &fixed_litlen, &fixed_dist);
+    } else if (type == 2) {
+      ok = inflate_dynamic(&s);
+    }
+
+    if (last < 0 || !ok) {
+      free(s.out);
+      return NULL;
+    }
+  } while (!last);
+
+  // Skip the Adler-32 trailer; Git verifies objects by their hash instead
+  if (consumed) {
+    size_t end = s.in_pos + 4;
+    *consumed = end < in_size ? end : in_size;
+  }
+
+  s.out[s.out_size] = '\0';
+  *out_size = s.out_size;
+  return s.out;
+}
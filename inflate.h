@@ -0,0 +1,26 @@
+/**
+ * inflate.h
+ * Decompression of zlib streams (RFC 1950/1951) as stored by Git
+ */
+
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include "common.h"
+
+/**
+ * Decompress a zlib stream into a newly allocated buffer
+ *
+ * @param in Compressed data (may be followed by unrelated bytes)
+ * @param in_size Number of bytes available at in
+ * @param size_hint Expected decompressed size, or 0 if unknown
+ * @param out_size Receives the decompressed size
+ * @param consumed Receives the number of input bytes used, or NULL
+ * @return Decompressed data (caller frees; one spare byte is allocated
+ *         past the end), or NULL if the stream is corrupt
+ */
+unsigned char *inflate_zlib(const unsigned char *in, size_t in_size,
+                            size_t size_hint, size_t *out_size,
+                            size_t *consumed);
+
+#endif // INFLATE_H
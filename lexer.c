@@ -0,0 +1,454 @@
+/**
+ * lexer.c
+ * Implementation of the command line lexer and parser
+ */
+
+#include "lexer.h"
+
+/**
+ * Check whether a character ends an unquoted word. In the operator position
+ * of a where filter (where size > 10kb) < and > are comparison operators,
+ * not redirections.
+ */
+static int is_word_break(char c, int comparison) {
+  if (c == '<' || c == '>') {
+    return !comparison;
+  }
+  return c == '\0' || c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+         c == '|' || c == ';';
+}
+
+/**
+ * Check whether a backslash before this character is an escape
+ */
+static int is_escapable(char c) {
+  return c == '"' || c == '\'' || c == ' ' || c == '\t' || c == '|' ||
+         c == ';' || c == '&' || c == '<' || c == '>';
+}
+
+/**
+ * Recognize an operator at p. Returns its length, or 0 if p starts a word.
+ */
+static int match_operator(const char *line, const char *p, int comparison,
+                          TokenType *type) {
+  if (comparison && (p[0] == '<' || p[0] == '>' || p[0] == '2')) {
+    return 0;
+  }
+
+  switch (p[0]) {
+  case '|':
+    *type = (p[1] == '|') ? TOKEN_OR : TOKEN_PIPE;
+    return (p[1] == '|') ? 2 : 1;
+  case ';':
+    *type = TOKEN_SEMICOLON;
+    return 1;
+  case '&':
+    if (p[1] == '&') {
+      *type = TOKEN_AND;
+      return 2;
+    }
+    return 0; // A lone & is an ordinary character
+  case '<':
+    *type = TOKEN_REDIRECT_IN;
+    return 1;
+  case '>':
+    *type = (p[1] == '>') ? TOKEN_REDIRECT_APPEND : TOKEN_REDIRECT_OUT;
+    return (p[1] == '>') ? 2 : 1;
+  case '2':
+    // Only a 2 that starts a word can redirect stderr
+    if (p > line && !isspace((unsigned char)p[-1]) && p[-1] != '|' &&
+        p[-1] != ';' && p[-1] != '&') {
+      return 0;
+    }
+    if (p[1] != '>') {
+      return 0;
+    }
+    if (p[2] == '&' && p[3] == '1') {
+      *type = TOKEN_REDIRECT_ERR_TO_OUT;
+      return 4;
+    }
+    *type = (p[2] == '>') ? TOKEN_REDIRECT_ERR_APPEND : TOKEN_REDIRECT_ERR;
+    return (p[2] == '>') ? 3 : 2;
+  }
+  return 0;
+}
+
+/**
+ * Split a line into tokens in a single pass
+ */
+int lsh_tokenize(const char *line, Arena *arena, Token **tokens, int *count) {
+  size_t line_len = strlen(line);
+
+  // A line of n characters has at most n tokens and n + n word characters
+  // including terminators, so both buffers are sized once up front
+  Token *out = (Token *)arena_alloc(arena, (line_len + 1) * sizeof(Token));
+  char *text = (char *)arena_alloc(arena, line_len * 2 + 1);
+  if (!out || !text) {
+    fprintf(stderr, "lsh: allocation error\n");
+    return 0;
+  }
+
+  int n = 0;
+  const char *p = line;
+
+  // Track where commands start so the operator of a where filter can be
+  // recognized; where_words counts the words after "where", -1 elsewhere
+  int command_start = 1;
+  int after_pipe = 0;
+  int where_words = -1;
+
+  while (*p) {
+    if (isspace((unsigned char)*p)) {
+      p++;
+      continue;
+    }
+
+    // Only the word after the field (where size > 10kb) is a comparison;
+    // a > after the value still redirects
+    int comparison = (where_words == 1);
+
+    TokenType type;
+    int op_len = match_operator(line, p, comparison, &type);
+    if (op_len > 0) {
+      if (type == TOKEN_PIPE || type == TOKEN_SEMICOLON || type == TOKEN_AND ||
+          type == TOKEN_OR) {
+        command_start = 1;
+        after_pipe = (type == TOKEN_PIPE);
+        where_words = -1;
+      }
+      out[n].type = type;
+      out[n].start = p;
+      out[n].length = op_len;
+      out[n].text = NULL;
+      n++;
+      p += op_len;
+      continue;
+    }
+
+    // Word: copy characters with quotes and escapes removed
+    const char *start = p;
+    char *word = text;
+
+    while (!is_word_break(*p, comparison) && !(p[0] == '&' && p[1] == '&')) {
+      if (*p == '\'') {
+        const char *close = strchr(p + 1, '\'');
+        if (!close) {
+          fprintf(stderr, "lsh: syntax error: unterminated quote\n");
+          return 0;
+        }
+        memcpy(text, p + 1, close - p - 1);
+        text += close - p - 1;
+        p = close + 1;
+      } else if (*p == '"') {
+        // Backslashes are literal unless a run of them ends at a quote, as
+        // Windows programs read their command lines: 2n backslashes give n
+        // and the quote closes, 2n+1 give n and a literal quote. A quote
+        // that nothing could close after it ends the string anyway, so
+        // "C:\dir\" is the directory C:\dir\.
+        p++;
+        while (*p && *p != '"') {
+          if (*p != '\\') {
+            *text++ = *p++;
+            continue;
+          }
+          int run = (int)strspn(p, "\\");
+          if (p[run] != '"') {
+            memcpy(text, p, run);
+            text += run;
+            p += run;
+            continue;
+          }
+          int escaped = (run & 1) && strchr(p + run + 1, '"') != NULL;
+          int keep = (escaped || !(run & 1)) ? run / 2 : run;
+          memset(text, '\\', keep);
+          text += keep;
+          p += run;
+          if (escaped) {
+            *text++ = *p++;
+          }
+        }
+        if (*p != '"') {
+          fprintf(stderr, "lsh: syntax error: unterminated quote\n");
+          return 0;
+        }
+        p++;
+      } else if (*p == '\\' && is_escapable(p[1])) {
+        *text++ = p[1];
+        p += 2;
+      } else {
+        *text++ = *p++;
+      }
+    }
+
+    *text++ = '\0';
+    out[n].type = TOKEN_WORD;
+    out[n].start = start;
+    out[n].length = (int)(p - start);
+    out[n].text = word;
+    n++;
+
+    // Filters only run after a pipe
+    if (command_start) {
+      where_words = (after_pipe && strcmp(word, "where") == 0) ? 0 : -1;
+      command_start = 0;
+    } else if (where_words >= 0) {
+      where_words++;
+    }
+  }
+
+  *tokens = out;
+  *count = n;
+  return 1;
+}
+
+static int is_redirect(TokenType type) {
+  return type >= TOKEN_REDIRECT_IN;
+}
+
+static void report_syntax_error(const Token *token) {
+  if (token) {
+    fprintf(stderr, "lsh: syntax error near '%.*s'\n", token->length,
+            token->start);
+  } else {
+    fprintf(stderr, "lsh: syntax error near end of line\n");
+  }
+}
+
+/**
+ * Parse one command (words and redirections) starting at tokens[*pos]
+ */
+static int parse_command(Token *tokens, int count, int *pos, Arena *arena,
+                         SimpleCommand *cmd) {
+  // Count the words first so args can be allocated in one go (redirection
+  // targets are counted too, which only over-allocates slightly)
+  int words = 0;
+  for (int i = *pos; i < count && (tokens[i].type == TOKEN_WORD ||
+                                   is_redirect(tokens[i].type));
+       i++) {
+    if (tokens[i].type == TOKEN_WORD) {
+      words++;
+    }
+  }
+
+  memset(cmd, 0, sizeof(*cmd));
+  cmd->args = (char **)arena_alloc(arena, (words + 1) * sizeof(char *));
+  if (!cmd->args) {
+    fprintf(stderr, "lsh: allocation error\n");
+    return 0;
+  }
+
+  int argc = 0;
+  int i = *pos;
+  while (i < count) {
+    Token *tok = &tokens[i];
+
+    if (tok->type == TOKEN_WORD) {
+      cmd->args[argc++] = tok->text;
+      i++;
+      continue;
+    }
+    if (!is_redirect(tok->type)) {
+      break;
+    }
+
+    if (tok->type == TOKEN_REDIRECT_ERR_TO_OUT) {
+      cmd->error_to_output = 1;
+      i++;
+      continue;
+    }
+
+    // Every other redirection needs a file name
+    if (i + 1 >= count || tokens[i + 1].type != TOKEN_WORD) {
+      report_syntax_error(i + 1 < count ? &tokens[i + 1] : NULL);
+      return 0;
+    }
+    const char *file = tokens[i + 1].text;
+
+    switch (tok->type) {
+    case TOKEN_REDIRECT_IN:
+      cmd->input_file = file;
+      break;
+    case TOKEN_REDIRECT_OUT:
+    case TOKEN_REDIRECT_APPEND:
+      cmd->output_file = file;
+      cmd->append_output = (tok->type == TOKEN_REDIRECT_APPEND);
+      break;
+    case TOKEN_REDIRECT_ERR:
+    case TOKEN_REDIRECT_ERR_APPEND:
+      cmd->error_file = file;
+      cmd->append_error = (tok->type == TOKEN_REDIRECT_ERR_APPEND);
+      break;
+    default:
+      break;
+    }
+    i += 2;
+  }
+
+  cmd->args[argc] = NULL;
+  *pos = i;
+
+  if (argc == 0) {
+    report_syntax_error(i < count ? &tokens[i] : NULL);
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Group tokens into pipelines joined by ;, && and ||
+ */
+static int parse_tokens(Token *tokens, int count, Arena *arena,
+                        CommandList *list) {
+  list->pipelines = NULL;
+  list->pipeline_count = 0;
+
+  if (count == 0) {
+    return 1;
+  }
+
+  // Upper bounds: every operator could start a new pipeline or command
+  int separators = 0;
+  int pipes = 0;
+  for (int i = 0; i < count; i++) {
+    if (tokens[i].type == TOKEN_SEMICOLON || tokens[i].type == TOKEN_AND ||
+        tokens[i].type == TOKEN_OR) {
+      separators++;
+    } else if (tokens[i].type == TOKEN_PIPE) {
+      pipes++;
+    }
+  }
+
+  list->pipelines =
+      (Pipeline *)arena_alloc(arena, (separators + 1) * sizeof(Pipeline));
+  SimpleCommand *commands = (SimpleCommand *)arena_alloc(
+      arena, (separators + pipes + 1) * sizeof(SimpleCommand));
+  char ***argv = (char ***)arena_alloc(
+      arena, (2 * separators + pipes + 2) * sizeof(char **));
+  if (!list->pipelines || !commands || !argv) {
+    fprintf(stderr, "lsh: allocation error\n");
+    return 0;
+  }
+
+  int pos = 0;
+  while (pos < count) {
+    Pipeline *pipeline = &list->pipelines[list->pipeline_count++];
+    pipeline->commands = commands;
+    pipeline->argv = argv;
+    pipeline->command_count = 0;
+    pipeline->next = LIST_END;
+
+    for (;;) {
+      SimpleCommand *cmd = &pipeline->commands[pipeline->command_count];
+      if (!parse_command(tokens, count, &pos, arena, cmd)) {
+        return 0;
+      }
+      pipeline->argv[pipeline->command_count] = cmd->args;
+      pipeline->command_count++;
+
+      if (pos < count && tokens[pos].type == TOKEN_PIPE) {
+        pos++;
+        continue;
+      }
+      break;
+    }
+    pipeline->argv[pipeline->command_count] = NULL;
+    commands += pipeline->command_count;
+    argv += pipeline->command_count + 1;
+
+    // Redirections must be at the ends of a pipeline
+    for (int i = 0; i < pipeline->command_count; i++) {
+      SimpleCommand *cmd = &pipeline->commands[i];
+      if ((cmd->input_file && i > 0) ||
+          ((cmd->output_file || cmd->error_file || cmd->error_to_output) &&
+           i < pipeline->command_count - 1)) {
+        fprintf(stderr, "lsh: redirection in the middle of a pipeline\n");
+        return 0;
+      }
+    }
+
+    if (pos >= count) {
+      break;
+    }
+
+    switch (tokens[pos].type) {
+    case TOKEN_SEMICOLON:
+      pipeline->next = LIST_SEQ;
+      break;
+    case TOKEN_AND:
+      pipeline->next = LIST_AND;
+      break;
+    case TOKEN_OR:
+      pipeline->next = LIST_OR;
+      break;
+    default:
+      report_syntax_error(&tokens[pos]);
+      return 0;
+    }
+    pos++;
+
+    // A trailing ; is allowed, a trailing && or || is not
+    if (pos >= count) {
+      if (pipeline->next != LIST_SEQ) {
+        report_syntax_error(NULL);
+        return 0;
+      }
+      pipeline->next = LIST_END;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Parse a line into pipelines joined by ;, && and ||
+ */
+int lsh_parse_line(const char *line, Arena *arena, CommandList *list) {
+  Token *tokens;
+  int count;
+
+  list->pipelines = NULL;
+  list->pipeline_count = 0;
+
+  if (!lsh_tokenize(line, arena, &tokens, &count)) {
+    return 0;
+  }
+  return parse_tokens(tokens, count, arena, list);
+}
+
+/**
+ * Parse an alias's command with the words it was given appended
+ */
+int lsh_parse_alias(const char *command, char **args, Arena *arena,
+                    CommandList *list) {
+  Token *alias_tokens;
+  int alias_count;
+
+  list->pipelines = NULL;
+  list->pipeline_count = 0;
+
+  if (!lsh_tokenize(command, arena, &alias_tokens, &alias_count)) {
+    return 0;
+  }
+
+  // The arguments are already unquoted, so they go in as words as they are
+  int arg_count = 0;
+  while (args[arg_count] != NULL) {
+    arg_count++;
+  }
+  Token *tokens = (Token *)arena_alloc(
+      arena, (alias_count + arg_count + 1) * sizeof(Token));
+  if (!tokens) {
+    fprintf(stderr, "lsh: allocation error\n");
+    return 0;
+  }
+  memcpy(tokens, alias_tokens, alias_count * sizeof(Token));
+  for (int i = 0; i < arg_count; i++) {
+    Token *tok = &tokens[alias_count + i];
+    tok->type = TOKEN_WORD;
+    tok->start = args[i];
+    tok->length = (int)strlen(args[i]);
+    tok->text = args[i];
+  }
+
+  return parse_tokens(tokens, alias_count + arg_count, arena, list);
+}
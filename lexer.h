@@ -0,0 +1,111 @@
+/**
+ * lexer.h
+ * Single-pass command line lexer and parser
+ */
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "arena.h"
+#include "common.h"
+
+// Token types produced by the lexer
+typedef enum {
+  TOKEN_WORD,
+  TOKEN_PIPE,                // |
+  TOKEN_SEMICOLON,           // ;
+  TOKEN_AND,                 // &&
+  TOKEN_OR,                  // ||
+  TOKEN_REDIRECT_IN,         // <
+  TOKEN_REDIRECT_OUT,        // >
+  TOKEN_REDIRECT_APPEND,     // >>
+  TOKEN_REDIRECT_ERR,        // 2>
+  TOKEN_REDIRECT_ERR_APPEND, // 2>>
+  TOKEN_REDIRECT_ERR_TO_OUT  // 2>&1
+} TokenType;
+
+// A token is a span of the original line; words also carry their text with
+// quotes and escapes removed
+typedef struct {
+  TokenType type;
+  const char *start; // Points into the original line
+  int length;
+  char *text; // Unquoted word text (arena), NULL for operators
+} Token;
+
+// How a pipeline is chained to the one after it
+typedef enum {
+  LIST_END, // Last pipeline on the line
+  LIST_SEQ, // ;  - always run the next pipeline
+  LIST_AND, // && - run the next pipeline if this one succeeded
+  LIST_OR   // || - run the next pipeline if this one failed
+} ListOperator;
+
+// One command of a pipeline with its redirections
+typedef struct {
+  char **args; // NULL-terminated
+  const char *input_file;
+  const char *output_file;
+  int append_output;
+  const char *error_file;
+  int append_error;
+  int error_to_output;
+} SimpleCommand;
+
+// Commands connected by |
+typedef struct {
+  SimpleCommand *commands;
+  char ***argv; // NULL-terminated list of each command's args
+  int command_count;
+  ListOperator next;
+} Pipeline;
+
+// Everything on one command line
+typedef struct {
+  Pipeline *pipelines;
+  int pipeline_count;
+} CommandList;
+
+/**
+ * Split a line into tokens in a single pass
+ *
+ * Words may contain 'single quoted' text (taken literally) and "double
+ * quoted" text (where \" is a literal quote). Outside quotes a backslash only
+ * escapes a following quote, space or operator character, so Windows paths
+ * like C:\Users keep their backslashes. In the operator position of a where
+ * filter after a pipe (where size > 10kb), < and > are ordinary characters;
+ * a > after the value is still a redirection.
+ *
+ * @param line The line to split (not modified)
+ * @param arena Arena for the token array and word text
+ * @param tokens Receives the token array
+ * @param count Receives the number of tokens
+ * @return 1 on success, 0 on a syntax error (already reported)
+ */
+int lsh_tokenize(const char *line, Arena *arena, Token **tokens, int *count);
+
+/**
+ * Parse a line into pipelines joined by ;, && and ||
+ *
+ * @param line The line to parse (not modified, so it can go to history as is)
+ * @param arena Arena for all parse results; reset it once the line has run
+ * @param list Receives the parsed command list
+ * @return 1 on success, 0 on a syntax error (already reported)
+ */
+int lsh_parse_line(const char *line, Arena *arena, CommandList *list);
+
+/**
+ * Parse the command an alias stands for, with the alias's arguments added
+ * as words at the end, as if they had been typed after it. The command may
+ * hold anything a line can, such as quotes, pipes and &&.
+ *
+ * @param command The alias's command
+ * @param args Arguments the alias was given (already unquoted), NULL-ended
+ * @param arena Arena for all parse results
+ * @param list Receives the parsed command list
+ * @return 1 on success, 0 on a syntax error (already reported)
+ */
+int lsh_parse_alias(const char *command, char **args, Arena *arena,
+                    CommandList *list);
+
+#endif // LEXER_H
@@ -20,6 +20,54 @@
 #define KEY_ENTER 13
 #define KEY_ESCAPE 27
 
+// Serializes console output between the line reader and background threads
+// that update the prompt while it waits for a key
+static INIT_ONCE console_lock_once = INIT_ONCE_STATIC_INIT;
+static CRITICAL_SECTION console_lock;
+
+// Reader state shared with those threads (guarded by console_lock)
+static int waiting_for_input = 0;
+static int input_length = 0;
+static int prompt_end_moved = 0;
+static COORD moved_prompt_end;
+
+static BOOL CALLBACK init_console_lock(PINIT_ONCE once, PVOID param,
+                                       PVOID *context) {
+  InitializeCriticalSection(&console_lock);
+  return TRUE;
+}
+
+/**
+ * Take the console output lock
+ */
+void lock_console_output(void) {
+  InitOnceExecuteOnce(&console_lock_once, init_console_lock, NULL, NULL);
+  EnterCriticalSection(&console_lock);
+}
+
+/**
+ * Release the console output lock
+ */
+void unlock_console_output(void) { LeaveCriticalSection(&console_lock); }
+
+/**
+ * Check whether the line reader is blocked waiting for a key
+ */
+int line_reader_waiting_for_input(void) { return waiting_for_input; }
+
+/**
+ * Get the length of the text typed so far
+ */
+int line_reader_input_length(void) { return input_length; }
+
+/**
+ * Tell the line reader the prompt was redrawn and input now starts at pos
+ */
+void line_reader_set_prompt_end(COORD pos) {
+  moved_prompt_end = pos;
+  prompt_end_moved = 1;
+}
+
 /**
  * Check if a command is valid
  *
@@ -215,7 +263,7 @@ int try_bookmark_completion(char *buffer, int position, HANDLE hConsole,
   return 0;
 }
 
-char *lsh_read_line(void) {
+static char *read_line_locked(void) {
   // Allocate buffer for the input
   int bufsize = LSH_RL_BUFSIZE;
   char *buffer = malloc(bufsize * sizeof(char));
@@ -408,8 +456,19 @@ char *lsh_read_line(void) {
       }
     }
 
-    // Read a character
+    // Read a character, letting background threads update the prompt
+    // while we wait
+    input_length = (int)strlen(buffer);
+    waiting_for_input = 1;
+    unlock_console_output();
     c = _getch();
+    lock_console_output();
+    waiting_for_input = 0;
+
+    if (prompt_end_moved) {
+      promptEndPos = moved_prompt_end;
+      prompt_end_moved = 0;
+    }
 
     // Check for CTRL and SHIFT key states
     SHORT ctrlKeyState = GetKeyState(VK_CONTROL);
@@ -1209,107 +1268,3 @@ char *lsh_read_line(void) {
 
   return buffer;
 }
-
-/**
- * Split a line into tokens
- */
-char **lsh_split_line(char *line) {
-  int bufsize = LSH_TOK_BUFSIZE;
-  int position = 0;
-  char **tokens = malloc(bufsize * sizeof(char *));
-  char *token;
-
-  if (!tokens) {
-    fprintf(stderr, "lsh: allocation error\n");
-    exit(EXIT_FAILURE);
-  }
-
-  token = strtok(line, LSH_TOK_DELIM);
-  while (token != NULL) {
-    tokens[position] = token;
-    position++;
-
-    if (position >= bufsize) {
-      bufsize += LSH_TOK_BUFSIZE;
-      tokens = realloc(tokens, bufsize * sizeof(char *));
-      if (!tokens) {
-        fprintf(stderr, "lsh: allocation error\n");
-        exit(EXIT_FAILURE);
-      }
-    }
-
-    token = strtok(NULL, LSH_TOK_DELIM);
-  }
-
-  tokens[position] = NULL;
-  return tokens;
-}
-
-/**
- * Split a line into commands separated by pipes
- */
-char ***lsh_split_commands(char *line) {
-  int bufsize = 8; // Initial number of commands
-  int cmd_count = 0;
-  char ***commands = malloc(bufsize * sizeof(char **));
-
-  if (!commands) {
-    fprintf(stderr, "lsh: allocation error\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // Make a copy of the line since strtok modifies the string
-  char *line_copy = _strdup(line);
-  if (!line_copy) {
-    fprintf(stderr, "lsh: allocation error\n");
-    free(commands);
-    exit(EXIT_FAILURE);
-  }
-
-  // Split by pipe symbol
-  char *saveptr;
-  char *cmd_str = strtok_s(line_copy, "|", &saveptr);
-
-  while (cmd_str != NULL) {
-    // Trim leading whitespace
-    while (isspace(*cmd_str))
-      cmd_str++;
-
-    // Make a copy of the cmd_str for splitting
-    char *cmd_copy = _strdup(cmd_str);
-    if (!cmd_copy) {
-      fprintf(stderr, "lsh: allocation error\n");
-      free(line_copy);
-      // Free previously allocated commands
-      for (int i = 0; i < cmd_count; i++) {
-        free(commands[i]);
-      }
-      free(commands);
-      exit(EXIT_FAILURE);
-    }
-
-    // Split the command into tokens
-    commands[cmd_count] = lsh_split_line(cmd_copy);
-    cmd_count++;
-
-    // Resize if needed
-    if (cmd_count >= bufsize) {
-      bufsize += 8;
-      commands = realloc(commands, bufsize * sizeof(char **));
-      if (!commands) {
-        fprintf(stderr, "lsh: allocation error\n");
-        free(line_copy);
-        exit(EXIT_FAILURE);
-      }
-    }
-
-    // The copy of cmd_str is now owned by lsh_split_line
-    cmd_str = strtok_s(NULL, "|", &saveptr);
-  }
-
-  // Add NULL terminator
-  commands[cmd_count] = NULL;
-
-  free(line_copy);
-  return commands;
-}
@@ -22,19 +22,39 @@ int update_command_validity(const char *buffer, int position, HANDLE hConsole,
 char *lsh_read_line(void);
 
 /**
- * Split a line into tokens
+ * Take the console output lock. The line reader holds it except while
+ * blocked waiting for a key, so other threads can safely redraw the prompt
+ * at that point.
+ */
+void lock_console_output(void);
+
+/**
+ * Release the console output lock
+ */
+void unlock_console_output(void);
+
+/**
+ * Check whether the line reader is blocked waiting for a key (call with the
+ * console output lock held)
+ *
+ * @return 1 if waiting, 0 otherwise
+ */
+int line_reader_waiting_for_input(void);
+
+/**
+ * Get the length of the text typed on the current line so far (call with the
+ * console output lock held)
  *
- * @param line The line to split
- * @return An array of tokens (must be freed by caller)
+ * @return Number of characters in the input buffer
  */
-char **lsh_split_line(char *line);
+int line_reader_input_length(void);
 
 /**
- * Split a line into commands separated by pipes
+ * Tell the line reader that the prompt was redrawn and input now starts at a
+ * new position (call with the console output lock held)
  *
- * @param line The line to split
- * @return A NULL-terminated array of command token arrays
+ * @param pos Position just after the redrawn prompt
  */
-char ***lsh_split_commands(char *line);
+void line_reader_set_prompt_end(COORD pos);
 
 #endif // LINE_READER_H
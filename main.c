@@ -5,12 +5,91 @@
 
 #include "common.h"
 #include "shell.h"
+#include "startup.h"
+#include "subsystems.h"
+
+/**
+ * Print command line usage
+ */
+static void print_usage(const char *program) {
+  printf("Usage: %s                 start an interactive shell\n", program);
+  printf("       %s -c \"command\"    run a command and exit\n", program);
+  printf("       %s script.lsh      run a script and exit\n", program);
+  printf("       %s --profile-startup  show startup timings\n", program);
+}
+
+/**
+ * Run the shell without any interactive setup. Subsystems are initialized
+ * on first use; themes are only needed when writing to a console.
+ */
+static int run_non_interactive(int argc, char **argv) {
+  if (stdout_is_tty()) {
+    ensure_subsystem(SUBSYSTEM_THEMES);
+  } else {
+    // Plain, block-buffered output for files and pipes
+    setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+  }
+
+  if (strcmp(argv[1], "-c") == 0) {
+    if (argc < 3) {
+      fprintf(stderr, "lsh: -c requires an argument\n");
+      return EXIT_FAILURE;
+    }
+
+    // Join the remaining arguments so unquoted commands work too
+    size_t length = 0;
+    for (int i = 2; i < argc; i++) {
+      length += strlen(argv[i]) + 1;
+    }
+    char *command = (char *)malloc(length);
+    if (!command) {
+      fprintf(stderr, "lsh: allocation error\n");
+      return EXIT_FAILURE;
+    }
+
+    size_t used = 0;
+    for (int i = 2; i < argc; i++) {
+      if (i > 2) {
+        command[used++] = ' ';
+      }
+      size_t arg_length = strlen(argv[i]);
+      memcpy(command + used, argv[i], arg_length);
+      used += arg_length;
+    }
+    command[used] = '\0';
+
+    int status = lsh_run_command_string(command);
+    free(command);
+    return status;
+  }
+
+  return lsh_run_script(argv[1]);
+}
 
 /**
  * Main entry point
  */
 
 int main(int argc, char **argv) {
+  // Interactive shell with a per-phase startup timing breakdown
+  if (argc > 1 && strcmp(argv[1], "--profile-startup") == 0) {
+    startup_profile_enable();
+    argc = 1;
+  }
+
+  if (argc > 1) {
+    if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+      print_usage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    if (argv[1][0] == '-' && strcmp(argv[1], "-c") != 0) {
+      fprintf(stderr, "lsh: unknown option '%s'\n", argv[1]);
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    return run_non_interactive(argc, argv);
+  }
+
   // Set console output code page to UTF-8 (65001)
   // This enables proper display of UTF-8 box characters
   UINT oldCP = GetConsoleOutputCP();
@@ -0,0 +1,60 @@
+/**
+ * mapped_file.c
+ * Implementation of read-only memory mapped files
+ */
+
+#include "mapped_file.h"
+
+/**
+ * Map a whole file read-only
+ */
+int map_file(const char *path, MappedFile *mapped) {
+  memset(mapped, 0, sizeof(*mapped));
+
+  HANDLE file = CreateFile(path, GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE |
+                               FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return 0;
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 ||
+      (unsigned long long)size.QuadPart > (SIZE_T)-1) {
+    CloseHandle(file);
+    return 0;
+  }
+
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping) {
+    CloseHandle(file);
+    return 0;
+  }
+
+  const unsigned char *data =
+      (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return 0;
+  }
+
+  mapped->file = file;
+  mapped->mapping = mapping;
+  mapped->data = data;
+  mapped->size = (size_t)size.QuadPart;
+  return 1;
+}
+
+/**
+ * Release a mapping made by map_file
+ */
+void unmap_file(MappedFile *mapped) {
+  if (mapped->data) {
+    UnmapViewOfFile(mapped->data);
+    CloseHandle(mapped->mapping);
+    CloseHandle(mapped->file);
+  }
+  memset(mapped, 0, sizeof(*mapped));
+}
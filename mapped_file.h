@@ -0,0 +1,35 @@
+/**
+ * mapped_file.h
+ * Read-only memory mapped files
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "common.h"
+
+typedef struct {
+  HANDLE file;
+  HANDLE mapping;
+  const unsigned char *data;
+  size_t size;
+} MappedFile;
+
+/**
+ * Map a whole file read-only. Other processes may keep writing, renaming or
+ * deleting it while it is mapped.
+ *
+ * @param path File to map
+ * @param mapped Receives the mapping (zeroed on failure)
+ * @return 1 on success, 0 if the file could not be opened or is empty
+ */
+int map_file(const char *path, MappedFile *mapped);
+
+/**
+ * Release a mapping made by map_file. Safe on a zeroed MappedFile.
+ *
+ * @param mapped The mapping
+ */
+void unmap_file(MappedFile *mapped);
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,559 @@
+/**
+ * parallel.c
+ * Implementation of the parallel command executor
+ */
+
+#include "parallel.h"
+#include "builtins.h"
+#include "thread_pool.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PARALLEL_CMD_BUFSIZE 8192
+#define PARALLEL_READ_CHUNK 4096
+
+// A single job: one substituted command line and its collected results
+typedef struct {
+  int number;       // 1-based job number
+  char *arg;        // Input the job was created from (for the result table)
+  char *command;    // Fully substituted command line
+  int exit_code;    // Process exit code, -1 if it could not be started
+  double elapsed_ms;
+  size_t output_bytes;
+} ParallelJob;
+
+// State shared by all jobs in one run
+typedef struct {
+  ParallelJob *jobs;
+  int job_count;
+  BOOL print_output;         // Print grouped output as jobs finish
+  CRITICAL_SECTION out_lock; // Serializes whole-job output blocks
+} ParallelRun;
+
+typedef struct {
+  ParallelRun *run;
+  ParallelJob *job;
+} ParallelTask;
+
+/**
+ * Convert a table cell to a newly allocated string
+ */
+static char *data_value_to_string(const DataValue *value) {
+  char buf[64];
+
+  switch (value->type) {
+  case TYPE_STRING:
+  case TYPE_SIZE:
+    return _strdup(value->value.str_val ? value->value.str_val : "");
+  case TYPE_INT:
+    snprintf(buf, sizeof(buf), "%d", value->value.int_val);
+    return _strdup(buf);
+  case TYPE_FLOAT:
+    snprintf(buf, sizeof(buf), "%.2f", value->value.float_val);
+    return _strdup(buf);
+  }
+  return _strdup("");
+}
+
+/**
+ * Append length bytes of text to a bounded command buffer
+ *
+ * @return FALSE if they did not fit; the buffer is left unchanged
+ */
+static BOOL append_text(char *command, size_t size, const char *text,
+                        size_t length) {
+  size_t len = strlen(command);
+  if (length >= size - len) {
+    return FALSE;
+  }
+  memcpy(command + len, text, length);
+  command[len + length] = '\0';
+  return TRUE;
+}
+
+/**
+ * Append text to a bounded command buffer, quoting it if it has spaces
+ *
+ * @return FALSE if it did not fit; the buffer is left unchanged
+ */
+static BOOL append_value(char *command, size_t size, const char *value) {
+  size_t len = strlen(command);
+  int quote = (strchr(value, ' ') != NULL || strchr(value, '\t') != NULL);
+
+  int written =
+      snprintf(command + len, size - len, quote ? "\"%s\"" : "%s", value);
+  if (written < 0 || (size_t)written >= size - len) {
+    command[len] = '\0';
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * Build a command line from a template, replacing placeholders
+ *
+ * {}       - the job input (first column when fed from a table)
+ * {#}      - the job number
+ * {column} - a named column of the input row (case-insensitive)
+ *
+ * If the template contains no placeholder the input is appended.
+ *
+ * @return The command line, or NULL (with an error printed) if it does not
+ *         fit in PARALLEL_CMD_BUFSIZE
+ */
+static char *build_command(char **template_args, const char *input,
+                           int job_number, TableData *table, int row) {
+  char command[PARALLEL_CMD_BUFSIZE] = "";
+  BOOL used_placeholder = FALSE;
+  BOOL fits = TRUE;
+
+  for (int i = 0; template_args[i] != NULL && fits; i++) {
+    const char *p = template_args[i];
+
+    if (i > 0) {
+      fits = append_text(command, sizeof(command), " ", 1);
+    }
+
+    while (*p && fits) {
+      const char *close = (*p == '{') ? strchr(p, '}') : NULL;
+      if (!close) {
+        fits = append_text(command, sizeof(command), p, 1);
+        p++;
+        continue;
+      }
+
+      char name[128];
+      size_t name_len = close - p - 1;
+      if (name_len >= sizeof(name)) {
+        name_len = sizeof(name) - 1;
+      }
+      strncpy(name, p + 1, name_len);
+      name[name_len] = '\0';
+
+      if (name[0] == '\0') {
+        fits = append_value(command, sizeof(command), input);
+        used_placeholder = TRUE;
+      } else if (strcmp(name, "#") == 0) {
+        char num[16];
+        snprintf(num, sizeof(num), "%d", job_number);
+        fits = append_value(command, sizeof(command), num);
+        used_placeholder = TRUE;
+      } else {
+        int col = -1;
+        if (table) {
+          for (int c = 0; c < table->header_count; c++) {
+            if (_stricmp(table->headers[c], name) == 0) {
+              col = c;
+              break;
+            }
+          }
+        }
+
+        if (col >= 0) {
+          char *value = data_value_to_string(&table->rows[row][col]);
+          fits = append_value(command, sizeof(command), value ? value : "");
+          free(value);
+          used_placeholder = TRUE;
+        } else {
+          // Not a placeholder we know - keep the braces literally
+          fits = append_text(command, sizeof(command), p, close - p + 1);
+        }
+      }
+
+      p = close + 1;
+    }
+  }
+
+  if (fits && !used_placeholder) {
+    fits = append_text(command, sizeof(command), " ", 1) &&
+           append_value(command, sizeof(command), input);
+  }
+
+  if (!fits) {
+    fprintf(stderr, "parallel: command for job %d is longer than %d "
+                    "characters\n",
+            job_number, PARALLEL_CMD_BUFSIZE - 1);
+    return NULL;
+  }
+  return _strdup(command);
+}
+
+/**
+ * Run one job through cmd.exe, capturing stdout and stderr into a buffer so
+ * the whole block can be printed at once
+ */
+static void run_parallel_job(void *arg) {
+  ParallelTask *task = (ParallelTask *)arg;
+  ParallelJob *job = task->job;
+  ParallelRun *run = task->run;
+
+  char *output = NULL;
+  size_t output_len = 0;
+  size_t output_cap = 0;
+
+  LARGE_INTEGER freq, start, end;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&start);
+
+  job->exit_code = -1;
+
+  SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+  HANDLE read_pipe = NULL, write_pipe = NULL;
+
+  // A job whose command did not fit fails without running
+  if (job->command && CreatePipe(&read_pipe, &write_pipe, &sa, 0)) {
+    // Only the child's end should be inherited
+    SetHandleInformation(read_pipe, HANDLE_FLAG_INHERIT, 0);
+
+    char cmdline[PARALLEL_CMD_BUFSIZE + 32];
+    snprintf(cmdline, sizeof(cmdline), "cmd.exe /d /s /c \"%s\"",
+             job->command);
+
+    STARTUPINFO si;
+    PROCESS_INFORMATION pi;
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = write_pipe;
+    si.hStdError = write_pipe;
+    ZeroMemory(&pi, sizeof(pi));
+
+    BOOL started = CreateProcess(NULL, cmdline, NULL, NULL, TRUE, 0, NULL,
+                                 NULL, &si, &pi);
+    CloseHandle(write_pipe);
+
+    if (started) {
+      char chunk[PARALLEL_READ_CHUNK];
+      DWORD bytes_read;
+
+      while (ReadFile(read_pipe, chunk, sizeof(chunk), &bytes_read, NULL) &&
+             bytes_read > 0) {
+        if (output_len + bytes_read > output_cap) {
+          size_t new_cap = output_cap ? output_cap * 2 : PARALLEL_READ_CHUNK;
+          while (new_cap < output_len + bytes_read) {
+            new_cap *= 2;
+          }
+          char *grown = (char *)realloc(output, new_cap);
+          if (!grown) {
+            break;
+          }
+          output = grown;
+          output_cap = new_cap;
+        }
+        memcpy(output + output_len, chunk, bytes_read);
+        output_len += bytes_read;
+      }
+
+      WaitForSingleObject(pi.hProcess, INFINITE);
+      DWORD code = 0;
+      GetExitCodeProcess(pi.hProcess, &code);
+      job->exit_code = (int)code;
+      CloseHandle(pi.hProcess);
+      CloseHandle(pi.hThread);
+    }
+
+    CloseHandle(read_pipe);
+  }
+
+  QueryPerformanceCounter(&end);
+  job->elapsed_ms =
+      (double)(end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+  job->output_bytes = output_len;
+
+  // Print the job's output as one uninterrupted block
+  if (run->print_output) {
+    EnterCriticalSection(&run->out_lock);
+    if (job->exit_code == -1 && job->command) {
+      fprintf(stderr, "parallel: failed to start job %d: %s\n", job->number,
+              job->command);
+    }
+    if (output_len > 0) {
+      fwrite(output, 1, output_len, stdout);
+      if (output[output_len - 1] != '\n') {
+        fputc('\n', stdout);
+      }
+    }
+    fflush(stdout);
+    LeaveCriticalSection(&run->out_lock);
+  }
+
+  free(output);
+  free(task);
+}
+
+/**
+ * Execute all jobs of a run on a pool with the given number of workers
+ */
+static void execute_jobs(ParallelRun *run, int max_jobs) {
+  if (run->job_count == 0) {
+    return;
+  }
+
+  if (max_jobs <= 0) {
+    max_jobs = get_cpu_count();
+  }
+  if (max_jobs > run->job_count) {
+    max_jobs = run->job_count;
+  }
+
+  InitializeCriticalSection(&run->out_lock);
+
+  ThreadPool *pool = thread_pool_create(max_jobs);
+  for (int i = 0; i < run->job_count; i++) {
+    ParallelTask *task = (ParallelTask *)malloc(sizeof(ParallelTask));
+    if (task) {
+      task->run = run;
+      task->job = &run->jobs[i];
+    }
+
+    if (!task || !pool || !thread_pool_submit(pool, run_parallel_job, task)) {
+      // No pool available - fall back to running the job inline
+      if (task) {
+        run_parallel_job(task);
+      }
+    }
+  }
+
+  if (pool) {
+    thread_pool_wait(pool);
+    thread_pool_destroy(pool);
+  }
+
+  DeleteCriticalSection(&run->out_lock);
+}
+
+/**
+ * Build the structured result table for a finished run
+ */
+static TableData *build_result_table(ParallelRun *run) {
+  char *headers[] = {"Job", "Arg", "Exit", "Duration", "Output", "Command"};
+  TableData *table = create_table(headers, 6);
+  if (!table) {
+    return NULL;
+  }
+
+  for (int i = 0; i < run->job_count; i++) {
+    ParallelJob *job = &run->jobs[i];
+    DataValue *row = (DataValue *)malloc(6 * sizeof(DataValue));
+    if (!row) {
+      fprintf(stderr, "lsh: allocation error in parallel\n");
+      break;
+    }
+
+    row[0].type = TYPE_INT;
+    row[0].value.int_val = job->number;
+    row[1].type = TYPE_STRING;
+    row[1].value.str_val = _strdup(job->arg ? job->arg : "");
+    row[2].type = TYPE_INT;
+    row[2].value.int_val = job->exit_code;
+    row[3].type = TYPE_FLOAT; // Milliseconds
+    row[3].value.float_val = (float)job->elapsed_ms;
+    row[4].type = TYPE_INT;
+    row[4].value.int_val = (int)job->output_bytes;
+    row[5].type = TYPE_STRING;
+    row[5].value.str_val = _strdup(job->command ? job->command : "");
+
+    for (int j = 0; j < 6; j++) {
+      row[j].is_highlighted = 0;
+    }
+    // Highlight failed jobs
+    row[2].is_highlighted = (job->exit_code != 0);
+
+    add_table_row(table, row);
+  }
+
+  return table;
+}
+
+static void free_run(ParallelRun *run) {
+  for (int i = 0; i < run->job_count; i++) {
+    free(run->jobs[i].arg);
+    free(run->jobs[i].command);
+  }
+  free(run->jobs);
+  run->jobs = NULL;
+  run->job_count = 0;
+}
+
+/**
+ * Parse leading options. Returns the index of the first template word or -1.
+ */
+static int parse_options(char **args, int start, int *max_jobs) {
+  int i = start;
+  *max_jobs = 0;
+
+  while (args[i] != NULL && args[i][0] == '-') {
+    if ((strcmp(args[i], "-j") == 0 || strcmp(args[i], "--jobs") == 0) &&
+        args[i + 1] != NULL) {
+      *max_jobs = atoi(args[i + 1]);
+      i += 2;
+    } else if (strncmp(args[i], "-j", 2) == 0 && isdigit(args[i][2])) {
+      *max_jobs = atoi(args[i] + 2);
+      i++;
+    } else {
+      break; // First word of the command template
+    }
+  }
+
+  return args[i] != NULL ? i : -1;
+}
+
+static void print_parallel_usage(void) {
+  printf("Usage: parallel [-j N] COMMAND [ARGS...] ::: INPUT...\n");
+  printf("       ... | parallel [-j N] COMMAND {column}\n");
+  printf("Placeholders: {} input, {#} job number, {column} table column\n");
+}
+
+/**
+ * Set up a run from "TEMPLATE... ::: INPUT..." arguments
+ */
+static int prepare_argument_run(char **args, ParallelRun *run,
+                                int *max_jobs) {
+  int template_start = parse_options(args, 1, max_jobs);
+  if (template_start < 0) {
+    print_parallel_usage();
+    return 0;
+  }
+
+  int separator = -1;
+  for (int i = template_start; args[i] != NULL; i++) {
+    if (strcmp(args[i], ":::") == 0) {
+      separator = i;
+      break;
+    }
+  }
+
+  if (separator < 0 || separator == template_start) {
+    print_parallel_usage();
+    return 0;
+  }
+
+  int input_count = 0;
+  while (args[separator + 1 + input_count] != NULL) {
+    input_count++;
+  }
+
+  run->jobs = (ParallelJob *)calloc(input_count ? input_count : 1,
+                                    sizeof(ParallelJob));
+  if (!run->jobs) {
+    fprintf(stderr, "lsh: allocation error in parallel\n");
+    return 0;
+  }
+
+  // Terminate the template at ::: temporarily while building commands
+  char *saved = args[separator];
+  args[separator] = NULL;
+
+  for (int i = 0; i < input_count; i++) {
+    const char *input = args[separator + 1 + i];
+    run->jobs[i].number = i + 1;
+    run->jobs[i].arg = _strdup(input);
+    run->jobs[i].command =
+        build_command(&args[template_start], input, i + 1, NULL, 0);
+  }
+  run->job_count = input_count;
+
+  args[separator] = saved;
+  return 1;
+}
+
+/**
+ * Command handler for the "parallel" command
+ */
+int lsh_parallel(char **args) {
+  ParallelRun run = {0};
+  int max_jobs;
+
+  if (!prepare_argument_run(args, &run, &max_jobs)) {
+    return lsh_builtin_failed();
+  }
+
+  LARGE_INTEGER freq, start, end;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&start);
+
+  run.print_output = TRUE;
+  execute_jobs(&run, max_jobs);
+
+  QueryPerformanceCounter(&end);
+  double total_ms =
+      (double)(end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+
+  int failed = 0;
+  for (int i = 0; i < run.job_count; i++) {
+    if (run.jobs[i].exit_code != 0) {
+      failed++;
+    }
+  }
+
+  printf("parallel: %d job(s), %d failed, %.2f s\n", run.job_count, failed,
+         total_ms / 1000.0);
+
+  free_run(&run);
+  return failed ? lsh_builtin_failed() : 1;
+}
+
+/**
+ * Run "parallel ... ::: INPUT..." as the first stage of a pipeline
+ */
+TableData *lsh_parallel_structured(char **args) {
+  ParallelRun run = {0};
+  int max_jobs;
+
+  if (!prepare_argument_run(args, &run, &max_jobs)) {
+    return NULL;
+  }
+
+  run.print_output = TRUE;
+  execute_jobs(&run, max_jobs);
+
+  TableData *table = build_result_table(&run);
+  free_run(&run);
+  return table;
+}
+
+/**
+ * Run a command template once per row of an upstream table
+ */
+TableData *lsh_parallel_filter(TableData *input, char **args) {
+  if (!input || !args || !args[0]) {
+    fprintf(stderr, "lsh: parallel: missing command\n");
+    print_parallel_usage();
+    return NULL;
+  }
+
+  // Options start at args[0] here (the filter name has been stripped)
+  int max_jobs;
+  int template_start = parse_options(args, 0, &max_jobs);
+  if (template_start < 0) {
+    print_parallel_usage();
+    return NULL;
+  }
+
+  ParallelRun run = {0};
+  run.jobs = (ParallelJob *)calloc(input->row_count ? input->row_count : 1,
+                                   sizeof(ParallelJob));
+  if (!run.jobs) {
+    fprintf(stderr, "lsh: allocation error in parallel\n");
+    return NULL;
+  }
+
+  for (int i = 0; i < input->row_count; i++) {
+    char *first = input->header_count > 0
+                      ? data_value_to_string(&input->rows[i][0])
+                      : _strdup("");
+    run.jobs[i].number = i + 1;
+    run.jobs[i].arg = first;
+    run.jobs[i].command = build_command(&args[template_start],
+                                        first ? first : "", i + 1, input, i);
+  }
+  run.job_count = input->row_count;
+
+  run.print_output = TRUE;
+  execute_jobs(&run, max_jobs);
+
+  TableData *table = build_result_table(&run);
+  free_run(&run);
+  return table;
+}
@@ -0,0 +1,42 @@
+/**
+ * parallel.h
+ * Built-in parallel command executor backed by the work-stealing pool
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "common.h"
+#include "structured_data.h"
+
+/**
+ * Command handler for the "parallel" command
+ *
+ * Usage: parallel [-j N] COMMAND [ARGS...] ::: INPUT...
+ * Runs COMMAND once per INPUT, substituting {} (or appending the input when
+ * no placeholder is present). Output of each job is printed as one block.
+ *
+ * @param args Command arguments
+ * @return 1 to continue shell execution
+ */
+int lsh_parallel(char **args);
+
+/**
+ * Run "parallel ... ::: INPUT..." as the first stage of a pipeline
+ *
+ * @param args Command arguments
+ * @return Result table (Job, Arg, Exit, Duration, Output, Command) or NULL
+ */
+TableData *lsh_parallel_structured(char **args);
+
+/**
+ * Run "parallel COMMAND {column}" once per row of an upstream table
+ * (e.g. ls | parallel gzip {name} | where exit > 0)
+ *
+ * @param input The input table
+ * @param args Filter arguments (without the "parallel" word)
+ * @return Result table or NULL on error
+ */
+TableData *lsh_parallel_filter(TableData *input, char **args);
+
+#endif // PARALLEL_H
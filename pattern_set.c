@@ -0,0 +1,393 @@
+/**
+ * pattern_set.c
+ * Implementation of multi-literal search: a packed matcher for small sets
+ * and an Aho-Corasick automaton for large ones
+ */
+
+#include "pattern_set.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) ||            \
+    defined(__SSE2__)
+#include <emmintrin.h>
+#define PATTERN_SET_HAVE_SSE2 1
+#endif
+
+// Sets up to this size are searched with the packed matcher
+#define PACKED_MAX_PATTERNS 8
+
+struct PatternSet {
+  int count;
+  unsigned char **patterns; // Lowercased when ignoring case
+  int *lengths;
+  int ignore_case;
+  int empty_id;   // A pattern that matches everywhere, or -1
+  int max_length;
+  int packed;
+
+  // Aho-Corasick automaton: next[state * class_count + byte_class] is the
+  // state after reading a byte, failure transitions included
+  unsigned char byte_class[256];
+  int class_count;
+  int *next;
+  int *longest;    // Length of the longest pattern ending in a state, or 0
+  int *longest_id; // Which pattern that is
+  int state_count;
+  int state_capacity;
+};
+
+static unsigned char fold_byte(const PatternSet *set, unsigned char c) {
+  return set->ignore_case ? (unsigned char)tolower(c) : c;
+}
+
+/**
+ * Check whether a pattern occurs at a position
+ */
+static int pattern_at(const PatternSet *set, int id, const char *text,
+                      int remaining) {
+  const unsigned char *pattern = set->patterns[id];
+  int length = set->lengths[id];
+
+  if (length > remaining) {
+    return 0;
+  }
+  if (!set->ignore_case) {
+    return memcmp(pattern, text, length) == 0;
+  }
+  for (int i = 0; i < length; i++) {
+    if (tolower((unsigned char)text[i]) != pattern[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Find the longest pattern occurring at a position
+ * @return Its id, or -1 if none does
+ */
+static int longest_at(const PatternSet *set, const char *text, int remaining) {
+  int best = -1;
+  for (int id = 0; id < set->count; id++) {
+    if ((best < 0 || set->lengths[id] > set->lengths[best]) &&
+        pattern_at(set, id, text, remaining)) {
+      best = id;
+    }
+  }
+  return best;
+}
+
+// ---------------------------------------------------------------------------
+// Packed matcher
+// ---------------------------------------------------------------------------
+
+static int packed_find(const PatternSet *set, const char *text, int length,
+                       int *pattern_id) {
+  int pos = 0;
+
+#ifdef PATTERN_SET_HAVE_SSE2
+  // Each pattern's first two bytes; letters are compared with their case bit
+  // forced on when ignoring case
+  __m128i value[PACKED_MAX_PATTERNS][2];
+  __m128i fold[PACKED_MAX_PATTERNS][2];
+  int two_bytes[PACKED_MAX_PATTERNS];
+
+  for (int id = 0; id < set->count; id++) {
+    two_bytes[id] = set->lengths[id] >= 2;
+    for (int k = 0; k < 1 + two_bytes[id]; k++) {
+      unsigned char c = set->patterns[id][k];
+      int letter = set->ignore_case && isalpha(c);
+      value[id][k] = _mm_set1_epi8((char)c);
+      fold[id][k] = _mm_set1_epi8(letter ? 0x20 : 0);
+    }
+  }
+
+  // The second byte is loaded one position later, so stop a byte early
+  for (; length - pos >= 17; pos += 16) {
+    __m128i first = _mm_loadu_si128((const __m128i *)(text + pos));
+    __m128i second = _mm_loadu_si128((const __m128i *)(text + pos + 1));
+    int candidates = 0;
+
+    for (int id = 0; id < set->count; id++) {
+      __m128i eq = _mm_cmpeq_epi8(_mm_or_si128(first, fold[id][0]),
+                                  value[id][0]);
+      if (two_bytes[id]) {
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_or_si128(second,
+                                                           fold[id][1]),
+                                              value[id][1]));
+      }
+      candidates |= _mm_movemask_epi8(eq);
+    }
+
+    for (int bit = 0; candidates; bit++, candidates >>= 1) {
+      if (candidates & 1) {
+        int id = longest_at(set, text + pos + bit, length - pos - bit);
+        if (id >= 0) {
+          *pattern_id = id;
+          return pos + bit;
+        }
+      }
+    }
+  }
+#endif
+
+  for (; pos < length; pos++) {
+    int id = longest_at(set, text + pos, length - pos);
+    if (id >= 0) {
+      *pattern_id = id;
+      return pos;
+    }
+  }
+  return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Aho-Corasick
+// ---------------------------------------------------------------------------
+
+/**
+ * Add an empty state to the trie
+ * @return Its index, or -1 on allocation failure
+ */
+static int add_state(PatternSet *set) {
+  if (set->state_count == set->state_capacity) {
+    int capacity = set->state_capacity ? set->state_capacity * 2 : 256;
+    int *next = (int *)realloc(set->next, (size_t)capacity *
+                                              set->class_count * sizeof(int));
+    if (!next) {
+      return -1;
+    }
+    set->next = next;
+    int *longest = (int *)realloc(set->longest, capacity * sizeof(int));
+    if (!longest) {
+      return -1;
+    }
+    set->longest = longest;
+    int *longest_id = (int *)realloc(set->longest_id, capacity * sizeof(int));
+    if (!longest_id) {
+      return -1;
+    }
+    set->longest_id = longest_id;
+    set->state_capacity = capacity;
+  }
+
+  int state = set->state_count++;
+  for (int c = 0; c < set->class_count; c++) {
+    set->next[(size_t)state * set->class_count + c] = -1;
+  }
+  set->longest[state] = 0;
+  set->longest_id[state] = -1;
+  return state;
+}
+
+static int build_automaton(PatternSet *set) {
+  // Bytes that occur in no pattern share class 0; with ignore_case both
+  // cases of a letter share the class of its lowercase form
+  unsigned char used[256] = {0};
+  int used_count = 0;
+  for (int id = 0; id < set->count; id++) {
+    for (int i = 0; i < set->lengths[id]; i++) {
+      unsigned char c = set->patterns[id][i];
+      used_count += !used[c];
+      used[c] = 1;
+    }
+  }
+  int classes = used_count < 256 ? 1 : 0;
+  for (int b = 0; b < 256; b++) {
+    set->byte_class[b] = used[b] ? (unsigned char)classes++ : 0;
+  }
+  if (set->ignore_case) {
+    for (int b = 'A'; b <= 'Z'; b++) {
+      set->byte_class[b] = set->byte_class[b + 32];
+    }
+  }
+  set->class_count = classes;
+
+  // Trie of the patterns
+  if (add_state(set) < 0) {
+    return 0;
+  }
+  for (int id = 0; id < set->count; id++) {
+    int state = 0;
+    for (int i = 0; i < set->lengths[id]; i++) {
+      size_t slot = (size_t)state * set->class_count +
+                    set->byte_class[set->patterns[id][i]];
+      if (set->next[slot] < 0) {
+        int child = add_state(set);
+        if (child < 0) {
+          return 0;
+        }
+        set->next[slot] = child;
+      }
+      state = set->next[slot];
+    }
+    if (set->longest_id[state] < 0) {
+      set->longest[state] = set->lengths[id];
+      set->longest_id[state] = id;
+    }
+  }
+
+  // Resolve failure links breadth first, so each state's failure target is
+  // complete before the state itself is
+  int *fail = (int *)malloc(set->state_count * sizeof(int));
+  int *queue = (int *)malloc(set->state_count * sizeof(int));
+  if (!fail || !queue) {
+    free(fail);
+    free(queue);
+    return 0;
+  }
+
+  int head = 0;
+  int tail = 0;
+  fail[0] = 0;
+  queue[tail++] = 0;
+  while (head < tail) {
+    int state = queue[head++];
+    int *row = &set->next[(size_t)state * set->class_count];
+    const int *fail_row = &set->next[(size_t)fail[state] * set->class_count];
+
+    for (int c = 0; c < set->class_count; c++) {
+      if (row[c] < 0) {
+        row[c] = state == 0 ? 0 : fail_row[c];
+        continue;
+      }
+
+      int child = row[c];
+      fail[child] = state == 0 ? 0 : fail_row[c];
+      // A pattern ending at the child itself is longer than any ending at
+      // its failure state
+      if (set->longest_id[child] < 0) {
+        set->longest[child] = set->longest[fail[child]];
+        set->longest_id[child] = set->longest_id[fail[child]];
+      }
+      queue[tail++] = child;
+    }
+  }
+
+  free(fail);
+  free(queue);
+  return 1;
+}
+
+static int automaton_find(const PatternSet *set, const char *text, int length,
+                          int *pattern_id, int *match_length) {
+  int state = 0;
+  int best_start = -1;
+  int limit = length;
+
+  for (int i = 0; i < limit; i++) {
+    state = set->next[(size_t)state * set->class_count +
+                      set->byte_class[(unsigned char)text[i]]];
+    int found = set->longest[state];
+    if (found == 0) {
+      continue;
+    }
+
+    // The longest pattern ending here starts earliest. A match starting
+    // before the best so far must end within max_length of it.
+    int start = i + 1 - found;
+    if (best_start < 0 || start < best_start ||
+        (start == best_start && found > *match_length)) {
+      best_start = start;
+      *match_length = found;
+      *pattern_id = set->longest_id[state];
+      if (best_start + set->max_length < limit) {
+        limit = best_start + set->max_length;
+      }
+    }
+  }
+
+  return best_start;
+}
+
+// ---------------------------------------------------------------------------
+// Interface
+// ---------------------------------------------------------------------------
+
+/**
+ * Compile a set of literal patterns
+ */
+PatternSet *pattern_set_create(const char *const *patterns, int count,
+                               int ignore_case) {
+  PatternSet *set = (PatternSet *)calloc(1, sizeof(PatternSet));
+  if (!set) {
+    return NULL;
+  }
+  set->ignore_case = ignore_case;
+  set->empty_id = -1;
+  set->patterns = (unsigned char **)calloc(count, sizeof(unsigned char *));
+  set->lengths = (int *)calloc(count, sizeof(int));
+  if (!set->patterns || !set->lengths) {
+    pattern_set_free(set);
+    return NULL;
+  }
+
+  for (int id = 0; id < count; id++) {
+    int length = (int)strlen(patterns[id]);
+    set->patterns[id] = (unsigned char *)malloc(length + 1);
+    if (!set->patterns[id]) {
+      set->count = id;
+      pattern_set_free(set);
+      return NULL;
+    }
+    for (int i = 0; i <= length; i++) {
+      set->patterns[id][i] = fold_byte(set, (unsigned char)patterns[id][i]);
+    }
+    set->lengths[id] = length;
+    if (length > set->max_length) {
+      set->max_length = length;
+    }
+    if (length == 0 && set->empty_id < 0) {
+      set->empty_id = id;
+    }
+  }
+  set->count = count;
+
+  set->packed = count <= PACKED_MAX_PATTERNS;
+  if (!set->packed && set->empty_id < 0 && !build_automaton(set)) {
+    pattern_set_free(set);
+    return NULL;
+  }
+  return set;
+}
+
+/**
+ * Free a compiled set
+ */
+void pattern_set_free(PatternSet *set) {
+  if (!set) {
+    return;
+  }
+  for (int id = 0; id < set->count; id++) {
+    free(set->patterns[id]);
+  }
+  free(set->patterns);
+  free(set->lengths);
+  free(set->next);
+  free(set->longest);
+  free(set->longest_id);
+  free(set);
+}
+
+/**
+ * Find the leftmost-longest match of any pattern
+ */
+int pattern_set_find(const PatternSet *set, const char *text, int length,
+                     int *pattern_id, int *match_length) {
+  if (set->empty_id >= 0) {
+    // The empty pattern matches at the start, unless a longer one does too
+    int id = longest_at(set, text, length);
+    *pattern_id = id;
+    *match_length = set->lengths[id];
+    return 0;
+  }
+
+  if (set->packed) {
+    int pos = packed_find(set, text, length, pattern_id);
+    if (pos >= 0) {
+      *match_length = set->lengths[*pattern_id];
+    }
+    return pos;
+  }
+
+  return automaton_find(set, text, length, pattern_id, match_length);
+}
@@ -0,0 +1,51 @@
+/**
+ * pattern_set.h
+ * Search for many literal strings in one pass
+ */
+
+#ifndef PATTERN_SET_H
+#define PATTERN_SET_H
+
+#include "common.h"
+
+// A compiled set is read-only and can be shared between threads
+typedef struct PatternSet PatternSet;
+
+/**
+ * Compile a set of literal patterns
+ *
+ * Small sets use a packed matcher that tests the first two bytes of every
+ * pattern against 16 text positions at once and verifies the candidates.
+ * Larger sets are compiled into an Aho-Corasick automaton with its failure
+ * transitions resolved, so the text is scanned once whatever the set size.
+ *
+ * @param patterns The patterns
+ * @param count Number of patterns
+ * @param ignore_case Nonzero to ignore ASCII case
+ * @return Compiled set, or NULL on allocation failure
+ */
+PatternSet *pattern_set_create(const char *const *patterns, int count,
+                               int ignore_case);
+
+/**
+ * Free a compiled set
+ *
+ * @param set The set
+ */
+void pattern_set_free(PatternSet *set);
+
+/**
+ * Find the leftmost match of any pattern; of the patterns matching there,
+ * the longest wins, and of equal ones the first given
+ *
+ * @param set The set
+ * @param text Text to search
+ * @param length Length of text
+ * @param pattern_id Receives the index of the pattern that matched
+ * @param match_length Receives the length of the match
+ * @return Offset of the match, or -1 if there is none
+ */
+int pattern_set_find(const PatternSet *set, const char *text, int length,
+                     int *pattern_id, int *match_length);
+
+#endif // PATTERN_SET_H
@@ -4,6 +4,7 @@
  */
 
 #include "persistent_history.h"
+#include "subsystems.h"
 #include <direct.h> // For _getcwd
 #include <shlobj.h> // For SHGetFolderPath
 
@@ -109,6 +110,8 @@ void cleanup_persistent_history(void) {
 }
 
 void add_to_persistent_history(const char *command) {
+  ensure_subsystem(SUBSYSTEM_HISTORY);
+
   if (!command || !command[0] || !history_entries) {
     return; // Don't add empty commands or if history not initialized
   }
@@ -174,6 +177,8 @@ void add_to_persistent_history(const char *command) {
  * Find the best matching command based on frequency
  */
 char *find_best_frequency_match(const char *prefix) {
+  ensure_subsystem(SUBSYSTEM_HISTORY);
+
   if (!prefix || !prefix[0] || !command_frequencies) {
     return NULL;
   }
@@ -533,6 +538,8 @@ void load_frequencies_from_file(void) {
  * Get the history entry at specified index
  */
 PersistentHistoryEntry *get_history_entry(int index) {
+  ensure_subsystem(SUBSYSTEM_HISTORY);
+
   if (!history_entries || index < 0 || index >= history_size) {
     return NULL;
   }
@@ -553,6 +560,8 @@ PersistentHistoryEntry *get_history_entry(int index) {
  * usage This can replace the existing function if there's a mismatch
  */
 char **get_frequency_suggestions(const char *prefix, int *num_suggestions) {
+  ensure_subsystem(SUBSYSTEM_HISTORY);
+
   if (!prefix || !command_frequencies) {
     *num_suggestions = 0;
     return NULL;
@@ -710,4 +719,7 @@ char *_stristr(const char *haystack, const char *needle) {
 /**
  * Get the total number of history entries
  */
-int get_history_count(void) { return history_size; }
+int get_history_count(void) {
+  ensure_subsystem(SUBSYSTEM_HISTORY);
+  return history_size;
+}
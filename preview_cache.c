@@ -0,0 +1,172 @@
+/**
+ * preview_cache.c
+ * Previews of file lines served from a small cache of mapped files
+ */
+
+#include "preview_cache.h"
+#include "ignore_rules.h"
+#include "mapped_file.h"
+
+#define PREVIEW_LINE_BYTES 4096 // Longest part of a line previewed
+
+// A previewed file. A file that could not be mapped is kept too, with no
+// data, so redraws do not keep trying to open it.
+typedef struct {
+  char path[MAX_PATH]; // Empty for an unused slot
+  MappedFile file;
+  BOOL binary;
+  size_t *line_starts; // Offsets of the lines indexed so far
+  int line_count;
+  int line_capacity;
+  size_t indexed_to;   // Bytes searched for line breaks
+  ULONGLONG used;      // When it was last previewed, for eviction
+} PreviewFile;
+
+struct PreviewCache {
+  PreviewFile files[PREVIEW_CACHE_FILES];
+  ULONGLONG clock;
+};
+
+static void release_preview_file(PreviewFile *file) {
+  unmap_file(&file->file);
+  free(file->line_starts);
+  memset(file, 0, sizeof(*file));
+}
+
+/**
+ * Create an empty preview cache
+ */
+PreviewCache *preview_cache_create(void) {
+  return (PreviewCache *)calloc(1, sizeof(PreviewCache));
+}
+
+/**
+ * Unmap a cache's files and free it
+ */
+void preview_cache_free(PreviewCache *cache) {
+  if (!cache) {
+    return;
+  }
+  for (int i = 0; i < PREVIEW_CACHE_FILES; i++) {
+    release_preview_file(&cache->files[i]);
+  }
+  free(cache);
+}
+
+/**
+ * Find a file in the cache, mapping it into the least recently used slot
+ * if it is not there
+ */
+static PreviewFile *open_preview_file(PreviewCache *cache, const char *path) {
+  PreviewFile *oldest = &cache->files[0];
+
+  for (int i = 0; i < PREVIEW_CACHE_FILES; i++) {
+    PreviewFile *file = &cache->files[i];
+    if (file->path[0] && _stricmp(file->path, path) == 0) {
+      file->used = ++cache->clock;
+      return file;
+    }
+    if (file->used < oldest->used) {
+      oldest = file;
+    }
+  }
+
+  release_preview_file(oldest);
+  snprintf(oldest->path, sizeof(oldest->path), "%s", path);
+  oldest->used = ++cache->clock;
+  if (map_file(path, &oldest->file)) {
+    oldest->binary = looks_binary(oldest->file.data, oldest->file.size);
+  }
+  return oldest;
+}
+
+/**
+ * Index a file's line starts until it has wanted lines or runs out
+ */
+static void index_lines(PreviewFile *file, int wanted) {
+  const char *data = (const char *)file->file.data;
+  size_t size = file->file.size;
+
+  while (file->line_count < wanted &&
+         (file->line_count == 0 || file->indexed_to < size)) {
+    size_t start = file->indexed_to;
+    if (file->line_count > 0) {
+      const char *newline =
+          (const char *)memchr(data + start, '\n', size - start);
+      if (!newline) {
+        file->indexed_to = size;
+        break;
+      }
+      start = (size_t)(newline - data) + 1;
+      file->indexed_to = start;
+      // A final line break starts no line
+      if (start >= size) {
+        break;
+      }
+    }
+
+    if (file->line_count == file->line_capacity) {
+      int capacity = file->line_capacity ? file->line_capacity * 2 : 256;
+      size_t *starts =
+          (size_t *)realloc(file->line_starts, capacity * sizeof(size_t));
+      if (!starts) {
+        break;
+      }
+      file->line_starts = starts;
+      file->line_capacity = capacity;
+    }
+    file->line_starts[file->line_count++] = start;
+  }
+}
+
+/**
+ * Fill preview lines from a file around a line
+ */
+int preview_cache_lines(PreviewCache *cache, const char *path, int line,
+                        PickerPreviewLine *lines, int max_lines) {
+  PreviewFile *file = open_preview_file(cache, path);
+  if (!file->file.data || max_lines <= 0) {
+    return 0;
+  }
+  if (file->binary) {
+    lines[0].text = "Binary file";
+    lines[0].length = 11;
+    lines[0].number = 0;
+    lines[0].highlight = FALSE;
+    return 1;
+  }
+
+  int first = line - max_lines / 3;
+  if (first < 1) {
+    first = 1;
+  }
+  index_lines(file, first + max_lines - 1);
+  if (first > file->line_count) {
+    first = file->line_count > max_lines ? file->line_count - max_lines + 1
+                                         : 1;
+  }
+
+  const char *data = (const char *)file->file.data;
+  int count = 0;
+  for (int number = first;
+       number <= file->line_count && count < max_lines; number++) {
+    // Nothing past the widest console is drawn
+    size_t start = file->line_starts[number - 1];
+    size_t span = file->file.size - start;
+    if (span > PREVIEW_LINE_BYTES) {
+      span = PREVIEW_LINE_BYTES;
+    }
+    const char *newline = (const char *)memchr(data + start, '\n', span);
+    size_t end = newline ? (size_t)(newline - data) : start + span;
+    if (end > start && data[end - 1] == '\r') {
+      end--;
+    }
+
+    lines[count].text = data + start;
+    lines[count].length = (int)(end - start);
+    lines[count].number = number;
+    lines[count].highlight = number == line;
+    count++;
+  }
+  return count;
+}
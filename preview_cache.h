@@ -0,0 +1,49 @@
+/**
+ * preview_cache.h
+ * Previews of file lines for the fuzzy picker, served from a small cache of
+ * mapped files
+ */
+
+#ifndef PREVIEW_CACHE_H
+#define PREVIEW_CACHE_H
+
+#include "common.h"
+#include "fuzzy_picker.h"
+
+// Files kept mapped at once; the least recently previewed is dropped first
+#define PREVIEW_CACHE_FILES 8
+
+// Recently previewed files, each mapped once with its line starts indexed
+// as far as previews have needed. Not thread-safe.
+typedef struct PreviewCache PreviewCache;
+
+/**
+ * Create an empty preview cache
+ *
+ * @return New cache (free with preview_cache_free), or NULL on failure
+ */
+PreviewCache *preview_cache_create(void);
+
+/**
+ * Fill preview lines from a file: a window with line in its upper third,
+ * highlighted, or the file's first lines when line is 0
+ *
+ * @param cache The cache
+ * @param path File to preview
+ * @param line Line to show (from 1), or 0
+ * @param lines Receives the lines, which point into the mapping and stay
+ *              valid until the next call
+ * @param max_lines Most lines to fill
+ * @return Lines filled; 0 if the file cannot be mapped
+ */
+int preview_cache_lines(PreviewCache *cache, const char *path, int line,
+                        PickerPreviewLine *lines, int max_lines);
+
+/**
+ * Unmap a cache's files and free it
+ *
+ * @param cache The cache, or NULL
+ */
+void preview_cache_free(PreviewCache *cache);
+
+#endif // PREVIEW_CACHE_H
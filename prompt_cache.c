@@ -0,0 +1,439 @@
+/**
+ * prompt_cache.c
+ * Per-repository cache of prompt segments, refreshed by a background worker
+ */
+
+#include "prompt_cache.h"
+#include "fs_watch.h"
+#include "git_integration.h"
+#include "git_repo.h"
+
+#define PROMPT_CACHE_ENTRIES 16
+
+// Modification times of the files that decide what the prompt shows
+typedef struct {
+  FILETIME head;
+  FILETIME branch_ref;
+  FILETIME refs_heads;
+  FILETIME packed_refs;
+  FILETIME index;
+} RepoStamp;
+
+typedef struct {
+  char root[MAX_PATH];
+  RepoStamp stamp;
+  PromptGitState state;
+  int has_state;   // state holds real (possibly stale) values
+  int refreshing;  // a refresh is queued or running
+  int watch_id;    // Watch on the working tree, 0 if there is none
+  int watch_covers_git;     // The watch also sees the .git files stamped
+  unsigned long generation; // Watch generation the state was computed at
+  ULONGLONG last_used;
+} RepoCacheEntry;
+
+// Recursive watches on recently used working trees. Only the worker adds
+// and removes them, so it can do so without holding cache_lock (the watch
+// callback takes it).
+typedef struct {
+  char root[MAX_PATH];
+  int id;
+  int covers_git;
+  ULONGLONG last_used;
+} RepoWatch;
+
+static RepoCacheEntry cache[PROMPT_CACHE_ENTRIES];
+static CRITICAL_SECTION cache_lock;
+static int cache_initialized = 0;
+static RepoWatch repo_watches[PROMPT_CACHE_ENTRIES];
+
+// Repository the prompt was last rendered for; changes anywhere else are
+// picked up when the prompt next visits it
+static GitRepo active_repo;
+
+// Worker state: only the most recent request matters, so it is one slot
+static HANDLE worker_thread = NULL;
+static HANDLE worker_wakeup = NULL;
+static volatile LONG worker_stop = 0;
+static GitRepo pending_repo;
+static PromptCacheListener cache_listener = NULL;
+
+/**
+ * Get the path of the file holding the last session's prompt state
+ */
+static void get_prompt_cache_path(char *path, size_t size) {
+  char *home_dir = getenv("USERPROFILE");
+  if (home_dir) {
+    snprintf(path, size, "%s\\.lsh_prompt_cache", home_dir);
+  } else {
+    snprintf(path, size, ".lsh_prompt_cache");
+  }
+}
+
+static void get_mtime(const char *path, FILETIME *mtime) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (GetFileAttributesEx(path, GetFileExInfoStandard, &data)) {
+    *mtime = data.ftLastWriteTime;
+  } else {
+    mtime->dwLowDateTime = 0;
+    mtime->dwHighDateTime = 0;
+  }
+}
+
+/**
+ * Record the modification times that decide whether a cached entry is stale
+ */
+static void read_repo_stamp(const GitRepo *repo, RepoStamp *stamp) {
+  char path[MAX_PATH];
+
+  snprintf(path, sizeof(path), "%s\\HEAD", repo->git_dir);
+  get_mtime(path, &stamp->head);
+
+  // The current branch's ref file changes on commit, reset, pull...
+  stamp->branch_ref.dwLowDateTime = 0;
+  stamp->branch_ref.dwHighDateTime = 0;
+  FILE *head = fopen(path, "r");
+  if (head) {
+    char line[512] = "";
+    fgets(line, sizeof(line), head);
+    fclose(head);
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (strncmp(line, "ref: ", 5) == 0) {
+      snprintf(path, sizeof(path), "%s\\%s", repo->common_dir, line + 5);
+      for (char *p = path; *p; p++) {
+        if (*p == '/') {
+          *p = '\\';
+        }
+      }
+      get_mtime(path, &stamp->branch_ref);
+    }
+  }
+
+  snprintf(path, sizeof(path), "%s\\refs\\heads", repo->common_dir);
+  get_mtime(path, &stamp->refs_heads);
+
+  snprintf(path, sizeof(path), "%s\\packed-refs", repo->common_dir);
+  get_mtime(path, &stamp->packed_refs);
+
+  snprintf(path, sizeof(path), "%s\\index", repo->git_dir);
+  get_mtime(path, &stamp->index);
+}
+
+/**
+ * Find the entry for a repository root, or claim the least recently used one
+ */
+static RepoCacheEntry *find_entry(const char *root, int create) {
+  RepoCacheEntry *oldest = &cache[0];
+
+  for (int i = 0; i < PROMPT_CACHE_ENTRIES; i++) {
+    if (cache[i].root[0] && _stricmp(cache[i].root, root) == 0) {
+      return &cache[i];
+    }
+    if (cache[i].last_used < oldest->last_used) {
+      oldest = &cache[i];
+    }
+  }
+
+  if (!create) {
+    return NULL;
+  }
+
+  memset(oldest, 0, sizeof(*oldest));
+  snprintf(oldest->root, sizeof(oldest->root), "%s", root);
+  return oldest;
+}
+
+/**
+ * Hand a stale entry to the worker. Called with cache_lock held.
+ */
+static void queue_refresh(RepoCacheEntry *entry, const GitRepo *repo) {
+  // A request the worker has not picked up yet is superseded
+  if (pending_repo.root[0]) {
+    RepoCacheEntry *superseded = find_entry(pending_repo.root, 0);
+    if (superseded) {
+      superseded->refreshing = 0;
+    }
+  }
+  entry->refreshing = 1;
+  pending_repo = *repo;
+  SetEvent(worker_wakeup);
+}
+
+/**
+ * Watch callback: refresh the repository the prompt is showing as soon as
+ * its working tree or .git directory changes, so the prompt is redrawn
+ * without waiting for the next command
+ */
+static void on_repo_change(int id, const char *path, void *context) {
+  (void)path;
+  (void)context;
+
+  EnterCriticalSection(&cache_lock);
+  if (cache_initialized && !worker_stop && active_repo.root[0]) {
+    RepoCacheEntry *entry = find_entry(active_repo.root, 0);
+    if (entry && entry->watch_id == id && entry->has_state &&
+        !entry->refreshing &&
+        fs_watch_generation(id) != entry->generation) {
+      queue_refresh(entry, &active_repo);
+    }
+  }
+  LeaveCriticalSection(&cache_lock);
+}
+
+static int path_is_under(const char *path, const char *root) {
+  size_t length = strlen(root);
+  return _strnicmp(path, root, length) == 0 &&
+         (path[length] == '\\' || path[length] == '/' ||
+          root[length - 1] == '\\');
+}
+
+/**
+ * Get the worker's watch on a repository's working tree, replacing the least
+ * recently used one when the table is full. Worker thread only.
+ */
+static RepoWatch *ensure_repo_watch(const GitRepo *repo) {
+  RepoWatch *oldest = &repo_watches[0];
+
+  for (int i = 0; i < PROMPT_CACHE_ENTRIES; i++) {
+    if (repo_watches[i].root[0] &&
+        _stricmp(repo_watches[i].root, repo->root) == 0) {
+      repo_watches[i].last_used = GetTickCount64();
+      return &repo_watches[i];
+    }
+    if (repo_watches[i].last_used < oldest->last_used) {
+      oldest = &repo_watches[i];
+    }
+  }
+
+  // Entries still holding the old id see generation 0 and refresh, which
+  // sets up a new watch for them
+  if (oldest->id) {
+    fs_watch_remove(oldest->id);
+  }
+  memset(oldest, 0, sizeof(*oldest));
+
+  oldest->id = fs_watch_add(repo->root, 1, on_repo_change, NULL);
+  if (!oldest->id) {
+    return NULL;
+  }
+  snprintf(oldest->root, sizeof(oldest->root), "%s", repo->root);
+  oldest->covers_git = !fs_watch_is_polled(oldest->id) &&
+                       path_is_under(repo->git_dir, repo->root) &&
+                       path_is_under(repo->common_dir, repo->root);
+  oldest->last_used = GetTickCount64();
+  return oldest;
+}
+
+/**
+ * Worker thread: recompute the Git segment for the most recently requested
+ * repository
+ */
+static unsigned __stdcall prompt_worker(void *arg) {
+  GitRepo repo;
+
+  while (WaitForSingleObject(worker_wakeup, INFINITE) == WAIT_OBJECT_0 &&
+         !worker_stop) {
+    EnterCriticalSection(&cache_lock);
+    repo = pending_repo;
+    pending_repo.root[0] = '\0';
+    LeaveCriticalSection(&cache_lock);
+
+    if (repo.root[0] == '\0') {
+      continue;
+    }
+
+    // Record the watch generation and stamps before reading the repository,
+    // so changes made while it runs trigger another refresh
+    RepoWatch *watch = ensure_repo_watch(&repo);
+    int watch_id = watch ? watch->id : 0;
+    int watch_covers_git = watch ? watch->covers_git : 0;
+    unsigned long generation = watch_id ? fs_watch_generation(watch_id) : 0;
+
+    RepoStamp stamp;
+    read_repo_stamp(&repo, &stamp);
+
+    PromptGitState fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    fresh.in_repo = get_git_prompt_info(repo.root, fresh.info, sizeof(fresh.info),
+                                        fresh.url, sizeof(fresh.url));
+
+    int changed = 0;
+    EnterCriticalSection(&cache_lock);
+    RepoCacheEntry *entry = find_entry(repo.root, 1);
+    changed = !entry->has_state ||
+              memcmp(&entry->state, &fresh, sizeof(fresh)) != 0;
+    entry->state = fresh;
+    entry->stamp = stamp;
+    entry->watch_id = watch_id;
+    entry->watch_covers_git = watch_covers_git;
+    entry->generation = generation;
+    entry->has_state = 1;
+    entry->refreshing = 0;
+    entry->last_used = GetTickCount64();
+    LeaveCriticalSection(&cache_lock);
+
+    if (changed && cache_listener) {
+      cache_listener(repo.root);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Load the state saved by the previous session. Entries start with an empty
+ * stamp, so they are shown immediately but refreshed on first use.
+ */
+static void load_saved_state(void) {
+  char path[MAX_PATH];
+  char line[1024 + 8];
+  RepoCacheEntry *entry = NULL;
+
+  get_prompt_cache_path(path, sizeof(path));
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (strncmp(line, "root=", 5) == 0) {
+      entry = find_entry(line + 5, 1);
+      entry->has_state = 1;
+      entry->state.in_repo = 1;
+    } else if (entry && strncmp(line, "git=", 4) == 0) {
+      snprintf(entry->state.info, sizeof(entry->state.info), "%s", line + 4);
+    } else if (entry && strncmp(line, "url=", 4) == 0) {
+      snprintf(entry->state.url, sizeof(entry->state.url), "%s", line + 4);
+    }
+  }
+
+  fclose(file);
+}
+
+static void save_state(void) {
+  char path[MAX_PATH];
+  get_prompt_cache_path(path, sizeof(path));
+
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    return;
+  }
+
+  for (int i = 0; i < PROMPT_CACHE_ENTRIES; i++) {
+    RepoCacheEntry *entry = &cache[i];
+    if (entry->root[0] && entry->has_state && entry->state.in_repo) {
+      fprintf(file, "root=%s\n", entry->root);
+      fprintf(file, "git=%s\n", entry->state.info);
+      fprintf(file, "url=%s\n", entry->state.url);
+    }
+  }
+
+  fclose(file);
+}
+
+/**
+ * Load the state saved by the previous session and start the worker
+ */
+void prompt_cache_init(PromptCacheListener listener) {
+  if (cache_initialized) {
+    return;
+  }
+
+  InitializeCriticalSection(&cache_lock);
+  cache_listener = listener;
+  load_saved_state();
+
+  worker_wakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (worker_wakeup) {
+    worker_thread =
+        (HANDLE)_beginthreadex(NULL, 0, prompt_worker, NULL, 0, NULL);
+  }
+
+  cache_initialized = 1;
+}
+
+/**
+ * Stop the worker and save the cached state for the next session
+ */
+void prompt_cache_shutdown(void) {
+  if (!cache_initialized) {
+    return;
+  }
+
+  if (worker_thread) {
+    InterlockedExchange(&worker_stop, 1);
+    SetEvent(worker_wakeup);
+    WaitForSingleObject(worker_thread, INFINITE);
+    CloseHandle(worker_thread);
+    worker_thread = NULL;
+  }
+  if (worker_wakeup) {
+    CloseHandle(worker_wakeup);
+    worker_wakeup = NULL;
+  }
+
+  // The worker has exited, so the watch table is ours; callbacks already
+  // running may still take cache_lock, so it is not held here
+  for (int i = 0; i < PROMPT_CACHE_ENTRIES; i++) {
+    if (repo_watches[i].id) {
+      fs_watch_remove(repo_watches[i].id);
+    }
+  }
+  memset(repo_watches, 0, sizeof(repo_watches));
+
+  save_state();
+  DeleteCriticalSection(&cache_lock);
+  cache_initialized = 0;
+}
+
+/**
+ * Get the prompt state for a directory without blocking
+ */
+int prompt_cache_lookup(const char *cwd, PromptGitState *state) {
+  GitRepo repo;
+
+  memset(state, 0, sizeof(*state));
+
+  if (!git_find_repository(cwd, &repo)) {
+    return 1; // Not in a repository - nothing to compute
+  }
+
+  if (!cache_initialized) {
+    // No worker - compute synchronously
+    state->in_repo = get_git_prompt_info(repo.root, state->info,
+                                         sizeof(state->info), state->url,
+                                         sizeof(state->url));
+    return 1;
+  }
+
+  int current;
+  EnterCriticalSection(&cache_lock);
+  RepoCacheEntry *entry = find_entry(repo.root, 1);
+  entry->last_used = GetTickCount64();
+  active_repo = repo;
+
+  if (entry->has_state) {
+    *state = entry->state;
+  }
+
+  // A native watch that sees the .git files makes the stamps unnecessary,
+  // and also catches edits to tracked files that change the dirty flag
+  current = entry->has_state && !entry->refreshing;
+  if (current && entry->watch_id) {
+    current = fs_watch_generation(entry->watch_id) == entry->generation;
+  }
+  if (current && !entry->watch_covers_git) {
+    RepoStamp stamp;
+    read_repo_stamp(&repo, &stamp);
+    current = memcmp(&entry->stamp, &stamp, sizeof(stamp)) == 0;
+  }
+
+  if (!current && !entry->refreshing) {
+    queue_refresh(entry, &repo);
+  }
+  LeaveCriticalSection(&cache_lock);
+
+  return current;
+}
@@ -0,0 +1,55 @@
+/**
+ * prompt_cache.h
+ * Per-repository cache of prompt segments, refreshed by a background worker
+ */
+
+#ifndef PROMPT_CACHE_H
+#define PROMPT_CACHE_H
+
+#include "common.h"
+
+// Git segment of the prompt
+typedef struct {
+  int in_repo;
+  char info[128]; // " git:(repo branch*)"
+  char url[1024]; // Repository web URL, empty if there is none
+} PromptGitState;
+
+/**
+ * Called on the worker thread after a repository's cached state changed
+ *
+ * @param root Working tree root of the repository
+ */
+typedef void (*PromptCacheListener)(const char *root);
+
+/**
+ * Load the state saved by the previous session and start the worker
+ *
+ * @param listener Function notified when fresh data arrives, or NULL
+ */
+void prompt_cache_init(PromptCacheListener listener);
+
+/**
+ * Stop the worker and save the cached state for the next session
+ */
+void prompt_cache_shutdown(void);
+
+/**
+ * Get the prompt state for a directory without blocking
+ *
+ * Finds the enclosing repository and checks whether the working tree's
+ * watch has seen a change since the entry was computed. When the watch is
+ * polled or the .git directory lies outside the working tree, the
+ * modification times of HEAD, the current branch ref, refs/heads,
+ * packed-refs and the index are compared too. If anything changed, or the
+ * repository has not been seen yet, a refresh is queued on the worker and
+ * the last known values are returned. Changes to the repository looked up
+ * last also queue a refresh by themselves, reported through the listener.
+ *
+ * @param cwd Directory the prompt is rendered for
+ * @param state Receives the last known state
+ * @return 1 if the state is current, 0 if it is stale or unknown
+ */
+int prompt_cache_lookup(const char *cwd, PromptGitState *state);
+
+#endif // PROMPT_CACHE_H
@@ -0,0 +1,2016 @@
+/**
+ * regex_engine.c
+ * Implementation of regular expressions: parser, byte NFA compiler, lazily
+ * built DFA and NFA simulation
+ */
+
+#include "regex_engine.h"
+#include "arena.h"
+
+#define REGEX_MAX_INSTS 50000
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_MAX_DEPTH 200
+#define REGEX_MAX_LITERAL 64
+#define REGEX_MIN_LITERAL 2
+#define MAX_CODE_POINT 0x10FFFF
+
+// Memory a thread's DFA may use before it is thrown away and rebuilt, and
+// how many rebuilds are tolerated before falling back to the NFA
+#define DFA_CACHE_BYTES (2 * 1024 * 1024)
+#define DFA_MAX_RESETS 8
+
+// How EOL assertions are treated while following empty transitions
+#define EOL_DROP 0   // Not at the end of a line
+#define EOL_FOLLOW 1 // At the end of a line
+#define EOL_KEEP 2   // Unknown yet (DFA); kept in the state
+
+// ---------------------------------------------------------------------------
+// Syntax tree
+// ---------------------------------------------------------------------------
+
+typedef enum {
+  NODE_EMPTY,
+  NODE_CHAR,
+  NODE_CLASS,
+  NODE_CONCAT,
+  NODE_ALT,
+  NODE_REPEAT,
+  NODE_BOL,
+  NODE_EOL
+} NodeType;
+
+typedef struct {
+  unsigned int lo;
+  unsigned int hi;
+} CodeRange;
+
+// A set of code points, plus bytes that only match where the text is not
+// valid UTF-8
+typedef struct {
+  CodeRange *ranges;
+  int count;
+  int capacity;
+  unsigned char raw[32];
+} CharClass;
+
+typedef struct Node {
+  NodeType type;
+  unsigned int code_point; // NODE_CHAR
+  int raw_byte;            // NODE_CHAR: code_point is a lone invalid byte
+  CharClass *char_class;   // NODE_CLASS
+  struct Node **children;  // NODE_CONCAT, NODE_ALT
+  int child_count;
+  struct Node *child; // NODE_REPEAT
+  int min;
+  int max; // -1 for unbounded
+} Node;
+
+typedef struct {
+  const unsigned char *p;
+  const unsigned char *end;
+  int flags;
+  int depth;
+  Arena arena;
+  const char *error;
+} Parser;
+
+typedef struct {
+  Node **items;
+  int count;
+  int capacity;
+} NodeList;
+
+// ---------------------------------------------------------------------------
+// Program
+// ---------------------------------------------------------------------------
+
+typedef enum {
+  INST_BYTES, // Consume one byte in bits
+  INST_SPLIT, // Continue at out and out1
+  INST_EMPTY, // Continue at out
+  INST_BOL,   // Continue at out at the start of a line
+  INST_EOL,   // Continue at out at the end of a line
+  INST_MATCH
+} InstOp;
+
+typedef struct {
+  unsigned char op;
+  int out;
+  int out1;
+  unsigned char bits[32];
+} Inst;
+
+struct Regex {
+  Inst *insts;
+  int inst_count;
+  int inst_capacity;
+  int start;
+
+  // Bytes no instruction can tell apart share a class, so DFA states only
+  // need one transition per class
+  unsigned char byte_class[256];
+  int class_count;
+  unsigned char class_byte[256]; // A member of each class
+
+  char literal[REGEX_MAX_LITERAL + 1];
+};
+
+// ---------------------------------------------------------------------------
+// Matching state
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  int *dense;
+  int *sparse;
+  int count;
+} SparseSet;
+
+typedef struct {
+  int *insts; // Sorted instructions (BYTES, pending EOL and MATCH)
+  int count;
+  unsigned int hash;
+  char is_match;
+  char eol_match; // -1 until computed
+  int *next;      // Per byte class, -1 until computed
+} DfaState;
+
+struct RegexScratch {
+  const Regex *re;
+
+  SparseSet visited[2];
+  int *stack;
+  int *pcs[2];    // NFA thread lists: instruction...
+  int *starts[2]; // ...and where the thread's match started
+  int counts[2];
+  int *work;      // Closure output for DFA states
+  int *saved;     // A state's instructions, kept across a cache reset
+
+  DfaState *states;
+  int state_count;
+  int state_capacity;
+  int *table; // Open addressing hash of state indices
+  int table_size;
+  Arena arena;
+  size_t cache_bytes;
+  int initial;
+  int empty_line_match; // -1 until computed
+  int resets;
+  int use_nfa;
+};
+
+// ---------------------------------------------------------------------------
+// UTF-8 and case folding
+// ---------------------------------------------------------------------------
+
+/**
+ * Decode one UTF-8 character
+ * @return Its length, or 0 if the bytes are not valid UTF-8
+ */
+static int decode_utf8(const unsigned char *p, const unsigned char *end,
+                       unsigned int *code_point) {
+  unsigned int c = p[0];
+  int length;
+  unsigned int min;
+
+  if (c < 0x80) {
+    *code_point = c;
+    return 1;
+  } else if (c >= 0xC2 && c <= 0xDF) {
+    length = 2;
+    c &= 0x1F;
+    min = 0x80;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    length = 3;
+    c &= 0x0F;
+    min = 0x800;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    length = 4;
+    c &= 0x07;
+    min = 0x10000;
+  } else {
+    return 0;
+  }
+
+  if (end - p < length) {
+    return 0;
+  }
+  for (int i = 1; i < length; i++) {
+    if ((p[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+    c = (c << 6) | (p[i] & 0x3F);
+  }
+  if (c < min || c > MAX_CODE_POINT || (c >= 0xD800 && c <= 0xDFFF)) {
+    return 0;
+  }
+
+  *code_point = c;
+  return length;
+}
+
+static int encode_utf8(unsigned int c, unsigned char *out) {
+  if (c < 0x80) {
+    out[0] = (unsigned char)c;
+    return 1;
+  } else if (c < 0x800) {
+    out[0] = (unsigned char)(0xC0 | (c >> 6));
+    out[1] = (unsigned char)(0x80 | (c & 0x3F));
+    return 2;
+  } else if (c < 0x10000) {
+    out[0] = (unsigned char)(0xE0 | (c >> 12));
+    out[1] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+    out[2] = (unsigned char)(0x80 | (c & 0x3F));
+    return 3;
+  }
+  out[0] = (unsigned char)(0xF0 | (c >> 18));
+  out[1] = (unsigned char)(0x80 | ((c >> 12) & 0x3F));
+  out[2] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+  out[3] = (unsigned char)(0x80 | (c & 0x3F));
+  return 4;
+}
+
+/**
+ * Get the other cases of a code point. ASCII is folded directly; the rest
+ * of the Basic Multilingual Plane uses the system's Unicode case mapping.
+ * @return Number of variants written (at most 2)
+ */
+static int fold_variants(unsigned int c, unsigned int *variants) {
+  int count = 0;
+
+  if (c < 0x80) {
+    if (c >= 'a' && c <= 'z') {
+      variants[count++] = c - 32;
+    } else if (c >= 'A' && c <= 'Z') {
+      variants[count++] = c + 32;
+    }
+    return count;
+  }
+  if (c > 0xFFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+    return 0;
+  }
+
+  WCHAR lower = (WCHAR)c;
+  WCHAR upper = (WCHAR)c;
+  CharLowerBuffW(&lower, 1);
+  CharUpperBuffW(&upper, 1);
+  if (lower != c) {
+    variants[count++] = lower;
+  }
+  if (upper != c && upper != lower) {
+    variants[count++] = upper;
+  }
+  return count;
+}
+
+// ---------------------------------------------------------------------------
+// Character classes
+// ---------------------------------------------------------------------------
+
+static int class_add(Parser *parser, CharClass *cls, unsigned int lo,
+                     unsigned int hi) {
+  if (cls->count == cls->capacity) {
+    int capacity = cls->capacity ? cls->capacity * 2 : 8;
+    CodeRange *ranges = (CodeRange *)arena_alloc(&parser->arena,
+                                                 capacity * sizeof(CodeRange));
+    if (!ranges) {
+      parser->error = "out of memory";
+      return 0;
+    }
+    if (cls->count) {
+      memcpy(ranges, cls->ranges, cls->count * sizeof(CodeRange));
+    }
+    cls->ranges = ranges;
+    cls->capacity = capacity;
+  }
+  cls->ranges[cls->count].lo = lo;
+  cls->ranges[cls->count].hi = hi;
+  cls->count++;
+  return 1;
+}
+
+/**
+ * Add a range and, when ignoring case, the other cases of its letters
+ */
+static int class_add_folded(Parser *parser, CharClass *cls, unsigned int lo,
+                            unsigned int hi) {
+  if (!class_add(parser, cls, lo, hi)) {
+    return 0;
+  }
+  if (!(parser->flags & REGEX_IGNORE_CASE)) {
+    return 1;
+  }
+
+  unsigned int last = hi < 0xFFFF ? hi : 0xFFFF;
+  for (unsigned int c = lo; c <= last; c++) {
+    unsigned int variants[2];
+    int count = fold_variants(c, variants);
+    for (int i = 0; i < count; i++) {
+      if ((variants[i] < lo || variants[i] > hi) &&
+          !class_add(parser, cls, variants[i], variants[i])) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static int compare_ranges(const void *a, const void *b) {
+  const CodeRange *x = (const CodeRange *)a;
+  const CodeRange *y = (const CodeRange *)b;
+  return x->lo < y->lo ? -1 : x->lo > y->lo;
+}
+
+/**
+ * Sort the ranges and merge the ones that overlap or touch
+ */
+static void class_normalize(CharClass *cls) {
+  if (cls->count < 2) {
+    return;
+  }
+
+  qsort(cls->ranges, cls->count, sizeof(CodeRange), compare_ranges);
+
+  int out = 0;
+  for (int i = 1; i < cls->count; i++) {
+    if (cls->ranges[i].lo <= cls->ranges[out].hi + 1) {
+      if (cls->ranges[i].hi > cls->ranges[out].hi) {
+        cls->ranges[out].hi = cls->ranges[i].hi;
+      }
+    } else {
+      cls->ranges[++out] = cls->ranges[i];
+    }
+  }
+  cls->count = out + 1;
+}
+
+static int class_negate(Parser *parser, CharClass *cls) {
+  class_normalize(cls);
+
+  CharClass negated;
+  memset(&negated, 0, sizeof(negated));
+
+  unsigned int next = 0;
+  for (int i = 0; i < cls->count; i++) {
+    if (cls->ranges[i].lo > next &&
+        !class_add(parser, &negated, next, cls->ranges[i].lo - 1)) {
+      return 0;
+    }
+    next = cls->ranges[i].hi + 1;
+  }
+  if (next <= MAX_CODE_POINT &&
+      !class_add(parser, &negated, next, MAX_CODE_POINT)) {
+    return 0;
+  }
+
+  // Bytes of invalid UTF-8 are never members, so the negation holds them
+  for (int b = 0x80; b < 0x100; b++) {
+    negated.raw[b >> 3] = (unsigned char)(negated.raw[b >> 3] |
+                                          (~cls->raw[b >> 3] & (1 << (b & 7))));
+  }
+
+  *cls = negated;
+  return 1;
+}
+
+/**
+ * Add ranges given as pairs of ASCII bounds, such as "azAZ"
+ */
+static int class_add_pairs(Parser *parser, CharClass *cls, const char *pairs,
+                           int fold) {
+  for (; pairs[0] && pairs[1]; pairs += 2) {
+    unsigned int lo = (unsigned char)pairs[0];
+    unsigned int hi = (unsigned char)pairs[1];
+    if (!(fold ? class_add_folded(parser, cls, lo, hi)
+               : class_add(parser, cls, lo, hi))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static const char *shorthand_pairs(int letter) {
+  switch (letter) {
+  case 'd':
+    return "09";
+  case 'w':
+    return "azAZ09__";
+  case 's':
+    return "\t\r  ";
+  }
+  return NULL;
+}
+
+static const struct {
+  const char *name;
+  const char *pairs;
+} posix_classes[] = {
+    {"alpha", "azAZ"},   {"digit", "09"},       {"alnum", "azAZ09"},
+    {"upper", "AZ"},     {"lower", "az"},       {"space", "\t\r  "},
+    {"blank", "\t\t  "}, {"punct", "!/:@[`{~"}, {"xdigit", "09afAF"},
+    {"word", "azAZ09__"}, {"cntrl", "\x01\x1f\x7f\x7f"}, {"print", " ~"},
+    {"graph", "!~"}};
+
+/**
+ * Add \d, \w, \s or a negated form (\D, \W, \S) to a class
+ */
+static int class_add_shorthand(Parser *parser, CharClass *cls, int letter) {
+  const char *pairs = shorthand_pairs(tolower(letter));
+
+  if (!isupper(letter)) {
+    return class_add_pairs(parser, cls, pairs, 0);
+  }
+
+  CharClass negated;
+  memset(&negated, 0, sizeof(negated));
+  if (!class_add_pairs(parser, &negated, pairs, 0) ||
+      !class_negate(parser, &negated)) {
+    return 0;
+  }
+  for (int i = 0; i < negated.count; i++) {
+    if (!class_add(parser, cls, negated.ranges[i].lo, negated.ranges[i].hi)) {
+      return 0;
+    }
+  }
+  for (int i = 0; i < 32; i++) {
+    cls->raw[i] |= negated.raw[i];
+  }
+  return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Parser
+// ---------------------------------------------------------------------------
+
+static Node *new_node(Parser *parser, NodeType type) {
+  Node *node = (Node *)arena_alloc(&parser->arena, sizeof(Node));
+  if (!node) {
+    parser->error = "out of memory";
+    return NULL;
+  }
+  memset(node, 0, sizeof(*node));
+  node->type = type;
+  return node;
+}
+
+static Node *new_class_node(Parser *parser) {
+  Node *node = new_node(parser, NODE_CLASS);
+  if (node) {
+    node->char_class =
+        (CharClass *)arena_alloc(&parser->arena, sizeof(CharClass));
+    if (!node->char_class) {
+      parser->error = "out of memory";
+      return NULL;
+    }
+    memset(node->char_class, 0, sizeof(CharClass));
+  }
+  return node;
+}
+
+static int node_list_add(Parser *parser, NodeList *list, Node *node) {
+  if (list->count == list->capacity) {
+    int capacity = list->capacity ? list->capacity * 2 : 8;
+    Node **items = (Node **)realloc(list->items, capacity * sizeof(Node *));
+    if (!items) {
+      parser->error = "out of memory";
+      return 0;
+    }
+    list->items = items;
+    list->capacity = capacity;
+  }
+  list->items[list->count++] = node;
+  return 1;
+}
+
+/**
+ * Turn a list of nodes into one node of the given type, freeing the list
+ */
+static Node *node_from_list(Parser *parser, NodeList *list, NodeType type) {
+  Node *node = NULL;
+
+  if (list->count == 0) {
+    node = new_node(parser, NODE_EMPTY);
+  } else if (list->count == 1) {
+    node = list->items[0];
+  } else {
+    node = new_node(parser, type);
+    if (node) {
+      node->children = (Node **)arena_alloc(&parser->arena,
+                                            list->count * sizeof(Node *));
+      if (node->children) {
+        memcpy(node->children, list->items, list->count * sizeof(Node *));
+        node->child_count = list->count;
+      } else {
+        parser->error = "out of memory";
+        node = NULL;
+      }
+    }
+  }
+
+  free(list->items);
+  return node;
+}
+
+static int hex_value(int c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c = tolower(c);
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/**
+ * Read one character of the pattern
+ * @return 1 for a code point, 2 for a lone byte of invalid UTF-8
+ */
+static int read_char(Parser *parser, unsigned int *value) {
+  int length = decode_utf8(parser->p, parser->end, value);
+  if (length == 0) {
+    *value = *parser->p++;
+    return 2;
+  }
+  parser->p += length;
+  return 1;
+}
+
+/**
+ * Parse the escape after a backslash
+ * @return 1 for a character in *value, 3 for a class shorthand letter in
+ *         *value, 0 on error
+ */
+static int parse_escape(Parser *parser, unsigned int *value) {
+  if (parser->p >= parser->end) {
+    parser->error = "trailing backslash";
+    return 0;
+  }
+
+  int c = *parser->p++;
+  switch (c) {
+  case 'd':
+  case 'D':
+  case 'w':
+  case 'W':
+  case 's':
+  case 'S':
+    *value = c;
+    return 3;
+  case 't':
+    *value = '\t';
+    return 1;
+  case 'n':
+    *value = '\n';
+    return 1;
+  case 'r':
+    *value = '\r';
+    return 1;
+  case 'f':
+    *value = '\f';
+    return 1;
+  case 'v':
+    *value = '\v';
+    return 1;
+  case 'x': {
+    unsigned int code = 0;
+    int digits = 0;
+    if (parser->p < parser->end && *parser->p == '{') {
+      parser->p++;
+      while (parser->p < parser->end && hex_value(*parser->p) >= 0 &&
+             digits < 6) {
+        code = code * 16 + hex_value(*parser->p++);
+        digits++;
+      }
+      if (parser->p >= parser->end || *parser->p != '}' || digits == 0) {
+        parser->error = "invalid \\x{...} escape";
+        return 0;
+      }
+      parser->p++;
+    } else {
+      while (parser->p < parser->end && hex_value(*parser->p) >= 0 &&
+             digits < 2) {
+        code = code * 16 + hex_value(*parser->p++);
+        digits++;
+      }
+      if (digits != 2) {
+        parser->error = "invalid \\x escape";
+        return 0;
+      }
+    }
+    if (code > MAX_CODE_POINT || (code >= 0xD800 && code <= 0xDFFF)) {
+      parser->error = "invalid code point";
+      return 0;
+    }
+    *value = code;
+    return 1;
+  }
+  }
+
+  if (c < 0x80 && isalnum(c)) {
+    parser->error = "unsupported escape";
+    return 0;
+  }
+
+  // Escaped punctuation, or an escaped non-ASCII character
+  parser->p--;
+  return read_char(parser, value) == 1 ? 1 : 2;
+}
+
+/**
+ * Parse a bracket expression after its '['
+ */
+static Node *parse_bracket(Parser *parser) {
+  Node *node = new_class_node(parser);
+  if (!node) {
+    return NULL;
+  }
+  CharClass *cls = node->char_class;
+
+  int negate = 0;
+  if (parser->p < parser->end && *parser->p == '^') {
+    negate = 1;
+    parser->p++;
+  }
+
+  int first = 1;
+  for (;;) {
+    if (parser->p >= parser->end) {
+      parser->error = "missing ]";
+      return NULL;
+    }
+    if (*parser->p == ']' && !first) {
+      parser->p++;
+      break;
+    }
+    first = 0;
+
+    // [:name:]
+    if (*parser->p == '[' && parser->end - parser->p > 1 &&
+        parser->p[1] == ':') {
+      const unsigned char *name = parser->p + 2;
+      const unsigned char *close = name;
+      while (close + 1 < parser->end && !(close[0] == ':' && close[1] == ']')) {
+        close++;
+      }
+      if (close + 1 >= parser->end) {
+        parser->error = "missing :]";
+        return NULL;
+      }
+
+      int found = 0;
+      for (size_t i = 0; i < sizeof(posix_classes) / sizeof(posix_classes[0]);
+           i++) {
+        if (strlen(posix_classes[i].name) == (size_t)(close - name) &&
+            memcmp(posix_classes[i].name, name, close - name) == 0) {
+          if (!class_add_pairs(parser, cls, posix_classes[i].pairs, 1)) {
+            return NULL;
+          }
+          found = 1;
+          break;
+        }
+      }
+      if (!found) {
+        parser->error = "unknown character class name";
+        return NULL;
+      }
+      parser->p = close + 2;
+      continue;
+    }
+
+    unsigned int lo;
+    int kind;
+    if (*parser->p == '\\') {
+      parser->p++;
+      kind = parse_escape(parser, &lo);
+    } else {
+      kind = read_char(parser, &lo);
+    }
+
+    if (kind == 0) {
+      return NULL;
+    } else if (kind == 3) {
+      if (!class_add_shorthand(parser, cls, lo)) {
+        return NULL;
+      }
+      continue;
+    } else if (kind == 2) {
+      cls->raw[lo >> 3] |= (unsigned char)(1 << (lo & 7));
+      continue;
+    }
+
+    unsigned int hi = lo;
+    if (parser->end - parser->p > 1 && parser->p[0] == '-' &&
+        parser->p[1] != ']') {
+      parser->p++;
+      if (*parser->p == '\\') {
+        parser->p++;
+        kind = parse_escape(parser, &hi);
+      } else {
+        kind = read_char(parser, &hi);
+      }
+      if (kind == 0) {
+        return NULL;
+      }
+      if (kind != 1 || hi < lo) {
+        parser->error = "invalid range in character class";
+        return NULL;
+      }
+    }
+
+    if (!class_add_folded(parser, cls, lo, hi)) {
+      return NULL;
+    }
+  }
+
+  if (negate && !class_negate(parser, cls)) {
+    return NULL;
+  }
+  class_normalize(cls);
+  return node;
+}
+
+static Node *parse_alternation(Parser *parser);
+
+/**
+ * Parse {m}, {m,} or {m,n} at the current '{'
+ * @return 1 if parsed, 0 if the brace is an ordinary character, -1 on error
+ */
+static int parse_bounds(Parser *parser, int *min, int *max) {
+  const unsigned char *p = parser->p + 1;
+  long lo = 0;
+  long hi;
+  int digits = 0;
+
+  while (p < parser->end && isdigit(*p)) {
+    lo = lo < 100000 ? lo * 10 + (*p - '0') : lo;
+    p++;
+    digits++;
+  }
+  if (digits == 0) {
+    return 0;
+  }
+
+  hi = lo;
+  if (p < parser->end && *p == ',') {
+    p++;
+    digits = 0;
+    hi = 0;
+    while (p < parser->end && isdigit(*p)) {
+      hi = hi < 100000 ? hi * 10 + (*p - '0') : hi;
+      p++;
+      digits++;
+    }
+    if (digits == 0) {
+      hi = -1;
+    }
+  }
+  if (p >= parser->end || *p != '}') {
+    return 0;
+  }
+
+  if (lo > REGEX_MAX_REPEAT || hi > REGEX_MAX_REPEAT) {
+    parser->error = "repetition count too large";
+    return -1;
+  }
+  if (hi >= 0 && hi < lo) {
+    parser->error = "invalid repetition bounds";
+    return -1;
+  }
+
+  parser->p = p + 1;
+  *min = (int)lo;
+  *max = (int)hi;
+  return 1;
+}
+
+static Node *parse_atom(Parser *parser) {
+  int c = *parser->p;
+  Node *node;
+
+  switch (c) {
+  case '(': {
+    parser->p++;
+    if (parser->end - parser->p > 1 && parser->p[0] == '?' &&
+        parser->p[1] == ':') {
+      parser->p += 2;
+    } else if (parser->p < parser->end && *parser->p == '?') {
+      parser->error = "unsupported group type";
+      return NULL;
+    }
+    if (++parser->depth > REGEX_MAX_DEPTH) {
+      parser->error = "pattern nested too deeply";
+      return NULL;
+    }
+    node = parse_alternation(parser);
+    parser->depth--;
+    if (!node) {
+      return NULL;
+    }
+    if (parser->p >= parser->end || *parser->p != ')') {
+      parser->error = "missing )";
+      return NULL;
+    }
+    parser->p++;
+    return node;
+  }
+  case '[':
+    parser->p++;
+    return parse_bracket(parser);
+  case '.':
+    parser->p++;
+    node = new_class_node(parser);
+    if (node) {
+      // Any character but a newline, or any byte of invalid UTF-8
+      CharClass *cls = node->char_class;
+      if (!class_add(parser, cls, 0, '\n' - 1) ||
+          !class_add(parser, cls, '\n' + 1, MAX_CODE_POINT)) {
+        return NULL;
+      }
+      memset(cls->raw + 16, 0xFF, 16);
+    }
+    return node;
+  case '^':
+    parser->p++;
+    return new_node(parser, NODE_BOL);
+  case '$':
+    parser->p++;
+    return new_node(parser, NODE_EOL);
+  case '*':
+  case '+':
+  case '?':
+    parser->error = "nothing to repeat";
+    return NULL;
+  case '\\': {
+    unsigned int value;
+    parser->p++;
+    int kind = parse_escape(parser, &value);
+    if (kind == 0) {
+      return NULL;
+    }
+    if (kind == 3) {
+      node = new_class_node(parser);
+      if (node && !class_add_shorthand(parser, node->char_class, value)) {
+        return NULL;
+      }
+      if (node) {
+        class_normalize(node->char_class);
+      }
+      return node;
+    }
+    node = new_node(parser, NODE_CHAR);
+    if (node) {
+      node->code_point = value;
+      node->raw_byte = kind == 2;
+    }
+    return node;
+  }
+  }
+
+  unsigned int value;
+  int kind = read_char(parser, &value);
+  node = new_node(parser, NODE_CHAR);
+  if (node) {
+    node->code_point = value;
+    node->raw_byte = kind == 2;
+  }
+  return node;
+}
+
+static Node *parse_repetition(Parser *parser) {
+  Node *node = parse_atom(parser);
+
+  while (node && parser->p < parser->end) {
+    int min;
+    int max;
+    int c = *parser->p;
+
+    if (c == '*') {
+      min = 0;
+      max = -1;
+      parser->p++;
+    } else if (c == '+') {
+      min = 1;
+      max = -1;
+      parser->p++;
+    } else if (c == '?') {
+      min = 0;
+      max = 1;
+      parser->p++;
+    } else if (c == '{') {
+      int parsed = parse_bounds(parser, &min, &max);
+      if (parsed < 0) {
+        return NULL;
+      }
+      if (parsed == 0) {
+        break;
+      }
+    } else {
+      break;
+    }
+
+    // A lazy quantifier matches the same lines
+    if (parser->p < parser->end && *parser->p == '?') {
+      parser->p++;
+    }
+
+    Node *repeat = new_node(parser, NODE_REPEAT);
+    if (!repeat) {
+      return NULL;
+    }
+    repeat->child = node;
+    repeat->min = min;
+    repeat->max = max;
+    node = repeat;
+  }
+
+  return node;
+}
+
+static Node *parse_concatenation(Parser *parser) {
+  NodeList list = {NULL, 0, 0};
+
+  while (parser->p < parser->end && *parser->p != '|' && *parser->p != ')') {
+    Node *item = parse_repetition(parser);
+    if (!item || !node_list_add(parser, &list, item)) {
+      free(list.items);
+      return NULL;
+    }
+  }
+
+  return node_from_list(parser, &list, NODE_CONCAT);
+}
+
+static Node *parse_alternation(Parser *parser) {
+  NodeList list = {NULL, 0, 0};
+
+  for (;;) {
+    Node *branch = parse_concatenation(parser);
+    if (!branch || !node_list_add(parser, &list, branch)) {
+      free(list.items);
+      return NULL;
+    }
+    if (parser->p >= parser->end || *parser->p != '|') {
+      break;
+    }
+    parser->p++;
+  }
+
+  return node_from_list(parser, &list, NODE_ALT);
+}
+
+// ---------------------------------------------------------------------------
+// Required literal
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  int exact; // The node only matches whole
+  char whole[REGEX_MAX_LITERAL + 1];
+  char prefix[REGEX_MAX_LITERAL + 1]; // Every match starts with this
+  char suffix[REGEX_MAX_LITERAL + 1]; // Every match ends with this
+  char best[REGEX_MAX_LITERAL + 1];   // Every match contains this
+} LiteralInfo;
+
+static void keep_longer(char *best, const char *candidate) {
+  if (strlen(candidate) > strlen(best)) {
+    strcpy(best, candidate);
+  }
+}
+
+/**
+ * Join two strings, keeping the first (or, with keep_end, the last)
+ * REGEX_MAX_LITERAL bytes
+ */
+static void join_literal(char *out, const char *a, const char *b,
+                         int keep_end) {
+  char joined[2 * REGEX_MAX_LITERAL + 1];
+  snprintf(joined, sizeof(joined), "%s%s", a, b);
+  size_t length = strlen(joined);
+  if (keep_end && length > REGEX_MAX_LITERAL) {
+    memmove(joined, joined + length - REGEX_MAX_LITERAL, REGEX_MAX_LITERAL + 1);
+  }
+  joined[REGEX_MAX_LITERAL] = '\0';
+  strcpy(out, joined);
+}
+
+static void set_exact(LiteralInfo *info, const char *text) {
+  info->exact = 1;
+  strcpy(info->whole, text);
+  strcpy(info->prefix, text);
+  strcpy(info->suffix, text);
+  strcpy(info->best, text);
+}
+
+static void literal_info(const Node *node, int fold, LiteralInfo *info) {
+  memset(info, 0, sizeof(*info));
+
+  switch (node->type) {
+  case NODE_EMPTY:
+  case NODE_BOL:
+  case NODE_EOL:
+    set_exact(info, "");
+    break;
+  case NODE_CHAR: {
+    unsigned char bytes[5];
+    int length;
+    if (node->code_point == 0 || (fold && !node->raw_byte &&
+                                  node->code_point >= 0x80)) {
+      break;
+    }
+    if (node->raw_byte) {
+      bytes[0] = (unsigned char)node->code_point;
+      length = 1;
+    } else {
+      length = encode_utf8(node->code_point, bytes);
+      if (fold) {
+        bytes[0] = (unsigned char)tolower(bytes[0]);
+      }
+    }
+    bytes[length] = '\0';
+    set_exact(info, (const char *)bytes);
+    break;
+  }
+  case NODE_CLASS:
+    break;
+  case NODE_CONCAT: {
+    LiteralInfo next;
+    literal_info(node->children[0], fold, info);
+    for (int i = 1; i < node->child_count; i++) {
+      literal_info(node->children[i], fold, &next);
+
+      char junction[REGEX_MAX_LITERAL + 1];
+      join_literal(junction, info->suffix, next.prefix, 0);
+      keep_longer(info->best, next.best);
+      keep_longer(info->best, junction);
+
+      if (info->exact) {
+        join_literal(info->prefix, info->whole, next.prefix, 0);
+      }
+      if (next.exact) {
+        join_literal(info->suffix, info->suffix, next.whole, 1);
+      } else {
+        strcpy(info->suffix, next.suffix);
+      }
+
+      if (info->exact && next.exact &&
+          strlen(info->whole) + strlen(next.whole) <= REGEX_MAX_LITERAL) {
+        strcat(info->whole, next.whole);
+      } else {
+        info->exact = 0;
+      }
+    }
+    break;
+  }
+  case NODE_ALT: {
+    LiteralInfo next;
+    literal_info(node->children[0], fold, info);
+    for (int i = 1; i < node->child_count; i++) {
+      literal_info(node->children[i], fold, &next);
+
+      size_t n = 0;
+      while (info->prefix[n] && info->prefix[n] == next.prefix[n]) {
+        n++;
+      }
+      info->prefix[n] = '\0';
+
+      size_t a = strlen(info->suffix);
+      size_t b = strlen(next.suffix);
+      size_t common = 0;
+      while (common < a && common < b &&
+             info->suffix[a - 1 - common] == next.suffix[b - 1 - common]) {
+        common++;
+      }
+      memmove(info->suffix, info->suffix + a - common, common + 1);
+
+      info->exact = info->exact && next.exact &&
+                    strcmp(info->whole, next.whole) == 0;
+    }
+    if (!info->exact) {
+      info->whole[0] = '\0';
+    }
+    info->best[0] = '\0';
+    keep_longer(info->best, info->prefix);
+    keep_longer(info->best, info->suffix);
+    break;
+  }
+  case NODE_REPEAT: {
+    if (node->min == 0) {
+      if (node->max == 0) {
+        set_exact(info, "");
+      }
+      break;
+    }
+
+    literal_info(node->child, fold, info);
+    if (node->min >= 2) {
+      char junction[REGEX_MAX_LITERAL + 1];
+      join_literal(junction, info->suffix, info->prefix, 0);
+      keep_longer(info->best, junction);
+    }
+
+    if (info->exact && node->min == node->max &&
+        strlen(info->whole) * node->min <= REGEX_MAX_LITERAL) {
+      char whole[REGEX_MAX_LITERAL + 1] = "";
+      for (int i = 0; i < node->min; i++) {
+        strcat(whole, info->whole);
+      }
+      set_exact(info, whole);
+    } else if (info->exact) {
+      // At least min copies: the repeated text starts and ends the match
+      char repeated[REGEX_MAX_LITERAL + 1] = "";
+      for (int i = 0; i < node->min &&
+                      strlen(repeated) + strlen(info->whole) <= REGEX_MAX_LITERAL;
+           i++) {
+        strcat(repeated, info->whole);
+      }
+      info->exact = 0;
+      strcpy(info->prefix, repeated);
+      strcpy(info->suffix, repeated);
+      keep_longer(info->best, repeated);
+    }
+    break;
+  }
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Compiler
+// ---------------------------------------------------------------------------
+
+static int emit(Regex *re, InstOp op, int out, int out1,
+                const unsigned char *bits) {
+  if (re->inst_count >= REGEX_MAX_INSTS) {
+    return -1;
+  }
+  if (re->inst_count == re->inst_capacity) {
+    int capacity = re->inst_capacity ? re->inst_capacity * 2 : 64;
+    Inst *insts = (Inst *)realloc(re->insts, capacity * sizeof(Inst));
+    if (!insts) {
+      return -1;
+    }
+    re->insts = insts;
+    re->inst_capacity = capacity;
+  }
+
+  Inst *inst = &re->insts[re->inst_count];
+  inst->op = (unsigned char)op;
+  inst->out = out;
+  inst->out1 = out1;
+  if (bits) {
+    memcpy(inst->bits, bits, sizeof(inst->bits));
+  } else {
+    memset(inst->bits, 0, sizeof(inst->bits));
+  }
+  return re->inst_count++;
+}
+
+static void set_byte_range(unsigned char *bits, int lo, int hi) {
+  for (int b = lo; b <= hi; b++) {
+    bits[b >> 3] = (unsigned char)(bits[b >> 3] | (1 << (b & 7)));
+  }
+}
+
+/**
+ * Compile one UTF-8 byte sequence range (bytes lo[i]..hi[i] at position i)
+ * and add it as an alternative to *start
+ */
+static int compile_sequence(Regex *re, const unsigned char *lo,
+                            const unsigned char *hi, int length, int next,
+                            int *start) {
+  int pc = next;
+  for (int i = length - 1; i >= 0 && pc >= 0; i--) {
+    unsigned char bits[32] = {0};
+    set_byte_range(bits, lo[i], hi[i]);
+    pc = emit(re, INST_BYTES, pc, -1, bits);
+  }
+  if (pc < 0) {
+    return 0;
+  }
+  *start = *start < 0 ? pc : emit(re, INST_SPLIT, *start, pc, NULL);
+  return *start >= 0;
+}
+
+/**
+ * Compile the UTF-8 encodings of a code point range as alternatives. The
+ * range is split until each piece is a run of byte ranges, one per position
+ * (the usual UTF-8 range construction).
+ */
+static int compile_utf8_range(Regex *re, unsigned int lo, unsigned int hi,
+                              int next, int *start) {
+  static const unsigned int length_limits[] = {0x7F, 0x7FF, 0xFFFF};
+
+  // Surrogates have no UTF-8 encoding
+  if (lo <= 0xDFFF && hi >= 0xD800) {
+    if (lo < 0xD800 && !compile_utf8_range(re, lo, 0xD7FF, next, start)) {
+      return 0;
+    }
+    return hi <= 0xDFFF || compile_utf8_range(re, 0xE000, hi, next, start);
+  }
+
+  for (int i = 0; i < 3; i++) {
+    if (lo <= length_limits[i] && hi > length_limits[i]) {
+      return compile_utf8_range(re, lo, length_limits[i], next, start) &&
+             compile_utf8_range(re, length_limits[i] + 1, hi, next, start);
+    }
+  }
+
+  for (int i = 1; i < 4; i++) {
+    unsigned int mask = (1u << (6 * i)) - 1;
+    if ((lo & ~mask) != (hi & ~mask)) {
+      if ((lo & mask) != 0) {
+        return compile_utf8_range(re, lo, lo | mask, next, start) &&
+               compile_utf8_range(re, (lo | mask) + 1, hi, next, start);
+      }
+      if ((hi & mask) != mask) {
+        return compile_utf8_range(re, lo, (hi & ~mask) - 1, next, start) &&
+               compile_utf8_range(re, hi & ~mask, hi, next, start);
+      }
+    }
+  }
+
+  unsigned char lo_bytes[4];
+  unsigned char hi_bytes[4];
+  int length = encode_utf8(lo, lo_bytes);
+  encode_utf8(hi, hi_bytes);
+  return compile_sequence(re, lo_bytes, hi_bytes, length, next, start);
+}
+
+/**
+ * Compile a set of code point ranges and raw bytes. All single byte members
+ * share one instruction. A newline never matches.
+ */
+static int compile_ranges(Regex *re, const CodeRange *ranges, int count,
+                          const unsigned char *raw, int next) {
+  unsigned char bits[32];
+  int start = -1;
+
+  memcpy(bits, raw, sizeof(bits));
+  for (int i = 0; i < count; i++) {
+    if (ranges[i].lo < 0x80) {
+      set_byte_range(bits, ranges[i].lo, ranges[i].hi < 0x7F ? ranges[i].hi
+                                                             : 0x7F);
+    }
+  }
+  bits['\n' >> 3] = (unsigned char)(bits['\n' >> 3] & ~(1 << ('\n' & 7)));
+
+  int any = 0;
+  for (int i = 0; i < 32; i++) {
+    any |= bits[i];
+  }
+  if (any) {
+    start = emit(re, INST_BYTES, next, -1, bits);
+    if (start < 0) {
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (ranges[i].hi >= 0x80) {
+      unsigned int lo = ranges[i].lo < 0x80 ? 0x80 : ranges[i].lo;
+      if (!compile_utf8_range(re, lo, ranges[i].hi, next, &start)) {
+        return -1;
+      }
+    }
+  }
+
+  // An empty set still needs an instruction; it never matches
+  return start >= 0 ? start : emit(re, INST_BYTES, next, -1, NULL);
+}
+
+static int compile_node(Regex *re, const Node *node, int fold, int next) {
+  switch (node->type) {
+  case NODE_EMPTY:
+    return next;
+  case NODE_BOL:
+    return emit(re, INST_BOL, next, -1, NULL);
+  case NODE_EOL:
+    return emit(re, INST_EOL, next, -1, NULL);
+  case NODE_CHAR: {
+    unsigned char raw[32] = {0};
+    CodeRange ranges[3];
+    int count = 0;
+
+    if (node->raw_byte) {
+      set_byte_range(raw, node->code_point, node->code_point);
+    } else {
+      unsigned int variants[2];
+      int variant_count = fold ? fold_variants(node->code_point, variants) : 0;
+      ranges[count].lo = ranges[count].hi = node->code_point;
+      count++;
+      for (int i = 0; i < variant_count; i++) {
+        ranges[count].lo = ranges[count].hi = variants[i];
+        count++;
+      }
+    }
+    return compile_ranges(re, ranges, count, raw, next);
+  }
+  case NODE_CLASS:
+    return compile_ranges(re, node->char_class->ranges,
+                          node->char_class->count, node->char_class->raw,
+                          next);
+  case NODE_CONCAT:
+    for (int i = node->child_count - 1; i >= 0 && next >= 0; i--) {
+      next = compile_node(re, node->children[i], fold, next);
+    }
+    return next;
+  case NODE_ALT: {
+    int start = compile_node(re, node->children[node->child_count - 1], fold,
+                             next);
+    for (int i = node->child_count - 2; i >= 0 && start >= 0; i--) {
+      int branch = compile_node(re, node->children[i], fold, next);
+      start = branch < 0 ? -1 : emit(re, INST_SPLIT, branch, start, NULL);
+    }
+    return start;
+  }
+  case NODE_REPEAT: {
+    int pc = next;
+
+    if (node->max < 0) {
+      // Loop: split into the body (which returns to the split) or on
+      int loop = emit(re, INST_SPLIT, -1, next, NULL);
+      if (loop < 0) {
+        return -1;
+      }
+      int body = compile_node(re, node->child, fold, loop);
+      if (body < 0) {
+        return -1;
+      }
+      re->insts[loop].out = body;
+      pc = loop;
+    } else {
+      // Optional copies, each skipping straight to next
+      for (int i = node->min; i < node->max && pc >= 0; i++) {
+        int body = compile_node(re, node->child, fold, pc);
+        pc = body < 0 ? -1 : emit(re, INST_SPLIT, body, next, NULL);
+      }
+    }
+
+    for (int i = 0; i < node->min && pc >= 0; i++) {
+      pc = compile_node(re, node->child, fold, pc);
+    }
+    return pc;
+  }
+  }
+  return -1;
+}
+
+/**
+ * Group bytes that every instruction treats alike
+ */
+static void compute_byte_classes(Regex *re) {
+  unsigned char boundary[256] = {0};
+
+  for (int i = 0; i < re->inst_count; i++) {
+    const Inst *inst = &re->insts[i];
+    if (inst->op != INST_BYTES) {
+      continue;
+    }
+    for (int b = 1; b < 256; b++) {
+      int in = (inst->bits[b >> 3] >> (b & 7)) & 1;
+      int prev = (inst->bits[(b - 1) >> 3] >> ((b - 1) & 7)) & 1;
+      if (in != prev) {
+        boundary[b] = 1;
+      }
+    }
+  }
+
+  // Line endings are handled by the scanner and need their own classes
+  boundary['\n'] = boundary['\n' + 1] = 1;
+  boundary['\r'] = boundary['\r' + 1] = 1;
+
+  int id = 0;
+  for (int b = 0; b < 256; b++) {
+    if (b > 0 && boundary[b]) {
+      id++;
+      re->class_byte[id] = (unsigned char)b;
+    }
+    re->byte_class[b] = (unsigned char)id;
+  }
+  re->class_byte[0] = 0;
+  re->class_count = id + 1;
+}
+
+/**
+ * Compile a pattern
+ */
+Regex *regex_compile(const char *pattern, int flags, char *error,
+                     size_t error_size) {
+  Parser parser;
+  memset(&parser, 0, sizeof(parser));
+  parser.p = (const unsigned char *)pattern;
+  parser.end = parser.p + strlen(pattern);
+  parser.flags = flags;
+  arena_init(&parser.arena, 0);
+
+  Node *root = parse_alternation(&parser);
+  if (root && parser.p < parser.end) {
+    parser.error = "unmatched )";
+    root = NULL;
+  }
+  if (!root) {
+    snprintf(error, error_size, "%s",
+             parser.error ? parser.error : "out of memory");
+    arena_free(&parser.arena);
+    return NULL;
+  }
+
+  Regex *re = (Regex *)calloc(1, sizeof(Regex));
+  int fold = (flags & REGEX_IGNORE_CASE) != 0;
+  int start = -1;
+  if (re) {
+    int match = emit(re, INST_MATCH, -1, -1, NULL);
+    start = match < 0 ? -1 : compile_node(re, root, fold, match);
+  }
+
+  if (start < 0) {
+    snprintf(error, error_size, "pattern too large");
+    regex_free(re);
+    arena_free(&parser.arena);
+    return NULL;
+  }
+
+  re->start = start;
+  compute_byte_classes(re);
+
+  LiteralInfo info;
+  literal_info(root, fold, &info);
+  keep_longer(info.best, info.prefix);
+  keep_longer(info.best, info.suffix);
+  if (strlen(info.best) >= REGEX_MIN_LITERAL) {
+    strcpy(re->literal, info.best);
+  }
+
+  arena_free(&parser.arena);
+  return re;
+}
+
+/**
+ * Free a compiled pattern
+ */
+void regex_free(Regex *re) {
+  if (re) {
+    free(re->insts);
+    free(re);
+  }
+}
+
+/**
+ * Get a string every match must contain
+ */
+const char *regex_required_literal(const Regex *re) {
+  return re->literal[0] ? re->literal : NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Scratch and closures
+// ---------------------------------------------------------------------------
+
+static int sparse_contains(const SparseSet *set, int value) {
+  int index = set->sparse[value];
+  return index < set->count && set->dense[index] == value;
+}
+
+static void sparse_insert(SparseSet *set, int value) {
+  set->sparse[value] = set->count;
+  set->dense[set->count++] = value;
+}
+
+static void dfa_reset(RegexScratch *scratch) {
+  arena_reset(&scratch->arena);
+  scratch->cache_bytes = 0;
+  scratch->state_count = 0;
+  scratch->initial = -1;
+  for (int i = 0; i < scratch->table_size; i++) {
+    scratch->table[i] = -1;
+  }
+}
+
+/**
+ * Create matching state for one thread
+ */
+RegexScratch *regex_scratch_create(const Regex *re) {
+  RegexScratch *scratch = (RegexScratch *)calloc(1, sizeof(RegexScratch));
+  if (!scratch) {
+    return NULL;
+  }
+  scratch->re = re;
+
+  int n = re->inst_count;
+  int ok = 1;
+  for (int i = 0; i < 2; i++) {
+    scratch->visited[i].dense = (int *)malloc(n * sizeof(int));
+    scratch->visited[i].sparse = (int *)calloc(n, sizeof(int));
+    scratch->pcs[i] = (int *)malloc(n * sizeof(int));
+    scratch->starts[i] = (int *)malloc(n * sizeof(int));
+    ok = ok && scratch->visited[i].dense && scratch->visited[i].sparse &&
+         scratch->pcs[i] && scratch->starts[i];
+  }
+  scratch->stack = (int *)malloc(n * sizeof(int));
+  scratch->work = (int *)malloc(n * sizeof(int));
+  scratch->saved = (int *)malloc(n * sizeof(int));
+  scratch->table_size = 1024;
+  scratch->table = (int *)malloc(scratch->table_size * sizeof(int));
+
+  if (!ok || !scratch->stack || !scratch->work || !scratch->saved ||
+      !scratch->table) {
+    regex_scratch_free(scratch);
+    return NULL;
+  }
+
+  arena_init(&scratch->arena, 64 * 1024);
+  dfa_reset(scratch);
+  scratch->empty_line_match = -1;
+  return scratch;
+}
+
+/**
+ * Free matching state
+ */
+void regex_scratch_free(RegexScratch *scratch) {
+  if (!scratch) {
+    return;
+  }
+  for (int i = 0; i < 2; i++) {
+    free(scratch->visited[i].dense);
+    free(scratch->visited[i].sparse);
+    free(scratch->pcs[i]);
+    free(scratch->starts[i]);
+  }
+  free(scratch->stack);
+  free(scratch->work);
+  free(scratch->saved);
+  free(scratch->table);
+  free(scratch->states);
+  arena_free(&scratch->arena);
+  free(scratch);
+}
+
+/**
+ * Follow empty transitions from pc, appending the instructions reached that
+ * consume input or match (and, with EOL_KEEP, pending EOL assertions) to out.
+ * visited must be cleared by the caller before building a new list.
+ */
+static void add_closure(RegexScratch *scratch, SparseSet *visited, int pc,
+                        int at_bol, int eol_mode, int *out, int *count) {
+  const Inst *insts = scratch->re->insts;
+  int *stack = scratch->stack;
+  int top = 0;
+
+  if (sparse_contains(visited, pc)) {
+    return;
+  }
+  sparse_insert(visited, pc);
+  stack[top++] = pc;
+
+  while (top > 0) {
+    pc = stack[--top];
+    const Inst *inst = &insts[pc];
+    int follow[2];
+    int follow_count = 0;
+
+    switch (inst->op) {
+    case INST_EMPTY:
+      follow[follow_count++] = inst->out;
+      break;
+    case INST_SPLIT:
+      follow[follow_count++] = inst->out1;
+      follow[follow_count++] = inst->out;
+      break;
+    case INST_BOL:
+      if (at_bol) {
+        follow[follow_count++] = inst->out;
+      }
+      break;
+    case INST_EOL:
+      if (eol_mode == EOL_FOLLOW) {
+        follow[follow_count++] = inst->out;
+      } else if (eol_mode == EOL_KEEP) {
+        out[(*count)++] = pc;
+      }
+      break;
+    default:
+      out[(*count)++] = pc;
+      break;
+    }
+
+    for (int i = 0; i < follow_count; i++) {
+      if (!sparse_contains(visited, follow[i])) {
+        sparse_insert(visited, follow[i]);
+        stack[top++] = follow[i];
+      }
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+// NFA simulation
+// ---------------------------------------------------------------------------
+
+static void add_thread(RegexScratch *scratch, int list, int pc, int start,
+                       int at_bol, int at_eol) {
+  int before = scratch->counts[list];
+  add_closure(scratch, &scratch->visited[list], pc, at_bol,
+              at_eol ? EOL_FOLLOW : EOL_DROP, scratch->pcs[list],
+              &scratch->counts[list]);
+  for (int i = before; i < scratch->counts[list]; i++) {
+    scratch->starts[list][i] = start;
+  }
+}
+
+/**
+ * Run the NFA over one line, tracking where each thread started. Threads
+ * are kept in order of their start, and a state reached twice keeps the
+ * earlier start, so the result is the leftmost-longest match in
+ * O(length * instructions) time.
+ */
+static int nfa_run(const Regex *re, RegexScratch *scratch, const char *line,
+                   int length, int earliest, int *match_start,
+                   int *match_end) {
+  int current = 0;
+  int best_start = -1;
+  int best_end = -1;
+
+  scratch->counts[0] = 0;
+  scratch->visited[0].count = 0;
+
+  for (int i = 0;; i++) {
+    if (best_start < 0) {
+      add_thread(scratch, current, re->start, i, i == 0, i == length);
+    }
+
+    int *pcs = scratch->pcs[current];
+    int *starts = scratch->starts[current];
+    int count = scratch->counts[current];
+
+    for (int t = 0; t < count; t++) {
+      if (re->insts[pcs[t]].op == INST_MATCH) {
+        if (earliest) {
+          *match_start = starts[t];
+          *match_end = i;
+          return 1;
+        }
+        if (best_start < 0 || starts[t] < best_start ||
+            (starts[t] == best_start && i > best_end)) {
+          best_start = starts[t];
+          best_end = i;
+        }
+      }
+    }
+
+    if (i == length) {
+      break;
+    }
+
+    int next = 1 - current;
+    scratch->counts[next] = 0;
+    scratch->visited[next].count = 0;
+
+    unsigned char c = (unsigned char)line[i];
+    for (int t = 0; t < count; t++) {
+      const Inst *inst = &re->insts[pcs[t]];
+      if (inst->op == INST_BYTES && (inst->bits[c >> 3] >> (c & 7)) & 1 &&
+          (best_start < 0 || starts[t] <= best_start)) {
+        add_thread(scratch, next, inst->out, starts[t], 0, i + 1 == length);
+      }
+    }
+
+    current = next;
+    if (scratch->counts[current] == 0 && best_start >= 0) {
+      break;
+    }
+  }
+
+  if (best_start < 0) {
+    return 0;
+  }
+  *match_start = best_start;
+  *match_end = best_end;
+  return 1;
+}
+
+/**
+ * regex_scan without the DFA: run the NFA over each line in turn
+ */
+static int nfa_scan(const Regex *re, RegexScratch *scratch, const char *text,
+                    int length) {
+  int pos = 0;
+
+  while (pos < length) {
+    const char *newline = (const char *)memchr(text + pos, '\n', length - pos);
+    int line_end = newline ? (int)(newline - text) : length;
+    int line_length = line_end - pos;
+    if (line_length > 0 && text[line_end - 1] == '\r') {
+      line_length--;
+    }
+
+    int start;
+    int end;
+    if (nfa_run(re, scratch, text + pos, line_length, 1, &start, &end)) {
+      return pos + end;
+    }
+    if (!newline) {
+      break;
+    }
+    pos = line_end + 1;
+  }
+
+  return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Lazy DFA
+// ---------------------------------------------------------------------------
+
+static int compare_ints(const void *a, const void *b) {
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+  return x < y ? -1 : x > y;
+}
+
+static unsigned int hash_insts(const int *insts, int count) {
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < count; i++) {
+    hash = (hash ^ (unsigned int)insts[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static int grow_state_table(RegexScratch *scratch) {
+  int size = scratch->table_size * 2;
+  int *table = (int *)malloc(size * sizeof(int));
+  if (!table) {
+    return 0;
+  }
+  for (int i = 0; i < size; i++) {
+    table[i] = -1;
+  }
+  for (int i = 0; i < scratch->state_count; i++) {
+    unsigned int slot = scratch->states[i].hash & (size - 1);
+    while (table[slot] >= 0) {
+      slot = (slot + 1) & (size - 1);
+    }
+    table[slot] = i;
+  }
+  free(scratch->table);
+  scratch->table = table;
+  scratch->table_size = size;
+  return 1;
+}
+
+/**
+ * Find or add the state for a set of instructions (sorted here)
+ * @return The state index, or -1 if the cache is full
+ */
+static int dfa_state_for(RegexScratch *scratch, int *insts, int count) {
+  const Regex *re = scratch->re;
+
+  qsort(insts, count, sizeof(int), compare_ints);
+  unsigned int hash = hash_insts(insts, count);
+
+  unsigned int slot = hash & (scratch->table_size - 1);
+  while (scratch->table[slot] >= 0) {
+    DfaState *state = &scratch->states[scratch->table[slot]];
+    if (state->hash == hash && state->count == count &&
+        memcmp(state->insts, insts, count * sizeof(int)) == 0) {
+      return scratch->table[slot];
+    }
+    slot = (slot + 1) & (scratch->table_size - 1);
+  }
+
+  size_t bytes = count * sizeof(int) + re->class_count * sizeof(int) +
+                 sizeof(DfaState);
+  if (scratch->cache_bytes + bytes > DFA_CACHE_BYTES) {
+    return -1;
+  }
+
+  if (scratch->state_count == scratch->state_capacity) {
+    int capacity = scratch->state_capacity ? scratch->state_capacity * 2 : 64;
+    DfaState *states =
+        (DfaState *)realloc(scratch->states, capacity * sizeof(DfaState));
+    if (!states) {
+      return -1;
+    }
+    scratch->states = states;
+    scratch->state_capacity = capacity;
+  }
+  if ((scratch->state_count + 1) * 2 > scratch->table_size) {
+    if (!grow_state_table(scratch)) {
+      return -1;
+    }
+    slot = hash & (scratch->table_size - 1);
+    while (scratch->table[slot] >= 0) {
+      slot = (slot + 1) & (scratch->table_size - 1);
+    }
+  }
+
+  DfaState *state = &scratch->states[scratch->state_count];
+  state->insts = (int *)arena_alloc(&scratch->arena, count * sizeof(int) + 1);
+  state->next =
+      (int *)arena_alloc(&scratch->arena, re->class_count * sizeof(int));
+  if (!state->insts || !state->next) {
+    return -1;
+  }
+  memcpy(state->insts, insts, count * sizeof(int));
+  state->count = count;
+  state->hash = hash;
+  state->eol_match = -1;
+  state->is_match = 0;
+  for (int i = 0; i < count; i++) {
+    if (re->insts[insts[i]].op == INST_MATCH) {
+      state->is_match = 1;
+    }
+  }
+  for (int i = 0; i < re->class_count; i++) {
+    state->next[i] = -1;
+  }
+
+  scratch->cache_bytes += bytes;
+  scratch->table[slot] = scratch->state_count;
+  return scratch->state_count++;
+}
+
+static int dfa_initial(RegexScratch *scratch) {
+  if (scratch->initial < 0) {
+    int count = 0;
+    scratch->visited[0].count = 0;
+    add_closure(scratch, &scratch->visited[0], scratch->re->start, 1, EOL_KEEP,
+                scratch->work, &count);
+    scratch->initial = dfa_state_for(scratch, scratch->work, count);
+  }
+  return scratch->initial;
+}
+
+/**
+ * Compute a transition. Every state also restarts the pattern, which makes
+ * the search unanchored.
+ * @return The next state, or -1 if the cache is full
+ */
+static int dfa_step(RegexScratch *scratch, int from, int byte_class) {
+  const Regex *re = scratch->re;
+  unsigned char c = re->class_byte[byte_class];
+  int count = 0;
+
+  scratch->visited[0].count = 0;
+  DfaState *state = &scratch->states[from];
+  for (int i = 0; i < state->count; i++) {
+    const Inst *inst = &re->insts[state->insts[i]];
+    if (inst->op == INST_BYTES && (inst->bits[c >> 3] >> (c & 7)) & 1) {
+      add_closure(scratch, &scratch->visited[0], inst->out, 0, EOL_KEEP,
+                  scratch->work, &count);
+    }
+  }
+  add_closure(scratch, &scratch->visited[0], re->start, 0, EOL_KEEP,
+              scratch->work, &count);
+
+  int to = dfa_state_for(scratch, scratch->work, count);
+  if (to >= 0) {
+    scratch->states[from].next[byte_class] = to;
+  }
+  return to;
+}
+
+/**
+ * Check whether a state matches when the line ends here
+ */
+static int dfa_eol_match(RegexScratch *scratch, int index) {
+  DfaState *state = &scratch->states[index];
+
+  if (state->eol_match < 0) {
+    const Regex *re = scratch->re;
+    int count = 0;
+    int match = state->is_match;
+
+    scratch->visited[0].count = 0;
+    for (int i = 0; i < state->count && !match; i++) {
+      if (re->insts[state->insts[i]].op == INST_EOL) {
+        add_closure(scratch, &scratch->visited[0],
+                    re->insts[state->insts[i]].out, 0, EOL_FOLLOW,
+                    scratch->work, &count);
+      }
+    }
+    for (int i = 0; i < count && !match; i++) {
+      match = re->insts[scratch->work[i]].op == INST_MATCH;
+    }
+    state->eol_match = (char)match;
+  }
+
+  return state->eol_match;
+}
+
+/**
+ * Check whether an empty line matches. DFA states do not record whether
+ * the line has started, so this case is worked out separately.
+ */
+static int empty_line_match(RegexScratch *scratch) {
+  if (scratch->empty_line_match < 0) {
+    const Regex *re = scratch->re;
+    int count = 0;
+    int match = 0;
+
+    scratch->visited[0].count = 0;
+    add_closure(scratch, &scratch->visited[0], re->start, 1, EOL_FOLLOW,
+                scratch->work, &count);
+    for (int i = 0; i < count && !match; i++) {
+      match = re->insts[scratch->work[i]].op == INST_MATCH;
+    }
+    scratch->empty_line_match = match;
+  }
+
+  return scratch->empty_line_match;
+}
+
+/**
+ * Throw the cache away, keeping the state the scan is in
+ * @return The state's new index, or -1 to give up on the DFA
+ */
+static int dfa_restart(RegexScratch *scratch, int current) {
+  if (++scratch->resets > DFA_MAX_RESETS) {
+    scratch->use_nfa = 1;
+    return -1;
+  }
+
+  int count = scratch->states[current].count;
+  memcpy(scratch->saved, scratch->states[current].insts, count * sizeof(int));
+  dfa_reset(scratch);
+  if (dfa_initial(scratch) < 0) {
+    scratch->use_nfa = 1;
+    return -1;
+  }
+  return dfa_state_for(scratch, scratch->saved, count);
+}
+
+/**
+ * Find the first line containing a match
+ */
+int regex_scan(const Regex *re, RegexScratch *scratch, const char *text,
+               int length) {
+  if (scratch->use_nfa) {
+    return nfa_scan(re, scratch, text, length);
+  }
+
+  int initial = dfa_initial(scratch);
+  if (initial < 0) {
+    scratch->use_nfa = 1;
+    return nfa_scan(re, scratch, text, length);
+  }
+
+  int state = initial;
+  int line_start = 0;
+
+  for (int i = 0; i < length; i++) {
+    if (scratch->states[state].is_match) {
+      return i;
+    }
+
+    unsigned char c = (unsigned char)text[i];
+    if (c == '\n' || (c == '\r' && (i + 1 == length || text[i + 1] == '\n'))) {
+      // The line ends here; a CR before the newline is not part of it
+      if (i == line_start ? empty_line_match(scratch)
+                          : dfa_eol_match(scratch, state)) {
+        return i;
+      }
+      if (c == '\n') {
+        state = scratch->initial;
+        line_start = i + 1;
+      }
+      continue;
+    }
+
+    int byte_class = re->byte_class[c];
+    int next = scratch->states[state].next[byte_class];
+    if (next < 0) {
+      next = dfa_step(scratch, state, byte_class);
+      if (next < 0) {
+        state = dfa_restart(scratch, state);
+        next = state < 0 ? -1 : dfa_step(scratch, state, byte_class);
+      }
+      if (next < 0) {
+        // The DFA keeps outgrowing its cache; finish with the NFA
+        scratch->use_nfa = 1;
+        int found =
+            nfa_scan(re, scratch, text + line_start, length - line_start);
+        return found < 0 ? -1 : line_start + found;
+      }
+    }
+    state = next;
+  }
+
+  // Text after the last newline is a line only if it is not empty
+  if (line_start < length && (scratch->states[state].is_match ||
+                              dfa_eol_match(scratch, state))) {
+    return length;
+  }
+  return -1;
+}
+
+/**
+ * Find the leftmost-longest match in one line
+ */
+int regex_match_line(const Regex *re, RegexScratch *scratch, const char *line,
+                     int length, int *match_start, int *match_length) {
+  int start;
+  int end;
+
+  if (!nfa_run(re, scratch, line, length, 0, &start, &end)) {
+    return 0;
+  }
+  *match_start = start;
+  *match_length = end - start;
+  return 1;
+}
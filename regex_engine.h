@@ -0,0 +1,100 @@
+/**
+ * regex_engine.h
+ * Line-oriented regular expressions with a lazily built DFA
+ */
+
+#ifndef REGEX_ENGINE_H
+#define REGEX_ENGINE_H
+
+#include "common.h"
+
+// Compile flags
+#define REGEX_IGNORE_CASE 1
+
+typedef struct Regex Regex;
+
+// Per-thread matching state (the DFA cache and NFA thread lists). A compiled
+// Regex is read-only and can be shared; each thread needs its own scratch.
+typedef struct RegexScratch RegexScratch;
+
+/**
+ * Compile a pattern
+ *
+ * Supported syntax: literals (UTF-8), '.', classes ([a-z], [^...], \d \w \s
+ * and their negations, [:alpha:] style names), grouping with (...) and
+ * (?:...), alternation, '*', '+', '?', {m}, {m,}, {m,n}, and the line anchors
+ * '^' and '$'. Matches never span a newline. With REGEX_IGNORE_CASE, letters
+ * outside ASCII are folded too.
+ *
+ * Matching is linear in the input: a DFA is built lazily from the NFA, and
+ * when its cache keeps overflowing the NFA is simulated directly instead.
+ *
+ * @param pattern The pattern
+ * @param flags REGEX_IGNORE_CASE or 0
+ * @param error Receives a message on failure
+ * @param error_size Size of error
+ * @return Compiled pattern, or NULL on a syntax error
+ */
+Regex *regex_compile(const char *pattern, int flags, char *error,
+                     size_t error_size);
+
+/**
+ * Free a compiled pattern
+ *
+ * @param re The pattern
+ */
+void regex_free(Regex *re);
+
+/**
+ * Get a string every match must contain, for prefiltering with a substring
+ * search. With REGEX_IGNORE_CASE it is lowercase ASCII and must be searched
+ * case-insensitively.
+ *
+ * @param re The pattern
+ * @return The literal, or NULL if there is no useful one
+ */
+const char *regex_required_literal(const Regex *re);
+
+/**
+ * Create matching state for one thread
+ *
+ * @param re The pattern
+ * @return Scratch space, or NULL on allocation failure
+ */
+RegexScratch *regex_scratch_create(const Regex *re);
+
+/**
+ * Free matching state
+ *
+ * @param scratch Scratch from regex_scratch_create
+ */
+void regex_scratch_free(RegexScratch *scratch);
+
+/**
+ * Find the first line containing a match
+ *
+ * @param re The pattern
+ * @param scratch This thread's scratch for re
+ * @param text Text starting at the beginning of a line; may hold many lines
+ * @param length Length of text
+ * @return An offset inside (or at the end of) the first matching line, or
+ *         -1 if no line matches
+ */
+int regex_scan(const Regex *re, RegexScratch *scratch, const char *text,
+               int length);
+
+/**
+ * Find the leftmost-longest match in one line
+ *
+ * @param re The pattern
+ * @param scratch This thread's scratch for re
+ * @param line The line, without its line ending
+ * @param length Length of line
+ * @param match_start Receives the start of the match
+ * @param match_length Receives the length of the match
+ * @return 1 if the line matches, 0 otherwise
+ */
+int regex_match_line(const Regex *re, RegexScratch *scratch, const char *line,
+                     int length, int *match_start, int *match_length);
+
+#endif // REGEX_ENGINE_H
@@ -1,54 +1,26 @@
 /**
  * ripgrep.c
- * Interactive wrapper for the ripgrep (rg) command-line search tool
+ * Interactive content search: grep's engine streams matching lines into the
+ * fuzzy picker, which previews the file around the selected match
  */
 
 #include "ripgrep.h"
 #include "common.h"
-#include "line_reader.h"
-#include "shell.h" // Add this for lsh_execute
+#include "fuzzy_picker.h"
+#include "grep.h"
+#include "preview_cache.h"
+#include "regex_engine.h"
 #include <ctype.h>
+#include <process.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-/**
- * Check if ripgrep (rg) is installed on the system
- *
- * @return 1 if installed, 0 if not
- */
-int is_rg_installed(void) {
-  // Try to run rg --version to check if it's installed
-  FILE *fp = _popen("rg --version 2>nul", "r");
-  if (fp == NULL) {
-    return 0;
-  }
-
-  // Read output (if any)
-  char buffer[128];
-  int has_output = (fgets(buffer, sizeof(buffer), fp) != NULL);
-
-  // Close the process
-  _pclose(fp);
-
-  return has_output;
-}
-
-/**
- * Display instructions for installing ripgrep
- */
-void show_rg_install_instructions(void) {
-  printf("\nripgrep (rg) is not installed on this system. To use this feature, "
-         "install ripgrep:\n\n");
-  printf("Installation options:\n");
-  printf("1. Using Chocolatey (Windows):\n");
-  printf("   choco install ripgrep\n\n");
-  printf("2. Using Scoop (Windows):\n");
-  printf("   scoop install ripgrep\n\n");
-  printf("3. Download prebuilt binary from: "
-         "https://github.com/BurntSushi/ripgrep/releases\n\n");
-  printf("After installation, restart your shell.\n");
-}
+// A search feeding a picker from its own thread
+typedef struct {
+  char **args; // grep command line
+  FuzzyPicker *picker;
+} PickerSearch;
 
 /**
  * Check if a specific editor is available
@@ -118,389 +90,202 @@ int rg_open_in_editor(const char *file_path, int line_number) {
 }
 
 /**
- * Parse a ripgrep result line to extract file path and line number
+ * Parse a "path:line:column:text" candidate to extract the file path and
+ * line number. A drive letter's colon is part of the path.
  *
- * @param result_line The result line from ripgrep (format:
- * file:line:column:text)
+ * @param result The candidate (need not be NUL-terminated)
+ * @param length Length of the candidate
  * @param file_path Buffer to store extracted file path
  * @param file_path_size Size of file_path buffer
  * @param line_number Pointer to store extracted line number
  * @return 1 if parsing successful, 0 if failed
  */
-static int parse_rg_result(const char *result_line, char *file_path,
+static int parse_rg_result(const char *result, int length, char *file_path,
                            size_t file_path_size, int *line_number) {
-  // Ripgrep output format is: file:line:column:text
-  const char *first_colon = strchr(result_line, ':');
+  const char *end = result + length;
+  int skip = length >= 2 && isalpha((unsigned char)result[0]) &&
+                     result[1] == ':'
+                 ? 2
+                 : 0;
+  const char *first_colon =
+      (const char *)memchr(result + skip, ':', length - skip);
   if (!first_colon)
     return 0;
 
-  const char *second_colon = strchr(first_colon + 1, ':');
-  if (!second_colon)
+  // Extract line number, which must end at the next colon
+  const char *digit = first_colon + 1;
+  int number = 0;
+  while (digit < end && isdigit((unsigned char)*digit) && number < 100000000) {
+    number = number * 10 + (*digit - '0');
+    digit++;
+  }
+  if (digit == first_colon + 1 || digit >= end || *digit != ':')
     return 0;
 
   // Extract file path
-  size_t path_length = first_colon - result_line;
+  size_t path_length = first_colon - result;
   if (path_length >= file_path_size)
-    path_length = file_path_size - 1;
-  strncpy(file_path, result_line, path_length);
+    return 0;
+  memcpy(file_path, result, path_length);
   file_path[path_length] = '\0';
 
-  // Extract line number
-  char line_str[16] = {0};
-  size_t line_str_length = second_colon - (first_colon + 1);
-  if (line_str_length >= sizeof(line_str))
-    line_str_length = sizeof(line_str) - 1;
-  strncpy(line_str, first_colon + 1, line_str_length);
-  line_str[line_str_length] = '\0';
-
-  *line_number = atoi(line_str);
+  *line_number = number;
   return 1;
 }
 
 /**
- * Run ripgrep with interactive filtering
- *
- * @param args Command arguments or NULL for interactive mode
- * @return Selected filename/line or NULL if canceled
+ * Preview the file around the selected match, from the cache of mapped files
  */
-char *run_interactive_ripgrep(char **args) {
-  // Check if ripgrep is installed
-  if (!is_rg_installed()) {
-    show_rg_install_instructions();
-    return NULL;
-  }
+static int preview_match(void *context, const char *candidate, int length,
+                         PickerPreviewLine *lines, int max_lines) {
+  char file_path[MAX_PATH];
+  int line_number;
 
-  // Create temporary files for the search results
-  char temp_rg_results[MAX_PATH];
-  char temp_fzf_output[MAX_PATH];
-  GetTempPath(MAX_PATH, temp_rg_results);
-  GetTempPath(MAX_PATH, temp_fzf_output);
-  strcat(temp_rg_results, "rg_results.txt");
-  strcat(temp_fzf_output, "rg_selected.txt");
+  if (!parse_rg_result(candidate, length, file_path, sizeof(file_path),
+                       &line_number)) {
+    return 0;
+  }
+  return preview_cache_lines((PreviewCache *)context, file_path, line_number,
+                             lines, max_lines);
+}
 
-  // Build the initial command
-  char command[4096] = {0};
+/**
+ * Search thread: stream grep's matches into the picker, then end its input
+ */
+static unsigned __stdcall run_picker_search(void *arg) {
+  PickerSearch *search = (PickerSearch *)arg;
+  lsh_grep_to_picker(search->args, search->picker);
+  fuzzy_picker_end_input(search->picker);
+  return 0;
+}
 
-  // Base ripgrep command with sensible defaults
-  strcpy(command,
-         "rg --line-number --column --no-heading --color=always --smart-case");
+/**
+ * Run an interactive search: matching lines stream into the picker while
+ * the search runs, and typing narrows them further
+ *
+ * @param args Command arguments: options, then the pattern and paths
+ * @return Selected "path:line:column:text" or NULL if canceled
+ */
+char *run_interactive_ripgrep(char **args) {
+  int arg_index = 1;
+  int ignore_case = -1; // Smart case unless -i or -s is given
+  int use_regex = 0;
+
+  // Process options
+  while (args[arg_index] != NULL && args[arg_index][0] == '-' &&
+         args[arg_index][1] != '\0') {
+    if (strcmp(args[arg_index], "-i") == 0 ||
+        strcmp(args[arg_index], "--ignore-case") == 0) {
+      ignore_case = 1;
+    } else if (strcmp(args[arg_index], "-s") == 0 ||
+               strcmp(args[arg_index], "--case-sensitive") == 0) {
+      ignore_case = 0;
+    } else if (strcmp(args[arg_index], "-e") == 0 ||
+               strcmp(args[arg_index], "--regexp") == 0) {
+      use_regex = 1;
+    } else if (strcmp(args[arg_index], "-F") == 0 ||
+               strcmp(args[arg_index], "-f") == 0 ||
+               strcmp(args[arg_index], "--fixed-strings") == 0) {
+      use_regex = 0;
+    } else if (strcmp(args[arg_index], "--") == 0) {
+      arg_index++;
+      break;
+    } else {
+      printf("ripgrep: unknown option: %s\n", args[arg_index]);
+      return NULL;
+    }
+    arg_index++;
+  }
 
-  // Add any user-provided arguments
-  if (args && args[1] != NULL) {
-    int i = 1;
-    while (args[i] != NULL) {
-      strcat(command, " ");
+  // With no pattern every line is a candidate
+  const char *pattern = args[arg_index] ? args[arg_index++] : "";
 
-      // If the argument contains spaces, quote it
-      if (strchr(args[i], ' ') != NULL) {
-        strcat(command, "\"");
-        strcat(command, args[i]);
-        strcat(command, "\"");
-      } else {
-        strcat(command, args[i]);
+  // Smart case: a pattern in lowercase matches any case
+  if (ignore_case < 0) {
+    ignore_case = 1;
+    for (const char *p = pattern; *p; p++) {
+      if (isupper((unsigned char)*p)) {
+        ignore_case = 0;
+        break;
       }
-      i++;
     }
-  } else {
-    // If no search pattern provided, use empty string to search all files
-    // Will be filtered by fzf as user types
-    strcat(command, " \"\"");
   }
 
-  // Pipe to fzf for interactive selection with preview
-  strcat(command, " | fzf --ansi");
-
-  // Add keybindings for navigation
-  strcat(command, " --bind=\"ctrl-j:down,ctrl-k:up,/:toggle-search\"");
-
-  // Add preview window showing file content with line highlighted
-  strcat(command, " --preview=\"bat --color=always --style=numbers "
-                  "--highlight-line={2} {1}\"");
-  strcat(command, " --preview-window=+{2}-10");
-
-  // Add output redirection
-  strcat(command, " > ");
-  strcat(command, temp_fzf_output);
-
-  // Run the command
-  printf("Starting interactive ripgrep search...\n");
-  int result = system(command);
-
-  // Check if user canceled (fzf returns non-zero)
-  if (result != 0) {
-    remove(temp_fzf_output);
-    return NULL;
+  // Anything grep would complain about is reported before the picker takes
+  // the console
+  if (use_regex) {
+    char error[128];
+    Regex *regex = regex_compile(pattern, ignore_case ? REGEX_IGNORE_CASE : 0,
+                                 error, sizeof(error));
+    if (!regex) {
+      printf("ripgrep: invalid regular expression: %s\n", error);
+      return NULL;
+    }
+    regex_free(regex);
   }
-
-  // Read the selected result from the temporary file
-  FILE *fp = fopen(temp_fzf_output, "r");
-  if (!fp) {
-    remove(temp_fzf_output);
-    return NULL;
+  int path_count = 0;
+  for (int i = arg_index; args[i] != NULL; i++) {
+    if (GetFileAttributes(args[i]) == INVALID_FILE_ATTRIBUTES) {
+      printf("ripgrep: %s: No such file or directory\n", args[i]);
+      return NULL;
+    }
+    path_count++;
   }
 
-  // Read the selected line
-  char *selected = (char *)malloc(MAX_PATH * 2);
-  if (!selected) {
-    fclose(fp);
-    remove(temp_fzf_output);
+  // grep -r [-i] [-E] -e PATTERN [path...]: after -e every argument is a
+  // path, so patterns starting with '-' need no escaping
+  char **grep_args = (char **)calloc(path_count + 7, sizeof(char *));
+  if (!grep_args) {
+    printf("ripgrep: memory allocation error\n");
     return NULL;
   }
-
-  if (fgets(selected, MAX_PATH * 2, fp) == NULL) {
-    fclose(fp);
-    remove(temp_fzf_output);
-    free(selected);
-    return NULL;
+  int grep_count = 0;
+  grep_args[grep_count++] = "grep";
+  grep_args[grep_count++] = "-r";
+  if (ignore_case) {
+    grep_args[grep_count++] = "-i";
   }
-
-  // Remove newline if present
-  size_t len = strlen(selected);
-  if (len > 0 && selected[len - 1] == '\n') {
-    selected[len - 1] = '\0';
+  if (use_regex) {
+    grep_args[grep_count++] = "-E";
   }
-
-  // Close and delete the temporary file
-  fclose(fp);
-  remove(temp_fzf_output);
-
-  return selected;
-}
-
-/**
- * Run ripgrep with interactive editing capabilities for a custom Neovim-like
- * experience
- */
-void run_ripgrep_interactive_session(void) {
-  // Check if ripgrep and fzf are installed
-  if (!is_rg_installed()) {
-    show_rg_install_instructions();
-    return;
+  grep_args[grep_count++] = "-e";
+  grep_args[grep_count++] = (char *)pattern;
+  for (int i = arg_index; args[i] != NULL; i++) {
+    grep_args[grep_count++] = args[i];
   }
 
-  // Initialize the search query
-  char search_query[256] = "";
-  char last_query[256] = "";
-
-  // Create a temporary file for results
-  char temp_results[MAX_PATH];
-  GetTempPath(MAX_PATH, temp_results);
-  strcat(temp_results, "ripgrep_results.txt");
-
-  // Save original console mode to restore later
-  HANDLE hStdin = GetStdHandle(STD_INPUT_HANDLE);
-  DWORD originalMode;
-  GetConsoleMode(hStdin, &originalMode);
-
-  // Set console mode for raw input
-  DWORD newMode = ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT;
-  SetConsoleMode(hStdin, newMode);
-
-  // Clear screen and show initial UI
-  system("cls");
-  printf("--- Interactive Ripgrep Search ---\n");
-  printf(
-      "Type to search | Ctrl+N/P: navigate | Enter: open | Ctrl+C: exit\n\n");
-  printf("Search: ");
-
-  int running = 1;
-  int selected_index = 0;
-  int results_count = 0;
-  char **results = NULL;
-
-  // Main interaction loop
-  while (running) {
-    // Display the current search query
-    printf("\rSearch: %s", search_query);
-    fflush(stdout);
-
-    // Check if the query has changed and we need to run ripgrep again
-    if (strcmp(search_query, last_query) != 0) {
-      // Free previous results if any
-      if (results) {
-        for (int i = 0; i < results_count; i++) {
-          free(results[i]);
-        }
-        free(results);
-        results = NULL;
-        results_count = 0;
-      }
-
-      // Execute ripgrep with the current query if not empty
-      if (strlen(search_query) > 0) {
-        // Build ripgrep command
-        char command[4096];
-        snprintf(command, sizeof(command),
-                 "rg --line-number --column --no-heading --color=never "
-                 "--smart-case \"%s\" > %s",
-                 search_query, temp_results);
-
-        system(command);
-
-        // Read results from the temp file
-        FILE *fp = fopen(temp_results, "r");
-        if (fp) {
-          // Count lines first
-          char line[1024];
-          results_count = 0;
-
-          while (fgets(line, sizeof(line), fp) != NULL) {
-            results_count++;
-          }
-
-          // Allocate memory for results
-          rewind(fp);
-          results = (char **)malloc(results_count * sizeof(char *));
-
-          if (results) {
-            int i = 0;
-            while (i < results_count && fgets(line, sizeof(line), fp) != NULL) {
-              // Remove newline
-              size_t len = strlen(line);
-              if (len > 0 && line[len - 1] == '\n') {
-                line[len - 1] = '\0';
-              }
-
-              results[i] = _strdup(line);
-              i++;
-            }
-          }
-
-          fclose(fp);
-        }
-      }
-
-      // Update last query
-      strcpy(last_query, search_query);
-
-      // Reset selection to first result
-      selected_index = 0;
-
-      // Clear the results display area
-      printf("\n\033[J"); // Clear from cursor to end of screen
-
-      // Display results count
-      printf("\nFound %d matches\n\n", results_count);
-
-      // Display results with selection
-      int max_display = 10; // Show at most 10 results at a time
-      for (int i = 0; i < results_count && i < max_display; i++) {
-        if (i == selected_index) {
-          printf("\033[7m> %s\033[0m\n",
-                 results[i]); // Invert colors for selection
-        } else {
-          printf("  %s\n", results[i]);
-        }
-      }
-    }
-
-    // Process user input
-    int c = _getch();
-
-    if (c == 3) { // Ctrl+C
-      running = 0;
-    } else if (c == 13) { // Enter
-      // Open the selected file if there are results
-      if (results_count > 0 && selected_index < results_count) {
-        char file_path[MAX_PATH];
-        int line_number;
-
-        if (parse_rg_result(results[selected_index], file_path,
-                            sizeof(file_path), &line_number)) {
-          rg_open_in_editor(file_path, line_number);
-
-          // After returning from editor, refresh the UI
-          system("cls");
-          printf("--- Interactive Ripgrep Search ---\n");
-          printf("Type to search | Ctrl+N/P: navigate | Enter: open | Ctrl+C: "
-                 "exit\n\n");
-          printf("Search: %s\n\n", search_query);
-
-          // Re-display results count
-          printf("Found %d matches\n\n", results_count);
-
-          // Re-display results with selection
-          int max_display = 10;
-          for (int i = 0; i < results_count && i < max_display; i++) {
-            if (i == selected_index) {
-              printf("\033[7m> %s\033[0m\n", results[i]);
-            } else {
-              printf("  %s\n", results[i]);
-            }
-          }
-        }
-      }
-    } else if (c == 14) { // Ctrl+N
-      if (results_count > 0) {
-        selected_index = (selected_index + 1) % results_count;
-
-        // Redraw results with new selection
-        printf("\033[%dA",
-               results_count > 10
-                   ? 10
-                   : results_count); // Move cursor up to results start
-
-        int max_display = 10;
-        for (int i = 0; i < results_count && i < max_display; i++) {
-          if (i == selected_index) {
-            printf("\033[2K\033[7m> %s\033[0m\n",
-                   results[i]); // Clear line and invert colors
-          } else {
-            printf("\033[2K  %s\n", results[i]); // Clear line
-          }
-        }
-      }
-    } else if (c == 16) { // Ctrl+P
-      if (results_count > 0) {
-        selected_index = (selected_index - 1 + results_count) % results_count;
-
-        // Redraw results with new selection
-        printf("\033[%dA",
-               results_count > 10
-                   ? 10
-                   : results_count); // Move cursor up to results start
-
-        int max_display = 10;
-        for (int i = 0; i < results_count && i < max_display; i++) {
-          if (i == selected_index) {
-            printf("\033[2K\033[7m> %s\033[0m\n",
-                   results[i]); // Clear line and invert colors
-          } else {
-            printf("\033[2K  %s\n", results[i]); // Clear line
-          }
-        }
-      }
-    } else if (c == 8) { // Backspace
-      // Remove last character from search query
-      size_t len = strlen(search_query);
-      if (len > 0) {
-        search_query[len - 1] = '\0';
-      }
-    } else if (isprint(c)) { // Printable character
-      // Add character to search query
-      size_t len = strlen(search_query);
-      if (len < sizeof(search_query) - 1) {
-        search_query[len] = c;
-        search_query[len + 1] = '\0';
-      }
-    }
+  FuzzyPicker *picker = fuzzy_picker_create();
+  PreviewCache *previews = preview_cache_create();
+  if (!picker || !previews) {
+    printf("ripgrep: memory allocation error\n");
+    fuzzy_picker_free(picker);
+    preview_cache_free(previews);
+    free(grep_args);
+    return NULL;
   }
-
-  // Clean up
-  if (results) {
-    for (int i = 0; i < results_count; i++) {
-      free(results[i]);
-    }
-    free(results);
+  fuzzy_picker_set_preview(picker, preview_match, previews);
+
+  // The search streams matches in while the picker runs; closing the
+  // picker stops it
+  PickerSearch search = {grep_args, picker};
+  HANDLE thread =
+      (HANDLE)_beginthreadex(NULL, 0, run_picker_search, &search, 0, NULL);
+  if (!thread) {
+    run_picker_search(&search);
   }
 
-  remove(temp_results);
+  char prompt[64];
+  snprintf(prompt, sizeof(prompt), "%.40s> ", pattern);
+  char *selected = fuzzy_picker_run(picker, prompt, NULL);
 
-  // Restore original console mode
-  SetConsoleMode(hStdin, originalMode);
-
-  // Final screen clear
-  system("cls");
+  if (thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+  }
+  fuzzy_picker_free(picker);
+  preview_cache_free(previews);
+  free(grep_args);
+  return selected;
 }
 
 /**
@@ -510,242 +295,45 @@ void run_ripgrep_interactive_session(void) {
  * @return 1 to continue shell execution, 0 to exit shell
  */
 int lsh_ripgrep(char **args) {
-  // Check if ripgrep is installed
-  if (!is_rg_installed()) {
-    printf("Ripgrep (rg) is not installed. Falling back to custom "
-           "implementation.\n");
-    printf("For better performance, consider installing ripgrep:\n");
-    show_rg_install_instructions();
-    printf("\nRunning with custom implementation...\n\n");
-
-    // Fall back to our custom implementation
-    run_ripgrep_interactive_session();
-    return 1;
-  }
-
-  // Also check if fzf is installed for the interactive UI
-  int fzf_available = is_fzf_installed(); // Reuse from fzf_native.h
-
   // Check for help flag
   if (args[1] &&
       (strcmp(args[1], "--help") == 0 || strcmp(args[1], "-h") == 0)) {
-    printf("Usage: ripgrep [pattern] [options]\n");
-    printf("Interactive code search using ripgrep (rg) with fzf.\n\n");
-    printf("If called without arguments, launches fzf with ripgrep for "
-           "interactive searching.\n\n");
+    printf("Usage: ripgrep [options] [pattern] [path...]\n");
+    printf("Interactive code search.\n\n");
+    printf("Searches the current directory (or the given paths) recursively "
+           "for pattern,\nskipping ignored and binary files. Matching lines "
+           "appear as they are found;\ntype to narrow them with fuzzy "
+           "matching, and Enter opens the selected line\nin an editor. "
+           "Without a pattern every line is a candidate.\n\n");
     printf("Options:\n");
-    printf("  -t, --type [TYPE]    Only search files matching TYPE (e.g., -t "
-           "cpp)\n");
     printf("  -i, --ignore-case    Case insensitive search\n");
-    printf("  -w, --word-regexp    Only match whole words\n");
+    printf("  -s, --case-sensitive Case sensitive search (default: "
+           "insensitive unless the\n"
+           "                       pattern has an uppercase letter)\n");
     printf("  -e, --regexp         Treat pattern as a regular expression\n");
-    printf("  -f, --fixed-strings  Treat pattern as a literal string\n");
-    printf("  -g, --glob [GLOB]    Include/exclude files matching the glob\n");
-    return 1;
-  }
-
-  // If no arguments provided, use fzf with ripgrep
-  if (!args[1]) {
-    if (!fzf_available) {
-      printf("fzf is not installed. Falling back to custom implementation.\n");
-      show_fzf_install_instructions();
-      printf("\nRunning with custom implementation...\n\n");
-
-      // Fall back to custom implementation if fzf is not available
-      run_ripgrep_interactive_session();
-      return 1;
-    }
-
-    // Create a temporary file for the fzf preview script
-    char preview_script[MAX_PATH];
-    GetTempPath(MAX_PATH, preview_script);
-    strcat(preview_script, "fzf_preview.bat");
-
-    // Create the preview script as a batch file with highlighting support
-    FILE *preview_fp = fopen(preview_script, "w");
-    if (preview_fp) {
-      // Write a smarter batch script that highlights searched content
-      fprintf(preview_fp, "@echo off\n");
-      fprintf(preview_fp, "set file=%%~1\n");
-      fprintf(preview_fp, "set line=%%~2\n");
-      fprintf(preview_fp, "set query=%%~3\n");
-      fprintf(preview_fp, "if \"%%query%%\"==\"\" (\n");
-      // If no query, just show the file with line highlighting
-      fprintf(preview_fp, "  bat --color=always --highlight-line %%line%% "
-                          "\"%%file%%\" 2>nul || type \"%%file%%\"\n");
-      fprintf(preview_fp, ") else (\n");
-      // If query provided, highlight both the line and the search term
-      fprintf(preview_fp,
-              "  bat --color=always --highlight-line %%line%% \"%%file%%\" "
-              "2>nul | findstr /i \"%%query%%\" >nul\n");
-      fprintf(preview_fp, "  if %%errorlevel%% equ 0 (\n");
-      fprintf(preview_fp,
-              "    rg --color=always --context 3 --line-number \"%%query%%\" "
-              "\"%%file%%\" 2>nul || bat --color=always --highlight-line "
-              "%%line%% \"%%file%%\" 2>nul || type \"%%file%%\"\n");
-      fprintf(preview_fp, "  ) else (\n");
-      fprintf(preview_fp, "    bat --color=always --highlight-line %%line%% "
-                          "\"%%file%%\" 2>nul || type \"%%file%%\"\n");
-      fprintf(preview_fp, "  )\n");
-      fprintf(preview_fp, ")\n");
-      fclose(preview_fp);
-    }
-
-    // Use fzf with ripgrep to provide an interactive UI similar to Neovim
-    char command[4096] = {0};
-
-    // Use ripgrep with an empty pattern to search all text files
-    // and pipe to fzf for interactive filtering - now with fullscreen mode
-    snprintf(
-        command, sizeof(command),
-        "cls && rg --line-number --column --no-heading --color=always \"\" | "
-        "fzf --ansi --delimiter : "
-        "--preview \"%s {1} {2} {{q}}\" "
-        "--preview-window=right:60%%:wrap "
-        "--bind \"ctrl-j:down,ctrl-k:up,enter:accept\" "
-        "--border "
-        "--height=100%% > %s",
-        preview_script, "rg_selection.txt");
-
-    // Execute the command
-    int result = system(command);
-
-    // Check if user selected something (fzf returns non-zero on cancel)
-    if (result == 0) {
-      // Read the selected file/line from the temporary file
-      FILE *fp = fopen("rg_selection.txt", "r");
-      if (fp) {
-        char selected[1024];
-        if (fgets(selected, sizeof(selected), fp)) {
-          // Remove newline if present
-          size_t len = strlen(selected);
-          if (len > 0 && selected[len - 1] == '\n') {
-            selected[len - 1] = '\0';
-          }
-
-          // Parse the selection to extract file path and line number
-          char file_path[MAX_PATH];
-          int line_number;
-
-          if (parse_rg_result(selected, file_path, sizeof(file_path),
-                              &line_number)) {
-            printf("Opening %s at line %d\n", file_path, line_number);
-            rg_open_in_editor(file_path, line_number);
-          }
-        }
-        fclose(fp);
-        remove("rg_selection.txt"); // Clean up
-      }
-    }
-
-    // Remove the preview script
-    remove(preview_script);
-
-    return 1;
-  }
-
-  // If options are provided but no pattern, run regular ripgrep
-  if (args[1][0] == '-') {
-    // Build command to pass to system
-    char command[4096] = "rg";
-
-    // Add all arguments
-    for (int i = 1; args[i] != NULL; i++) {
-      strcat(command, " ");
-
-      // If argument contains spaces, quote it
-      if (strchr(args[i], ' ') != NULL) {
-        strcat(command, "\"");
-        strcat(command, args[i]);
-        strcat(command, "\"");
-      } else {
-        strcat(command, args[i]);
-      }
-    }
-
-    // Execute standard ripgrep command
-    system(command);
+    printf("  -F, --fixed-strings  Treat pattern as a literal string "
+           "(default)\n");
+    printf("\nControls:\n");
+    printf("  Up/Down, Ctrl+k/j    Move up/down\n");
+    printf("  PgUp/PgDn            Move a page up/down\n");
+    printf("  Ctrl+u               Clear the filter\n");
+    printf("  Enter                Open the selected line\n");
+    printf("  Ctrl+C/Esc           Cancel\n");
     return 1;
   }
 
-  // If a pattern is provided, run ripgrep with fzf for selection
-  if (fzf_available) {
-    // Create a temporary file for the fzf preview script
-    char preview_script[MAX_PATH];
-    GetTempPath(MAX_PATH, preview_script);
-    strcat(preview_script, "fzf_preview.bat");
-
-    // Create the preview script as a batch file with highlighting
-    FILE *preview_fp = fopen(preview_script, "w");
-    if (preview_fp) {
-      // Write a smarter batch script that highlights searched content
-      fprintf(preview_fp, "@echo off\n");
-      fprintf(preview_fp, "set file=%%~1\n");
-      fprintf(preview_fp, "set line=%%~2\n");
-      fprintf(preview_fp, "set search_term=%s\n",
-              args[1]); // Use the search term provided
-      // Show file with both line highlighting and search term highlighting
-      fprintf(preview_fp,
-              "rg --color=always --context 3 --line-number \"%s\" \"%%file%%\" "
-              "2>nul || ",
-              args[1]);
-      fprintf(preview_fp, "bat --color=always --highlight-line %%line%% "
-                          "\"%%file%%\" 2>nul || type \"%%file%%\"\n");
-      fclose(preview_fp);
-    }
-
-    // Build command with fzf for better interaction
-    char command[4096] = {0};
+  char *selected = run_interactive_ripgrep(args);
+  if (selected) {
+    // Parse the selection to extract file path and line number
+    char file_path[MAX_PATH];
+    int line_number;
 
-    // Now with better UI but using compatible options
-    snprintf(
-        command, sizeof(command),
-        "cls && rg --line-number --column --no-heading --color=always \"%s\" | "
-        "fzf --ansi --delimiter : "
-        "--preview \"%s {1} {2}\" "
-        "--preview-window=right:60%%:wrap "
-        "--bind \"ctrl-j:down,ctrl-k:up,enter:accept\" "
-        "--border "
-        "--height=100%% > %s",
-        args[1], preview_script, "rg_selection.txt");
-
-    // Execute the command
-    int result = system(command);
-
-    // Check if user selected something
-    if (result == 0) {
-      // Read the selected file/line from the temporary file
-      FILE *fp = fopen("rg_selection.txt", "r");
-      if (fp) {
-        char selected[1024];
-        if (fgets(selected, sizeof(selected), fp)) {
-          // Remove newline if present
-          size_t len = strlen(selected);
-          if (len > 0 && selected[len - 1] == '\n') {
-            selected[len - 1] = '\0';
-          }
-
-          // Parse the selection to extract file path and line number
-          char file_path[MAX_PATH];
-          int line_number;
-
-          if (parse_rg_result(selected, file_path, sizeof(file_path),
-                              &line_number)) {
-            printf("Opening %s at line %d\n", file_path, line_number);
-            rg_open_in_editor(file_path, line_number);
-          }
-        }
-        fclose(fp);
-        remove("rg_selection.txt"); // Clean up
-      }
+    if (parse_rg_result(selected, (int)strlen(selected), file_path,
+                        sizeof(file_path), &line_number)) {
+      printf("Opening %s at line %d\n", file_path, line_number);
+      rg_open_in_editor(file_path, line_number);
     }
-
-    // Remove the preview script
-    remove(preview_script);
-  } else {
-    // If fzf is not available, fall back to custom implementation
-    printf("fzf is not installed. Falling back to custom implementation.\n");
-    run_ripgrep_interactive_session();
+    free(selected);
   }
 
   return 1;
@@ -1,18 +1,31 @@
+/**
+ * ripgrep.h
+ * Header for interactive content search with the fuzzy picker
+ */
+
 #ifndef RIPGREP_H
 #define RIPGREP_H
 
 #include "builtins.h"
 #include "common.h"
-#include "fzf_native.h"
-
-int is_rg_installed(void);
-
-void show_fzf_install_instructions(void);
 
+/**
+ * Run an interactive search: matching lines stream into the picker while
+ * the search runs, and typing narrows them further
+ *
+ * @param args Command arguments: options, then the pattern and paths
+ * @return Selected "path:line:column:text" (free with free) or NULL if
+ *         canceled
+ */
 char *run_interactive_ripgrep(char **args);
 
-int lsh_grep(char **args);
-
+/**
+ * Open a file at a specific line in the best available editor
+ *
+ * @param file_path Path to the file to open
+ * @param line_number Line number to position cursor at
+ * @return 1 if successful, 0 if failed
+ */
 int rg_open_in_editor(const char *file_path, int line_number);
 
 #endif // RIPGREP_H
@@ -0,0 +1,130 @@
+/**
+ * sha1.c
+ * Implementation of SHA-1 (FIPS 180-4)
+ */
+
+#include "sha1.h"
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_transform(unsigned int state[5], const unsigned char *block) {
+  unsigned int w[80];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = ((unsigned int)block[i * 4] << 24) |
+           ((unsigned int)block[i * 4 + 1] << 16) |
+           ((unsigned int)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+  }
+  for (int i = 16; i < 80; i++) {
+    w[i] = ROTL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  unsigned int a = state[0];
+  unsigned int b = state[1];
+  unsigned int c = state[2];
+  unsigned int d = state[3];
+  unsigned int e = state[4];
+
+  for (int i = 0; i < 80; i++) {
+    unsigned int f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+
+    unsigned int temp = ROTL(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ROTL(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+/**
+ * Start a new digest
+ */
+void sha1_init(Sha1Context *ctx) {
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xEFCDAB89;
+  ctx->state[2] = 0x98BADCFE;
+  ctx->state[3] = 0x10325476;
+  ctx->state[4] = 0xC3D2E1F0;
+  ctx->length = 0;
+  ctx->block_used = 0;
+}
+
+/**
+ * Add data to a digest
+ */
+void sha1_update(Sha1Context *ctx, const void *data, size_t length) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  ctx->length += length;
+
+  // Top up a partially filled block first
+  if (ctx->block_used > 0) {
+    size_t take = 64 - ctx->block_used;
+    if (take > length) {
+      take = length;
+    }
+    memcpy(ctx->block + ctx->block_used, bytes, take);
+    ctx->block_used += take;
+    bytes += take;
+    length -= take;
+
+    if (ctx->block_used < 64) {
+      return;
+    }
+    sha1_transform(ctx->state, ctx->block);
+    ctx->block_used = 0;
+  }
+
+  // Whole blocks straight from the input
+  while (length >= 64) {
+    sha1_transform(ctx->state, bytes);
+    bytes += 64;
+    length -= 64;
+  }
+
+  memcpy(ctx->block, bytes, length);
+  ctx->block_used = length;
+}
+
+/**
+ * Finish a digest
+ */
+void sha1_final(Sha1Context *ctx, unsigned char digest[SHA1_DIGEST_SIZE]) {
+  unsigned long long bit_length = ctx->length * 8;
+  unsigned char padding[72];
+  size_t pad_length = (ctx->block_used < 56) ? 56 - ctx->block_used
+                                             : 120 - ctx->block_used;
+
+  memset(padding, 0, sizeof(padding));
+  padding[0] = 0x80;
+  for (int i = 0; i < 8; i++) {
+    padding[pad_length + i] = (unsigned char)(bit_length >> (56 - i * 8));
+  }
+  sha1_update(ctx, padding, pad_length + 8);
+
+  for (int i = 0; i < 5; i++) {
+    digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+    digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+    digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+    digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+  }
+}
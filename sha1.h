@@ -0,0 +1,44 @@
+/**
+ * sha1.h
+ * SHA-1 digests, used to compare working tree files with Git object ids
+ */
+
+#ifndef SHA1_H
+#define SHA1_H
+
+#include "common.h"
+
+#define SHA1_DIGEST_SIZE 20
+
+typedef struct {
+  unsigned int state[5];
+  unsigned long long length; // Bytes hashed so far
+  unsigned char block[64];
+  size_t block_used;
+} Sha1Context;
+
+/**
+ * Start a new digest
+ *
+ * @param ctx Context to initialize
+ */
+void sha1_init(Sha1Context *ctx);
+
+/**
+ * Add data to a digest
+ *
+ * @param ctx The context
+ * @param data Bytes to hash
+ * @param length Number of bytes
+ */
+void sha1_update(Sha1Context *ctx, const void *data, size_t length);
+
+/**
+ * Finish a digest
+ *
+ * @param ctx The context (must be re-initialized before reuse)
+ * @param digest Receives the 20 byte digest
+ */
+void sha1_final(Sha1Context *ctx, unsigned char digest[SHA1_DIGEST_SIZE]);
+
+#endif // SHA1_H
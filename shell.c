@@ -10,14 +10,24 @@
 #include "builtins.h"
 #include "countdown_timer.h"
 #include "favorite_cities.h"
+#include "file_index.h"
 #include "filters.h"
+#include "fs_watch.h"
+#include "git_files.h"
 #include "git_integration.h" // Added for Git repository detection
+#include "grep.h"
+#include "lexer.h"
 #include "line_reader.h"
+#include "parallel.h"
 #include "persistent_history.h"
+#include "prompt_cache.h"
+#include "startup.h"
 #include "structured_data.h"
+#include "subsystems.h"
 #include "tab_complete.h" // Added for tab completion support
 #include "themes.h"
 #include <stdio.h>
+#include <sys/stat.h>
 #include <time.h> // Added for time functions
 //
 
@@ -29,6 +39,16 @@ static WORD g_status_attributes = 0;
 static BOOL g_status_bar_enabled =
     FALSE; // Flag to track if status bar is enabled
 
+// Exit code of the most recently executed command
+int g_last_exit_code = 0;
+
+// Set while a command's standard streams are redirected, so external
+// programs are started with the redirected handles
+static int g_streams_redirected = 0;
+
+// Arena for the tokens and arguments of the line being executed
+static Arena g_line_arena = {0};
+
 /**
  * Temporarily hide the status bar before command execution
  */
@@ -396,29 +416,104 @@ void display_welcome_banner(void) {
   SetConsoleTextAttribute(hConsole, originalAttrs);
 }
 
+// Longest command line CreateProcess accepts, terminator included
+#define LSH_MAX_COMMAND_LINE 32768
+
+/**
+ * Build the command line for CreateProcess, re-quoting arguments the lexer
+ * unquoted. Returns a malloc'd string, or NULL (already reported) if it is
+ * too long to launch.
+ */
+static char *build_command_line(char **args) {
+  // Every character takes at most two, and every argument adds at most a
+  // space and a pair of quotes
+  size_t size = 1;
+  for (int i = 0; args[i] != NULL; i++) {
+    size += strlen(args[i]) * 2 + 3;
+  }
+
+  char *command = (char *)malloc(size);
+  if (!command) {
+    fprintf(stderr, "lsh: allocation error\n");
+    return NULL;
+  }
+
+  size_t used = 0;
+  for (int i = 0; args[i] != NULL; i++) {
+    int needs_quotes = args[i][0] == '\0' || strpbrk(args[i], " \t\"") != NULL;
+
+    if (i > 0) {
+      command[used++] = ' ';
+    }
+    if (needs_quotes) {
+      command[used++] = '"';
+    }
+    // Backslashes before a quote, or before the closing quote, are doubled
+    // so the program reads them back as the lexer produced them
+    for (const char *c = args[i]; *c; c++) {
+      size_t run = strspn(c, "\\");
+      if (run > 0) {
+        int doubled = c[run] == '"' || (c[run] == '\0' && needs_quotes);
+        size_t count = doubled ? run * 2 : run;
+        memset(command + used, '\\', count);
+        used += count;
+        c += run - 1;
+        continue;
+      }
+      if (*c == '"') {
+        command[used++] = '\\';
+      }
+      command[used++] = *c;
+    }
+    if (needs_quotes) {
+      command[used++] = '"';
+    }
+  }
+  command[used] = '\0';
+
+  if (used >= LSH_MAX_COMMAND_LINE) {
+    fprintf(stderr, "lsh: command line too long\n");
+    free(command);
+    return NULL;
+  }
+  return command;
+}
+
 /**
  * Launch an external program with auto-correction support
  */
 int lsh_launch(char **args) {
-  // Construct command line string for CreateProcess
-  char command[1024] = "";
-  for (int i = 0; args[i] != NULL; i++) {
-    strcat(command, args[i]);
-    strcat(command, " ");
+  char *command = build_command_line(args);
+  if (!command) {
+    g_last_exit_code = 1;
+    return 1;
   }
 
   // Hide the timer before launching external program
   hide_timer_display();
 
+  // Our own buffered output must reach the handle before the child's does
+  fflush(stdout);
+
   STARTUPINFO si;
   PROCESS_INFORMATION pi;
   ZeroMemory(&si, sizeof(si));
   si.cb = sizeof(si);
   ZeroMemory(&pi, sizeof(pi));
 
+  // Hand redirected streams to the child explicitly
+  if (g_streams_redirected) {
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+  }
+
   // Create a new process
-  if (!CreateProcess(NULL, command, NULL, NULL, FALSE, 0, NULL, NULL, &si,
-                     &pi)) {
+  BOOL created = CreateProcess(NULL, command, NULL, NULL, g_streams_redirected,
+                               0, NULL, NULL, &si, &pi);
+  free(command);
+  if (!created) {
 
     DWORD error = GetLastError();
 
@@ -433,6 +528,7 @@ int lsh_launch(char **args) {
     }
 
     fprintf(stderr, "lsh: failed to execute %s\n", args[0]);
+    g_last_exit_code = 1;
     // Restore timer even if process creation failed
     show_timer_display();
     return 1;
@@ -440,6 +536,11 @@ int lsh_launch(char **args) {
 
   // Wait for the process to finish
   WaitForSingleObject(pi.hProcess, INFINITE);
+
+  DWORD exit_code = 0;
+  GetExitCodeProcess(pi.hProcess, &exit_code);
+  g_last_exit_code = (int)exit_code;
+
   CloseHandle(pi.hProcess);
   CloseHandle(pi.hThread);
 
@@ -449,6 +550,20 @@ int lsh_launch(char **args) {
   return 1;
 }
 
+// Aliases being expanded, innermost last
+#define LSH_ALIAS_DEPTH 16
+static AliasEntry *g_expanding_aliases[LSH_ALIAS_DEPTH];
+static int g_alias_depth = 0;
+
+static int alias_is_expanding(const AliasEntry *alias) {
+  for (int i = 0; i < g_alias_depth; i++) {
+    if (g_expanding_aliases[i] == alias) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 /**
  * Execute a command (updated with auto-correction support)
  */
@@ -459,36 +574,32 @@ int lsh_execute(char **args) {
     return 1;
   }
 
-  // Check if the command is an alias
+  // Check if the command is an alias. Its command goes through the lexer
+  // like a typed line, with the arguments added as words; an alias is not
+  // expanded again inside its own expansion, so "alias ls=ls -la" works.
   AliasEntry *alias = find_alias(args[0]);
-  if (alias) {
-    // Create expanded command with the alias
-    char expanded_cmd[1024] = "";
-    strcpy(expanded_cmd, alias->command);
-
-    // Add any arguments
-    for (i = 1; args[i] != NULL; i++) {
-      strcat(expanded_cmd, " ");
-      strcat(expanded_cmd, args[i]);
+  if (alias && !alias_is_expanding(alias) &&
+      g_alias_depth < LSH_ALIAS_DEPTH) {
+    Arena arena = {0};
+    CommandList list;
+    int status = 1;
+
+    g_expanding_aliases[g_alias_depth++] = alias;
+    if (lsh_parse_alias(alias->command, args + 1, &arena, &list)) {
+      status = lsh_execute_list(&list);
+    } else {
+      g_last_exit_code = 2;
     }
+    g_alias_depth--;
 
-    // Parse the expanded command
-    char *expanded_copy = _strdup(expanded_cmd);
-    char **expanded_args = lsh_split_line(expanded_copy);
-
-    // Execute the expanded command
-    int status = lsh_execute(expanded_args);
-
-    // Clean up
-    free(expanded_copy);
-    free(expanded_args);
-
+    arena_free(&arena);
     return status;
   }
 
   // Check for builtin commands
   for (i = 0; i < lsh_num_builtins(); i++) {
     if (strcmp(args[0], builtin_str[i]) == 0) {
+      g_last_exit_code = 0;
       return (*builtin_func[i])(args);
     }
   }
@@ -497,6 +608,26 @@ int lsh_execute(char **args) {
   return lsh_launch(args);
 }
 
+/**
+ * Get how many rows of its input the rest of a pipeline uses: N if its
+ * first stage that drops or reorders rows is "limit N", otherwise 0 (all).
+ * select keeps every row in place, so a limit after it still counts.
+ */
+static int pipeline_row_limit(char ***commands) {
+  for (int i = 0; commands[i] != NULL; i++) {
+    char **args = commands[i];
+    if (args[0] == NULL || strcmp(args[0], "select") == 0) {
+      continue;
+    }
+    if (strcmp(args[0], "limit") == 0 && args[1] != NULL &&
+        atoi(args[1]) > 0) {
+      return atoi(args[1]);
+    }
+    break;
+  }
+  return 0;
+}
+
 /**
  * Execute a pipeline of commands
  */
@@ -504,6 +635,8 @@ int lsh_execute_piped(char ***commands) {
   int i;
   TableData *result = NULL;
 
+  g_last_exit_code = 0;
+
   // Execute each command in the pipeline
   for (i = 0; commands[i] != NULL; i++) {
     char **args = commands[i];
@@ -520,6 +653,7 @@ int lsh_execute_piped(char ***commands) {
         if (!result) {
           fprintf(stderr, "lsh: error generating structured output for '%s'\n",
                   args[0]);
+          g_last_exit_code = 1;
           return 1;
         }
       } else if (strcmp(args[0], "ps") == 0) {
@@ -528,16 +662,42 @@ int lsh_execute_piped(char ***commands) {
         if (!result) {
           fprintf(stderr, "lsh: error generating structured output for '%s'\n",
                   args[0]);
+          g_last_exit_code = 1;
+          return 1;
+        }
+      } else if (strcmp(args[0], "git-files") == 0) {
+        // Tracked files with their working tree status
+        result = lsh_git_files_structured(args);
+        if (!result) {
+          g_last_exit_code = 1;
+          return 1;
+        }
+      } else if (strcmp(args[0], "grep") == 0) {
+        // Matching lines as rows; a limit later on ends the search early
+        result = lsh_grep_structured(args, pipeline_row_limit(commands + 1));
+        if (!result) {
+          g_last_exit_code = 1;
+          return 1;
+        }
+      } else if (strcmp(args[0], "parallel") == 0) {
+        // Job results (exit code, timing) as a table
+        result = lsh_parallel_structured(args);
+        if (!result) {
+          fprintf(stderr, "lsh: error generating structured output for '%s'\n",
+                  args[0]);
+          g_last_exit_code = 1;
           return 1;
         }
       } else {
         fprintf(stderr, "lsh: command '%s' does not support piping\n", args[0]);
+        g_last_exit_code = 1;
         return 1;
       }
     } else {
       // Handle piped commands (filters)
       if (result == NULL) {
         fprintf(stderr, "lsh: no data to pipe\n");
+        g_last_exit_code = 1;
         return 1;
       }
 
@@ -562,6 +722,7 @@ int lsh_execute_piped(char ***commands) {
         fprintf(stderr, "lsh: filter '%s' not supported\n", args[0]);
         free_table(result);
         result = NULL;
+        g_last_exit_code = 1;
         return 1;
       }
     }
@@ -576,19 +737,160 @@ int lsh_execute_piped(char ***commands) {
   return 1;
 }
 
+// Standard streams saved while a pipeline is redirected
+typedef struct {
+  int saved_fd[3]; // -1 when the stream is not redirected
+  HANDLE saved_handle[3];
+} SavedStreams;
+
+static const DWORD std_handle_ids[3] = {STD_INPUT_HANDLE, STD_OUTPUT_HANDLE,
+                                        STD_ERROR_HANDLE};
+
 /**
- * Free memory for a command array from lsh_split_commands
+ * Point a standard stream (0, 1 or 2) at another file descriptor
  */
-void free_commands(char ***commands) {
-  if (!commands)
-    return;
+static void redirect_stream(int fd, int target_fd, SavedStreams *saved) {
+  if (saved->saved_fd[fd] < 0) {
+    saved->saved_fd[fd] = _dup(fd);
+    saved->saved_handle[fd] = GetStdHandle(std_handle_ids[fd]);
+  }
+  _dup2(target_fd, fd);
+  SetStdHandle(std_handle_ids[fd], (HANDLE)_get_osfhandle(fd));
+}
 
-  for (int i = 0; commands[i] != NULL; i++) {
-    // Note: We don't free the token strings since they're
-    // just pointers into the original command string
-    free(commands[i]);
+/**
+ * Open a redirection target and attach it to a standard stream
+ */
+static int redirect_to_file(int fd, const char *path, int flags,
+                            SavedStreams *saved) {
+  int file_fd = _open(path, flags, _S_IREAD | _S_IWRITE);
+  if (file_fd < 0) {
+    fprintf(stderr, "lsh: cannot open '%s'\n", path);
+    return 0;
+  }
+  redirect_stream(fd, file_fd, saved);
+  _close(file_fd);
+  return 1;
+}
+
+/**
+ * Restore the standard streams saved by apply_redirections
+ */
+static void restore_redirections(SavedStreams *saved) {
+  fflush(stdout);
+  fflush(stderr);
+
+  for (int fd = 0; fd < 3; fd++) {
+    if (saved->saved_fd[fd] >= 0) {
+      _dup2(saved->saved_fd[fd], fd);
+      _close(saved->saved_fd[fd]);
+      SetStdHandle(std_handle_ids[fd], saved->saved_handle[fd]);
+      saved->saved_fd[fd] = -1;
+    }
+  }
+
+  clearerr(stdin);
+  g_streams_redirected = 0;
+}
+
+/**
+ * Apply a pipeline's redirections: input on its first command, output and
+ * errors on its last
+ */
+static int apply_redirections(const Pipeline *pipeline, SavedStreams *saved) {
+  const SimpleCommand *first = &pipeline->commands[0];
+  const SimpleCommand *last =
+      &pipeline->commands[pipeline->command_count - 1];
+
+  for (int fd = 0; fd < 3; fd++) {
+    saved->saved_fd[fd] = -1;
+  }
+
+  if (!first->input_file && !last->output_file && !last->error_file &&
+      !last->error_to_output) {
+    return 1;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+
+  if (first->input_file &&
+      !redirect_to_file(0, first->input_file, _O_RDONLY, saved)) {
+    restore_redirections(saved);
+    return 0;
+  }
+
+  if (last->output_file &&
+      !redirect_to_file(1, last->output_file,
+                        _O_WRONLY | _O_CREAT |
+                            (last->append_output ? _O_APPEND : _O_TRUNC),
+                        saved)) {
+    restore_redirections(saved);
+    return 0;
+  }
+
+  if (last->error_file &&
+      !redirect_to_file(2, last->error_file,
+                        _O_WRONLY | _O_CREAT |
+                            (last->append_error ? _O_APPEND : _O_TRUNC),
+                        saved)) {
+    restore_redirections(saved);
+    return 0;
+  }
+
+  if (last->error_to_output) {
+    redirect_stream(2, 1, saved);
   }
-  free(commands);
+
+  g_streams_redirected = 1;
+  return 1;
+}
+
+/**
+ * Execute a parsed command line
+ */
+int lsh_execute_list(CommandList *list) {
+  int run = 1;
+
+  for (int i = 0; i < list->pipeline_count; i++) {
+    Pipeline *pipeline = &list->pipelines[i];
+
+    if (run) {
+      SavedStreams saved;
+      int status = 1;
+
+      if (apply_redirections(pipeline, &saved)) {
+        if (pipeline->command_count > 1) {
+          status = lsh_execute_piped(pipeline->argv);
+        } else {
+          status = lsh_execute(pipeline->commands[0].args);
+        }
+        restore_redirections(&saved);
+      } else {
+        g_last_exit_code = 1;
+      }
+
+      if (!status) {
+        return 0; // exit
+      }
+    }
+
+    // A skipped pipeline leaves the exit code alone, so in "a && b || c"
+    // a failing a still runs c
+    switch (pipeline->next) {
+    case LIST_AND:
+      run = (g_last_exit_code == 0);
+      break;
+    case LIST_OR:
+      run = (g_last_exit_code != 0);
+      break;
+    default:
+      run = 1;
+      break;
+    }
+  }
+
+  return 1;
 }
 
 /**
@@ -634,33 +936,216 @@ void get_path_display(const char *cwd, char *parent_dir_name,
   }
 }
 
+/**
+ * Print the prompt: directory, Git segment and the ✘ marker
+ */
+static void render_prompt(HANDLE hConsole, const char *current_dir,
+                          const PromptGitState *git) {
+  // Define color reset code
+  const char *COLOR_RESET = "\033[0m";
+
+  // Check if we should use ANSI colors based on the theme setting
+  if (current_theme.use_ansi_colors) {
+    // Print directory in Rose color (soft pink/peach)
+    printf("%s%s", current_theme.ANSI_ROSE, current_dir);
+
+    // Git info with exact colors
+    if (git->in_repo) {
+      // Git syntax in Pine color (soft blue)
+      printf("%s git:(", current_theme.ANSI_PINE);
+
+      // Repository name in Love color (soft red) with clickable link if URL
+      // is available
+      if (git->url[0] != '\0') {
+        // Extract repo and branch info for the link text
+        char repo_branch[128] = "";
+        char *start = strstr(git->info, "(");
+        char *end = strstr(git->info, ")");
+
+        if (start && end && end > start) {
+          // Copy the content between parentheses for link text
+          strncpy(repo_branch, start + 1, end - start - 1);
+          repo_branch[end - start - 1] = '\0';
+
+          // Create a clickable link using OSC 8 escape sequence - broken
+          // into separate printf calls
+          printf("%s", current_theme.ANSI_LOVE);
+          printf("\033]8;;%s\033\\", git->url); // Start hyperlink
+          printf("%s", repo_branch);            // Link text
+          printf("\033]8;;\033\\");             // End hyperlink
+          printf("%s", current_theme.ANSI_PINE);
+        } else {
+          // Fallback to non-link display if parsing fails
+          printf("%s", current_theme.ANSI_LOVE);
+
+          // Print the repo/branch info
+          if (start && end && end > start) {
+            char repo_branch[128] = "";
+            strncpy(repo_branch, start + 1, end - start - 1);
+            repo_branch[end - start - 1] = '\0';
+            printf("%s", repo_branch);
+          }
+        }
+      } else {
+        // No URL available, print without link
+        printf("%s", current_theme.ANSI_LOVE);
+
+        // Print the repo/branch info
+        char *start = strstr(git->info, "(");
+        char *end = strstr(git->info, ")");
+
+        if (start && end && end > start) {
+          char repo_branch[128] = "";
+          strncpy(repo_branch, start + 1, end - start - 1);
+          repo_branch[end - start - 1] = '\0';
+          printf("%s", repo_branch);
+        }
+      }
+
+      // Closing parenthesis in Pine color (soft blue)
+      printf("%s)", current_theme.ANSI_PINE);
+    }
+
+    // Gold X character at end
+    printf("%s ✘ ", current_theme.ANSI_GOLD);
+
+    // Reset to default color for user input
+    printf("%s", COLOR_RESET);
+  } else {
+    // Fallback to standard console colors if ANSI not supported
+    SetConsoleTextAttribute(hConsole, current_theme.DIRECTORY_COLOR);
+    printf("%s", current_dir);
+
+    if (git->in_repo) {
+      SetConsoleTextAttribute(hConsole, current_theme.ACCENT_COLOR);
+      printf(" git:(");
+
+      SetConsoleTextAttribute(hConsole, current_theme.PROMPT_COLOR);
+
+      // Extract repository and branch name
+      char repo_branch[128] = "";
+      char *start = strstr(git->info, "(");
+      char *end = strstr(git->info, ")");
+
+      if (start && end && end > start) {
+        strncpy(repo_branch, start + 1, end - start - 1);
+        repo_branch[end - start - 1] = '\0';
+
+        // If we have a git URL, make the repo name clickable
+        if (git->url[0] != '\0') {
+          // Create a clickable link using OSC 8 escape sequence
+          printf("\033]8;;%s\033\\", git->url); // Start hyperlink
+          printf("%s", repo_branch);            // Display link text
+          printf("\033]8;;\033\\");             // End hyperlink
+        } else {
+          printf("%s", repo_branch);
+        }
+      }
+
+      SetConsoleTextAttribute(hConsole, current_theme.ACCENT_COLOR);
+      printf(")");
+    }
+
+    SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN |
+                                          FOREGROUND_INTENSITY);
+    printf(" ✘ ");
+
+    SetConsoleTextAttribute(hConsole, current_theme.PRIMARY_COLOR);
+  }
+
+  fflush(stdout);
+}
+
+// What the current prompt shows, so it can be updated in place when the
+// prompt cache finishes a refresh (guarded by the console output lock)
+static char g_prompt_cwd[1024] = "";
+static char g_prompt_dir_name[256] = "";
+static COORD g_prompt_start;
+static PromptGitState g_prompt_git;
+
+/**
+ * Called on the prompt cache worker when a repository's Git state changed.
+ * Redraws the waiting prompt if nothing has been typed yet, and always
+ * refreshes the status bar.
+ */
+static void on_prompt_cache_update(const char *root) {
+  HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+  PromptGitState git;
+
+  lock_console_output();
+
+  if (!line_reader_waiting_for_input() || g_prompt_cwd[0] == '\0') {
+    unlock_console_output();
+    return;
+  }
+
+  prompt_cache_lookup(g_prompt_cwd, &git);
+  if (memcmp(&git, &g_prompt_git, sizeof(git)) == 0) {
+    unlock_console_output();
+    return;
+  }
+
+  if (line_reader_input_length() == 0) {
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (GetConsoleScreenBufferInfo(hConsole, &csbi)) {
+      // Blank the old prompt, then draw the new one in its place
+      DWORD written;
+      COORD end = csbi.dwCursorPosition;
+      DWORD length = (DWORD)((end.Y - g_prompt_start.Y) * csbi.dwSize.X +
+                             (end.X - g_prompt_start.X));
+      FillConsoleOutputCharacter(hConsole, ' ', length, g_prompt_start,
+                                 &written);
+      SetConsoleCursorPosition(hConsole, g_prompt_start);
+
+      render_prompt(hConsole, g_prompt_dir_name, &git);
+
+      if (GetConsoleScreenBufferInfo(hConsole, &csbi)) {
+        line_reader_set_prompt_end(csbi.dwCursorPosition);
+      }
+      g_prompt_git = git;
+    }
+  }
+
+  update_status_bar(hConsole, git.in_repo ? git.info : "");
+
+  unlock_console_output();
+}
+
+/**
+ * Stop the shell's workers and free what it holds. Every way the shell
+ * runs (interactive, -c and scripts) ends here, after any background
+ * loading has finished.
+ */
+static void shell_shutdown(void) {
+  prompt_cache_shutdown();
+  file_index_shutdown();
+  fs_watch_shutdown();
+  startup_wait_background(INFINITE);
+  cleanup_subsystems();
+  arena_free(&g_line_arena);
+}
+
 /**
  * Main shell loop (updated with persistent history support)
  */
 void lsh_loop(void) {
   char *line;
-  char ***commands;
+  CommandList list;
   int status;
   char cwd[1024];
   char prompt_path[1024];
   char git_info[128];
-  char git_url[1024] = "";
   char username[256];
+  PromptGitState git;
 
-  // Static variables to cache Git information
-  static char last_directory[1024];
-  static char cached_git_info[128];
-  static int cached_in_git_repo = 0;
-
-  // Define color reset code
-  const char *COLOR_RESET = "\033[0m";
+  int first_prompt = 1;
 
   // Initialize static strings
-  last_directory[0] = '\0';
-  cached_git_info[0] = '\0';
   git_info[0] = '\0';
   strcpy(username, "Elden Lord");
 
+  startup_phase("console setup");
+
   // Get handle to console
   HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
 
@@ -670,32 +1155,31 @@ void lsh_loop(void) {
   dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
   SetConsoleMode(hConsole, dwMode);
 
-  // Initialize aliases
-  init_aliases();
-
-  // Initialize bookmarks
-  init_bookmarks();
+  // The prompt needs the theme right away; everything else (aliases,
+  // bookmarks, cities and history) loads in the background
+  startup_phase("theme");
+  ensure_subsystem(SUBSYSTEM_THEMES);
 
-  // Initialize favorite cities
-  init_favorite_cities();
+  startup_phase("start background init");
+  startup_begin_background_init();
 
-  // Initialize theme system
-  init_theme_system();
-  apply_current_theme();
-
-  // Initialize persistent history
-  init_persistent_history();
+  // Git prompt segments are computed on the prompt cache's worker
+  startup_phase("prompt cache");
+  prompt_cache_init(on_prompt_cache_update);
 
   // Display the welcome banner at startup
+  startup_phase("welcome banner");
   display_welcome_banner();
 
   // Initialize the status bar
+  startup_phase("status bar");
   init_status_bar(hConsole);
 
+  startup_phase("first prompt");
+
   do {
     // Clear git_info for this iteration
     git_info[0] = '\0';
-    git_url[0] = '\0';
 
     // Get current console info
     CONSOLE_SCREEN_BUFFER_INFO csbi;
@@ -717,111 +1201,21 @@ void lsh_loop(void) {
     if (_getcwd(cwd, sizeof(cwd)) == NULL) {
       perror("lsh");
       strcpy(prompt_path, "unknown_path"); // Fallback in case of error
-      // Reset cached directory since we can't determine current directory
-      last_directory[0] = '\0';
+      g_prompt_cwd[0] = '\0';
     } else {
-      // Check if directory has changed since last prompt
-      int directory_changed = (strcmp(cwd, last_directory) != 0);
-
       // Get parent and current directory names
       char parent_dir[256] = "";
       char current_dir[256] = "";
       get_path_display(cwd, parent_dir, current_dir, sizeof(parent_dir));
 
-      // Check for Git info
-      char git_branch[64] = "";
-      char git_repo[64] = "";
-      int is_dirty = 0;
-      int in_git_repo = 0;
-
-      if (directory_changed) {
-        // Update last directory
-        strcpy(last_directory, cwd);
-
-        // Clear cached Git info
-        cached_git_info[0] = '\0';
-        cached_in_git_repo = 0;
-
-        // Check if we're in a Git repository
-        cached_in_git_repo =
-            get_git_branch(git_branch, sizeof(git_branch), &is_dirty);
-
-        if (cached_in_git_repo) {
-          int has_repo_name = get_git_repo_name(git_repo, sizeof(git_repo));
-
-          if (has_repo_name) {
-            snprintf(cached_git_info, sizeof(cached_git_info),
-                     " git:(%s%s%s%s)", git_repo,
-                     strlen(git_branch) > 0 ? " " : "", git_branch,
-                     is_dirty ? "*" : "");
-          } else {
-            snprintf(cached_git_info, sizeof(cached_git_info), " git:(%s%s)",
-                     git_branch, is_dirty ? "*" : "");
-          }
-        }
-      } else if (cached_in_git_repo) {
-        // Use cached info for branch/repo names, but still populate git_branch
-        get_git_branch(git_branch, sizeof(git_branch), &is_dirty);
-        get_git_repo_name(git_repo, sizeof(git_repo));
-      }
+      // Never waits on git: a stale or unknown state is shown as is and the
+      // prompt is updated in place once the worker has fresh data
+      prompt_cache_lookup(cwd, &git);
 
-      // Set in_git_repo from cached value
-      in_git_repo = cached_in_git_repo;
-
-      // Always get Git remote URL if we're in a repository
-      // This ensures the URL is available for every prompt, not just when
-      // directory changes
-      if (in_git_repo) {
-        char cmd[1024] = "";
-        FILE *fp;
-        snprintf(cmd, sizeof(cmd), "git config --get remote.origin.url 2>nul");
-        fp = _popen(cmd, "r");
-        if (fp) {
-          char origin_url[1024] = "";
-          if (fgets(origin_url, sizeof(origin_url), fp)) {
-            // Remove newline
-            size_t len = strlen(origin_url);
-            if (len > 0 && origin_url[len - 1] == '\n') {
-              origin_url[len - 1] = '\0';
-            }
-
-            // Convert SSH URLs to HTTPS URLs if needed
-            if (strncmp(origin_url, "git@", 4) == 0) {
-              // SSH format: git@github.com:username/repo.git
-              char *domain_start = origin_url + 4;
-              char *repo_path = strchr(domain_start, ':');
-
-              if (repo_path) {
-                *repo_path = '\0'; // Terminate the domain part
-                repo_path++;       // Move past the colon
-
-                // Remove .git suffix if present
-                char *git_suffix = strstr(repo_path, ".git");
-                if (git_suffix) {
-                  *git_suffix = '\0';
-                }
-
-                // Construct HTTPS URL
-                snprintf(git_url, sizeof(git_url), "https://%s/%s",
-                         domain_start, repo_path);
-              } else {
-                // Fallback - just use the original
-                strcpy(git_url, origin_url);
-              }
-            } else if (strncmp(origin_url, "https://", 8) == 0) {
-              // Already HTTPS URL, just remove .git suffix if present
-              char *git_suffix = strstr(origin_url, ".git");
-              if (git_suffix) {
-                *git_suffix = '\0';
-              }
-              strcpy(git_url, origin_url);
-            } else {
-              // Unknown format, use as-is
-              strcpy(git_url, origin_url);
-            }
-          }
-          _pclose(fp);
-        }
+      // Everything the first prompt needs is ready
+      if (first_prompt) {
+        startup_profile_report();
+        first_prompt = 0;
       }
 
       // Ensure we still have room for status bar after prompt
@@ -831,8 +1225,8 @@ void lsh_loop(void) {
       update_status_bar(hConsole, "");
 
       // Use cached Git info for status bar
-      if (cached_in_git_repo) {
-        strcpy(git_info, cached_git_info);
+      if (git.in_repo) {
+        strcpy(git_info, git.info);
       }
 
       // Update status bar with Git info (if any)
@@ -840,182 +1234,118 @@ void lsh_loop(void) {
         update_status_bar(hConsole, git_info);
       }
 
-      // Check if we should use ANSI colors based on the theme setting
-      if (current_theme.use_ansi_colors) {
-        // Print directory in Rose color (soft pink/peach)
-        printf("%s%s", current_theme.ANSI_ROSE, current_dir);
-
-        // Git info with exact colors
-        if (cached_in_git_repo) {
-          // Git syntax in Pine color (soft blue)
-          printf("%s git:(", current_theme.ANSI_PINE);
-
-          // Repository name in Love color (soft red) with clickable link if URL
-          // is available
-          if (git_url[0] != '\0') {
-            // Extract repo and branch info for the link text
-            char repo_branch[128] = "";
-            char *start = strstr(cached_git_info, "(");
-            char *end = strstr(cached_git_info, ")");
-
-            if (start && end && end > start) {
-              // Copy the content between parentheses for link text
-              strncpy(repo_branch, start + 1, end - start - 1);
-              repo_branch[end - start - 1] = '\0';
-
-              // Create a clickable link using OSC 8 escape sequence - broken
-              // into separate printf calls
-              printf("%s", current_theme.ANSI_LOVE);
-              printf("\033]8;;%s\033\\", git_url); // Start hyperlink
-              printf("%s", repo_branch);           // Link text
-              printf("\033]8;;\033\\");            // End hyperlink
-              printf("%s", current_theme.ANSI_PINE);
-            } else {
-              // Fallback to non-link display if parsing fails
-              printf("%s", current_theme.ANSI_LOVE);
-
-              // Print the repo/branch info
-              if (start && end && end > start) {
-                char repo_branch[128] = "";
-                strncpy(repo_branch, start + 1, end - start - 1);
-                repo_branch[end - start - 1] = '\0';
-                printf("%s", repo_branch);
-              }
-            }
-          } else {
-            // No URL available, print without link
-            printf("%s", current_theme.ANSI_LOVE);
-
-            // Print the repo/branch info
-            char *start = strstr(cached_git_info, "(");
-            char *end = strstr(cached_git_info, ")");
-
-            if (start && end && end > start) {
-              char repo_branch[128] = "";
-              strncpy(repo_branch, start + 1, end - start - 1);
-              repo_branch[end - start - 1] = '\0';
-              printf("%s", repo_branch);
-            }
-          }
+      // Remember what this prompt shows for in-place updates
+      lock_console_output();
+      if (GetConsoleScreenBufferInfo(hConsole, &csbi)) {
+        g_prompt_start = csbi.dwCursorPosition;
+      }
+      strcpy(g_prompt_cwd, cwd);
+      strcpy(g_prompt_dir_name, current_dir);
+      g_prompt_git = git;
 
-          // Closing parenthesis in Pine color (soft blue)
-          printf("%s)", current_theme.ANSI_PINE);
-        }
+      render_prompt(hConsole, current_dir, &git);
+      unlock_console_output();
+    }
 
-        // Gold X character at end
-        printf("%s ✘ ", current_theme.ANSI_GOLD);
+    // Read user input
+    line = lsh_read_line();
 
-        // Reset to default color for user input
-        printf("%s", COLOR_RESET);
-      } else {
-        // Fallback to standard console colors if ANSI not supported
-        SetConsoleTextAttribute(hConsole, current_theme.DIRECTORY_COLOR);
-        printf("%s", current_dir);
+    // Parse the line; tokens and arguments live in the line arena
+    if (!lsh_parse_line(line, &g_line_arena, &list)) {
+      list.pipeline_count = 0;
+      g_last_exit_code = 2;
+    }
 
-        if (cached_in_git_repo) {
-          SetConsoleTextAttribute(hConsole, current_theme.ACCENT_COLOR);
-          printf(" git:(");
+    // Record the line exactly as typed
+    if (line[strspn(line, " \t\r\n")] != '\0') {
+      lsh_add_to_history(line);
+    }
 
-          SetConsoleTextAttribute(hConsole, current_theme.PROMPT_COLOR);
+    // Hide status bar before command execution to prevent ghost duplicates
+    hide_status_bar(hConsole);
 
-          // Extract repository and branch name
-          char repo_branch[128] = "";
-          char *start = strstr(cached_git_info, "(");
-          char *end = strstr(cached_git_info, ")");
+    status = lsh_execute_list(&list);
 
-          if (start && end && end > start) {
-            strncpy(repo_branch, start + 1, end - start - 1);
-            repo_branch[end - start - 1] = '\0';
+    // Always redraw the status bar after command execution
+    update_status_bar(hConsole, git_info);
 
-            // If we have a git URL, make the repo name clickable
-            if (git_url[0] != '\0') {
-              // Create a clickable link using OSC 8 escape sequence
-              printf("\033]8;;%s\033\\", git_url); // Start hyperlink
-              printf("%s", repo_branch);           // Display link text
-              printf("\033]8;;\033\\");            // End hyperlink
-            } else {
-              printf("%s", repo_branch);
-            }
-          }
+    // Clean up
+    free(line);
+    arena_reset(&g_line_arena);
 
-          SetConsoleTextAttribute(hConsole, current_theme.ACCENT_COLOR);
-          printf(")");
-        }
+  } while (status);
 
-        SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN |
-                                              FOREGROUND_INTENSITY);
-        printf(" ✘ ");
+  shell_shutdown();
+}
 
-        SetConsoleTextAttribute(hConsole, current_theme.PRIMARY_COLOR);
-      }
+/**
+ * Execute one line of input without any interactive prompt handling
+ */
+static int execute_line(const char *line) {
+  CommandList list;
+  int status = 1;
 
-      fflush(stdout);
-    }
+  if (lsh_parse_line(line, &g_line_arena, &list)) {
+    status = lsh_execute_list(&list);
+  } else {
+    g_last_exit_code = 2;
+  }
 
-    // Read user input
-    line = lsh_read_line();
+  arena_reset(&g_line_arena);
+  return status;
+}
 
-    // Split commands
-    commands = lsh_split_commands(line);
+/**
+ * Run a single command string (shell -c "cmd")
+ */
+int lsh_run_command_string(const char *command) {
+  char *line = _strdup(command);
+  if (!line) {
+    fprintf(stderr, "lsh: allocation error\n");
+    return EXIT_FAILURE;
+  }
 
-    // Check if there are any pipes (more than one command)
-    int pipe_count = 0;
-    while (commands[pipe_count] != NULL)
-      pipe_count++;
+  execute_line(line);
+  free(line);
 
-    // Record the final command to history
-    if (pipe_count >= 1 && line[0] != '\0') {
-      // Reconstruct the final command for history (for accurate frequency
-      // tracking)
-      char final_command[LSH_RL_BUFSIZE] = "";
+  fflush(stdout);
+  shell_shutdown();
+  return g_last_exit_code;
+}
 
-      for (int cmd_idx = 0; cmd_idx < pipe_count; cmd_idx++) {
-        char **args = commands[cmd_idx];
+/**
+ * Run a script file line by line (shell script.lsh)
+ */
+int lsh_run_script(const char *path) {
+  FILE *script = fopen(path, "r");
+  if (!script) {
+    fprintf(stderr, "lsh: cannot open script '%s'\n", path);
+    return EXIT_FAILURE;
+  }
 
-        // Add pipe symbol between commands
-        if (cmd_idx > 0) {
-          strcat(final_command, " | ");
-        }
+  char line[LSH_RL_BUFSIZE * 8];
+  int status = 1;
 
-        // Add each argument for this command
-        for (int arg_idx = 0; args[arg_idx] != NULL; arg_idx++) {
-          if (arg_idx > 0) {
-            strcat(final_command, " ");
-          }
-          strcat(final_command, args[arg_idx]);
-        }
-      }
+  while (status && fgets(line, sizeof(line), script)) {
+    // Strip the line ending
+    size_t len = strcspn(line, "\r\n");
+    line[len] = '\0';
 
-      // Now add the fully constructed command to history
-      lsh_add_to_history(final_command);
+    // Skip leading whitespace, blank lines and comments
+    char *start = line;
+    while (*start == ' ' || *start == '\t') {
+      start++;
     }
-
-    // Hide status bar before command execution to prevent ghost duplicates
-    hide_status_bar(hConsole);
-
-    if (pipe_count > 1) {
-      // Execute piped commands
-      status = lsh_execute_piped(commands);
-    } else if (pipe_count == 1) {
-      // Execute single command the normal way
-      status = lsh_execute(commands[0]);
-    } else {
-      // No commands (empty line)
-      status = 1;
+    if (*start == '\0' || *start == '#') {
+      continue;
     }
 
-    // Always redraw the status bar after command execution
-    update_status_bar(hConsole, git_info);
-
-    // Clean up
-    free(line);
-    free_commands(commands);
+    status = execute_line(start);
+  }
 
-  } while (status);
+  fclose(script);
 
-  // Clean up
-  cleanup_aliases();
-  cleanup_bookmarks();
-  cleanup_favorite_cities();
-  cleanup_persistent_history();
+  fflush(stdout);
+  shell_shutdown();
+  return g_last_exit_code;
 }
@@ -7,6 +7,7 @@
 #define SHELL_H
 
 #include "common.h"
+#include "lexer.h"
 #include "structured_data.h"
 
 /**
@@ -44,9 +45,33 @@ int lsh_launch(char **args);
 void lsh_loop(void);
 
 /**
- * Free memory for a command array from lsh_split_commands
+ * Run a single command string without interactive setup (shell -c "cmd")
+ *
+ * @param command The command line to run
+ * @return Exit code of the last command
+ */
+int lsh_run_command_string(const char *command);
+
+/**
+ * Run a script file line by line without interactive setup
+ * (shell script.lsh). Blank lines and lines starting with # are skipped.
+ *
+ * @param path Path to the script
+ * @return Exit code of the last command
+ */
+int lsh_run_script(const char *path);
+
+// Exit code of the most recently executed command
+extern int g_last_exit_code;
+
+/**
+ * Execute a parsed command line: pipelines joined by ;, && and ||, with
+ * their redirections applied
+ *
+ * @param list The parsed command line
+ * @return 1 to continue the shell, 0 to exit
  */
-void free_commands(char ***commands);
+int lsh_execute_list(CommandList *list);
 
 /**
  * Initialize the status bar at the bottom of the screen
@@ -0,0 +1,208 @@
+/**
+ * startup.c
+ * Deferred interactive startup and the startup-time profiler
+ */
+
+#include "startup.h"
+#include "subsystems.h"
+
+#define MAX_STARTUP_PHASES 32
+#define MAX_BACKGROUND_TASKS 8
+
+// One timed phase of startup
+typedef struct {
+  const char *name;
+  LONGLONG start;
+  LONGLONG end; // 0 while the phase is still running
+  int background;
+} StartupPhase;
+
+// Background startup task
+typedef struct {
+  const char *name;
+  void (*func)(void);
+} StartupTask;
+
+static int profile_enabled = 0;
+static LARGE_INTEGER profile_freq;
+static LONGLONG profile_origin = 0;
+static StartupPhase phases[MAX_STARTUP_PHASES];
+static int phase_count = 0;
+static int current_phase = -1;
+static CRITICAL_SECTION phase_lock;
+
+static HANDLE background_threads[MAX_BACKGROUND_TASKS];
+static int background_count = 0;
+
+static LONGLONG profile_now(void) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return now.QuadPart;
+}
+
+static double ticks_to_ms(LONGLONG ticks) {
+  return (double)ticks * 1000.0 / (double)profile_freq.QuadPart;
+}
+
+/**
+ * Enable the startup profiler
+ */
+void startup_profile_enable(void) {
+  QueryPerformanceFrequency(&profile_freq);
+  profile_origin = profile_now();
+  InitializeCriticalSection(&phase_lock);
+  profile_enabled = 1;
+}
+
+/**
+ * Check whether the startup profiler is enabled
+ */
+int startup_profile_enabled(void) { return profile_enabled; }
+
+/**
+ * Record the start of a phase and return its index (-1 if not profiling)
+ */
+static int begin_phase(const char *name, int background) {
+  int index = -1;
+
+  if (!profile_enabled) {
+    return -1;
+  }
+
+  EnterCriticalSection(&phase_lock);
+  if (phase_count < MAX_STARTUP_PHASES) {
+    index = phase_count++;
+    phases[index].name = name;
+    phases[index].start = profile_now();
+    phases[index].end = 0;
+    phases[index].background = background;
+  }
+  LeaveCriticalSection(&phase_lock);
+
+  return index;
+}
+
+static void end_phase(int index) {
+  if (!profile_enabled || index < 0) {
+    return;
+  }
+
+  EnterCriticalSection(&phase_lock);
+  phases[index].end = profile_now();
+  LeaveCriticalSection(&phase_lock);
+}
+
+/**
+ * Start timing a phase on the main thread, ending the previous one
+ */
+void startup_phase(const char *name) {
+  if (!profile_enabled) {
+    return;
+  }
+  end_phase(current_phase);
+  current_phase = begin_phase(name, 0);
+}
+
+/**
+ * Print the per-phase timing breakdown
+ */
+void startup_profile_report(void) {
+  if (!profile_enabled) {
+    return;
+  }
+
+  end_phase(current_phase);
+  current_phase = -1;
+  LONGLONG first_prompt = profile_now();
+
+  // Give background phases a moment to finish so they can be reported
+  startup_wait_background(2000);
+
+  printf("\nStartup profile (ms since launch)\n");
+  printf("  %-22s %10s %10s\n", "Phase", "Start", "Duration");
+
+  EnterCriticalSection(&phase_lock);
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      printf("  Background:\n");
+    }
+    for (int i = 0; i < phase_count; i++) {
+      StartupPhase *phase = &phases[i];
+      if (phase->background != pass) {
+        continue;
+      }
+
+      double start_ms = ticks_to_ms(phase->start - profile_origin);
+      if (phase->end) {
+        printf("  %-22s %10.2f %10.2f\n", phase->name, start_ms,
+               ticks_to_ms(phase->end - phase->start));
+      } else {
+        printf("  %-22s %10.2f %10s\n", phase->name, start_ms, "running");
+      }
+    }
+  }
+  LeaveCriticalSection(&phase_lock);
+
+  printf("  %-22s %10.2f\n\n", "Time to first prompt",
+         ticks_to_ms(first_prompt - profile_origin));
+}
+
+static void load_aliases_task(void) { ensure_subsystem(SUBSYSTEM_ALIASES); }
+static void load_bookmarks_task(void) { ensure_subsystem(SUBSYSTEM_BOOKMARKS); }
+static void load_cities_task(void) { ensure_subsystem(SUBSYSTEM_CITIES); }
+static void load_history_task(void) { ensure_subsystem(SUBSYSTEM_HISTORY); }
+
+static unsigned __stdcall startup_task_thread(void *arg) {
+  StartupTask *task = (StartupTask *)arg;
+  int phase = begin_phase(task->name, 1);
+  task->func();
+  end_phase(phase);
+  free(task);
+  return 0;
+}
+
+static void start_task(const char *name, void (*func)(void)) {
+  if (background_count >= MAX_BACKGROUND_TASKS) {
+    func();
+    return;
+  }
+
+  StartupTask *task = (StartupTask *)malloc(sizeof(StartupTask));
+  if (!task) {
+    func();
+    return;
+  }
+  task->name = name;
+  task->func = func;
+
+  HANDLE thread =
+      (HANDLE)_beginthreadex(NULL, 0, startup_task_thread, task, 0, NULL);
+  if (!thread) {
+    // Could not start a thread - do the work now instead
+    free(task);
+    func();
+    return;
+  }
+  background_threads[background_count++] = thread;
+}
+
+/**
+ * Start the deferred startup work on background threads
+ */
+void startup_begin_background_init(void) {
+  start_task("history", load_history_task);
+  start_task("aliases", load_aliases_task);
+  start_task("bookmarks", load_bookmarks_task);
+  start_task("favorite cities", load_cities_task);
+}
+
+/**
+ * Wait for the background startup work to finish
+ */
+void startup_wait_background(DWORD timeout_ms) {
+  if (background_count == 0) {
+    return;
+  }
+  WaitForMultipleObjects(background_count, background_threads, TRUE,
+                         timeout_ms);
+}
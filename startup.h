@@ -0,0 +1,50 @@
+/**
+ * startup.h
+ * Deferred interactive startup and the startup-time profiler
+ */
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include "common.h"
+
+/**
+ * Enable the startup profiler (--profile-startup). Should be called as early
+ * as possible; timings are relative to this call.
+ */
+void startup_profile_enable(void);
+
+/**
+ * Check whether the startup profiler is enabled
+ *
+ * @return 1 if enabled, 0 otherwise
+ */
+int startup_profile_enabled(void);
+
+/**
+ * Start timing a phase on the main thread, ending the previous one
+ *
+ * @param name Phase name (must be a string literal or otherwise outlive the
+ *             report)
+ */
+void startup_phase(const char *name);
+
+/**
+ * Print the per-phase timing breakdown. Ends the current main thread phase
+ * and waits briefly for background phases so their timings can be shown.
+ */
+void startup_profile_report(void);
+
+/**
+ * Start loading aliases, bookmarks, cities and history on background threads
+ */
+void startup_begin_background_init(void);
+
+/**
+ * Wait for the background startup work to finish
+ *
+ * @param timeout_ms Maximum time to wait, or INFINITE
+ */
+void startup_wait_background(DWORD timeout_ms);
+
+#endif // STARTUP_H
@@ -0,0 +1,104 @@
+/**
+ * subsystems.c
+ * On-demand initialization of the shell's persistent subsystems
+ */
+
+#include "subsystems.h"
+#include "aliases.h"
+#include "bookmarks.h"
+#include "favorite_cities.h"
+#include "persistent_history.h"
+#include "themes.h"
+
+static INIT_ONCE subsystem_once[SUBSYSTEM_COUNT] = {
+    INIT_ONCE_STATIC_INIT, INIT_ONCE_STATIC_INIT, INIT_ONCE_STATIC_INIT,
+    INIT_ONCE_STATIC_INIT, INIT_ONCE_STATIC_INIT};
+static volatile LONG subsystem_ready[SUBSYSTEM_COUNT] = {0};
+
+/**
+ * Initialize the theme system. Redirected output stays plain: the theme's
+ * ANSI sequences are disabled and nothing is written to the console.
+ */
+static void init_themes_for_output(void) {
+  init_theme_system();
+
+  if (stdout_is_tty()) {
+    apply_current_theme();
+  } else {
+    current_theme.use_ansi_colors = FALSE;
+  }
+}
+
+static BOOL CALLBACK init_subsystem_once(PINIT_ONCE once, PVOID param,
+                                         PVOID *context) {
+  Subsystem id = (Subsystem)(INT_PTR)param;
+
+  switch (id) {
+  case SUBSYSTEM_ALIASES:
+    init_aliases();
+    break;
+  case SUBSYSTEM_BOOKMARKS:
+    init_bookmarks();
+    break;
+  case SUBSYSTEM_CITIES:
+    init_favorite_cities();
+    break;
+  case SUBSYSTEM_THEMES:
+    init_themes_for_output();
+    break;
+  case SUBSYSTEM_HISTORY:
+    init_persistent_history();
+    break;
+  default:
+    return FALSE;
+  }
+
+  InterlockedExchange(&subsystem_ready[id], 1);
+  return TRUE;
+}
+
+/**
+ * Initialize a subsystem if it has not been initialized yet
+ */
+void ensure_subsystem(Subsystem id) {
+  if (id < 0 || id >= SUBSYSTEM_COUNT || subsystem_ready[id]) {
+    return;
+  }
+  InitOnceExecuteOnce(&subsystem_once[id], init_subsystem_once,
+                      (PVOID)(INT_PTR)id, NULL);
+}
+
+/**
+ * Check whether a subsystem has finished initializing
+ */
+int subsystem_initialized(Subsystem id) {
+  if (id < 0 || id >= SUBSYSTEM_COUNT) {
+    return 0;
+  }
+  return subsystem_ready[id] != 0;
+}
+
+/**
+ * Clean up the subsystems that were actually initialized. Subsystems that
+ * were never loaded are left alone so their files are not overwritten with
+ * empty state.
+ */
+void cleanup_subsystems(void) {
+  if (subsystem_ready[SUBSYSTEM_ALIASES]) {
+    cleanup_aliases();
+  }
+  if (subsystem_ready[SUBSYSTEM_BOOKMARKS]) {
+    cleanup_bookmarks();
+  }
+  if (subsystem_ready[SUBSYSTEM_CITIES]) {
+    cleanup_favorite_cities();
+  }
+  if (subsystem_ready[SUBSYSTEM_HISTORY]) {
+    cleanup_persistent_history();
+  }
+}
+
+/**
+ * Check whether standard output is an interactive console
+ */
+int stdout_is_tty(void) { return _isatty(_fileno(stdout)) != 0; }
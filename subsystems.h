@@ -0,0 +1,52 @@
+/**
+ * subsystems.h
+ * On-demand initialization of the shell's persistent subsystems
+ */
+
+#ifndef SUBSYSTEMS_H
+#define SUBSYSTEMS_H
+
+#include "common.h"
+
+// Subsystems that load state from the user's profile
+typedef enum {
+  SUBSYSTEM_ALIASES,
+  SUBSYSTEM_BOOKMARKS,
+  SUBSYSTEM_CITIES,
+  SUBSYSTEM_THEMES,
+  SUBSYSTEM_HISTORY,
+  SUBSYSTEM_COUNT
+} Subsystem;
+
+/**
+ * Initialize a subsystem if it has not been initialized yet
+ *
+ * Safe to call from any thread; concurrent callers block until the first
+ * initialization has finished. Must not be called from inside the
+ * subsystem's own init function.
+ *
+ * @param id The subsystem
+ */
+void ensure_subsystem(Subsystem id);
+
+/**
+ * Check whether a subsystem has finished initializing
+ *
+ * @param id The subsystem
+ * @return 1 if initialized, 0 otherwise
+ */
+int subsystem_initialized(Subsystem id);
+
+/**
+ * Clean up the subsystems that were actually initialized
+ */
+void cleanup_subsystems(void);
+
+/**
+ * Check whether standard output is an interactive console
+ *
+ * @return 1 if stdout is a TTY, 0 if it is redirected to a file or pipe
+ */
+int stdout_is_tty(void);
+
+#endif // SUBSYSTEMS_H
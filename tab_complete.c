@@ -8,6 +8,7 @@
 #include "bookmarks.h"
 #include "builtins.h" // Added to access builtin_str[]
 #include "favorite_cities.h"
+#include "file_index.h"
 #include "filters.h" // Added for filter commands
 #include "persistent_history.h"
 #include "structured_data.h" // Added for table header information
@@ -803,49 +804,34 @@ char **find_matches(const char *partial_text, int is_first_word,
     strcpy(search_pattern, partial_text);
   }
 
-  // Prepare for file searching
-  char search_path[1024];
-  strcpy(search_path, search_dir);
-  strcat(search_path, "*");
-
-  WIN32_FIND_DATA findData;
-  HANDLE hFind = FindFirstFile(search_path, &findData);
-
-  if (hFind == INVALID_HANDLE_VALUE) {
+  // The shared file index serves the directory from memory until it changes
+  FileIndexEntry *entries = NULL;
+  int entry_count = file_index_find(search_dir, search_pattern,
+                                    FILE_INDEX_PREFIX, &entries);
+  if (entry_count < 0) {
     free(matches);
     return NULL;
   }
 
-  // Find all matching files/directories
-  do {
-    // Skip . and .. directories
-    if (strcmp(findData.cFileName, ".") == 0 ||
-        strcmp(findData.cFileName, "..") == 0) {
-      continue;
-    }
-
-    // Check if file matches our pattern (case insensitive)
-    if (_strnicmp(findData.cFileName, search_pattern, strlen(search_pattern)) ==
-        0) {
-      // Add to matches
-      if (*num_matches >= matches_capacity) {
-        matches_capacity *= 2;
-        matches = (char **)realloc(matches, sizeof(char *) * matches_capacity);
-        if (!matches) {
-          fprintf(stderr, "lsh: allocation error in tab completion\n");
-          FindClose(hFind);
-          return NULL;
-        }
+  // Every entry found matches our pattern (case insensitive)
+  for (int i = 0; i < entry_count; i++) {
+    // Add to matches
+    if (*num_matches >= matches_capacity) {
+      matches_capacity *= 2;
+      matches = (char **)realloc(matches, sizeof(char *) * matches_capacity);
+      if (!matches) {
+        fprintf(stderr, "lsh: allocation error in tab completion\n");
+        free(entries);
+        return NULL;
       }
-
-      // Just copy the filename without adding backslash for directories
-      matches[*num_matches] = _strdup(findData.cFileName);
-      (*num_matches)++;
     }
-  } while (FindNextFile(hFind, &findData));
 
-  FindClose(hFind);
+    // Just copy the filename without adding backslash for directories
+    matches[*num_matches] = _strdup(entries[i].name);
+    (*num_matches)++;
+  }
 
+  free(entries);
   return matches;
 }
 
@@ -1348,54 +1334,39 @@ char **find_directory_matches(const char *partial_text, int *num_matches) {
     strcpy(search_pattern, partial_text);
   }
 
-  // Prepare for file searching
-  char search_path[1024];
-  strcpy(search_path, search_dir);
-  strcat(search_path, "*");
-
-  WIN32_FIND_DATA findData;
-  HANDLE hFind = FindFirstFile(search_path, &findData);
-
-  if (hFind == INVALID_HANDLE_VALUE) {
+  // The shared file index serves the directory from memory until it changes
+  FileIndexEntry *entries = NULL;
+  int entry_count = file_index_find(search_dir, search_pattern,
+                                    FILE_INDEX_PREFIX, &entries);
+  if (entry_count < 0) {
     free(matches);
     return NULL;
   }
 
   // Find all matching directories
-  do {
-    // Skip . and .. directories
-    if (strcmp(findData.cFileName, ".") == 0 ||
-        strcmp(findData.cFileName, "..") == 0) {
-      continue;
-    }
-
+  for (int i = 0; i < entry_count; i++) {
     // Only include directories
-    if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-      // Check if directory matches our pattern (case insensitive)
-      if (_strnicmp(findData.cFileName, search_pattern,
-                    strlen(search_pattern)) == 0) {
-        // Add to matches
-        if (*num_matches >= matches_capacity) {
-          matches_capacity *= 2;
-          matches =
-              (char **)realloc(matches, sizeof(char *) * matches_capacity);
-          if (!matches) {
-            fprintf(stderr,
-                    "lsh: allocation error in directory tab completion\n");
-            FindClose(hFind);
-            return NULL;
-          }
+    if (entries[i].attributes & FILE_ATTRIBUTE_DIRECTORY) {
+      // Add to matches
+      if (*num_matches >= matches_capacity) {
+        matches_capacity *= 2;
+        matches =
+            (char **)realloc(matches, sizeof(char *) * matches_capacity);
+        if (!matches) {
+          fprintf(stderr,
+                  "lsh: allocation error in directory tab completion\n");
+          free(entries);
+          return NULL;
         }
-
-        // Just copy the filename
-        matches[*num_matches] = _strdup(findData.cFileName);
-        (*num_matches)++;
       }
-    }
-  } while (FindNextFile(hFind, &findData));
 
-  FindClose(hFind);
+      // Just copy the filename
+      matches[*num_matches] = _strdup(entries[i].name);
+      (*num_matches)++;
+    }
+  }
 
+  free(entries);
   return matches;
 }
 
@@ -1438,87 +1409,40 @@ char **find_file_matches(const char *partial_text, int *num_matches) {
     strcpy(search_pattern, partial_text);
   }
 
-  // Prepare for file searching
-  char search_path[1024];
-  strcpy(search_path, search_dir);
-  strcat(search_path, "*");
-
-  WIN32_FIND_DATA findData;
-  HANDLE hFind = FindFirstFile(search_path, &findData);
-
-  if (hFind == INVALID_HANDLE_VALUE) {
+  // The shared file index serves the directory from memory until it changes
+  FileIndexEntry *entries = NULL;
+  int entry_count = file_index_find(search_dir, search_pattern,
+                                    FILE_INDEX_PREFIX, &entries);
+  if (entry_count < 0) {
     free(matches);
     return NULL;
   }
 
-  // Find all matching files (prioritize files over directories)
-  do {
-    // Skip . and .. directories
-    if (strcmp(findData.cFileName, ".") == 0 ||
-        strcmp(findData.cFileName, "..") == 0) {
-      continue;
-    }
+  // Find all matching files (prioritize files over directories); if there are
+  // none, take a second pass that includes directories as a fallback
+  for (int pass = 0; pass < 2 && *num_matches == 0; pass++) {
+    for (int i = 0; i < entry_count; i++) {
+      if (pass == 0 && (entries[i].attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        continue;
+      }
 
-    // Check if file matches our pattern (case insensitive)
-    if (_strnicmp(findData.cFileName, search_pattern, strlen(search_pattern)) ==
-        0) {
-      // Add to matches - prioritize files
       if (*num_matches >= matches_capacity) {
         matches_capacity *= 2;
-        matches = (char **)realloc(matches, sizeof(char *) * matches_capacity);
+        matches =
+            (char **)realloc(matches, sizeof(char *) * matches_capacity);
         if (!matches) {
           fprintf(stderr, "lsh: allocation error in file tab completion\n");
-          FindClose(hFind);
+          free(entries);
           return NULL;
         }
       }
 
-      // Prioritize files by adding them first
-      if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-        matches[*num_matches] = _strdup(findData.cFileName);
-        (*num_matches)++;
-      }
-    }
-  } while (FindNextFile(hFind, &findData));
-
-  FindClose(hFind);
-
-  // If we didn't find any files, run the search again to include directories as
-  // fallback
-  if (*num_matches == 0) {
-    hFind = FindFirstFile(search_path, &findData);
-
-    if (hFind != INVALID_HANDLE_VALUE) {
-      do {
-        // Skip . and .. directories
-        if (strcmp(findData.cFileName, ".") == 0 ||
-            strcmp(findData.cFileName, "..") == 0) {
-          continue;
-        }
-
-        // This time include directories too
-        if (_strnicmp(findData.cFileName, search_pattern,
-                      strlen(search_pattern)) == 0) {
-          if (*num_matches >= matches_capacity) {
-            matches_capacity *= 2;
-            matches =
-                (char **)realloc(matches, sizeof(char *) * matches_capacity);
-            if (!matches) {
-              fprintf(stderr, "lsh: allocation error in file tab completion\n");
-              FindClose(hFind);
-              return NULL;
-            }
-          }
-
-          matches[*num_matches] = _strdup(findData.cFileName);
-          (*num_matches)++;
-        }
-      } while (FindNextFile(hFind, &findData));
-
-      FindClose(hFind);
+      matches[*num_matches] = _strdup(entries[i].name);
+      (*num_matches)++;
     }
   }
 
+  free(entries);
   return matches;
 }
 
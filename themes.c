@@ -4,6 +4,7 @@
  */
 
 #include "themes.h"
+#include "subsystems.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -309,6 +310,8 @@ void list_available_themes(void) {
  * @return 1 to continue shell execution, 0 to exit shell
  */
 int lsh_theme(char **args) {
+  ensure_subsystem(SUBSYSTEM_THEMES);
+
   if (args[1] == NULL) {
     // No arguments, show usage info and current theme
     printf("Usage: theme <command> [arguments]\n");
@@ -0,0 +1,394 @@
+/**
+ * thread_pool.c
+ * Implementation of a work-stealing worker pool
+ */
+
+#include "thread_pool.h"
+
+#define DEQUE_INITIAL_CAPACITY 64
+
+// A queued unit of work
+typedef struct {
+  ThreadPoolTaskFunc func;
+  void *arg;
+  ThreadPoolGroup *group; // NULL when the task belongs to no group
+} PoolTask;
+
+// Per-worker deque. The owner pushes and pops at the bottom, thieves take
+// from the top, so stolen work tends to be the oldest (largest) subtree.
+typedef struct {
+  PoolTask *tasks;
+  int capacity;
+  int top;    // Index of the oldest task
+  int bottom; // One past the newest task
+  CRITICAL_SECTION lock;
+} WorkDeque;
+
+typedef struct {
+  struct ThreadPool *pool;
+  int index;
+  HANDLE thread;
+  WorkDeque deque;
+} PoolWorker;
+
+struct ThreadPool {
+  PoolWorker *workers;
+  int worker_count;
+  volatile LONG next_worker;  // Round-robin cursor for external submits
+  volatile LONG queued;       // Tasks sitting in deques
+  volatile LONG outstanding;  // Tasks queued or running
+  volatile LONG shutting_down;
+  CRITICAL_SECTION sleep_lock;
+  CONDITION_VARIABLE work_available;
+  CONDITION_VARIABLE all_done;
+};
+
+// TLS slot holding the PoolWorker of the current thread
+static DWORD g_worker_tls = TLS_OUT_OF_INDEXES;
+static INIT_ONCE g_tls_once = INIT_ONCE_STATIC_INIT;
+
+// The pool every command shares, created on first use
+static ThreadPool *g_shared_pool = NULL;
+static INIT_ONCE g_shared_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK init_worker_tls(PINIT_ONCE once, PVOID param,
+                                     PVOID *context) {
+  g_worker_tls = TlsAlloc();
+  return g_worker_tls != TLS_OUT_OF_INDEXES;
+}
+
+/**
+ * Get the number of logical processors available to the shell
+ */
+int get_cpu_count(void) {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+static int deque_init(WorkDeque *deque) {
+  deque->tasks =
+      (PoolTask *)malloc(DEQUE_INITIAL_CAPACITY * sizeof(PoolTask));
+  if (!deque->tasks) {
+    return 0;
+  }
+  deque->capacity = DEQUE_INITIAL_CAPACITY;
+  deque->top = 0;
+  deque->bottom = 0;
+  InitializeCriticalSection(&deque->lock);
+  return 1;
+}
+
+static void deque_free(WorkDeque *deque) {
+  DeleteCriticalSection(&deque->lock);
+  free(deque->tasks);
+  deque->tasks = NULL;
+}
+
+/**
+ * Push a task at the bottom of a deque
+ */
+static int deque_push(WorkDeque *deque, PoolTask task) {
+  EnterCriticalSection(&deque->lock);
+
+  // Compact or grow when the bottom reaches the end of the buffer
+  if (deque->bottom >= deque->capacity) {
+    int count = deque->bottom - deque->top;
+    if (deque->top > deque->capacity / 2) {
+      memmove(deque->tasks, deque->tasks + deque->top,
+              count * sizeof(PoolTask));
+    } else {
+      PoolTask *grown = (PoolTask *)malloc(deque->capacity * 2 *
+                                           sizeof(PoolTask));
+      if (!grown) {
+        LeaveCriticalSection(&deque->lock);
+        return 0;
+      }
+      memcpy(grown, deque->tasks + deque->top, count * sizeof(PoolTask));
+      free(deque->tasks);
+      deque->tasks = grown;
+      deque->capacity *= 2;
+    }
+    deque->top = 0;
+    deque->bottom = count;
+  }
+
+  deque->tasks[deque->bottom++] = task;
+  LeaveCriticalSection(&deque->lock);
+  return 1;
+}
+
+/**
+ * Pop the newest task (owner side)
+ */
+static int deque_pop(WorkDeque *deque, PoolTask *task) {
+  int found = 0;
+  EnterCriticalSection(&deque->lock);
+  if (deque->bottom > deque->top) {
+    *task = deque->tasks[--deque->bottom];
+    found = 1;
+  }
+  if (deque->bottom == deque->top) {
+    deque->top = deque->bottom = 0;
+  }
+  LeaveCriticalSection(&deque->lock);
+  return found;
+}
+
+/**
+ * Steal the oldest task (thief side). Uses a try-lock so a thief never
+ * blocks behind a busy owner; it simply moves on to the next victim.
+ */
+static int deque_steal(WorkDeque *deque, PoolTask *task) {
+  int found = 0;
+  if (!TryEnterCriticalSection(&deque->lock)) {
+    return 0;
+  }
+  if (deque->bottom > deque->top) {
+    *task = deque->tasks[deque->top++];
+    found = 1;
+  }
+  LeaveCriticalSection(&deque->lock);
+  return found;
+}
+
+/**
+ * Find work for a worker: own deque first, then steal from the others
+ */
+static int find_task(PoolWorker *self, PoolTask *task) {
+  ThreadPool *pool = self->pool;
+
+  if (deque_pop(&self->deque, task)) {
+    return 1;
+  }
+
+  for (int i = 1; i < pool->worker_count; i++) {
+    PoolWorker *victim = &pool->workers[(self->index + i) % pool->worker_count];
+    if (deque_steal(&victim->deque, task)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Worker thread main loop
+ */
+static unsigned __stdcall worker_main(void *arg) {
+  PoolWorker *self = (PoolWorker *)arg;
+  ThreadPool *pool = self->pool;
+  PoolTask task;
+
+  TlsSetValue(g_worker_tls, self);
+
+  while (!pool->shutting_down) {
+    if (find_task(self, &task)) {
+      InterlockedDecrement(&pool->queued);
+      task.func(task.arg);
+
+      // Waiters for the pool and for each group share all_done
+      BOOL group_done =
+          task.group && InterlockedDecrement(&task.group->pending) == 0;
+      if (InterlockedDecrement(&pool->outstanding) == 0 || group_done) {
+        EnterCriticalSection(&pool->sleep_lock);
+        WakeAllConditionVariable(&pool->all_done);
+        LeaveCriticalSection(&pool->sleep_lock);
+      }
+      continue;
+    }
+
+    // Nothing to do anywhere - sleep until a submit wakes us. A thief may
+    // have lost a try-lock race, so wake periodically and look again.
+    EnterCriticalSection(&pool->sleep_lock);
+    if (pool->queued == 0 && !pool->shutting_down) {
+      SleepConditionVariableCS(&pool->work_available, &pool->sleep_lock, 50);
+    }
+    LeaveCriticalSection(&pool->sleep_lock);
+  }
+
+  return 0;
+}
+
+/**
+ * Create a pool of worker threads
+ */
+ThreadPool *thread_pool_create(int worker_count) {
+  if (!InitOnceExecuteOnce(&g_tls_once, init_worker_tls, NULL, NULL)) {
+    return NULL;
+  }
+
+  if (worker_count <= 0) {
+    worker_count = get_cpu_count();
+  }
+
+  ThreadPool *pool = (ThreadPool *)calloc(1, sizeof(ThreadPool));
+  if (!pool) {
+    return NULL;
+  }
+
+  pool->workers = (PoolWorker *)calloc(worker_count, sizeof(PoolWorker));
+  if (!pool->workers) {
+    free(pool);
+    return NULL;
+  }
+
+  InitializeCriticalSection(&pool->sleep_lock);
+  InitializeConditionVariable(&pool->work_available);
+  InitializeConditionVariable(&pool->all_done);
+
+  for (int i = 0; i < worker_count; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    if (!deque_init(&pool->workers[i].deque)) {
+      pool->worker_count = i;
+      thread_pool_destroy(pool);
+      return NULL;
+    }
+  }
+  pool->worker_count = worker_count;
+
+  for (int i = 0; i < worker_count; i++) {
+    pool->workers[i].thread = (HANDLE)_beginthreadex(
+        NULL, 0, worker_main, &pool->workers[i], 0, NULL);
+    if (!pool->workers[i].thread) {
+      thread_pool_destroy(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+static BOOL CALLBACK init_shared_pool(PINIT_ONCE once, PVOID param,
+                                      PVOID *context) {
+  g_shared_pool = thread_pool_create(0);
+  return TRUE;
+}
+
+/**
+ * Get the pool shared by every command
+ */
+ThreadPool *thread_pool_shared(void) {
+  InitOnceExecuteOnce(&g_shared_once, init_shared_pool, NULL, NULL);
+  return g_shared_pool;
+}
+
+/**
+ * Queue a task on the pool
+ */
+int thread_pool_submit(ThreadPool *pool, ThreadPoolTaskFunc func, void *arg) {
+  return thread_pool_submit_group(pool, NULL, func, arg);
+}
+
+/**
+ * Queue a task on the pool as part of a group
+ */
+int thread_pool_submit_group(ThreadPool *pool, ThreadPoolGroup *group,
+                             ThreadPoolTaskFunc func, void *arg) {
+  if (!pool || !func) {
+    return 0;
+  }
+
+  PoolTask task = {func, arg, group};
+  PoolWorker *self = (PoolWorker *)TlsGetValue(g_worker_tls);
+  WorkDeque *target;
+
+  if (self && self->pool == pool) {
+    target = &self->deque;
+  } else {
+    LONG slot = InterlockedIncrement(&pool->next_worker);
+    target = &pool->workers[(unsigned long)slot % pool->worker_count].deque;
+  }
+
+  InterlockedIncrement(&pool->outstanding);
+  if (group) {
+    InterlockedIncrement(&group->pending);
+  }
+  if (!deque_push(target, task)) {
+    if (group) {
+      InterlockedDecrement(&group->pending);
+    }
+    InterlockedDecrement(&pool->outstanding);
+    return 0;
+  }
+  InterlockedIncrement(&pool->queued);
+
+  EnterCriticalSection(&pool->sleep_lock);
+  WakeConditionVariable(&pool->work_available);
+  LeaveCriticalSection(&pool->sleep_lock);
+
+  return 1;
+}
+
+/**
+ * Block until all submitted tasks have finished
+ */
+void thread_pool_wait(ThreadPool *pool) {
+  if (!pool) {
+    return;
+  }
+
+  EnterCriticalSection(&pool->sleep_lock);
+  while (pool->outstanding > 0) {
+    SleepConditionVariableCS(&pool->all_done, &pool->sleep_lock, INFINITE);
+  }
+  LeaveCriticalSection(&pool->sleep_lock);
+}
+
+/**
+ * Block until all tasks of a group have finished
+ */
+void thread_pool_wait_group(ThreadPool *pool, ThreadPoolGroup *group) {
+  if (!pool) {
+    return;
+  }
+
+  EnterCriticalSection(&pool->sleep_lock);
+  while (group->pending > 0) {
+    SleepConditionVariableCS(&pool->all_done, &pool->sleep_lock, INFINITE);
+  }
+  LeaveCriticalSection(&pool->sleep_lock);
+}
+
+/**
+ * Stop the workers and free the pool
+ */
+void thread_pool_destroy(ThreadPool *pool) {
+  if (!pool) {
+    return;
+  }
+
+  EnterCriticalSection(&pool->sleep_lock);
+  InterlockedExchange(&pool->shutting_down, 1);
+  WakeAllConditionVariable(&pool->work_available);
+  LeaveCriticalSection(&pool->sleep_lock);
+
+  for (int i = 0; i < pool->worker_count; i++) {
+    if (pool->workers[i].thread) {
+      WaitForSingleObject(pool->workers[i].thread, INFINITE);
+      CloseHandle(pool->workers[i].thread);
+    }
+    deque_free(&pool->workers[i].deque);
+  }
+
+  DeleteCriticalSection(&pool->sleep_lock);
+  free(pool->workers);
+  free(pool);
+}
+
+/**
+ * Get the number of workers in a pool
+ */
+int thread_pool_size(ThreadPool *pool) { return pool ? pool->worker_count : 0; }
+
+/**
+ * Get the index of the calling worker thread
+ */
+int thread_pool_worker_index(void) {
+  if (g_worker_tls == TLS_OUT_OF_INDEXES) {
+    return -1;
+  }
+  PoolWorker *self = (PoolWorker *)TlsGetValue(g_worker_tls);
+  return self ? self->index : -1;
+}
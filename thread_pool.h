@@ -0,0 +1,120 @@
+/**
+ * thread_pool.h
+ * Work-stealing worker pool shared by commands that fan work out over cores
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "common.h"
+
+/**
+ * Task function executed by a pool worker
+ *
+ * @param arg Argument passed to thread_pool_submit
+ */
+typedef void (*ThreadPoolTaskFunc)(void *arg);
+
+typedef struct ThreadPool ThreadPool;
+
+// Tasks that are waited for together. The pool is shared, so a command
+// waits for the tasks it submitted through a group rather than for the
+// whole pool. Starts zeroed: ThreadPoolGroup group = {0};
+typedef struct {
+  volatile LONG pending; // Tasks of the group queued or running
+} ThreadPoolGroup;
+
+/**
+ * Get the number of logical processors available to the shell
+ *
+ * @return Processor count (at least 1)
+ */
+int get_cpu_count(void);
+
+/**
+ * Create a pool of worker threads, each owning a work-stealing deque
+ *
+ * @param worker_count Number of workers, or 0 to use one per core
+ * @return New pool, or NULL on failure
+ */
+ThreadPool *thread_pool_create(int worker_count);
+
+/**
+ * Get the pool shared by every command, with one worker per core. It is
+ * created on first use and kept for the life of the process, so commands
+ * running at the same time (a search feeding the picker, the file index
+ * filling a tree) split the cores rather than each starting a worker per
+ * core.
+ *
+ * @return The shared pool, or NULL if it could not be created
+ */
+ThreadPool *thread_pool_shared(void);
+
+/**
+ * Queue a task on the pool
+ *
+ * Tasks submitted from inside a worker go to the bottom of that worker's own
+ * deque (LIFO, cache friendly); tasks submitted from other threads are
+ * distributed round-robin. Idle workers steal from the top of other deques.
+ *
+ * @param pool The pool
+ * @param func Task function
+ * @param arg Argument for the task function
+ * @return 1 if queued, 0 on failure
+ */
+int thread_pool_submit(ThreadPool *pool, ThreadPoolTaskFunc func, void *arg);
+
+/**
+ * Queue a task on the pool as part of a group (see thread_pool_submit)
+ *
+ * @param pool The pool
+ * @param group Group the task counts towards until it finishes
+ * @param func Task function
+ * @param arg Argument for the task function
+ * @return 1 if queued, 0 on failure (the group is left unchanged)
+ */
+int thread_pool_submit_group(ThreadPool *pool, ThreadPoolGroup *group,
+                             ThreadPoolTaskFunc func, void *arg);
+
+/**
+ * Block until every task of a group, including tasks the group's tasks
+ * submitted to it, has finished. Other tasks on the pool are not waited
+ * for.
+ *
+ * @param pool The pool the group's tasks were submitted to
+ * @param group The group
+ */
+void thread_pool_wait_group(ThreadPool *pool, ThreadPoolGroup *group);
+
+/**
+ * Block until every submitted task, including tasks submitted by other tasks,
+ * has finished
+ *
+ * @param pool The pool
+ */
+void thread_pool_wait(ThreadPool *pool);
+
+/**
+ * Stop the workers and free the pool. Pending tasks are discarded.
+ *
+ * @param pool The pool
+ */
+void thread_pool_destroy(ThreadPool *pool);
+
+/**
+ * Get the number of workers in a pool
+ *
+ * @param pool The pool
+ * @return Worker count
+ */
+int thread_pool_size(ThreadPool *pool);
+
+/**
+ * Get the index of the calling worker thread
+ *
+ * @return Worker index in [0, thread_pool_size), or -1 when not called from a
+ *         pool worker
+ */
+int thread_pool_worker_index(void);
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,1012 @@
+/**
+ * trigram_index.c
+ * Implementation of the persistent trigram index: a forward list of
+ * trigrams per file, kept so unchanged files need not be read again, and
+ * the inverted posting lists built from them for queries
+ */
+
+#include "trigram_index.h"
+#include "file_index.h"
+#include "ignore_rules.h"
+#include "mapped_file.h"
+#include <limits.h>
+
+// On-disk layout, all integers little-endian:
+//   header         "LTGI", version, file count, trigram count, root length,
+//                  paths size, forward lists size, postings size
+//   root           full path of the indexed tree, to catch hash collisions
+//   file table     per file: size (64 bits), mtime (64 bits), path offset,
+//                  forward list offset and length
+//   paths          NUL-terminated, relative to the root
+//   forward lists  per file, its sorted trigrams as varint coded gaps
+//   trigram table  per trigram, in order: trigram, postings offset, length
+//   postings       per trigram, its sorted file numbers as varint coded gaps
+#define INDEX_MAGIC "LTGI"
+#define INDEX_VERSION 1
+#define HEADER_SIZE 32
+#define FILE_ENTRY_SIZE 28
+#define TRIGRAM_ENTRY_SIZE 12
+
+// Trigrams are three case-folded bytes
+#define TRIGRAM_SPACE (1 << 24)
+#define TRIGRAM_WORDS (TRIGRAM_SPACE / 64)
+
+struct TrigramIndex {
+  MappedFile file;
+  char root[MAX_PATH];
+  int file_count;
+  int trigram_count;
+  const unsigned char *files;
+  const char *paths;
+  const unsigned char *forward;
+  const unsigned char *trigrams;
+  const unsigned char *postings;
+  unsigned int postings_size;
+};
+
+// A file found by the walk, with its trigrams either carried over from the
+// previous index or read again
+typedef struct {
+  char *path; // Relative to the root
+  unsigned long long size;
+  unsigned long long mtime;
+  int old_file;                // Number in the previous index, or -1
+  const unsigned char *forward;
+  unsigned int forward_length;
+  unsigned char *owned; // Forward list read this time
+} IndexEntry;
+
+// Per-thread state for reading files: a bit per trigram seen in the
+// current file, and the trigrams in the order they were first seen
+typedef struct {
+  unsigned long long *seen;
+  unsigned int *list;
+  int capacity;
+} TrigramScratch;
+
+// The files of one directory, recorded together
+typedef struct EntryBatch {
+  struct EntryBatch *next;
+  int count;
+  IndexEntry *items[1];
+} EntryBatch;
+
+typedef struct {
+  const char *root;
+  size_t root_length;
+  const TrigramIndex *old;
+  int *old_slots; // Hash of the previous index's paths: file number + 1
+  unsigned int old_mask;
+  ThreadPool *pool;
+  ThreadPoolGroup tasks;   // The build's walk and read tasks on the pool
+  TrigramScratch *scratch; // One per pool worker, plus one for the caller
+  int scratch_count;
+  CRITICAL_SECTION lock;
+  EntryBatch *batches; // Filled by the walk
+  IndexEntry **entries; // All files, sorted by path once the walk is done
+  int count;
+  volatile LONG reindexed;
+} IndexBuild;
+
+typedef struct {
+  IndexBuild *build;
+  char path[MAX_PATH];
+} WalkTask;
+
+typedef struct {
+  IndexBuild *build;
+  IndexEntry *entry;
+} ReadTask;
+
+// ---------------------------------------------------------------------------
+// Encoding
+// ---------------------------------------------------------------------------
+
+static unsigned int read_le32(const unsigned char *p) {
+  return (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+         ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned long long read_le64(const unsigned char *p) {
+  return (unsigned long long)read_le32(p) |
+         ((unsigned long long)read_le32(p + 4) << 32);
+}
+
+static void put_le32(unsigned char *p, unsigned int value) {
+  p[0] = (unsigned char)value;
+  p[1] = (unsigned char)(value >> 8);
+  p[2] = (unsigned char)(value >> 16);
+  p[3] = (unsigned char)(value >> 24);
+}
+
+static void put_le64(unsigned char *p, unsigned long long value) {
+  put_le32(p, (unsigned int)value);
+  put_le32(p + 4, (unsigned int)(value >> 32));
+}
+
+static int varint_size(unsigned int value) {
+  int size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+static unsigned char *put_varint(unsigned char *p, unsigned int value) {
+  while (value >= 0x80) {
+    *p++ = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (unsigned char)value;
+  return p;
+}
+
+/**
+ * Decode a varint
+ * @return Position after it, or NULL if it runs past end
+ */
+static const unsigned char *read_varint(const unsigned char *p,
+                                        const unsigned char *end,
+                                        unsigned int *value) {
+  unsigned int result = 0;
+  for (int shift = 0; shift < 35 && p < end; shift += 7) {
+    unsigned char byte = *p++;
+    result |= (unsigned int)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static int popcount64(unsigned long long x) {
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+static unsigned char fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + 32) : c;
+}
+
+static unsigned int path_hash(const char *path) {
+  unsigned int hash = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+    hash = (hash ^ fold(*p)) * 16777619u;
+  }
+  return hash;
+}
+
+// ---------------------------------------------------------------------------
+// Reading an index
+// ---------------------------------------------------------------------------
+
+static const unsigned char *file_entry(const TrigramIndex *index, int file) {
+  return index->files + (size_t)file * FILE_ENTRY_SIZE;
+}
+
+/**
+ * Map an index file and check that its sections fit together
+ */
+static TrigramIndex *open_index(const char *path, const char *full_root,
+                                const char *root) {
+  TrigramIndex *index = (TrigramIndex *)calloc(1, sizeof(TrigramIndex));
+  if (!index) {
+    return NULL;
+  }
+  if (!map_file(path, &index->file) || index->file.size < HEADER_SIZE ||
+      memcmp(index->file.data, INDEX_MAGIC, 4) != 0 ||
+      read_le32(index->file.data + 4) != INDEX_VERSION) {
+    trigram_index_close(index);
+    return NULL;
+  }
+
+  const unsigned char *header = index->file.data;
+  unsigned int file_count = read_le32(header + 8);
+  unsigned int trigram_count = read_le32(header + 12);
+  unsigned int root_length = read_le32(header + 16);
+  unsigned int paths_size = read_le32(header + 20);
+  unsigned int forward_size = read_le32(header + 24);
+  unsigned int postings_size = read_le32(header + 28);
+
+  unsigned long long expected =
+      HEADER_SIZE + (unsigned long long)root_length +
+      (unsigned long long)file_count * FILE_ENTRY_SIZE + paths_size +
+      forward_size + (unsigned long long)trigram_count * TRIGRAM_ENTRY_SIZE +
+      postings_size;
+  if (expected != index->file.size || file_count > INT_MAX ||
+      trigram_count > TRIGRAM_SPACE || root_length != strlen(full_root) ||
+      _strnicmp((const char *)header + HEADER_SIZE, full_root,
+                root_length) != 0) {
+    trigram_index_close(index);
+    return NULL;
+  }
+
+  const unsigned char *p = header + HEADER_SIZE + root_length;
+  index->files = p;
+  p += (size_t)file_count * FILE_ENTRY_SIZE;
+  index->paths = (const char *)p;
+  p += paths_size;
+  index->forward = p;
+  p += forward_size;
+  index->trigrams = p;
+  p += (size_t)trigram_count * TRIGRAM_ENTRY_SIZE;
+  index->postings = p;
+  index->postings_size = postings_size;
+  index->file_count = (int)file_count;
+  index->trigram_count = (int)trigram_count;
+  snprintf(index->root, sizeof(index->root), "%s", root);
+
+  // Every path must end inside the paths section and every forward list
+  // inside its own
+  if (paths_size > 0 && index->paths[paths_size - 1] != '\0') {
+    trigram_index_close(index);
+    return NULL;
+  }
+  for (int i = 0; i < index->file_count; i++) {
+    const unsigned char *entry = file_entry(index, i);
+    unsigned int path_offset = read_le32(entry + 16);
+    unsigned long long forward_end =
+        (unsigned long long)read_le32(entry + 20) + read_le32(entry + 24);
+    if (path_offset >= paths_size || forward_end > forward_size) {
+      trigram_index_close(index);
+      return NULL;
+    }
+  }
+
+  return index;
+}
+
+/**
+ * Close an index
+ */
+void trigram_index_close(TrigramIndex *index) {
+  if (index) {
+    unmap_file(&index->file);
+    free(index);
+  }
+}
+
+/**
+ * Get the number of files in an index
+ */
+int trigram_index_file_count(const TrigramIndex *index) {
+  return index->file_count;
+}
+
+static const char *relative_path(const TrigramIndex *index, int file) {
+  return index->paths + read_le32(file_entry(index, file) + 16);
+}
+
+/**
+ * Get the path of an indexed file
+ */
+void trigram_index_file_path(const TrigramIndex *index, int file, char *path,
+                             size_t size) {
+  snprintf(path, size, "%s\\%s", index->root, relative_path(index, file));
+}
+
+/**
+ * Find a trigram's posting list
+ * @return Start of the list, or NULL if no file holds the trigram
+ */
+static const unsigned char *find_postings(const TrigramIndex *index,
+                                          unsigned int trigram,
+                                          unsigned int *length) {
+  int low = 0;
+  int high = index->trigram_count - 1;
+  while (low <= high) {
+    int mid = low + (high - low) / 2;
+    const unsigned char *entry =
+        index->trigrams + (size_t)mid * TRIGRAM_ENTRY_SIZE;
+    unsigned int value = read_le32(entry);
+    if (value < trigram) {
+      low = mid + 1;
+    } else if (value > trigram) {
+      high = mid - 1;
+    } else {
+      unsigned int offset = read_le32(entry + 4);
+      *length = read_le32(entry + 8);
+      if ((unsigned long long)offset + *length > index->postings_size) {
+        return NULL;
+      }
+      return index->postings + offset;
+    }
+  }
+  return NULL;
+}
+
+static int compare_trigrams(const void *a, const void *b) {
+  unsigned int x = *(const unsigned int *)a;
+  unsigned int y = *(const unsigned int *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Mark the files that may contain a string
+ */
+int trigram_index_mark(const TrigramIndex *index, const char *literal,
+                       int ignore_case, unsigned char *candidates) {
+  const unsigned char *text = (const unsigned char *)literal;
+  size_t length = strlen(literal);
+  if (length < 3) {
+    return 0;
+  }
+
+  // Matches never span lines, so neither do indexed trigrams
+  unsigned int *query =
+      (unsigned int *)malloc((length - 2) * sizeof(unsigned int));
+  if (!query) {
+    return 0;
+  }
+  int count = 0;
+  for (size_t i = 0; i + 2 < length; i++) {
+    unsigned char a = text[i], b = text[i + 1], c = text[i + 2];
+    if (a == '\n' || b == '\n' || c == '\n' || a == '\r' || b == '\r' ||
+        c == '\r' || (ignore_case && (a | b | c) >= 0x80)) {
+      continue;
+    }
+    query[count++] = ((unsigned int)fold(a) << 16) |
+                     ((unsigned int)fold(b) << 8) | fold(c);
+  }
+  qsort(query, count, sizeof(unsigned int), compare_trigrams);
+  int unique = 0;
+  for (int i = 0; i < count; i++) {
+    if (unique == 0 || query[unique - 1] != query[i]) {
+      query[unique++] = query[i];
+    }
+  }
+  if (unique == 0) {
+    free(query);
+    return 0;
+  }
+
+  // Start from the shortest list; a missing trigram rules out every file
+  const unsigned char *shortest = NULL;
+  unsigned int shortest_length = 0;
+  for (int i = 0; i < unique; i++) {
+    unsigned int list_length;
+    const unsigned char *list = find_postings(index, query[i], &list_length);
+    if (!list) {
+      free(query);
+      return 1;
+    }
+    if (!shortest || list_length < shortest_length) {
+      shortest = list;
+      shortest_length = list_length;
+    }
+  }
+
+  // Each posting takes at least a byte
+  int *files = (int *)malloc((shortest_length + 1) * sizeof(int));
+  if (!files) {
+    free(query);
+    return 0;
+  }
+  int file_count = 0;
+  const unsigned char *p = shortest;
+  const unsigned char *end = shortest + shortest_length;
+  int file = -1;
+  unsigned int gap;
+  while (p < end && (p = read_varint(p, end, &gap)) != NULL) {
+    file += (int)gap + 1;
+    files[file_count++] = file;
+  }
+
+  // Intersect with the other lists, walking each once
+  for (int i = 0; i < unique && file_count > 0; i++) {
+    unsigned int list_length;
+    const unsigned char *list = find_postings(index, query[i], &list_length);
+    if (list == shortest) {
+      continue;
+    }
+    p = list;
+    end = list + list_length;
+    file = -1;
+    int kept = 0;
+    for (int k = 0; k < file_count; k++) {
+      while (file < files[k] && p && p < end) {
+        p = read_varint(p, end, &gap);
+        if (p) {
+          file += (int)gap + 1;
+        }
+      }
+      if (file == files[k]) {
+        files[kept++] = files[k];
+      }
+    }
+    file_count = kept;
+  }
+
+  for (int i = 0; i < file_count; i++) {
+    if (files[i] >= 0 && files[i] < index->file_count) {
+      candidates[files[i]] = 1;
+    }
+  }
+
+  free(files);
+  free(query);
+  return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Building an index
+// ---------------------------------------------------------------------------
+
+/**
+ * Read a file's trigrams into a varint coded forward list. Binary files
+ * get an empty list, so they are never candidates.
+ */
+static void read_trigrams(IndexEntry *entry, const char *path,
+                          TrigramScratch *scratch) {
+  MappedFile file;
+  if (!map_file(path, &file)) {
+    return;
+  }
+  if (looks_binary(file.data, file.size)) {
+    unmap_file(&file);
+    return;
+  }
+
+  if (!scratch->seen) {
+    scratch->seen = (unsigned long long *)calloc(TRIGRAM_WORDS,
+                                                 sizeof(unsigned long long));
+    if (!scratch->seen) {
+      unmap_file(&file);
+      return;
+    }
+  }
+
+  int count = 0;
+  unsigned int trigram = 0;
+  int run = 0;
+  for (size_t i = 0; i < file.size; i++) {
+    unsigned char c = fold(file.data[i]);
+    if (c == '\n' || c == '\r') {
+      run = 0;
+      continue;
+    }
+    trigram = ((trigram << 8) | c) & (TRIGRAM_SPACE - 1);
+    if (++run < 3) {
+      continue;
+    }
+
+    unsigned long long bit = 1ULL << (trigram & 63);
+    if (scratch->seen[trigram >> 6] & bit) {
+      continue;
+    }
+    if (count == scratch->capacity) {
+      int capacity = scratch->capacity ? scratch->capacity * 2 : 4096;
+      unsigned int *list = (unsigned int *)realloc(
+          scratch->list, capacity * sizeof(unsigned int));
+      if (!list) {
+        break;
+      }
+      scratch->list = list;
+      scratch->capacity = capacity;
+    }
+    scratch->seen[trigram >> 6] |= bit;
+    scratch->list[count++] = trigram;
+  }
+  unmap_file(&file);
+
+  qsort(scratch->list, count, sizeof(unsigned int), compare_trigrams);
+
+  // Trigrams fit in 24 bits, so no gap takes more than four bytes
+  entry->owned = (unsigned char *)malloc((size_t)count * 4 + 1);
+  if (entry->owned) {
+    unsigned char *out = entry->owned;
+    int previous = -1;
+    for (int i = 0; i < count; i++) {
+      out = put_varint(out, scratch->list[i] - (unsigned int)(previous + 1));
+      previous = (int)scratch->list[i];
+    }
+    entry->forward = entry->owned;
+    entry->forward_length = (unsigned int)(out - entry->owned);
+  }
+
+  for (int i = 0; i < count; i++) {
+    scratch->seen[scratch->list[i] >> 6] = 0;
+  }
+}
+
+static void run_read_task(void *arg) {
+  ReadTask *task = (ReadTask *)arg;
+  IndexBuild *build = task->build;
+
+  char path[MAX_PATH];
+  snprintf(path, sizeof(path), "%s\\%s", build->root, task->entry->path);
+  read_trigrams(task->entry, path,
+                &build->scratch[thread_pool_worker_index() + 1]);
+  InterlockedIncrement(&build->reindexed);
+  free(task);
+}
+
+/**
+ * Find a path in the previous index
+ * @return Its file number, or -1
+ */
+static int find_old_file(const IndexBuild *build, const char *path) {
+  if (!build->old) {
+    return -1;
+  }
+  for (unsigned int slot = path_hash(path) & build->old_mask;
+       build->old_slots[slot]; slot = (slot + 1) & build->old_mask) {
+    int file = build->old_slots[slot] - 1;
+    if (_stricmp(relative_path(build->old, file), path) == 0) {
+      return file;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Record a file, carrying its trigrams over from the previous index if its
+ * size and modification time are unchanged, and queueing a read otherwise
+ */
+static IndexEntry *add_file(IndexBuild *build, const char *full_path,
+                            const FileIndexEntry *file) {
+  IndexEntry *entry = (IndexEntry *)calloc(1, sizeof(IndexEntry));
+  if (!entry) {
+    return NULL;
+  }
+  entry->path = _strdup(full_path + build->root_length + 1);
+  if (!entry->path) {
+    free(entry);
+    return NULL;
+  }
+  entry->size = file->size;
+  entry->mtime =
+      ((unsigned long long)file->write_time.dwHighDateTime << 32) |
+      file->write_time.dwLowDateTime;
+
+  entry->old_file = find_old_file(build, entry->path);
+  if (entry->old_file >= 0) {
+    const unsigned char *old = file_entry(build->old, entry->old_file);
+    if (read_le64(old) == entry->size && read_le64(old + 8) == entry->mtime) {
+      entry->forward = build->old->forward + read_le32(old + 20);
+      entry->forward_length = read_le32(old + 24);
+      return entry;
+    }
+  }
+
+  ReadTask *task = (ReadTask *)malloc(sizeof(ReadTask));
+  if (task) {
+    task->build = build;
+    task->entry = entry;
+    if (!thread_pool_submit_group(build->pool, &build->tasks, run_read_task,
+                                  task)) {
+      run_read_task(task);
+    }
+  }
+  return entry;
+}
+
+static void queue_walk_task(IndexBuild *build, const char *path);
+
+/**
+ * Enumerate one directory from the shared file index: queue its
+ * subdirectories, record its files
+ */
+static void run_walk_task(void *arg) {
+  WalkTask *task = (WalkTask *)arg;
+  IndexBuild *build = task->build;
+
+  FileIndexEntry *files = NULL;
+  int file_count = file_index_list(build->root, task->path, &files);
+  if (file_count < 0) {
+    free(task);
+    return;
+  }
+
+  IndexEntry **found = NULL;
+  int found_count = 0;
+  int found_capacity = 0;
+
+  for (int i = 0; i < file_count; i++) {
+    // Hidden entries, version control directories among them, are skipped
+    // as grep skips them
+    if (files[i].name[0] == '.' || files[i].ignored) {
+      continue;
+    }
+
+    char full_path[MAX_PATH];
+    snprintf(full_path, sizeof(full_path), "%s\\%s", task->path,
+             files[i].name);
+    if (files[i].attributes & FILE_ATTRIBUTE_DIRECTORY) {
+      queue_walk_task(build, full_path);
+      continue;
+    }
+
+    if (found_count == found_capacity) {
+      int capacity = found_capacity ? found_capacity * 2 : 64;
+      IndexEntry **grown =
+          (IndexEntry **)realloc(found, capacity * sizeof(IndexEntry *));
+      if (!grown) {
+        break;
+      }
+      found = grown;
+      found_capacity = capacity;
+    }
+    IndexEntry *entry = add_file(build, full_path, &files[i]);
+    if (entry) {
+      found[found_count++] = entry;
+    }
+  }
+
+  free(files);
+
+  // One lock per directory rather than per file
+  EntryBatch *batch = NULL;
+  if (found_count > 0) {
+    batch = (EntryBatch *)malloc(sizeof(EntryBatch) +
+                                 found_count * sizeof(IndexEntry *));
+  }
+  if (batch) {
+    batch->count = found_count;
+    memcpy(batch->items, found, found_count * sizeof(IndexEntry *));
+    EnterCriticalSection(&build->lock);
+    batch->next = build->batches;
+    build->batches = batch;
+    build->count += found_count;
+    LeaveCriticalSection(&build->lock);
+  }
+  // Out of memory, the directory's files are left out of the index; their
+  // entries stay allocated, as reads of them may still be in flight
+
+  free(found);
+  free(task);
+}
+
+static void queue_walk_task(IndexBuild *build, const char *path) {
+  WalkTask *task = (WalkTask *)malloc(sizeof(WalkTask));
+  if (!task) {
+    return;
+  }
+  task->build = build;
+  snprintf(task->path, sizeof(task->path), "%s", path);
+
+  if (!thread_pool_submit_group(build->pool, &build->tasks, run_walk_task,
+                                task)) {
+    run_walk_task(task);
+  }
+}
+
+static int compare_entries(const void *a, const void *b) {
+  const IndexEntry *x = *(const IndexEntry *const *)a;
+  const IndexEntry *y = *(const IndexEntry *const *)b;
+  int result = _stricmp(x->path, y->path);
+  return result ? result : strcmp(x->path, y->path);
+}
+
+static void free_entries(IndexBuild *build) {
+  while (build->batches) {
+    EntryBatch *batch = build->batches;
+    build->batches = batch->next;
+    for (int i = 0; i < batch->count; i++) {
+      free(batch->items[i]->path);
+      free(batch->items[i]->owned);
+      free(batch->items[i]);
+    }
+    free(batch);
+  }
+  free(build->entries);
+}
+
+/**
+ * Write an index holding the walked files, building the posting lists from
+ * their forward lists
+ * @return 1 on success
+ */
+static int write_index(const IndexBuild *build, const char *full_root,
+                       const char *path) {
+  IndexEntry *const *entries = build->entries;
+  int count = build->count;
+  int success = 0;
+
+  unsigned long long paths_size = 0;
+  unsigned long long forward_size = 0;
+  for (int i = 0; i < count; i++) {
+    paths_size += strlen(entries[i]->path) + 1;
+    forward_size += entries[i]->forward_length;
+  }
+
+  // The trigrams present, and each one's rank among them
+  unsigned long long *present = (unsigned long long *)calloc(
+      TRIGRAM_WORDS, sizeof(unsigned long long));
+  unsigned int *rank = (unsigned int *)malloc(TRIGRAM_WORDS *
+                                              sizeof(unsigned int));
+  unsigned int *sizes = NULL;
+  unsigned int *offsets = NULL;
+  int *last = NULL;
+  unsigned char *postings = NULL;
+  FILE *out = NULL;
+  if (!present || !rank) {
+    goto cleanup;
+  }
+
+  for (int i = 0; i < count; i++) {
+    const unsigned char *p = entries[i]->forward;
+    const unsigned char *end = p + entries[i]->forward_length;
+    unsigned int trigram = (unsigned int)-1;
+    unsigned int gap;
+    while (p < end && (p = read_varint(p, end, &gap)) != NULL) {
+      trigram += gap + 1;
+      present[(trigram >> 6) & (TRIGRAM_WORDS - 1)] |= 1ULL << (trigram & 63);
+    }
+  }
+  unsigned int trigram_count = 0;
+  for (int w = 0; w < TRIGRAM_WORDS; w++) {
+    rank[w] = trigram_count;
+    trigram_count += popcount64(present[w]);
+  }
+
+  // Size each posting list, then encode them all into one buffer; files
+  // are visited in order, so each list comes out sorted
+  sizes = (unsigned int *)calloc(trigram_count + 1, sizeof(unsigned int));
+  offsets = (unsigned int *)malloc((trigram_count + 1) * sizeof(unsigned int));
+  last = (int *)malloc((trigram_count + 1) * sizeof(int));
+  if (!sizes || !offsets || !last) {
+    goto cleanup;
+  }
+
+  unsigned long long postings_size = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    for (unsigned int t = 0; t < trigram_count; t++) {
+      last[t] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+      const unsigned char *p = entries[i]->forward;
+      const unsigned char *end = p + entries[i]->forward_length;
+      unsigned int trigram = (unsigned int)-1;
+      unsigned int gap;
+      while (p < end && (p = read_varint(p, end, &gap)) != NULL) {
+        trigram += gap + 1;
+        unsigned int word = (trigram >> 6) & (TRIGRAM_WORDS - 1);
+        unsigned int dense =
+            rank[word] +
+            popcount64(present[word] & ((1ULL << (trigram & 63)) - 1));
+        unsigned int value = (unsigned int)(i - last[dense] - 1);
+        last[dense] = i;
+        if (pass == 0) {
+          sizes[dense] += varint_size(value);
+        } else {
+          offsets[dense] = (unsigned int)(
+              put_varint(postings + offsets[dense], value) - postings);
+        }
+      }
+    }
+
+    if (pass == 0) {
+      for (unsigned int t = 0; t < trigram_count; t++) {
+        offsets[t] = (unsigned int)postings_size;
+        postings_size += sizes[t];
+      }
+      if (paths_size > UINT_MAX || forward_size > UINT_MAX ||
+          postings_size > UINT_MAX) {
+        goto cleanup;
+      }
+      postings = (unsigned char *)malloc((size_t)postings_size + 1);
+      if (!postings) {
+        goto cleanup;
+      }
+    }
+  }
+
+  out = fopen(path, "wb");
+  if (!out) {
+    goto cleanup;
+  }
+
+  unsigned char header[HEADER_SIZE];
+  memcpy(header, INDEX_MAGIC, 4);
+  put_le32(header + 4, INDEX_VERSION);
+  put_le32(header + 8, (unsigned int)count);
+  put_le32(header + 12, trigram_count);
+  put_le32(header + 16, (unsigned int)strlen(full_root));
+  put_le32(header + 20, (unsigned int)paths_size);
+  put_le32(header + 24, (unsigned int)forward_size);
+  put_le32(header + 28, (unsigned int)postings_size);
+  fwrite(header, 1, sizeof(header), out);
+  fwrite(full_root, 1, strlen(full_root), out);
+
+  unsigned int path_offset = 0;
+  unsigned int forward_offset = 0;
+  for (int i = 0; i < count; i++) {
+    unsigned char entry[FILE_ENTRY_SIZE];
+    put_le64(entry, entries[i]->size);
+    put_le64(entry + 8, entries[i]->mtime);
+    put_le32(entry + 16, path_offset);
+    put_le32(entry + 20, forward_offset);
+    put_le32(entry + 24, entries[i]->forward_length);
+    fwrite(entry, 1, sizeof(entry), out);
+    path_offset += (unsigned int)strlen(entries[i]->path) + 1;
+    forward_offset += entries[i]->forward_length;
+  }
+  for (int i = 0; i < count; i++) {
+    fwrite(entries[i]->path, 1, strlen(entries[i]->path) + 1, out);
+  }
+  for (int i = 0; i < count; i++) {
+    if (entries[i]->forward_length > 0) {
+      fwrite(entries[i]->forward, 1, entries[i]->forward_length, out);
+    }
+  }
+
+  // offsets now hold each list's end
+  unsigned int dense = 0;
+  for (unsigned int w = 0; w < TRIGRAM_WORDS; w++) {
+    for (unsigned long long bits = present[w]; bits; bits &= bits - 1) {
+      unsigned int bit = 0;
+      while (!(bits & (1ULL << bit))) {
+        bit++;
+      }
+      unsigned char entry[TRIGRAM_ENTRY_SIZE];
+      put_le32(entry, (w << 6) | bit);
+      put_le32(entry + 4, offsets[dense] - sizes[dense]);
+      put_le32(entry + 8, sizes[dense]);
+      fwrite(entry, 1, sizeof(entry), out);
+      dense++;
+    }
+  }
+  fwrite(postings, 1, (size_t)postings_size, out);
+
+  success = !ferror(out);
+
+cleanup:
+  if (out && fclose(out) != 0) {
+    success = 0;
+  }
+  if (out && !success) {
+    remove(path);
+  }
+  free(postings);
+  free(last);
+  free(offsets);
+  free(sizes);
+  free(rank);
+  free(present);
+  return success;
+}
+
+/**
+ * Get the path of the index for a tree
+ */
+static int get_index_path(const char *full_root, char *path, size_t size) {
+  char *home_dir = getenv("USERPROFILE");
+  if (!home_dir) {
+    return 0;
+  }
+
+  char directory[MAX_PATH];
+  snprintf(directory, sizeof(directory), "%s\\.lsh_grep_index", home_dir);
+  CreateDirectory(directory, NULL);
+
+  unsigned long long hash = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)full_root; *p; p++) {
+    hash = (hash ^ fold(*p)) * 1099511628211ULL;
+  }
+  snprintf(path, size, "%s\\%016llx.idx", directory, hash);
+  return 1;
+}
+
+/**
+ * Bring the index of a directory tree up to date and open it
+ */
+TrigramIndex *trigram_index_update(const char *root, ThreadPool *pool,
+                                   TrigramIndexStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  char full_root[MAX_PATH];
+  DWORD length = GetFullPathName(root, sizeof(full_root), full_root, NULL);
+  if (length == 0 || length >= sizeof(full_root)) {
+    return NULL;
+  }
+  while (length > 3 && full_root[length - 1] == '\\') {
+    full_root[--length] = '\0';
+  }
+
+  char index_path[MAX_PATH];
+  if (!get_index_path(full_root, index_path, sizeof(index_path))) {
+    return NULL;
+  }
+
+  IndexBuild build;
+  memset(&build, 0, sizeof(build));
+  build.root = root;
+  build.root_length = strlen(root);
+  build.pool = pool;
+  build.old = open_index(index_path, full_root, root);
+  InitializeCriticalSection(&build.lock);
+
+  TrigramIndex *result = NULL;
+  build.scratch_count = thread_pool_size(pool) + 1;
+  build.scratch =
+      (TrigramScratch *)calloc(build.scratch_count, sizeof(TrigramScratch));
+  if (!build.scratch) {
+    goto cleanup;
+  }
+
+  if (build.old) {
+    unsigned int slots = 16;
+    while (slots < (unsigned int)build.old->file_count * 2) {
+      slots *= 2;
+    }
+    build.old_slots = (int *)calloc(slots, sizeof(int));
+    if (!build.old_slots) {
+      goto cleanup;
+    }
+    build.old_mask = slots - 1;
+    for (int i = 0; i < build.old->file_count; i++) {
+      unsigned int slot = path_hash(relative_path(build.old, i)) & build.old_mask;
+      while (build.old_slots[slot]) {
+        slot = (slot + 1) & build.old_mask;
+      }
+      build.old_slots[slot] = i + 1;
+    }
+  }
+
+  // Walk the tree; reads of new and changed files run alongside
+  queue_walk_task(&build, root);
+  thread_pool_wait_group(pool, &build.tasks);
+
+  build.entries = (IndexEntry **)malloc((build.count + 1) *
+                                        sizeof(IndexEntry *));
+  if (!build.entries) {
+    goto cleanup;
+  }
+  int gathered = 0;
+  for (EntryBatch *batch = build.batches; batch; batch = batch->next) {
+    memcpy(build.entries + gathered, batch->items,
+           batch->count * sizeof(IndexEntry *));
+    gathered += batch->count;
+  }
+  qsort(build.entries, build.count, sizeof(IndexEntry *), compare_entries);
+
+  int carried = 0;
+  for (int i = 0; i < build.count; i++) {
+    carried += build.entries[i]->old_file >= 0;
+  }
+  stats->files = build.count;
+  stats->reindexed = (int)build.reindexed;
+  stats->removed = build.old ? build.old->file_count - carried : 0;
+
+  if (build.old && stats->reindexed == 0 && stats->removed == 0 &&
+      build.count == build.old->file_count) {
+    // Nothing changed: the index on disk is current
+    result = (TrigramIndex *)build.old;
+    build.old = NULL;
+    goto cleanup;
+  }
+
+  // Write beside the old index while its forward lists are still mapped,
+  // then swap it in
+  char temp_path[MAX_PATH];
+  snprintf(temp_path, sizeof(temp_path), "%s.%lu.tmp", index_path,
+           (unsigned long)GetCurrentProcessId());
+  if (write_index(&build, full_root, temp_path)) {
+    trigram_index_close((TrigramIndex *)build.old);
+    build.old = NULL;
+    if (MoveFileEx(temp_path, index_path, MOVEFILE_REPLACE_EXISTING)) {
+      result = open_index(index_path, full_root, root);
+    } else {
+      remove(temp_path);
+    }
+  }
+
+cleanup:
+  free_entries(&build);
+  free(build.old_slots);
+  trigram_index_close((TrigramIndex *)build.old);
+  if (build.scratch) {
+    for (int i = 0; i < build.scratch_count; i++) {
+      free(build.scratch[i].seen);
+      free(build.scratch[i].list);
+    }
+    free(build.scratch);
+  }
+  DeleteCriticalSection(&build.lock);
+  return result;
+}
@@ -0,0 +1,85 @@
+/**
+ * trigram_index.h
+ * Persistent trigram index of a directory tree, used by grep --index to
+ * pick the files a search can match without reading the others
+ */
+
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include "common.h"
+#include "thread_pool.h"
+
+// An index read from disk. Read-only once opened, so it can be queried from
+// several threads.
+typedef struct TrigramIndex TrigramIndex;
+
+typedef struct {
+  int files;     // Files in the index
+  int reindexed; // Files read because they were new or had changed
+  int removed;   // Files dropped because they no longer exist
+} TrigramIndexStats;
+
+/**
+ * Bring the index of a directory tree up to date and open it
+ *
+ * The tree is walked the way grep walks it, skipping hidden and ignored
+ * entries. A file whose size and modification time match the stored ones
+ * keeps its trigrams; only new and changed files are read, in parallel on
+ * the pool. The index lives in %USERPROFILE%\.lsh_grep_index, one file per
+ * root, and is rewritten only if something changed.
+ *
+ * @param root Root of the tree, as the caller will report paths under it
+ * @param pool Pool to read files on
+ * @param stats Receives what the update did
+ * @return The index (close with trigram_index_close), or NULL if it could
+ *         not be written
+ */
+TrigramIndex *trigram_index_update(const char *root, ThreadPool *pool,
+                                   TrigramIndexStats *stats);
+
+/**
+ * Close an index
+ *
+ * @param index The index, or NULL
+ */
+void trigram_index_close(TrigramIndex *index);
+
+/**
+ * Get the number of files in an index
+ *
+ * @param index The index
+ * @return File count
+ */
+int trigram_index_file_count(const TrigramIndex *index);
+
+/**
+ * Get the path of an indexed file: the root as given to
+ * trigram_index_update, a backslash and the path below it
+ *
+ * @param index The index
+ * @param file File number in [0, trigram_index_file_count)
+ * @param path Buffer for the path
+ * @param size Size of path
+ */
+void trigram_index_file_path(const TrigramIndex *index, int file, char *path,
+                             size_t size);
+
+/**
+ * Mark the files that may contain a string: those holding every trigram of
+ * it. ASCII case is folded in the index, so the answer holds for case
+ * sensitive and insensitive searches alike.
+ *
+ * @param index The index
+ * @param literal String every match contains
+ * @param ignore_case Nonzero if the search folds case (trigrams with bytes
+ *                    outside ASCII are then not used)
+ * @param candidates One byte per file, set to 1 for each candidate; others
+ *                   are left alone, so calls for several strings add up
+ * @return 1 if candidates were marked, 0 if the string is too short to
+ *         narrow the search (every file is a candidate)
+ */
+int trigram_index_mark(const TrigramIndex *index, const char *literal,
+                       int ignore_case, unsigned char *candidates);
+
+#endif // TRIGRAM_INDEX_H